@@ -12,6 +12,7 @@
 #include "audio_resample.h"
 
 hb_audio_resample_t* hb_audio_resample_init(enum AVSampleFormat sample_fmt,
+                                            int sample_rate,
                                             int hb_amixdown, int normalize_mix)
 {
     hb_audio_resample_t *resample = calloc(1, sizeof(hb_audio_resample_t));
@@ -51,8 +52,9 @@ hb_audio_resample_t* hb_audio_resample_init(enum AVSampleFormat sample_fmt,
         resample->dual_mono_downmix = 0;
     }
 
-    // requested output channel_layout, sample_fmt
+    // requested output channel_layout, sample_fmt, sample_rate
     resample->out.channels = av_get_channel_layout_nb_channels(channel_layout);
+    resample->out.sample_rate         = sample_rate;
     resample->out.channel_layout      = channel_layout;
     resample->out.matrix_encoding     = matrix_encoding;
     resample->out.normalize_mix_level = normalize_mix;
@@ -61,6 +63,7 @@ hb_audio_resample_t* hb_audio_resample_init(enum AVSampleFormat sample_fmt,
 
     // set default input characteristics
     resample->in.sample_fmt         = resample->out.sample_fmt;
+    resample->in.sample_rate        = resample->out.sample_rate;
     resample->in.channel_layout     = resample->out.channel_layout;
     resample->in.lfe_mix_level      = HB_MIXLEV_ZERO;
     resample->in.center_mix_level   = HB_MIXLEV_DEFAULT;
@@ -111,6 +114,15 @@ void hb_audio_resample_set_sample_fmt(hb_audio_resample_t *resample,
     }
 }
 
+void hb_audio_resample_set_sample_rate(hb_audio_resample_t *resample,
+                                       int sample_rate)
+{
+    if (resample != NULL)
+    {
+        resample->in.sample_rate = sample_rate;
+    }
+}
+
 int hb_audio_resample_update(hb_audio_resample_t *resample)
 {
     if (resample == NULL)
@@ -121,13 +133,20 @@ int hb_audio_resample_update(hb_audio_resample_t *resample)
 
     int ret, resample_changed;
 
+    if (resample->out.sample_rate <= 0)
+    {
+        // no output sample_rate requested, keep the input's
+        resample->out.sample_rate = resample->in.sample_rate;
+    }
     resample->resample_needed =
         (resample->out.sample_fmt != resample->in.sample_fmt ||
+         resample->out.sample_rate != resample->in.sample_rate ||
          resample->out.channel_layout != resample->in.channel_layout);
 
     resample_changed =
         (resample->resample_needed &&
          (resample->resample.sample_fmt != resample->in.sample_fmt ||
+          resample->resample.sample_rate != resample->in.sample_rate ||
           resample->resample.channel_layout != resample->in.channel_layout ||
           resample->resample.lfe_mix_level != resample->in.lfe_mix_level ||
           resample->resample.center_mix_level != resample->in.center_mix_level ||
@@ -153,6 +172,12 @@ int hb_audio_resample_update(hb_audio_resample_t *resample)
                            resample->out.matrix_encoding, 0);
             av_opt_set_int(resample->avresample, "normalize_mix_level",
                            resample->out.normalize_mix_level, 0);
+            av_opt_set_int(resample->avresample, "out_sample_rate",
+                           resample->out.sample_rate, 0);
+            // about the bandwidth of libsamplerate's SRC_SINC_MEDIUM_QUALITY,
+            // which sync used to resample with
+            av_opt_set_int(resample->avresample, "filter_size", 32, 0);
+            av_opt_set_double(resample->avresample, "cutoff", 0.9, 0);
         }
         else if (resample_changed)
         {
@@ -161,6 +186,8 @@ int hb_audio_resample_update(hb_audio_resample_t *resample)
 
         av_opt_set_int(resample->avresample, "in_sample_fmt",
                        resample->in.sample_fmt, 0);
+        av_opt_set_int(resample->avresample, "in_sample_rate",
+                       resample->in.sample_rate, 0);
         av_opt_set_int(resample->avresample, "in_channel_layout",
                        resample->in.channel_layout, 0);
         av_opt_set_double(resample->avresample, "lfe_mix_level",
@@ -182,6 +209,7 @@ int hb_audio_resample_update(hb_audio_resample_t *resample)
         }
 
         resample->resample.sample_fmt         = resample->in.sample_fmt;
+        resample->resample.sample_rate        = resample->in.sample_rate;
         resample->resample.channel_layout     = resample->in.channel_layout;
         resample->resample.channels           =
             av_get_channel_layout_nb_channels(resample->in.channel_layout);
@@ -225,18 +253,22 @@ hb_buffer_t* hb_audio_resample(hb_audio_resample_t *resample,
 
     if (resample->resample_needed)
     {
-        int in_linesize, out_linesize;
+        int in_linesize, out_linesize, out_max;
+        // room for the samples still in the resampler's filter too
+        out_max = av_rescale_rnd(avresample_get_delay(resample->avresample) +
+                                 nsamples, resample->out.sample_rate,
+                                 resample->resample.sample_rate, AV_ROUND_UP);
         // set in/out linesize and out_size
         av_samples_get_buffer_size(&in_linesize,
                                    resample->resample.channels, nsamples,
                                    resample->resample.sample_fmt, 0);
         out_size = av_samples_get_buffer_size(&out_linesize,
-                                              resample->out.channels, nsamples,
+                                              resample->out.channels, out_max,
                                               resample->out.sample_fmt, 0);
         out = hb_buffer_init(out_size);
 
         out_samples = avresample_convert(resample->avresample,
-                                         &out->data, out_linesize, nsamples,
+                                         &out->data, out_linesize, out_max,
                                          samples,     in_linesize, nsamples);
 
         if (out_samples <= 0)
@@ -9,10 +9,8 @@
 
 /* Implements a libavresample wrapper for convenience.
  *
- * Supports sample_fmt and channel_layout conversion.
- *
- * sample_rate conversion will come later (libavresample doesn't support
- * sample_rate conversion with float samples yet). */
+ * Supports sample_fmt, channel_layout and sample_rate conversion, all done
+ * in a single pass over the samples. */
 
 #ifndef AUDIO_RESAMPLE_H
 #define AUDIO_RESAMPLE_H
@@ -37,6 +35,7 @@ typedef struct
 
     struct
     {
+        int sample_rate;
         uint64_t channel_layout;
         double lfe_mix_level;
         double center_mix_level;
@@ -47,6 +46,7 @@ typedef struct
     struct
     {
         int channels;
+        int sample_rate;
         uint64_t channel_layout;
         double lfe_mix_level;
         double center_mix_level;
@@ -57,6 +57,7 @@ typedef struct
     struct
     {
         int channels;
+        int sample_rate;
         int sample_size;
         int normalize_mix_level;
         uint64_t channel_layout;
@@ -66,12 +67,15 @@ typedef struct
 } hb_audio_resample_t;
 
 /* Initialize an hb_audio_resample_t for converting audio to the requested
- * sample_fmt and mixdown.
+ * sample_fmt, sample_rate and mixdown.
  *
  * Also sets the default audio input characteristics, so that they are the same
  * as the output characteristics (no conversion needed).
+ *
+ * A sample_rate of 0 keeps the sample_rate of the first input.
  */
 hb_audio_resample_t* hb_audio_resample_init(enum AVSampleFormat sample_fmt,
+                                            int sample_rate,
                                             int hb_amixdown, int normalize_mix);
 
 /* The following functions set the audio input characteristics.
@@ -91,6 +95,9 @@ void                 hb_audio_resample_set_mix_levels(hb_audio_resample_t *resam
 void                 hb_audio_resample_set_sample_fmt(hb_audio_resample_t *resample,
                                                       enum AVSampleFormat sample_fmt);
 
+void                 hb_audio_resample_set_sample_rate(hb_audio_resample_t *resample,
+                                                       int sample_rate);
+
 /* Update an hb_audio_resample_t.
  *
  * Must be called after using any of the above functions.
@@ -101,11 +108,13 @@ int                  hb_audio_resample_update(hb_audio_resample_t *resample);
 void                 hb_audio_resample_free(hb_audio_resample_t *resample);
 
 /* Convert input samples to the requested output characteristics
- * (sample_fmt and channel_layout + matrix_encoding).
+ * (sample_fmt, sample_rate and channel_layout + matrix_encoding).
  *
  * Returns an hb_buffer_t with the converted output.
  *
- * resampling is only done when necessary.
+ * resampling is only done when necessary.  When the sample_rate changes, the
+ * resampler keeps track of the fractional samples, so the output of a given
+ * number of input samples may be one sample longer or shorter than expected.
  */
 hb_buffer_t*         hb_audio_resample(hb_audio_resample_t *resample,
                                        uint8_t **samples, int nsamples);
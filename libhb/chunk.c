@@ -0,0 +1,845 @@
+/* chunk.c
+
+   Copyright (c) 2003-2014 HandBrake Team
+   This file is part of the HandBrake source code
+   Homepage: <http://handbrake.fr/>.
+   It may be used under the terms of the GNU General Public License v2.
+   For full terms see the file COPYING file or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*
+ * Segmented video encoding.
+ *
+ * When job->chunk_count asks for it, the video of a job is split into
+ * segments at fixed time positions and every segment is encoded by a
+ * sub-job of its own (reader, decoder, sync, filters and encoder) that
+ * runs in parallel with the others.  A sub-job spools its encoded frames
+ * to a temporary file instead of muxing them.
+ *
+ * The main job still reads and syncs the whole title because audio and
+ * passthru subtitles are synced against the video, but it doesn't decode
+ * the video.  Its video decoder is replaced by the pacer below, which
+ * only puts the time stamps of the demuxed packets in presentation
+ * order.  Its video encoder is replaced by the collector, which uses the
+ * synced packets for pacing and emits the encoded frames of the segments
+ * in order instead, shifted to the position of their segment.  All
+ * segments start with an IDR frame, so the elementary streams
+ * concatenate without re-encoding.
+ */
+
+#include "hb.h"
+
+// Don't bother splitting into segments shorter than this
+#define CHUNK_MIN_DURATION (30 * 90000)
+
+// Packets held back by the pacer to reorder their time stamps
+#define CHUNK_PACE_DELAY 16
+
+struct hb_chunk_s
+{
+    int             index;
+    hb_job_t      * job;        // freed by the sub-job thread when done
+    hb_title_t    * title;      // private copy, see chunk_title_copy()
+    hb_thread_t   * thread;
+
+    char            filename[1024];
+    FILE          * out;        // written by the sub-job
+    FILE          * in;         // read by the collector
+
+    hb_lock_t     * lock;
+    hb_cond_t     * cond;
+    int             written;    // frames in the file, protected by lock
+    int             read;       // frames taken by the collector
+    int             eof;        // sub-job has finished, protected by lock
+
+    // Encoder settings of the sub-job, set once 'ready', protected by lock
+    int             ready;
+    hb_esconfig_t   config;
+    int             areBframes;
+    int             color_matrix_code;
+    int             color_prim;
+    int             color_transfer;
+    int             color_matrix;
+
+    volatile int    die;
+    hb_error_code   error;
+};
+
+struct hb_work_private_s
+{
+    hb_job_t      * job;
+
+    // Segment writer
+    hb_chunk_t    * chunk;
+
+    // Collector
+    int             current;    // segment being emitted
+    int64_t         offset;     // output start time of current segment
+    int64_t         end;        // latest stop time emitted so far
+    int             last_chap;
+    int             frames;     // frames emitted from current segment
+    hb_buffer_t   * pending;    // next frame of current segment
+
+    // Pacer
+    hb_buffer_t   * delay[CHUNK_PACE_DELAY];  // packets in decode order
+    int64_t         pts[CHUNK_PACE_DELAY];    // their time stamps, sorted
+    int             count;
+    int64_t         last_pts;
+    int64_t         duration;   // of a frame at the source frame rate
+};
+
+static int  decchunkInit( hb_work_object_t *, hb_job_t * );
+static int  decchunkWork( hb_work_object_t *, hb_buffer_t **, hb_buffer_t ** );
+static void decchunkClose( hb_work_object_t * );
+
+hb_work_object_t hb_decchunk =
+{
+    WORK_DECCHUNK,
+    "Segment pacer",
+    decchunkInit,
+    decchunkWork,
+    decchunkClose
+};
+
+static int  encchunkInit( hb_work_object_t *, hb_job_t * );
+static int  encchunkWork( hb_work_object_t *, hb_buffer_t **, hb_buffer_t ** );
+static void encchunkClose( hb_work_object_t * );
+
+hb_work_object_t hb_encchunk =
+{
+    WORK_ENCCHUNK,
+    "Segmented video encoder",
+    encchunkInit,
+    encchunkWork,
+    encchunkClose
+};
+
+/***********************************************************************
+ * Segment set up
+ **********************************************************************/
+static hb_job_t * chunk_job_copy( hb_job_t * job, int threads )
+{
+    hb_job_t      * copy;
+    hb_subtitle_t * subtitle;
+    int             ii;
+
+    copy = calloc( sizeof( hb_job_t ), 1 );
+    memcpy( copy, job, sizeof( hb_job_t ) );
+
+    // Only burned in subtitles affect the video.  Everything else is
+    // handled by the main job.
+    copy->list_subtitle = hb_list_init();
+    for( ii = 0; ii < hb_list_count( job->list_subtitle ); ii++ )
+    {
+        subtitle = hb_list_item( job->list_subtitle, ii );
+        if( subtitle->config.dest == RENDERSUB )
+        {
+            hb_list_add( copy->list_subtitle, hb_subtitle_copy( subtitle ) );
+        }
+    }
+    copy->list_chapter    = hb_chapter_list_copy( job->list_chapter );
+    copy->list_audio      = hb_list_init();
+    copy->list_attachment = hb_list_init();
+    copy->list_rendition  = hb_list_init();
+    copy->metadata        = NULL;
+    copy->list_filter     = hb_filter_list_copy( job->list_filter );
+
+    if( job->encoder_preset != NULL )
+        copy->encoder_preset = strdup( job->encoder_preset );
+    if( job->encoder_tune != NULL )
+        copy->encoder_tune = strdup( job->encoder_tune );
+    if( job->encoder_profile != NULL )
+        copy->encoder_profile = strdup( job->encoder_profile );
+    if( job->encoder_level != NULL )
+        copy->encoder_level = strdup( job->encoder_level );
+    copy->file = NULL;
+
+    // The segments share the cpu, so keep x264 from starting
+    // a full set of threads for each of them.
+    if( job->vcodec == HB_VCODEC_X264 &&
+        ( job->encoder_options == NULL ||
+          strstr( job->encoder_options, "threads=" ) == NULL ) )
+    {
+        if( job->encoder_options != NULL && *job->encoder_options )
+            copy->encoder_options = hb_strdup_printf( "threads=%d:%s", threads,
+                                                      job->encoder_options );
+        else
+            copy->encoder_options = hb_strdup_printf( "threads=%d", threads );
+    }
+    else if( job->encoder_options != NULL )
+    {
+        copy->encoder_options = strdup( job->encoder_options );
+    }
+
+    copy->use_opencl = 0;
+    copy->use_hwd    = 0;
+    copy->chunk_count = 0;
+    copy->list_chunk = NULL;
+    copy->list_work  = NULL;
+    copy->mux_data   = NULL;
+    memset( &copy->config, 0, sizeof( copy->config ) );
+
+    return copy;
+}
+
+/*
+ * Every sub-job opens the source itself, which stores state in the
+ * title, so each one gets a copy of its own.
+ */
+static hb_title_t * chunk_title_copy( hb_title_t * title )
+{
+    hb_title_t * copy;
+
+    copy = malloc( sizeof( hb_title_t ) );
+    memcpy( copy, title, sizeof( hb_title_t ) );
+
+    copy->metadata        = hb_metadata_copy( title->metadata );
+    copy->list_chapter    = hb_chapter_list_copy( title->list_chapter );
+    copy->list_audio      = hb_audio_list_copy( title->list_audio );
+    copy->list_subtitle   = hb_subtitle_list_copy( title->list_subtitle );
+    copy->list_attachment = hb_attachment_list_copy( title->list_attachment );
+    if( title->video_codec_name != NULL )
+        copy->video_codec_name = strdup( title->video_codec_name );
+    if( title->container_name != NULL )
+        copy->container_name = strdup( title->container_name );
+
+    return copy;
+}
+
+static void chunk_close( hb_chunk_t ** _c )
+{
+    hb_chunk_t * c = *_c;
+
+    if( c->in != NULL )
+        fclose( c->in );
+    if( c->out != NULL )
+        fclose( c->out );
+    if( c->filename[0] )
+        unlink( c->filename );
+    if( c->job != NULL )
+        hb_job_close( &c->job );
+    if( c->title != NULL )
+        hb_title_close( &c->title );
+    hb_cond_close( &c->cond );
+    hb_lock_close( &c->lock );
+    free( c );
+    *_c = NULL;
+}
+
+/*
+ * Returns the start and duration of the encoded range relative to the
+ * beginning of the title.
+ */
+static void chunk_range( hb_job_t * job, int64_t * start, int64_t * duration )
+{
+    hb_chapter_t * chapter;
+    int            ii;
+
+    *start = 0;
+    *duration = 0;
+    if( job->pts_to_start || job->pts_to_stop )
+    {
+        *start = job->pts_to_start;
+        *duration = job->pts_to_stop ? job->pts_to_stop :
+                                       job->title->duration - *start;
+        return;
+    }
+    for( ii = 0; ii < hb_list_count( job->title->list_chapter ); ii++ )
+    {
+        chapter = hb_list_item( job->title->list_chapter, ii );
+        if( ii < job->chapter_start - 1 )
+            *start += chapter->duration;
+        else if( ii < job->chapter_end )
+            *duration += chapter->duration;
+    }
+}
+
+/*
+ * Splits the video of 'job' into segments when job->chunk_count asks for
+ * it and the job allows it.  Returns the number of segments, 0 if the
+ * video is encoded by the job itself.
+ */
+int hb_chunk_init( hb_job_t * job )
+{
+    hb_title_t         * title = job->title;
+    hb_subtitle_t      * subtitle;
+    hb_filter_object_t * filter;
+    int64_t              start, duration, length;
+    int                  count, threads, ii;
+    const char         * reason = NULL;
+
+    if( job->chunk_count < 2 || job->chunk != NULL )
+        return 0;
+
+    chunk_range( job, &start, &duration );
+    count = MIN( job->chunk_count, duration / CHUNK_MIN_DURATION );
+
+    if( job->pass != 0 || job->indepth_scan )
+        reason = "multi-pass encodes or subtitle scans";
+    else if( job->vcodec != HB_VCODEC_X264 && job->vcodec != HB_VCODEC_X265 )
+        reason = "this video encoder";
+    else if( title->type != HB_STREAM_TYPE &&
+             title->type != HB_FF_STREAM_TYPE )
+        reason = "disc sources";
+    else if( job->frame_to_start || job->frame_to_stop ||
+             job->start_at_preview )
+        reason = "frame or preview ranges";
+    else if( count < 2 )
+        reason = "short titles";
+    else if( hb_list_count( job->list_rendition ) > 0 )
+        reason = "jobs with renditions";
+    for( ii = 0; reason == NULL &&
+                 ii < hb_list_count( job->list_subtitle ); ii++ )
+    {
+        // Closed captions come out of the video decoder, which only
+        // the segments run
+        subtitle = hb_list_item( job->list_subtitle, ii );
+        if( subtitle->source == CC608SUB &&
+            subtitle->config.dest != RENDERSUB )
+            reason = "closed caption tracks";
+    }
+    if( reason != NULL )
+    {
+        hb_log( "chunk: segmented encoding is not supported for %s", reason );
+        return 0;
+    }
+
+    length  = duration / count;
+    threads = MAX( 1, hb_get_cpu_count() * 3 / 2 / count );
+
+    job->list_chunk = hb_list_init();
+    for( ii = 0; ii < count; ii++ )
+    {
+        hb_chunk_t * c = calloc( sizeof( hb_chunk_t ), 1 );
+
+        c->index = ii;
+        c->lock  = hb_lock_init();
+        c->cond  = hb_cond_init();
+        hb_list_add( job->list_chunk, c );
+
+        hb_get_tempory_filename( job->h, c->filename, "chunk%d.%d",
+                                 job->sequence_id, ii );
+        c->out = hb_fopen( c->filename, "wb" );
+        c->in  = c->out != NULL ? hb_fopen( c->filename, "rb" ) : NULL;
+        if( c->in == NULL )
+        {
+            hb_error( "chunk: failed to create %s", c->filename );
+            hb_chunk_close( job );
+            return 0;
+        }
+
+        c->title = chunk_title_copy( title );
+
+        c->job = chunk_job_copy( job, threads );
+        c->job->title        = c->title;
+        c->job->chunk        = c;
+        c->job->die          = &c->die;
+        c->job->done_error   = &c->error;
+        c->job->pts_to_start = start + ii * length;
+        c->job->pts_to_stop  = length;
+        if( ii == count - 1 )
+        {
+            // The last segment runs to the end of the range
+            if( job->pts_to_stop || job->chapter_end <
+                                    hb_list_count( title->list_chapter ) )
+                c->job->pts_to_stop = duration - ii * length;
+            else
+                c->job->pts_to_stop = 0;
+        }
+    }
+
+    // Burned in subtitles are rendered by the segments
+    for( ii = 0; ii < hb_list_count( job->list_subtitle ); )
+    {
+        subtitle = hb_list_item( job->list_subtitle, ii );
+        if( subtitle->config.dest == RENDERSUB )
+        {
+            hb_list_rem( job->list_subtitle, subtitle );
+            hb_subtitle_close( &subtitle );
+            continue;
+        }
+        ii++;
+    }
+    for( ii = 0; ii < hb_list_count( job->list_filter ); )
+    {
+        filter = hb_list_item( job->list_filter, ii );
+        if( filter->id == HB_FILTER_RENDER_SUB )
+        {
+            hb_list_rem( job->list_filter, filter );
+            hb_filter_close( &filter );
+            continue;
+        }
+        ii++;
+    }
+
+    hb_log( "chunk: encoding video in %d segments of %"PRId64" ms",
+            count, length / 90 );
+
+    return count;
+}
+
+void hb_chunk_close( hb_job_t * job )
+{
+    hb_chunk_t * c;
+
+    if( job->list_chunk == NULL )
+        return;
+
+    while( ( c = hb_list_item( job->list_chunk, 0 ) ) )
+    {
+        hb_list_rem( job->list_chunk, c );
+        chunk_close( &c );
+    }
+    hb_list_close( &job->list_chunk );
+}
+
+static void chunk_thread( void * _c )
+{
+    hb_chunk_t * c = _c;
+
+    hb_work_run_job( c->job );
+    c->job = NULL;
+
+    hb_lock( c->lock );
+    c->eof = 1;
+    hb_cond_broadcast( c->cond );
+    hb_unlock( c->lock );
+}
+
+/***********************************************************************
+ * Segment writer
+ ***********************************************************************
+ * Replaces the muxer of a sub-job.  Each frame is stored as its
+ * buffer settings, its size and its data.
+ **********************************************************************/
+static int chunk_write( hb_chunk_t * c, hb_buffer_t * buf )
+{
+    if( fwrite( &buf->s, sizeof( buf->s ), 1, c->out ) != 1 ||
+        fwrite( &buf->size, sizeof( buf->size ), 1, c->out ) != 1 ||
+        fwrite( buf->data, 1, buf->size, c->out ) != buf->size ||
+        fflush( c->out ) )
+    {
+        return -1;
+    }
+    hb_lock( c->lock );
+    c->written++;
+    hb_cond_broadcast( c->cond );
+    hb_unlock( c->lock );
+
+    return 0;
+}
+
+static int chunkWriterWork( hb_work_object_t * w, hb_buffer_t ** buf_in,
+                            hb_buffer_t ** buf_out )
+{
+    hb_work_private_t * pv = w->private_data;
+    hb_buffer_t       * buf;
+
+    for( buf = *buf_in; buf != NULL; buf = buf->next )
+    {
+        if( buf->size <= 0 )
+        {
+            return HB_WORK_DONE;
+        }
+        if( chunk_write( pv->chunk, buf ) )
+        {
+            hb_error( "chunk: write to %s failed", pv->chunk->filename );
+            *pv->job->done_error = HB_ERROR_UNKNOWN;
+            *pv->job->die = 1;
+            return HB_WORK_ERROR;
+        }
+    }
+    return HB_WORK_OK;
+}
+
+static void chunkWriterClose( hb_work_object_t * w )
+{
+    free( w->private_data );
+    w->private_data = NULL;
+}
+
+hb_work_object_t * hb_chunk_writer_init( hb_job_t * job )
+{
+    hb_work_object_t  * w = calloc( sizeof( hb_work_object_t ), 1 );
+    hb_work_private_t * pv = calloc( sizeof( hb_work_private_t ), 1 );
+
+    w->id           = WORK_MUX;
+    w->name         = "Segment writer";
+    w->work         = chunkWriterWork;
+    w->close        = chunkWriterClose;
+    w->fifo_in      = job->fifo_mpeg4;
+    w->done         = &job->done;
+    w->private_data = pv;
+
+    pv->job   = job;
+    pv->chunk = job->chunk;
+
+    // The encoder is initialized by now.  The main job takes the
+    // stream headers from the first segment.
+    hb_lock( pv->chunk->lock );
+    pv->chunk->config            = job->config;
+    pv->chunk->areBframes        = job->areBframes;
+    pv->chunk->color_matrix_code = job->color_matrix_code;
+    pv->chunk->color_prim        = job->color_prim;
+    pv->chunk->color_transfer    = job->color_transfer;
+    pv->chunk->color_matrix      = job->color_matrix;
+    pv->chunk->ready             = 1;
+    hb_cond_broadcast( pv->chunk->cond );
+    hb_unlock( pv->chunk->lock );
+
+    return w;
+}
+
+/***********************************************************************
+ * Segment pacer
+ ***********************************************************************
+ * Replaces the video decoder of the main job.  Sync only needs the
+ * time stamps of the frames, so the demuxed packets are passed on
+ * undecoded with their time stamps put in presentation order.
+ **********************************************************************/
+static int decchunkInit( hb_work_object_t * w, hb_job_t * job )
+{
+    hb_work_private_t * pv;
+
+    pv = calloc( 1, sizeof( hb_work_private_t ) );
+    w->private_data = pv;
+    pv->job = job;
+
+    pv->last_pts = AV_NOPTS_VALUE;
+    pv->duration = 3003;
+    if( job->title->vrate.num > 0 && job->title->vrate.den > 0 )
+        pv->duration = 90000LL * job->title->vrate.den /
+                       job->title->vrate.num;
+
+    return 0;
+}
+
+static void pace_push( hb_work_private_t * pv, hb_buffer_t * buf )
+{
+    int64_t pts = buf->s.start;
+    int     ii;
+
+    if( pts == AV_NOPTS_VALUE )
+    {
+        if( pv->last_pts == AV_NOPTS_VALUE )
+        {
+            // Can't place a packet before the first time stamp
+            hb_buffer_close( &buf );
+            return;
+        }
+        pts = pv->last_pts + pv->duration;
+    }
+    if( pv->last_pts == AV_NOPTS_VALUE || pts > pv->last_pts )
+        pv->last_pts = pts;
+
+    for( ii = pv->count; ii > 0 && pv->pts[ii - 1] > pts; ii-- )
+        pv->pts[ii] = pv->pts[ii - 1];
+    pv->pts[ii] = pts;
+    pv->delay[pv->count++] = buf;
+}
+
+/*
+ * Returns the oldest packet with the earliest time stamp.
+ */
+static hb_buffer_t * pace_pop( hb_work_private_t * pv )
+{
+    hb_buffer_t * buf = pv->delay[0];
+
+    buf->s.start = pv->pts[0];
+    buf->s.stop  = pv->pts[0] + pv->duration;
+    buf->next    = NULL;
+
+    pv->count--;
+    memmove( pv->delay, pv->delay + 1, pv->count * sizeof( pv->delay[0] ) );
+    memmove( pv->pts, pv->pts + 1, pv->count * sizeof( pv->pts[0] ) );
+
+    return buf;
+}
+
+static int decchunkWork( hb_work_object_t * w, hb_buffer_t ** buf_in,
+                         hb_buffer_t ** buf_out )
+{
+    hb_work_private_t  * pv = w->private_data;
+    hb_buffer_t        * in = *buf_in;
+    hb_buffer_t       ** tail = buf_out;
+
+    *buf_in = NULL;
+    *buf_out = NULL;
+    if( in->size <= 0 )
+    {
+        while( pv->count > 0 )
+        {
+            *tail = pace_pop( pv );
+            tail = &(*tail)->next;
+        }
+        *tail = in;
+        return HB_WORK_DONE;
+    }
+
+    pace_push( pv, in );
+    if( pv->count == CHUNK_PACE_DELAY )
+    {
+        *buf_out = pace_pop( pv );
+    }
+
+    return HB_WORK_OK;
+}
+
+static void decchunkClose( hb_work_object_t * w )
+{
+    hb_work_private_t * pv = w->private_data;
+
+    if( pv == NULL )
+        return;
+
+    while( pv->count > 0 )
+    {
+        hb_buffer_t * buf = pace_pop( pv );
+        hb_buffer_close( &buf );
+    }
+    free( pv );
+    w->private_data = NULL;
+}
+
+/***********************************************************************
+ * Segment collector
+ **********************************************************************/
+/*
+ * Waits for the encoder of the first segment to be initialized and
+ * fills job->config and the settings the muxer needs from it.  The
+ * segments use identical settings, so their streams share these headers.
+ */
+static int chunk_config( hb_job_t * job )
+{
+    hb_chunk_t * c = hb_list_item( job->list_chunk, 0 );
+    int          ready;
+
+    hb_lock( c->lock );
+    while( !c->ready && !c->eof && !*job->die )
+    {
+        hb_cond_timedwait( c->cond, c->lock, 200 );
+    }
+    ready = c->ready;
+    hb_unlock( c->lock );
+
+    if( !ready )
+        return 1;
+
+    job->config            = c->config;
+    job->areBframes        = c->areBframes;
+    job->color_matrix_code = c->color_matrix_code;
+    job->color_prim        = c->color_prim;
+    job->color_transfer    = c->color_transfer;
+    job->color_matrix      = c->color_matrix;
+
+    return 0;
+}
+
+static int encchunkInit( hb_work_object_t * w, hb_job_t * job )
+{
+    hb_work_private_t * pv;
+    hb_chunk_t        * c;
+    int                 ii;
+
+    pv = calloc( 1, sizeof( hb_work_private_t ) );
+    w->private_data = pv;
+    pv->job = job;
+
+    for( ii = 0; ii < hb_list_count( job->list_chunk ); ii++ )
+    {
+        c = hb_list_item( job->list_chunk, ii );
+        c->thread = hb_thread_init( "chunk", chunk_thread, c,
+                                    HB_LOW_PRIORITY );
+    }
+
+    if( chunk_config( job ) )
+    {
+        hb_error( "chunk: failed to initialize video encoder" );
+        // Not closed by work.c since the thread was never started
+        encchunkClose( w );
+        return 1;
+    }
+    job->config.h264.init_delay = 0;
+
+    return 0;
+}
+
+/*
+ * Returns the next frame of the current segment, waiting for it to be
+ * encoded if necessary.  Returns NULL once the segment is done.
+ */
+static hb_buffer_t * chunk_read( hb_work_private_t * pv, hb_chunk_t * c )
+{
+    hb_buffer_t          * buf;
+    hb_buffer_settings_t   s;
+    int                    avail, size;
+
+    hb_lock( c->lock );
+    while( c->read >= c->written && !c->eof && !*pv->job->die )
+    {
+        hb_cond_timedwait( c->cond, c->lock, 200 );
+    }
+    avail = c->read < c->written;
+    hb_unlock( c->lock );
+
+    if( !avail )
+    {
+        return NULL;
+    }
+
+    if( fread( &s, sizeof( s ), 1, c->in ) != 1 ||
+        fread( &size, sizeof( size ), 1, c->in ) != 1 || size < 0 )
+    {
+        hb_error( "chunk: read from %s failed", c->filename );
+        c->error = HB_ERROR_UNKNOWN;
+        return NULL;
+    }
+    buf = hb_buffer_init( size );
+    if( fread( buf->data, 1, size, c->in ) != size )
+    {
+        hb_error( "chunk: read from %s failed", c->filename );
+        c->error = HB_ERROR_UNKNOWN;
+        hb_buffer_close( &buf );
+        return NULL;
+    }
+    buf->s = s;
+    c->read++;
+
+    return buf;
+}
+
+/*
+ * Returns the next frame in output order with its time stamps shifted
+ * to the position of its segment.  Returns NULL when all segments are
+ * done or one of them failed.
+ */
+static hb_buffer_t * chunk_next( hb_work_private_t * pv )
+{
+    hb_job_t    * job = pv->job;
+    hb_chunk_t  * c;
+    hb_buffer_t * buf;
+
+    while( ( c = hb_list_item( job->list_chunk, pv->current ) ) != NULL )
+    {
+        buf = chunk_read( pv, c );
+        if( buf != NULL )
+        {
+            if( pv->current == 0 && pv->frames == 0 &&
+                buf->s.renderOffset < 0 )
+            {
+                job->config.h264.init_delay = -buf->s.renderOffset;
+            }
+            pv->frames++;
+            buf->s.start        += pv->offset;
+            buf->s.stop         += pv->offset;
+            buf->s.renderOffset += pv->offset;
+            if( buf->s.new_chap )
+            {
+                if( buf->s.new_chap <= pv->last_chap )
+                    buf->s.new_chap = 0;
+                else
+                    pv->last_chap = buf->s.new_chap;
+            }
+            if( buf->s.stop > pv->end )
+                pv->end = buf->s.stop;
+            return buf;
+        }
+        if( *job->die )
+        {
+            return NULL;
+        }
+        if( c->error != HB_ERROR_NONE )
+        {
+            hb_error( "chunk: segment %d failed", c->index );
+            *job->done_error = c->error;
+            *job->die = 1;
+            return NULL;
+        }
+        hb_deep_log( 2, "chunk: segment %d done, %d frames", c->index,
+                     pv->frames );
+        pv->current++;
+        pv->offset = pv->end;
+        pv->frames = 0;
+    }
+    return NULL;
+}
+
+static void chunk_push( hb_work_object_t * w, hb_buffer_t * buf )
+{
+    while( !*w->done && !*w->private_data->job->die )
+    {
+        if( hb_fifo_full_wait( w->fifo_out ) )
+        {
+            hb_fifo_push( w->fifo_out, buf );
+            return;
+        }
+    }
+    hb_buffer_close( &buf );
+}
+
+/*
+ * The synced packets of the main job only set the pace: encoded frames
+ * are emitted until their decode time catches up with the packet, so
+ * the video reaches the muxer at the same rate as the audio.
+ */
+static int encchunkWork( hb_work_object_t * w, hb_buffer_t ** buf_in,
+                         hb_buffer_t ** buf_out )
+{
+    hb_work_private_t * pv = w->private_data;
+    hb_buffer_t       * in = *buf_in;
+
+    if( in->size <= 0 )
+    {
+        // Flush whatever the segments have left
+        while( pv->pending != NULL ||
+               ( pv->pending = chunk_next( pv ) ) != NULL )
+        {
+            chunk_push( w, pv->pending );
+            pv->pending = NULL;
+        }
+        *buf_out = in;
+        *buf_in = NULL;
+        return HB_WORK_DONE;
+    }
+
+    while( pv->pending != NULL ||
+           ( pv->pending = chunk_next( pv ) ) != NULL )
+    {
+        if( pv->pending->s.renderOffset > in->s.start )
+        {
+            break;
+        }
+        chunk_push( w, pv->pending );
+        pv->pending = NULL;
+    }
+
+    return HB_WORK_OK;
+}
+
+static void encchunkClose( hb_work_object_t * w )
+{
+    hb_work_private_t * pv = w->private_data;
+    hb_chunk_t        * c;
+    int                 ii;
+
+    if( pv == NULL )
+        return;
+
+    for( ii = 0; ii < hb_list_count( pv->job->list_chunk ); ii++ )
+    {
+        c = hb_list_item( pv->job->list_chunk, ii );
+        c->die = 1;
+    }
+    for( ii = 0; ii < hb_list_count( pv->job->list_chunk ); ii++ )
+    {
+        c = hb_list_item( pv->job->list_chunk, ii );
+        if( c->thread != NULL )
+        {
+            hb_thread_close( &c->thread );
+        }
+    }
+    hb_buffer_close( &pv->pending );
+
+    free( pv );
+    w->private_data = NULL;
+}
@@ -3010,6 +3010,7 @@ static void job_setup(hb_job_t * job, hb_title_t * title)
     job->list_audio = hb_list_init();
     job->list_subtitle = hb_list_init();
     job->list_filter = hb_list_init();
+    job->list_rendition = hb_list_init();
 
     job->list_attachment = hb_attachment_list_copy( title->list_attachment );
     job->metadata = hb_metadata_copy( title->metadata );
@@ -3031,6 +3032,7 @@ static void job_clean( hb_job_t * job )
         hb_subtitle_t *subtitle;
         hb_filter_object_t *filter;
         hb_attachment_t *attachment;
+        hb_rendition_t *rendition;
 
         free(job->encoder_preset);
         job->encoder_preset = NULL;
@@ -3077,6 +3079,14 @@ static void job_clean( hb_job_t * job )
         }
         hb_list_close( &job->list_filter );
 
+        // clean up rendition list
+        while( ( rendition = hb_list_item( job->list_rendition, 0 ) ) )
+        {
+            hb_list_rem( job->list_rendition, rendition );
+            hb_rendition_close( &rendition );
+        }
+        hb_list_close( &job->list_rendition );
+
         // clean up attachment list
         while( ( attachment = hb_list_item( job->list_attachment, 0 ) ) )
         {
@@ -3194,6 +3204,30 @@ void hb_job_set_file(hb_job_t *job, const char *file)
     }
 }
 
+/*
+ * Adds an output of 'width' x 'height' to 'job' that is encoded
+ * from the same decode and filters, see hb_rendition_t.  It starts
+ * out with the job's rate control settings.
+ */
+hb_rendition_t * hb_job_add_rendition( hb_job_t * job, const char * file,
+                                       int width, int height )
+{
+    hb_rendition_t * rendition;
+
+    if( job == NULL || file == NULL || width <= 0 || height <= 0 )
+        return NULL;
+
+    rendition = calloc( 1, sizeof( hb_rendition_t ) );
+    rendition->file     = strdup( file );
+    rendition->width    = width;
+    rendition->height   = height;
+    rendition->vquality = job->vquality;
+    rendition->vbitrate = job->vbitrate;
+    hb_list_add( job->list_rendition, rendition );
+
+    return rendition;
+}
+
 hb_filter_object_t * hb_filter_copy( hb_filter_object_t * filter )
 {
     if( filter == NULL )
@@ -4134,6 +4168,67 @@ char * hb_strncat_dup( const char * s1, const char * s2, size_t n )
     return str;
 }
 
+/**********************************************************************
+ * hb_rendition_copy
+ **********************************************************************
+ *
+ *********************************************************************/
+hb_rendition_t *hb_rendition_copy(const hb_rendition_t *src)
+{
+    hb_rendition_t *rendition = NULL;
+
+    if( src )
+    {
+        rendition = calloc(1, sizeof(*rendition));
+        memcpy(rendition, src, sizeof(*rendition));
+        if ( src->file )
+        {
+            rendition->file = strdup( src->file );
+        }
+        rendition->priv = NULL;
+    }
+    return rendition;
+}
+
+/**********************************************************************
+ * hb_rendition_list_copy
+ **********************************************************************
+ *
+ *********************************************************************/
+hb_list_t *hb_rendition_list_copy(const hb_list_t *src)
+{
+    hb_list_t *list = hb_list_init();
+    hb_rendition_t *rendition = NULL;
+    int i;
+
+    if( src )
+    {
+        for( i = 0; i < hb_list_count(src); i++ )
+        {
+            if( ( rendition = hb_list_item( src, i ) ) )
+            {
+                hb_list_add( list, hb_rendition_copy(rendition) );
+            }
+        }
+    }
+    return list;
+}
+
+/**********************************************************************
+ * hb_rendition_close
+ **********************************************************************
+ *
+ *********************************************************************/
+void hb_rendition_close( hb_rendition_t **rendition )
+{
+    if ( rendition && *rendition )
+    {
+        free((*rendition)->file);
+        free(*rendition);
+        *rendition = NULL;
+    }
+}
+
 /**********************************************************************
  * hb_attachment_copy
  **********************************************************************
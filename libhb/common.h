@@ -82,6 +82,7 @@ typedef struct hb_geometry_s hb_geometry_t;
 typedef struct hb_geometry_settings_s hb_geometry_settings_t;
 typedef struct hb_image_s hb_image_t;
 typedef struct hb_job_s  hb_job_t;
+typedef struct hb_rendition_s hb_rendition_t;
 typedef struct hb_title_set_s hb_title_set_t;
 typedef struct hb_title_s hb_title_t;
 typedef struct hb_chapter_s hb_chapter_t;
@@ -150,6 +151,12 @@ void hb_job_set_encoder_profile(hb_job_t *job, const char *profile);
 void hb_job_set_encoder_level  (hb_job_t *job, const char *level);
 void hb_job_set_file           (hb_job_t *job, const char *file);
 
+hb_rendition_t *hb_job_add_rendition(hb_job_t *job, const char *file,
+                                     int width, int height);
+hb_rendition_t *hb_rendition_copy(const hb_rendition_t *src);
+hb_list_t *hb_rendition_list_copy(const hb_list_t *src);
+void hb_rendition_close(hb_rendition_t **rendition);
+
 hb_audio_t *hb_audio_copy(const hb_audio_t *src);
 hb_list_t *hb_audio_list_copy(const hb_list_t *src);
 void hb_audio_close(hb_audio_t **audio);
@@ -503,6 +510,8 @@ struct hb_job_s
     char           *encoder_profile;
     char           *encoder_level;
     int             areBframes;
+    int             chunk_count;    // Encode the video in this many segments
+                                    //  in parallel (file sources, x264/x265)
 
     int             color_matrix_code;
     int             color_prim;
@@ -558,6 +567,10 @@ struct hb_job_s
     int             mux;
     char          * file;
 
+    // Additional video-only outputs encoded from the same decode and
+    // filters, see hb_rendition_t
+    hb_list_t     * list_rendition;
+
     int             mp4_optimize;
     int             ipod_atom;
 
@@ -620,10 +633,38 @@ struct hb_job_s
     hb_fifo_t     * fifo_mpeg4;   /* MPEG-4 video ES */
 
     hb_list_t     * list_work;
+    hb_list_t     * list_chunk;   /* Video segments encoded by sub-jobs */
+    hb_chunk_t    * chunk;        /* Segment encoded by this sub-job */
+    hb_fifo_t     * fifo_fanout;  /* Raw pictures, shared with the renditions */
+    hb_rendition_t * rendition;   /* Rendition encoded by this sub-job */
 
     hb_esconfig_t config;
 
     hb_mux_data_t * mux_data;
+
+    int             trace_pid;    /* Timeline process, see trace.c */
+#endif
+};
+
+/******************************************************************************
+ * hb_rendition_t: an additional output of a job
+ *
+ * A rendition gets its frames from the end of the job's filter chain and
+ * scales them to its own size before encoding them with the job's video
+ * encoder settings.  It is written to a file of its own, in the job's
+ * container, without audio or subtitles.  Since the filtered frames are
+ * scaled, a rendition should not be larger than the job's own output.
+ *****************************************************************************/
+struct hb_rendition_s
+{
+    char          * file;
+    int             width;
+    int             height;
+    double          vquality;       // -1 to encode with vbitrate
+    int             vbitrate;       // kbps
+
+#ifdef __LIBHB__
+    struct hb_rendition_private_s * priv;   // see rendition.c
 #endif
 };
 
@@ -1086,6 +1127,8 @@ struct hb_work_object_s
 
     hb_work_object_t  * next;
     int                 thread_sleep_interval;
+
+    hb_stage_stats_t    stats;
 #endif
 };
 
@@ -1104,6 +1147,8 @@ extern hb_work_object_t hb_encqsv;
 extern hb_work_object_t hb_encx264;
 extern hb_work_object_t hb_enctheora;
 extern hb_work_object_t hb_encx265;
+extern hb_work_object_t hb_encchunk;
+extern hb_work_object_t hb_decchunk;
 extern hb_work_object_t hb_decavcodeca;
 extern hb_work_object_t hb_decavcodecv;
 extern hb_work_object_t hb_declpcm;
@@ -1171,6 +1216,8 @@ struct hb_filter_object_s
     // These are used to bridge the chapter to the next buffer
     int                 chapter_val;
     int64_t             chapter_time;
+
+    hb_stage_stats_t    stats;
 #endif
 };
 
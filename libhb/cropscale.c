@@ -11,6 +11,28 @@
 #include "hbffmpeg.h"
 #include "common.h"
 #include "opencl.h"
+#include "taskset.h"
+
+/*
+ * Large frames are scaled in bands of output rows, one task and one
+ * scaling context per band.  Each context scales the input rows its band
+ * needs plus a margin above and below wider than the vertical filter,
+ * and only the band's own rows are kept.  Bands start where the filter
+ * phase of the whole frame starts over, so the rows kept are the ones a
+ * single context scaling the whole frame would make.
+ */
+typedef struct
+{
+    hb_filter_private_t * pv;
+    int                   segment;
+    struct SwsContext   * context;
+    int                   src_y;    // first input row scaled
+    int                   src_h;
+    int                   dst_y;    // first output row the context makes
+    int                   out_y;    // rows of the band, kept
+    int                   out_h;
+    hb_buffer_t         * scratch;  // context output, margins included
+} crop_scale_slice_t;
 
 struct hb_filter_private_s
 {
@@ -30,6 +52,13 @@ struct hb_filter_private_s
     hb_oclscale_t      *os; //ocl scaler handler
 
     struct SwsContext * context;
+
+    int                 cpu_count;
+    int                 slice_count;
+    taskset_t           slice_taskset;
+    const uint8_t     * slice_src[4];   // cropped input of the frame scaled
+    int                 slice_src_stride[4];
+    hb_buffer_t       * slice_out;
 };
 
 static int hb_crop_scale_init( hb_filter_object_t * filter,
@@ -44,6 +73,8 @@ static int hb_crop_scale_info( hb_filter_object_t * filter,
 
 static void hb_crop_scale_close( hb_filter_object_t * filter );
 
+static void crop_scale_slice_thread( void * thread_args_v );
+
 hb_filter_object_t hb_filter_crop_scale =
 {
     .id            = HB_FILTER_CROP_SCALE,
@@ -74,6 +105,7 @@ static int hb_crop_scale_init( hb_filter_object_t * filter,
     pv->use_dxva       = init->use_dxva;
     pv->use_decomb     = init->job->use_decomb;
     pv->use_detelecine = init->job->use_detelecine;
+    pv->cpu_count      = hb_get_cpu_count();
 
     if (pv->job->use_opencl && pv->job->title->opencl_support)
     {
@@ -126,6 +158,226 @@ static int hb_crop_scale_info( hb_filter_object_t * filter,
     return 0;
 }
 
+static void crop_scale_free_contexts( hb_filter_private_t * pv )
+{
+    int ii;
+
+    if( pv->context )
+    {
+        sws_freeContext( pv->context );
+        pv->context = NULL;
+    }
+    for( ii = 0; ii < pv->slice_count; ii++ )
+    {
+        crop_scale_slice_t * slice = taskset_thread_args( &pv->slice_taskset, ii );
+        if( slice->context )
+        {
+            sws_freeContext( slice->context );
+        }
+        hb_buffer_close( &slice->scratch );
+    }
+    if( pv->slice_count )
+    {
+        taskset_fini( &pv->slice_taskset );
+        pv->slice_count = 0;
+    }
+}
+
+static int gcd( int a, int b )
+{
+    while( b )
+    {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+/*
+ * Returns the number of bands to scale src_h rows to dst_h in, 0 when
+ * the frame is scaled whole, and sets the alignment of the band edges
+ * and the margin around each band, both in output rows.
+ */
+static int crop_scale_slice_plan( hb_filter_private_t * pv, int pix_fmt,
+                                  int src_h, int dst_h,
+                                  int * unit, int * margin )
+{
+    const AVPixFmtDescriptor * desc = av_pix_fmt_desc_get( pix_fmt );
+    int vsub, step, u, reach, count;
+
+    if( pv->cpu_count < 2 || desc == NULL )
+    {
+        return 0;
+    }
+    vsub = 1 << desc->log2_chroma_h;
+    if( src_h % vsub || dst_h % vsub )
+    {
+        return 0;
+    }
+    // Band offsets are only exact when the vertical step is, swscale
+    // keeps it in 16.16 fixed point
+    if( ( (int64_t)src_h << 16 ) % dst_h )
+    {
+        return 0;
+    }
+
+    // Bands start on a filter phase boundary of both luma and chroma,
+    // on chroma rows of the input and on the 8 line dither pattern
+    step = ( dst_h / vsub ) / gcd( src_h / vsub, dst_h / vsub ) * vsub;
+    for( u = step; u <= dst_h / 2; u += step )
+    {
+        if( u % 8 == 0 && (int64_t)u * src_h / dst_h % vsub == 0 )
+        {
+            break;
+        }
+    }
+    if( u > dst_h / 2 )
+    {
+        return 0;
+    }
+
+    // Lanczos reaches 3 taps either side, scaled up when downscaling,
+    // plus the slack swscale takes aligning filters.  Chroma rows count
+    // vsub times.
+    reach = vsub * ( 3 * ( ( src_h + dst_h - 1 ) / dst_h ) + 8 );
+    *margin = MULTIPLE_MOD_UP( ( reach * dst_h + src_h - 1 ) / src_h, u );
+    *unit = u;
+
+    // Keep the margins to a fraction of the rows scaled
+    count = MIN( pv->cpu_count, dst_h / ( 4 * *margin ) );
+    return count >= 2 ? count : 0;
+}
+
+static int crop_scale_init_contexts( hb_filter_private_t * pv,
+                                     hb_buffer_t * in, hb_buffer_t * out )
+{
+    int width_in  = in->f.width  - ( pv->crop[2] + pv->crop[3] );
+    int height_in = in->f.height - ( pv->crop[0] + pv->crop[1] );
+    int unit, margin, count, ii;
+
+    crop_scale_free_contexts( pv );
+
+    count = 0;
+    if( in->f.fmt == out->f.fmt )
+    {
+        count = crop_scale_slice_plan( pv, out->f.fmt, height_in,
+                                       out->f.height, &unit, &margin );
+    }
+    if( count > 0 && taskset_init( &pv->slice_taskset, count,
+                                   sizeof( crop_scale_slice_t ) ) == 0 )
+    {
+        hb_error( "cropscale could not initialize taskset" );
+        count = 0;
+    }
+    if( count == 0 )
+    {
+        goto single;
+    }
+    pv->slice_count = count;
+
+    int units = ( out->f.height + unit - 1 ) / unit;
+    for( ii = 0; ii < count; ii++ )
+    {
+        crop_scale_slice_t * slice = taskset_thread_args( &pv->slice_taskset, ii );
+        int top    = units *  ii      / count * unit;
+        int bottom = MIN( units * ( ii + 1 ) / count * unit, out->f.height );
+        int dst_y  = MAX( top - margin, 0 );
+        int dst_h  = MIN( bottom + margin, out->f.height ) - dst_y;
+
+        memset( slice, 0, sizeof( *slice ) );
+        slice->pv      = pv;
+        slice->segment = ii;
+        slice->out_y   = top;
+        slice->out_h   = bottom - top;
+        slice->dst_y   = dst_y;
+        slice->src_y   = (int64_t)dst_y * height_in / out->f.height;
+        if( dst_y + dst_h == out->f.height )
+        {
+            slice->src_h = height_in - slice->src_y;
+        }
+        else
+        {
+            slice->src_h = (int64_t)( dst_y + dst_h ) * height_in /
+                           out->f.height - slice->src_y;
+        }
+
+        slice->context = hb_sws_get_context( width_in, slice->src_h,
+                                             in->f.fmt,
+                                             out->f.width, dst_h, out->f.fmt,
+                                             SWS_LANCZOS|SWS_ACCURATE_RND );
+        slice->scratch = hb_frame_buffer_init( out->f.fmt, out->f.width,
+                                               dst_h );
+        if( slice->context == NULL || slice->scratch == NULL ||
+            taskset_thread_spawn( &pv->slice_taskset, ii, "cropscale_slice",
+                                  crop_scale_slice_thread,
+                                  HB_NORMAL_PRIORITY ) == 0 )
+        {
+            hb_error( "cropscale could not set up slice %d", ii );
+            pv->slice_count = ii + 1;
+            crop_scale_free_contexts( pv );
+            goto single;
+        }
+    }
+    hb_log( "cropscale: scaling %d rows to %d in %d slices",
+            height_in, out->f.height, count );
+
+    return 0;
+
+single:
+    pv->context = hb_sws_get_context( width_in, height_in, in->f.fmt,
+                                      out->f.width, out->f.height,
+                                      out->f.fmt,
+                                      SWS_LANCZOS|SWS_ACCURATE_RND );
+    return pv->context != NULL ? 0 : -1;
+}
+
+static void crop_scale_slice_thread( void * thread_args_v )
+{
+    crop_scale_slice_t  * slice = thread_args_v;
+    hb_filter_private_t * pv    = slice->pv;
+    hb_buffer_t         * out   = pv->slice_out;
+    hb_buffer_t         * buf   = slice->scratch;
+    const uint8_t       * src[4];
+    uint8_t             * dst[4];
+    int                   dst_stride[4];
+    int                   p, y;
+
+    for( p = 0; p < 4; p++ )
+    {
+        src[p] = NULL;
+        if( pv->slice_src[p] != NULL )
+        {
+            src[p] = pv->slice_src[p] + pv->slice_src_stride[p] *
+                     hb_image_height( out->f.fmt, slice->src_y, p );
+        }
+        dst[p] = buf->plane[p].data;
+        dst_stride[p] = buf->plane[p].stride;
+    }
+    sws_scale( slice->context, src, pv->slice_src_stride, 0, slice->src_h,
+               dst, dst_stride );
+
+    // Keep the band, drop the margins
+    for( p = 0; p < 4; p++ )
+    {
+        if( buf->plane[p].data == NULL )
+        {
+            continue;
+        }
+        int first = hb_image_height( out->f.fmt, slice->out_y, p );
+        int last  = hb_image_height( out->f.fmt, slice->out_y + slice->out_h, p );
+        int skip  = first - hb_image_height( out->f.fmt, slice->dst_y, p );
+        int len   = av_image_get_linesize( out->f.fmt, out->f.width, p );
+
+        for( y = first; y < last; y++ )
+        {
+            memcpy( out->plane[p].data + y * out->plane[p].stride,
+                    buf->plane[p].data + ( y - first + skip ) * buf->plane[p].stride,
+                    len );
+        }
+    }
+}
+
 static void hb_crop_scale_close( hb_filter_object_t * filter )
 {
     hb_filter_private_t * pv = filter->private_data;
@@ -146,10 +398,7 @@ static void hb_crop_scale_close( hb_filter_object_t * filter )
         free(pv->os);
     }
 
-    if( pv->context )
-    {
-        sws_freeContext( pv->context );
-    }
+    crop_scale_free_contexts( pv );
 
     free( pv );
     filter->private_data = NULL;
@@ -182,32 +431,40 @@ static hb_buffer_t* crop_scale( hb_filter_private_t * pv, hb_buffer_t * in )
     }
     else
     {
-        if (pv->context   == NULL         ||
+        if ((pv->context == NULL && pv->slice_count == 0) ||
             pv->width_in  != in->f.width  ||
             pv->height_in != in->f.height ||
             pv->pix_fmt   != in->f.fmt)
         {
-            // Something changed, need a new scaling context.
-            if (pv->context != NULL)
-            {
-                sws_freeContext(pv->context);
-            }
-            
-            pv->context = hb_sws_get_context(in->f.width  - (pv->crop[2] + pv->crop[3]),
-                                             in->f.height - (pv->crop[0] + pv->crop[1]),
-                                             in->f.fmt, out->f.width, out->f.height,
-                                             out->f.fmt, SWS_LANCZOS|SWS_ACCURATE_RND);
+            // Something changed, need new scaling contexts.
+            crop_scale_init_contexts(pv, in, out);
             pv->width_in  = in->f.width;
             pv->height_in = in->f.height;
             pv->pix_fmt   = in->f.fmt;
         }
-        
-        // Scale pic_crop into pic_render according to the
-        // context set up above
-        sws_scale(pv->context,
-                  (const uint8_t* const*)pic_crop.data, pic_crop.linesize,
-                  0, in->f.height - (pv->crop[0] + pv->crop[1]),
-                  pic_out.data, pic_out.linesize);
+
+        if (pv->slice_count > 0)
+        {
+            int p;
+            for (p = 0; p < 4; p++)
+            {
+                pv->slice_src[p]        = out->plane[p].data != NULL ?
+                                          pic_crop.data[p] : NULL;
+                pv->slice_src_stride[p] = pic_crop.linesize[p];
+            }
+            pv->slice_out = out;
+            taskset_cycle(&pv->slice_taskset);
+            pv->slice_out = NULL;
+        }
+        else if (pv->context != NULL)
+        {
+            // Scale pic_crop into pic_render according to the
+            // context set up above
+            sws_scale(pv->context,
+                      (const uint8_t* const*)pic_crop.data, pic_crop.linesize,
+                      0, in->f.height - (pv->crop[0] + pv->crop[1]),
+                      pic_out.data, pic_out.linesize);
+        }
     }
 
     out->s = in->s;
@@ -257,6 +514,18 @@ static int hb_crop_scale_work( hb_filter_object_t * filter,
         return HB_FILTER_OK;
     }
 
+    // Crop only, the frame is cut in place
+    if (in->f.fmt == pv->pix_fmt_out && in->cl.buffer == NULL &&
+        in->f.width  - (pv->crop[2] + pv->crop[3]) == pv->width_out &&
+        in->f.height - (pv->crop[0] + pv->crop[1]) == pv->height_out &&
+        hb_frame_buffer_crop(in, pv->crop[0], pv->crop[2],
+                             pv->width_out, pv->height_out) == 0)
+    {
+        *buf_out = in;
+        *buf_in  = NULL;
+        return HB_FILTER_OK;
+    }
+
     *buf_out = crop_scale( pv, in );
 
     return HB_FILTER_OK;
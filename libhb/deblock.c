@@ -18,6 +18,10 @@
 
 #include "hb.h"
 #include "hbffmpeg.h"
+#include "taskset.h"
+#if HB_SIMD_X86
+#include <immintrin.h>
+#endif
 
 #define PP7_QP_DEFAULT    5
 #define PP7_MODE_DEFAULT  2
@@ -40,13 +44,41 @@ static const uint8_t  __attribute__((aligned(8))) pp7_dither[8][8] =
     { 42,  26,  38,  22,  41,  25,  37,  21, },
 };
 
+// Filters one row of a padded plane, see pp7_row_c()
+typedef void (pp7_row_t)( const hb_filter_private_t * pv, DCTELEM * temp,
+                          uint8_t * dst, const uint8_t * src, int stride,
+                          int width, int y );
+
+typedef struct
+{
+    uint8_t     * dst;
+    int           width;        // also the stride of dst
+    int           height;
+    uint8_t     * src;          // copy of the input with 8 pixel borders
+    int           stride;       // of src
+    int           size;         // allocated for src
+} pp7_plane_t;
+
+typedef struct pp7_thread_arg_s
+{
+    hb_filter_private_t * pv;
+    int                   segment;
+    DCTELEM             * temp;      // scratch for the row kernel
+    int                   temp_size;
+} pp7_thread_arg_t;
+
 struct hb_filter_private_s
 {
     int           pp7_qp;
     int           pp7_mode;
     int           pp7_mpeg2;
-    int           pp7_temp_stride;
-    uint8_t     * pp7_src;
+    pp7_plane_t   pp7_plane[3];
+
+    int        ( * pp7_requantize )( DCTELEM * src, int qp );
+    pp7_row_t    * pp7_row;
+
+    int           segments;
+    taskset_t     pp7_taskset;
 };
 
 static int hb_deblock_init( hb_filter_object_t * filter,
@@ -69,7 +101,7 @@ hb_filter_object_t hb_filter_deblock =
     .close         = hb_deblock_close,
 };
 
-static inline void pp7_dct_a( DCTELEM * dst, uint8_t * src, int stride )
+static inline void pp7_dct_a( DCTELEM * dst, const uint8_t * src, int stride )
 {
     int i;
 
@@ -235,28 +267,360 @@ static int pp7_soft_threshold( DCTELEM * src, int qp )
     return (a + (1<<11)) >> 12;
 }
 
-static int ( * pp7_requantize )( DCTELEM * src, int qp ) = pp7_hard_threshold;
+/*
+ * Row 'y' of a plane padded by pp7_pad_plane(): 'src' points at the top
+ * left corner of the padding, and output pixel x is at (x+8, y+8) in it.
+ * 'temp' is per thread scratch of at least 4 * (stride + 32) elements.
+ */
+static void pp7_row_c( const hb_filter_private_t * pv, DCTELEM * temp,
+                       uint8_t * dst, const uint8_t * src, int stride,
+                       int width, int y )
+{
+    DCTELEM __attribute__((aligned(16))) block[16];
+    const int qp = pv->pp7_qp;
+    int x;
+
+    src  += (y+5)*stride + 8+5;
+    temp += 32;
+
+    for( x = -8; x < 0; x += 4 )
+    {
+        pp7_dct_a( temp+4*x+4*8, src+x, stride );
+    }
+
+    for( x = 0; x < width; x++ )
+    {
+        DCTELEM * tp = temp+4*x;
+        int v;
+
+        if( (x&3) == 0 )
+        {
+            pp7_dct_a( tp+4*8, src+x, stride );
+        }
+
+        pp7_dct_b( block, tp );
 
-static void pp7_filter( hb_filter_private_t * pv,
-                        uint8_t * dst,
-                        uint8_t * src,
-                        int width,
-                        int height,
-                        uint8_t * qp_store,
-                        int qp_stride,
-                        int is_luma)
+        v = pv->pp7_requantize( block, qp );
+        v = (v + pp7_dither[y&7][x&7]) >> 6;
+        if( (unsigned)v > 255 )
+        {
+            v = (-v) >> 31;
+        }
+        dst[x] = v;
+    }
+}
+
+#if HB_SIMD_X86
+/*
+ * The SIMD rows filter 8 (SSE2) or 16 (AVX2) pixels at once.  The
+ * vertical transform of the whole row is done first, each of its four
+ * coefficients into its own array, so that the horizontal transform of
+ * neighbouring pixels is a set of unaligned loads from those.
+ *
+ * They give the same output as pp7_row_c(): the coefficients fit in 16
+ * bits (the C version stores them in a DCTELEM too), the thresholds and
+ * factors fit in 16 bits, and the weighted sum is accumulated in 32 bits
+ * like the C int.
+ */
+__attribute__((target("sse2")))
+static inline __m128i pp7_load_epi16_sse2( const uint8_t * p )
 {
-    int x, y;
+    return _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i *)p ),
+                              _mm_setzero_si128() );
+}
+
+// pp7_dct_a() / pp7_dct_b() of seven rows (or columns) of coefficients
+__attribute__((target("sse2")))
+static inline void pp7_dct_sse2( __m128i * d, const __m128i * r )
+{
+    __m128i s0 = _mm_add_epi16( r[0], r[6] );
+    __m128i s1 = _mm_add_epi16( r[1], r[5] );
+    __m128i s2 = _mm_add_epi16( r[2], r[4] );
+    __m128i s  = _mm_add_epi16( r[3], r[3] );
+    __m128i s3 = _mm_sub_epi16( s, s0 );
+
+    s0 = _mm_add_epi16( s, s0 );
+    s  = _mm_add_epi16( s2, s1 );
+    s2 = _mm_sub_epi16( s2, s1 );
+
+    d[0] = _mm_add_epi16( s0, s );
+    d[1] = _mm_add_epi16( _mm_add_epi16( s3, s3 ), s2 );
+    d[2] = _mm_sub_epi16( s0, s );
+    d[3] = _mm_sub_epi16( s3, _mm_add_epi16( s2, s2 ) );
+}
 
-    const int  stride = is_luma ? pv->pp7_temp_stride : ((width+16+15)&(~15));
-    uint8_t  * p_src  = pv->pp7_src + 8*stride;
-    DCTELEM  * block  = (DCTELEM *)(pv->pp7_src);
-    DCTELEM  * temp   = (DCTELEM *)(pv->pp7_src + 32);
+// The level pp7_requantize() weights a coefficient with, 0 if it is cut
+__attribute__((target("sse2")))
+static inline __m128i pp7_threshold_sse2( __m128i level, int threshold,
+                                          int mode )
+{
+    __m128i t1   = _mm_set1_epi16( threshold );
+    __m128i mag  = _mm_max_epi16( level,
+                                  _mm_sub_epi16( _mm_setzero_si128(), level ) );
+    __m128i keep = _mm_cmpgt_epi16( mag, t1 );
+    __m128i sign, v;
 
-    if( !src || !dst )
+    if( mode == 0 )
     {
-        return;
+        return _mm_and_si128( level, keep );
+    }
+    // level - threshold, or level + threshold for negative levels
+    sign = _mm_srai_epi16( level, 15 );
+    v    = _mm_sub_epi16( level, _mm_sub_epi16( _mm_xor_si128( t1, sign ),
+                                                sign ) );
+    if( mode == 2 )
+    {
+        __m128i big = _mm_cmpgt_epi16( mag, _mm_set1_epi16( 2*threshold ) );
+        v = _mm_or_si128( _mm_and_si128( big, level ),
+                          _mm_andnot_si128( big, _mm_add_epi16( v, v ) ) );
     }
+    return _mm_and_si128( v, keep );
+}
+
+__attribute__((target("sse2")))
+static void pp7_row_sse2( const hb_filter_private_t * pv, DCTELEM * temp,
+                          uint8_t * dst, const uint8_t * src, int stride,
+                          int width, int y )
+{
+    const int * threshold = pp7_threshold[pv->pp7_qp];
+    const int   mode      = pv->pp7_mode;
+    __m128i     dither    = pp7_load_epi16_sse2( pp7_dither[y&7] );
+    __m128i     zero      = _mm_setzero_si128();
+    DCTELEM   * v[4];
+    int x, i, k;
+
+    for( i = 0; i < 4; i++ )
+    {
+        v[i] = temp + i * (stride + 32);
+    }
+
+    // Vertical transform of every column the horizontal one reads
+    src += (y+5)*stride;
+    for( x = 0; x < stride + 16; x += 8 )
+    {
+        __m128i r[7], d[4];
+
+        for( k = 0; k < 7; k++ )
+        {
+            r[k] = pp7_load_epi16_sse2( src + k*stride + x );
+        }
+        pp7_dct_sse2( d, r );
+        for( i = 0; i < 4; i++ )
+        {
+            _mm_storeu_si128( (__m128i *)(v[i] + x), d[i] );
+        }
+    }
+
+    for( x = 0; x < width; x += 8 )
+    {
+        __m128i block[16], lo, hi;
+
+        for( i = 0; i < 4; i++ )
+        {
+            __m128i r[7], d[4];
+
+            for( k = 0; k < 7; k++ )
+            {
+                r[k] = _mm_loadu_si128( (const __m128i *)(v[i] + x+5 + k) );
+            }
+            pp7_dct_sse2( d, r );
+            for( k = 0; k < 4; k++ )
+            {
+                block[k*4 + i] = d[k];
+            }
+        }
+
+        lo = hi = zero;
+        for( i = 0; i < 16; i += 2 )
+        {
+            __m128i l0 = i ? pp7_threshold_sse2( block[i], threshold[i], mode )
+                           : block[0];
+            __m128i l1 = pp7_threshold_sse2( block[i+1], threshold[i+1], mode );
+            __m128i f  = _mm_set1_epi32( (pp7_factor[i+1] << 16) |
+                                          pp7_factor[i] );
+
+            lo = _mm_add_epi32( lo, _mm_madd_epi16(
+                                        _mm_unpacklo_epi16( l0, l1 ), f ) );
+            hi = _mm_add_epi32( hi, _mm_madd_epi16(
+                                        _mm_unpackhi_epi16( l0, l1 ), f ) );
+        }
+        lo = _mm_srai_epi32( _mm_add_epi32( lo, _mm_set1_epi32( 1<<11 ) ), 12 );
+        hi = _mm_srai_epi32( _mm_add_epi32( hi, _mm_set1_epi32( 1<<11 ) ), 12 );
+        lo = _mm_srai_epi32( _mm_add_epi32( lo,
+                                _mm_unpacklo_epi16( dither, zero ) ), 6 );
+        hi = _mm_srai_epi32( _mm_add_epi32( hi,
+                                _mm_unpackhi_epi16( dither, zero ) ), 6 );
+        lo = _mm_packs_epi32( lo, hi );
+        lo = _mm_packus_epi16( lo, lo );
+        if( x + 8 <= width )
+        {
+            _mm_storel_epi64( (__m128i *)(dst + x), lo );
+        }
+        else
+        {
+            uint8_t __attribute__((aligned(16))) tail[16];
+
+            _mm_store_si128( (__m128i *)tail, lo );
+            memcpy( dst + x, tail, width - x );
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+static inline __m256i pp7_load_epi16_avx2( const uint8_t * p )
+{
+    return _mm256_cvtepu8_epi16( _mm_loadu_si128( (const __m128i *)p ) );
+}
+
+__attribute__((target("avx2")))
+static inline void pp7_dct_avx2( __m256i * d, const __m256i * r )
+{
+    __m256i s0 = _mm256_add_epi16( r[0], r[6] );
+    __m256i s1 = _mm256_add_epi16( r[1], r[5] );
+    __m256i s2 = _mm256_add_epi16( r[2], r[4] );
+    __m256i s  = _mm256_add_epi16( r[3], r[3] );
+    __m256i s3 = _mm256_sub_epi16( s, s0 );
+
+    s0 = _mm256_add_epi16( s, s0 );
+    s  = _mm256_add_epi16( s2, s1 );
+    s2 = _mm256_sub_epi16( s2, s1 );
+
+    d[0] = _mm256_add_epi16( s0, s );
+    d[1] = _mm256_add_epi16( _mm256_add_epi16( s3, s3 ), s2 );
+    d[2] = _mm256_sub_epi16( s0, s );
+    d[3] = _mm256_sub_epi16( s3, _mm256_add_epi16( s2, s2 ) );
+}
+
+__attribute__((target("avx2")))
+static inline __m256i pp7_threshold_avx2( __m256i level, int threshold,
+                                          int mode )
+{
+    __m256i t1   = _mm256_set1_epi16( threshold );
+    __m256i mag  = _mm256_abs_epi16( level );
+    __m256i keep = _mm256_cmpgt_epi16( mag, t1 );
+    __m256i v;
+
+    if( mode == 0 )
+    {
+        return _mm256_and_si256( level, keep );
+    }
+    v = _mm256_sub_epi16( level, _mm256_sign_epi16( t1, level ) );
+    if( mode == 2 )
+    {
+        __m256i big = _mm256_cmpgt_epi16( mag,
+                                          _mm256_set1_epi16( 2*threshold ) );
+        v = _mm256_blendv_epi8( _mm256_add_epi16( v, v ), level, big );
+    }
+    return _mm256_and_si256( v, keep );
+}
+
+__attribute__((target("avx2")))
+static void pp7_row_avx2( const hb_filter_private_t * pv, DCTELEM * temp,
+                          uint8_t * dst, const uint8_t * src, int stride,
+                          int width, int y )
+{
+    const int * threshold = pp7_threshold[pv->pp7_qp];
+    const int   mode      = pv->pp7_mode;
+    __m128i     d8        = _mm_loadl_epi64( (const __m128i *)pp7_dither[y&7] );
+    __m256i     dither    = _mm256_cvtepu8_epi16( _mm_unpacklo_epi64( d8, d8 ) );
+    __m256i     zero      = _mm256_setzero_si256();
+    DCTELEM   * v[4];
+    int x, i, k;
+
+    for( i = 0; i < 4; i++ )
+    {
+        v[i] = temp + i * (stride + 32);
+    }
+
+    src += (y+5)*stride;
+    for( x = 0; x < stride + 16; x += 16 )
+    {
+        __m256i r[7], d[4];
+
+        for( k = 0; k < 7; k++ )
+        {
+            r[k] = pp7_load_epi16_avx2( src + k*stride + x );
+        }
+        pp7_dct_avx2( d, r );
+        for( i = 0; i < 4; i++ )
+        {
+            _mm256_storeu_si256( (__m256i *)(v[i] + x), d[i] );
+        }
+    }
+
+    for( x = 0; x < width; x += 16 )
+    {
+        __m256i block[16], lo, hi;
+
+        for( i = 0; i < 4; i++ )
+        {
+            __m256i r[7], d[4];
+
+            for( k = 0; k < 7; k++ )
+            {
+                r[k] = _mm256_loadu_si256( (const __m256i *)(v[i] + x+5 + k) );
+            }
+            pp7_dct_avx2( d, r );
+            for( k = 0; k < 4; k++ )
+            {
+                block[k*4 + i] = d[k];
+            }
+        }
+
+        // unpacklo/hi work within 128 bit lanes, so lo holds pixels 0-3
+        // and 8-11, hi 4-7 and 12-15, and packs_epi32 puts them back
+        lo = hi = zero;
+        for( i = 0; i < 16; i += 2 )
+        {
+            __m256i l0 = i ? pp7_threshold_avx2( block[i], threshold[i], mode )
+                           : block[0];
+            __m256i l1 = pp7_threshold_avx2( block[i+1], threshold[i+1], mode );
+            __m256i f  = _mm256_set1_epi32( (pp7_factor[i+1] << 16) |
+                                             pp7_factor[i] );
+
+            lo = _mm256_add_epi32( lo, _mm256_madd_epi16(
+                                        _mm256_unpacklo_epi16( l0, l1 ), f ) );
+            hi = _mm256_add_epi32( hi, _mm256_madd_epi16(
+                                        _mm256_unpackhi_epi16( l0, l1 ), f ) );
+        }
+        lo = _mm256_srai_epi32( _mm256_add_epi32( lo,
+                                    _mm256_set1_epi32( 1<<11 ) ), 12 );
+        hi = _mm256_srai_epi32( _mm256_add_epi32( hi,
+                                    _mm256_set1_epi32( 1<<11 ) ), 12 );
+        lo = _mm256_srai_epi32( _mm256_add_epi32( lo,
+                                    _mm256_unpacklo_epi16( dither, zero ) ), 6 );
+        hi = _mm256_srai_epi32( _mm256_add_epi32( hi,
+                                    _mm256_unpackhi_epi16( dither, zero ) ), 6 );
+        lo = _mm256_packs_epi32( lo, hi );
+        lo = _mm256_permute4x64_epi64( _mm256_packus_epi16( lo, lo ), 0xd8 );
+        if( x + 16 <= width )
+        {
+            _mm_storeu_si128( (__m128i *)(dst + x),
+                              _mm256_castsi256_si128( lo ) );
+        }
+        else
+        {
+            uint8_t __attribute__((aligned(16))) tail[16];
+
+            _mm_store_si128( (__m128i *)tail, _mm256_castsi256_si128( lo ) );
+            memcpy( dst + x, tail, width - x );
+        }
+    }
+    _mm256_zeroupper();
+}
+#endif // HB_SIMD_X86
+
+/*
+ * Copies 'src' into the plane's padded buffer, mirroring 8 pixels of it
+ * past each edge for the transforms to read.
+ */
+static void pp7_pad_plane( pp7_plane_t * plane, const uint8_t * src )
+{
+    const int  width  = plane->width;
+    const int  height = plane->height;
+    const int  stride = plane->stride;
+    uint8_t  * p_src  = plane->src;
+    int x, y;
 
     for( y = 0; y < height; y++ )
     {
@@ -277,63 +641,91 @@ static void pp7_filter( hb_filter_private_t * pv,
         memcpy( p_src + (height+8+y)*stride,
                 p_src + (height-y+7)*stride, stride );
     }
+}
 
-    for( y = 0; y < height; y++ )
+/*
+ * Filters this segment of the rows of all three planes.  The planes are
+ * padded before the taskset is cycled, so segments only share read only
+ * data and each writes its own rows of the output.
+ */
+static void pp7_filter_thread( void * thread_args_v )
+{
+    pp7_thread_arg_t    * thread_args = thread_args_v;
+    hb_filter_private_t * pv          = thread_args->pv;
+    int segment = thread_args->segment;
+    int pp;
+
+    for( pp = 0; pp < 3; pp++ )
     {
-        for( x = -8; x < 0; x += 4 )
-        {
-            const int index = x + y*stride + (8-3)*(1+stride) + 8;
-            uint8_t * src   = p_src + index;
-            DCTELEM * tp    = temp+4*x;
+        pp7_plane_t * plane = &pv->pp7_plane[pp];
+        int segment_height  = (plane->height / pv->segments) & ~1;
+        int segment_start   = segment_height * segment;
+        int segment_stop    = segment_height * (segment + 1);
+        int y;
 
-            pp7_dct_a( tp+4*8, src, stride );
+        if( segment == pv->segments - 1 )
+        {
+            /* Final segment */
+            segment_stop = plane->height;
         }
 
-        for( x = 0; x < width; )
+        for( y = segment_start; y < segment_stop; y++ )
         {
-            const int qps = 3 + is_luma;
-            int end = XMIN(x+8, width);
+            pv->pp7_row( pv, thread_args->temp, plane->dst + y*plane->width,
+                         plane->src, plane->stride, plane->width, y );
+        }
+    }
+}
 
-            int qp;
-            if( pv->pp7_qp )
-            {
-                qp = pv->pp7_qp;
-            }
-            else
-            {
-                qp = qp_store[ (XMIN(x, width-1)>>qps) +
-                               (XMIN(y, height-1)>>qps) * qp_stride ];
+/*
+ * Sizes the padded planes and the per thread scratch for 'in', whose
+ * strides may differ from the geometry the filter was initialized with.
+ */
+static int pp7_alloc( hb_filter_private_t * pv, hb_buffer_t * in )
+{
+    int pp, ii, temp_size;
 
-                if( pv->pp7_mpeg2 )
-                {
-                    qp >>= 1;
-                }
-            }
+    for( pp = 0; pp < 3; pp++ )
+    {
+        pp7_plane_t * plane = &pv->pp7_plane[pp];
+        int size;
 
-            for( ; x < end; x++ )
-            {
-                const int index = x + y*stride + (8-3)*(1+stride) + 8;
-                uint8_t * src   = p_src + index;
-                DCTELEM * tp    = temp+4*x;
-                int v;
+        plane->width  = in->plane[pp].stride;
+        plane->height = in->plane[pp].height;
+        plane->stride = (plane->width + 16 + 15) & (~15);
 
-                if( (x&3) == 0 )
-                {
-                    pp7_dct_a( tp+4*8, src, stride );
-                }
+        size = plane->stride * (plane->height + 16);
+        if( size > plane->size )
+        {
+            free( plane->src );
+            plane->src  = malloc( size );
+            plane->size = plane->src != NULL ? size : 0;
+            if( plane->src == NULL )
+            {
+                return -1;
+            }
+        }
+    }
 
-                pp7_dct_b( block, tp );
+    temp_size = 4 * (pv->pp7_plane[0].stride + 32);
+    for( ii = 0; ii < pv->segments; ii++ )
+    {
+        pp7_thread_arg_t * thread_args;
 
-                v = pp7_requantize( block, qp );
-                v = (v + pp7_dither[y&7][x&7]) >> 6;
-                if( (unsigned)v > 255 )
-                {
-                    v = (-v) >> 31;
-                }
-                dst[x + y*width] = v;
+        thread_args = taskset_thread_args( &pv->pp7_taskset, ii );
+        if( temp_size > thread_args->temp_size )
+        {
+            free( thread_args->temp );
+            thread_args->temp      = malloc( temp_size * sizeof(DCTELEM) );
+            thread_args->temp_size = thread_args->temp != NULL ? temp_size : 0;
+            if( thread_args->temp == NULL )
+            {
+                return -1;
             }
         }
     }
+
+    return 0;
 }
 
 static int hb_deblock_init( hb_filter_object_t * filter, 
@@ -355,27 +747,72 @@ static int hb_deblock_init( hb_filter_object_t * filter,
     {
         pv->pp7_qp = 0;
     }
+    if( pv->pp7_qp > 98 )
+    {
+        pv->pp7_qp = 98;
+    }
 
     pp7_init_threshold();
 
     switch( pv->pp7_mode )
     {
-        case 0:
-            pp7_requantize = pp7_hard_threshold;
-            break;
         case 1:
-            pp7_requantize = pp7_soft_threshold;
+            pv->pp7_requantize = pp7_soft_threshold;
             break;
         case 2:
-            pp7_requantize = pp7_medium_threshold;
+            pv->pp7_requantize = pp7_medium_threshold;
+            break;
+        default:
+            pv->pp7_mode = 0;
+            pv->pp7_requantize = pp7_hard_threshold;
             break;
     }
 
-    int h = (init->geometry.height + 16 + 15) & (~15);
+    pv->pp7_row = pp7_row_c;
+#if HB_SIMD_X86
+    if( hb_get_cpu_flags() & HB_CPU_FLAG_AVX2 )
+    {
+        pv->pp7_row = pp7_row_avx2;
+    }
+    else if( hb_get_cpu_flags() & HB_CPU_FLAG_SSE2 )
+    {
+        pv->pp7_row = pp7_row_sse2;
+    }
+#endif
+
+    /*
+     * Setup pp7 taskset, each thread filters a segment of the rows.
+     */
+    pv->segments = hb_get_cpu_count();
+    if( taskset_init( &pv->pp7_taskset, pv->segments,
+                      sizeof( pp7_thread_arg_t ) ) == 0 )
+    {
+        hb_error( "deblock could not initialize taskset" );
+        pv->segments = 0;
+        return -1;
+    }
+
+    int ii;
+    for( ii = 0; ii < pv->segments; ii++ )
+    {
+        pp7_thread_arg_t *thread_args;
+
+        thread_args = taskset_thread_args( &pv->pp7_taskset, ii );
 
-    pv->pp7_temp_stride = (init->geometry.width + 16 + 15) & (~15);
+        thread_args->pv = pv;
+        thread_args->segment = ii;
+        thread_args->temp = NULL;
+        thread_args->temp_size = 0;
 
-    pv->pp7_src = (uint8_t*)malloc( pv->pp7_temp_stride*(h+8)*sizeof(uint8_t) );
+        if( taskset_thread_spawn( &pv->pp7_taskset, ii,
+                                  "deblock_filter_segment",
+                                  pp7_filter_thread,
+                                  HB_NORMAL_PRIORITY ) == 0 )
+        {
+            hb_error( "deblock could not spawn thread" );
+            return -1;
+        }
+    }
 
     return 0;
 }
@@ -383,12 +820,27 @@ static int hb_deblock_init( hb_filter_object_t * filter,
 static void hb_deblock_close( hb_filter_object_t * filter )
 {
     hb_filter_private_t * pv = filter->private_data;
+    int ii;
 
     if( !pv )
     {
         return;
     }
 
+    for( ii = 0; ii < pv->segments; ii++ )
+    {
+        pp7_thread_arg_t *thread_args;
+
+        thread_args = taskset_thread_args( &pv->pp7_taskset, ii );
+        free( thread_args->temp );
+    }
+    taskset_fini( &pv->pp7_taskset );
+
+    for( ii = 0; ii < 3; ii++ )
+    {
+        free( pv->pp7_plane[ii].src );
+    }
+
     free( pv );
     filter->private_data = NULL;
 }
@@ -407,36 +859,29 @@ static int hb_deblock_work( hb_filter_object_t * filter,
         return HB_FILTER_DONE;
     }
 
+    /* TODO: per macroblock qp from mpi->qscale, halved for mpeg2 */
     if( /*TODO: mpi->qscale ||*/ pv->pp7_qp )
     {
+        int pp;
+
+        if( pp7_alloc( pv, in ) < 0 )
+        {
+            hb_error( "deblock: out of memory" );
+            *buf_in = NULL;
+            *buf_out = in;
+            return HB_FILTER_OK;
+        }
+
         out = hb_video_buffer_init( in->f.width, in->f.height );
 
-        pp7_filter( pv,
-                out->plane[0].data,
-                in->plane[0].data,
-                in->plane[0].stride,
-                in->plane[0].height,
-                NULL, /* TODO: mpi->qscale*/
-                0,    /* TODO: mpi->qstride*/
-                1 );
-
-        pp7_filter( pv,
-                out->plane[1].data,
-                in->plane[1].data,
-                in->plane[1].stride,
-                in->plane[1].height,
-                NULL, /* TODO: mpi->qscale*/
-                0,    /* TODO: mpi->qstride*/
-                0 );
-
-        pp7_filter( pv,
-                out->plane[2].data,
-                in->plane[2].data,
-                in->plane[2].stride,
-                in->plane[2].height,
-                NULL, /* TODO: mpi->qscale*/
-                0,    /* TODO: mpi->qstride*/
-                0 );
+        for( pp = 0; pp < 3; pp++ )
+        {
+            pv->pp7_plane[pp].dst = out->plane[pp].data;
+            pp7_pad_plane( &pv->pp7_plane[pp], in->plane[pp].data );
+        }
+
+        /* Allow the taskset threads to make one pass over the data. */
+        taskset_cycle( &pv->pp7_taskset );
 
         out->s = in->s;
         hb_buffer_move_subs( out, in );
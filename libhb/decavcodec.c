@@ -296,6 +296,7 @@ static int decavcodecaInit( hb_work_object_t * w, hb_job_t * job )
     {
         pv->resample =
             hb_audio_resample_init(AV_SAMPLE_FMT_FLT,
+                                   w->audio->config.out.samplerate,
                                    w->audio->config.out.mixdown,
                                    w->audio->config.out.normalize_mix_level);
         if (pv->resample == NULL)
@@ -2232,6 +2233,7 @@ static void decodeAudio(hb_audio_t *audio, hb_work_private_t *pv, uint8_t *data,
                                                      pv->frame->channel_layout);
                 hb_audio_resample_set_sample_fmt(pv->resample,
                                                  pv->frame->format);
+                hb_audio_resample_set_sample_rate(pv->resample, samplerate);
                 if (hb_audio_resample_update(pv->resample))
                 {
                     hb_log("decavcodec: hb_audio_resample_update() failed");
@@ -163,6 +163,7 @@ static int declpcmInit( hb_work_object_t * w, hb_job_t * job )
 
     pv->resample =
         hb_audio_resample_init(AV_SAMPLE_FMT_FLT,
+                               w->audio->config.out.samplerate,
                                w->audio->config.out.mixdown,
                                w->audio->config.out.normalize_mix_level);
     if (pv->resample == NULL)
@@ -331,6 +332,7 @@ static hb_buffer_t *Decode( hb_work_object_t *w )
 
     hb_audio_resample_set_channel_layout(pv->resample,
                                          hdr2layout[pv->nchannels - 1]);
+    hb_audio_resample_set_sample_rate(pv->resample, pv->samplerate);
     if (hb_audio_resample_update(pv->resample))
     {
         hb_log("declpcm: hb_audio_resample_update() failed");
@@ -70,6 +70,11 @@ which will feed EEDI2 interpolations to yadif.
 #include "hbffmpeg.h"
 #include "eedi2.h"
 #include "taskset.h"
+#include "decomb.h"
+
+#if HB_SIMD_X86
+#include <immintrin.h>
+#endif
 
 #define PARITY_DEFAULT   -1
 
@@ -119,6 +124,8 @@ typedef struct yadif_thread_arg_s {
 
 struct hb_filter_private_s
 {
+    decomb_kernels_t kernels;
+
     // Decomb parameters
     int              mode;
     int              filter_mode;
@@ -188,12 +195,6 @@ struct hb_filter_private_s
     taskset_t        eedi2_taskset;       // Threads for eedi2 - one per plane
 };
 
-typedef struct
-{
-    int tap[5];
-    int normalize;
-} filter_param_t;
-
 static int hb_decomb_init( hb_filter_object_t * filter,
                            hb_filter_init_t * init );
 
@@ -248,67 +249,6 @@ static inline int cubic_interpolate_pixel( int y0, int y1, int y2, int y3 )
     return result;
 }
 
-static void cubic_interpolate_line(
-        uint8_t *dst,
-        uint8_t *cur,
-        int width,
-        int height,
-        int stride,
-        int y)
-{
-    int w = width;
-    int x;
-
-    for( x = 0; x < w; x++)
-    {
-        int a, b, c, d;
-        a = b = c = d = 0;
-
-        if( y >= 3 )
-        {
-            /* Normal top*/
-            a = cur[-3*stride];
-            b = cur[-stride];
-        }
-        else if( y == 2 || y == 1 )
-        {
-            /* There's only one sample above this pixel, use it twice. */
-            a = cur[-stride];
-            b = cur[-stride];
-        }
-        else if( y == 0 )
-        {
-            /* No samples above, triple up on the one below. */
-            a = cur[+stride];
-            b = cur[+stride];
-        }
-
-        if( y <= ( height - 4 ) )
-        {
-            /* Normal bottom*/
-            c = cur[+stride];
-            d = cur[3*stride];
-        }
-        else if( y == ( height - 3 ) || y == ( height - 2 ) )
-        {
-            /* There's only one sample below, use it twice. */
-            c = cur[+stride];
-            d = cur[+stride];
-        }
-        else if( y == height - 1)
-        {
-            /* No samples below, triple up on the one above. */
-            c = cur[-stride];
-            d = cur[-stride];
-        }
-
-        dst[0] = cubic_interpolate_pixel( a, b, c, d );
-
-        dst++;
-        cur++;
-    }
-}
-
 static void draw_mask_box( hb_filter_private_t * pv )
 {
     int x = pv->mask_box_x;
@@ -412,7 +352,7 @@ static void store_ref(hb_filter_private_t * pv, hb_buffer_t * b)
     pv->ref[2] = b;
 }
 
-static inline int blend_filter_pixel(filter_param_t *filter, int up2, int up1, int current, int down1, int down2)
+static inline int blend_filter_pixel(const filter_param_t *filter, int up2, int up1, int current, int down1, int down2)
 {
     /* Low-pass 5-tap filter */
     int result = 0;
@@ -428,7 +368,956 @@ static inline int blend_filter_pixel(filter_param_t *filter, int up2, int up1, i
     return result;
 }
 
-static void blend_filter_line(filter_param_t *filter,
+/*
+ * Per pixel loops of the comb detection and of the blend and cubic
+ * interpolators.  The C versions are the reference, the SIMD versions
+ * give the same results and leave the ends of rows to the C versions.
+ */
+static void detect_row_c( const comb_param_t * param, uint8_t * mask,
+                          const uint8_t * prev, const uint8_t * cur,
+                          const uint8_t * next, int stride, int width )
+{
+    int spatial_metric  = param->spatial_metric;
+    int mthresh         = param->mthresh;
+    int athresh         = param->athresh;
+    int athresh_squared = param->athresh_squared;
+    int athresh6        = param->athresh6;
+
+    /* These are just to make the buffer locations easier to read. */
+    int up_2    = -2 * stride ;
+    int up_1    = -1 * stride;
+    int down_1  =      stride;
+    int down_2  =  2 * stride;
+    int x;
+
+    for( x = 0; x < width; x++ )
+    {
+        int up_diff = cur[0] - cur[up_1];
+        int down_diff = cur[0] - cur[down_1];
+
+        if( ( up_diff >  athresh && down_diff >  athresh ) ||
+            ( up_diff < -athresh && down_diff < -athresh ) )
+        {
+            /* The pixel above and below are different,
+               and they change in the same "direction" too.*/
+            int motion = 0;
+            if( mthresh > 0 )
+            {
+                /* Make sure there's sufficient motion between frame t-1 to frame t+1. */
+                if( abs( prev[0] - cur[0] ) > mthresh &&
+                    abs(  cur[up_1] - next[up_1]    ) > mthresh &&
+                    abs(  cur[down_1] - next[down_1]    ) > mthresh )
+                        motion++;
+                if( abs(     next[0] - cur[0] ) > mthresh &&
+                    abs( prev[up_1] - cur[up_1] ) > mthresh &&
+                    abs( prev[down_1] - cur[down_1] ) > mthresh )
+                        motion++;
+            }
+            else
+            {
+                /* User doesn't want to check for motion,
+                   so move on to the spatial check.       */
+                motion = 1;
+            }
+
+            if( motion || param->force_motion )
+            {
+                   /* That means it's time for the spatial check.
+                      We've got several options here.             */
+                if( spatial_metric == 0 )
+                {
+                    /* Simple 32detect style comb detection */
+                    if( ( abs( cur[0] - cur[down_2] ) < 10  ) &&
+                        ( abs( cur[0] - cur[down_1] ) > 15 ) )
+                    {
+                        mask[0] = 1;
+                    }
+                }
+                else if( spatial_metric == 1 )
+                {
+                    /* This, for comparison, is what IsCombed uses.
+                       It's better, but still noise senstive.      */
+                       int combing = ( cur[up_1] - cur[0] ) *
+                                     ( cur[down_1] - cur[0] );
+
+                       if( combing > athresh_squared )
+                       {
+                           mask[0] = 1;
+                       }
+                }
+                else if( spatial_metric == 2 )
+                {
+                    /* Tritical's noise-resistant combing scorer.
+                       The check is done on a bob+blur convolution. */
+                    int combing = abs( cur[up_2]
+                                     + ( 4 * cur[0] )
+                                     + cur[down_2]
+                                     - ( 3 * ( cur[up_1]
+                                             + cur[down_1] ) ) );
+
+                    /* If the frame is sufficiently combed,
+                       then mark it down on the mask as 1. */
+                    if( combing > athresh6 )
+                    {
+                        mask[0] = 1;
+                    }
+                }
+            }
+        }
+
+        cur++;
+        prev++;
+        next++;
+        mask++;
+    }
+}
+
+static void detect_gamma_row_c( const gamma_comb_param_t * param,
+                                uint8_t * mask, const uint8_t * prev,
+                                const uint8_t * cur, const uint8_t * next,
+                                int stride, int width )
+{
+    const float * gamma_lut = param->gamma_lut;
+    float mthresh  = param->mthresh;
+    float athresh  = param->athresh;
+    float athresh6 = param->athresh6;
+
+    /* These are just to make the buffer locations easier to read. */
+    int up_2    = -2 * stride ;
+    int up_1    = -1 * stride;
+    int down_1  =      stride;
+    int down_2  =  2 * stride;
+    int x;
+
+    for( x = 0; x < width; x++ )
+    {
+        float up_diff, down_diff;
+        up_diff   = gamma_lut[cur[0]] - gamma_lut[cur[up_1]];
+        down_diff = gamma_lut[cur[0]] - gamma_lut[cur[down_1]];
+
+        if( ( up_diff >  athresh && down_diff >  athresh ) ||
+            ( up_diff < -athresh && down_diff < -athresh ) )
+        {
+            /* The pixel above and below are different,
+               and they change in the same "direction" too.*/
+            int motion = 0;
+            if( mthresh > 0 )
+            {
+                /* Make sure there's sufficient motion between frame t-1 to frame t+1. */
+                if( fabs( gamma_lut[prev[0]]      - gamma_lut[cur[0]] ) > mthresh &&
+                    fabs( gamma_lut[cur[up_1]]    - gamma_lut[next[up_1]]    ) > mthresh &&
+                    fabs( gamma_lut[cur[down_1]]  - gamma_lut[next[down_1]]    ) > mthresh )
+                        motion++;
+                if( fabs( gamma_lut[next[0]]      - gamma_lut[cur[0]] ) > mthresh &&
+                    fabs( gamma_lut[prev[up_1]]   - gamma_lut[cur[up_1]] ) > mthresh &&
+                    fabs( gamma_lut[prev[down_1]] - gamma_lut[cur[down_1]] ) > mthresh )
+                        motion++;
+
+            }
+            else
+            {
+                /* User doesn't want to check for motion,
+                   so move on to the spatial check.       */
+                motion = 1;
+            }
+
+            if( motion || param->force_motion )
+            {
+
+                /* Tritical's noise-resistant combing scorer.
+                   The check is done on a bob+blur convolution. */
+                float combing = fabs( gamma_lut[cur[up_2]]
+                                 + ( 4 * gamma_lut[cur[0]] )
+                                 + gamma_lut[cur[down_2]]
+                                 - ( 3 * ( gamma_lut[cur[up_1]]
+                                         + gamma_lut[cur[down_1]] ) ) );
+                /* If the frame is sufficiently combed,
+                   then mark it down on the mask as 1. */
+                if( combing > athresh6 )
+                {
+                    mask[0] = 1;
+                }
+            }
+        }
+
+        cur++;
+        prev++;
+        next++;
+        mask++;
+    }
+}
+
+// Score of 'block_width' pixels of a mask row starting at 'x'
+static int comb_block_row_c( const uint8_t * mask, int x, int width,
+                             int block_width )
+{
+    int end = x + block_width;
+    int score = 0;
+
+    for( ; x < end; x++ )
+    {
+        /* We only want to mark a pixel in a block as combed
+           if the adjacent pixels are as well. Got to
+           handle the sides separately.       */
+        if( x == 0 )
+        {
+            score += mask[0] & mask[1];
+        }
+        else if( x == (width -1) )
+        {
+            score += mask[x - 1] & mask[x];
+        }
+        else
+        {
+            score += mask[x - 1] & mask[x] & mask[x + 1];
+        }
+    }
+    return score;
+}
+
+static int filtered_block_row_c( const uint8_t * mask, int x, int width,
+                                 int block_width )
+{
+    int end = x + block_width;
+    int score = 0;
+
+    for( ; x < end; x++ )
+    {
+        score += mask[x];
+    }
+    return score;
+}
+
+static void blend_row_c( const filter_param_t * filter, uint8_t * dst,
+                         const uint8_t * cur, int up2, int up1,
+                         int down1, int down2, int width )
+{
+    int x;
+
+    for( x = 0; x < width; x++ )
+    {
+        /* Low-pass 5-tap filter */
+        dst[x] = blend_filter_pixel( filter, cur[x + up2], cur[x + up1],
+                                     cur[x], cur[x + down1], cur[x + down2] );
+    }
+}
+
+static void cubic_row_c( uint8_t * dst, const uint8_t * a, const uint8_t * b,
+                         const uint8_t * c, const uint8_t * d, int width )
+{
+    int x;
+
+    for( x = 0; x < width; x++ )
+    {
+        dst[x] = cubic_interpolate_pixel( a[x], b[x], c[x], d[x] );
+    }
+}
+
+#if HB_SIMD_X86
+/*
+ * Pixels are widened to 16 bits, which holds any difference or sum the
+ * C versions compute.  Thresholds are clamped to the range of those so
+ * they compare the same.
+ */
+#define CLAMP_THRESH(t, lo, hi) MIN(MAX(t, lo), hi)
+
+__attribute__((target("sse2")))
+static inline __m128i load_epi16_sse2( const uint8_t * p )
+{
+    return _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i *)p ),
+                              _mm_setzero_si128() );
+}
+
+__attribute__((target("sse2")))
+static inline __m128i abs_epi16_sse2( __m128i v )
+{
+    return _mm_max_epi16( v, _mm_sub_epi16( _mm_setzero_si128(), v ) );
+}
+
+__attribute__((target("sse2")))
+static void detect_row_sse2( const comb_param_t * param, uint8_t * mask,
+                             const uint8_t * prev, const uint8_t * cur,
+                             const uint8_t * next, int stride, int width )
+{
+    int     athresh  = CLAMP_THRESH( param->athresh, -256, 256 );
+    __m128i a        = _mm_set1_epi16( athresh );
+    __m128i na       = _mm_set1_epi16( -athresh );
+    __m128i m        = _mm_set1_epi16( MIN( param->mthresh, 256 ) );
+    __m128i a6       = _mm_set1_epi16(
+                            CLAMP_THRESH( param->athresh6, -1, 2048 ) );
+    __m128i sq       = _mm_set1_epi32( param->athresh_squared );
+    int     motion   = param->mthresh > 0 && !param->force_motion;
+    int     x;
+
+    for( x = 0; x + 8 <= width; x += 8 )
+    {
+        __m128i c  = load_epi16_sse2( &cur[x] );
+        __m128i u1 = load_epi16_sse2( &cur[x - stride] );
+        __m128i d1 = load_epi16_sse2( &cur[x + stride] );
+        __m128i up = _mm_sub_epi16( c, u1 );
+        __m128i dn = _mm_sub_epi16( c, d1 );
+        __m128i comb, sp;
+
+        comb = _mm_or_si128(
+            _mm_and_si128( _mm_cmpgt_epi16( up, a ),
+                           _mm_cmpgt_epi16( dn, a ) ),
+            _mm_and_si128( _mm_cmplt_epi16( up, na ),
+                           _mm_cmplt_epi16( dn, na ) ) );
+        // Most of a frame isn't combed, the mask row is already cleared
+        if( _mm_movemask_epi8( comb ) == 0 )
+        {
+            continue;
+        }
+        if( motion )
+        {
+            __m128i m1, m2;
+
+            m1 = _mm_and_si128( _mm_and_si128(
+                _mm_cmpgt_epi16( abs_epi16_sse2( _mm_sub_epi16(
+                    load_epi16_sse2( &prev[x] ), c ) ), m ),
+                _mm_cmpgt_epi16( abs_epi16_sse2( _mm_sub_epi16(
+                    u1, load_epi16_sse2( &next[x - stride] ) ) ), m ) ),
+                _mm_cmpgt_epi16( abs_epi16_sse2( _mm_sub_epi16(
+                    d1, load_epi16_sse2( &next[x + stride] ) ) ), m ) );
+            m2 = _mm_and_si128( _mm_and_si128(
+                _mm_cmpgt_epi16( abs_epi16_sse2( _mm_sub_epi16(
+                    load_epi16_sse2( &next[x] ), c ) ), m ),
+                _mm_cmpgt_epi16( abs_epi16_sse2( _mm_sub_epi16(
+                    load_epi16_sse2( &prev[x - stride] ), u1 ) ), m ) ),
+                _mm_cmpgt_epi16( abs_epi16_sse2( _mm_sub_epi16(
+                    load_epi16_sse2( &prev[x + stride] ), d1 ) ), m ) );
+            comb = _mm_and_si128( comb, _mm_or_si128( m1, m2 ) );
+        }
+        switch( param->spatial_metric )
+        {
+            case 0:
+                sp = _mm_and_si128(
+                    _mm_cmplt_epi16( abs_epi16_sse2( _mm_sub_epi16( c,
+                            load_epi16_sse2( &cur[x + 2 * stride] ) ) ),
+                        _mm_set1_epi16( 10 ) ),
+                    _mm_cmpgt_epi16( abs_epi16_sse2( dn ),
+                                     _mm_set1_epi16( 15 ) ) );
+                break;
+            case 1:
+            {
+                // up * down needs 32 bits
+                __m128i lo = _mm_mullo_epi16( up, dn );
+                __m128i hi = _mm_mulhi_epi16( up, dn );
+                sp = _mm_packs_epi32(
+                    _mm_cmpgt_epi32( _mm_unpacklo_epi16( lo, hi ), sq ),
+                    _mm_cmpgt_epi32( _mm_unpackhi_epi16( lo, hi ), sq ) );
+            } break;
+            case 2:
+            {
+                __m128i t = _mm_sub_epi16(
+                    _mm_add_epi16( _mm_add_epi16(
+                        load_epi16_sse2( &cur[x - 2 * stride] ),
+                        _mm_slli_epi16( c, 2 ) ),
+                        load_epi16_sse2( &cur[x + 2 * stride] ) ),
+                    _mm_mullo_epi16( _mm_add_epi16( u1, d1 ),
+                                     _mm_set1_epi16( 3 ) ) );
+                sp = _mm_cmpgt_epi16( abs_epi16_sse2( t ), a6 );
+            } break;
+            default:
+                sp = _mm_setzero_si128();
+                break;
+        }
+        comb = _mm_and_si128( _mm_and_si128( comb, sp ),
+                              _mm_set1_epi16( 1 ) );
+        _mm_storel_epi64( (__m128i *)&mask[x], _mm_packus_epi16( comb, comb ) );
+    }
+    detect_row_c( param, &mask[x], &prev[x], &cur[x], &next[x],
+                  stride, width - x );
+}
+
+__attribute__((target("sse2")))
+static int comb_block_row_sse2( const uint8_t * mask, int x, int width,
+                                int block_width )
+{
+    __m128i sum  = _mm_setzero_si128();
+    int     end  = x + block_width;
+    int     last = MIN( end, width - 1 ); // last pixel with both neighbours
+    int     score = 0;
+
+    if( x == 0 && end > 0 )
+    {
+        score = comb_block_row_c( mask, 0, width, 1 );
+        x = 1;
+    }
+    for( ; x + 16 <= last; x += 16 )
+    {
+        __m128i v = _mm_and_si128( _mm_and_si128(
+            _mm_loadu_si128( (const __m128i *)&mask[x - 1] ),
+            _mm_loadu_si128( (const __m128i *)&mask[x] ) ),
+            _mm_loadu_si128( (const __m128i *)&mask[x + 1] ) );
+        sum = _mm_add_epi64( sum, _mm_sad_epu8( v, _mm_setzero_si128() ) );
+    }
+    score += _mm_cvtsi128_si32( sum ) +
+             _mm_cvtsi128_si32( _mm_srli_si128( sum, 8 ) );
+    return score + comb_block_row_c( mask, x, width, end - x );
+}
+
+__attribute__((target("sse2")))
+static int filtered_block_row_sse2( const uint8_t * mask, int x, int width,
+                                    int block_width )
+{
+    __m128i sum = _mm_setzero_si128();
+    int     end = x + block_width;
+
+    for( ; x + 16 <= end; x += 16 )
+    {
+        sum = _mm_add_epi64( sum, _mm_sad_epu8(
+                    _mm_loadu_si128( (const __m128i *)&mask[x] ),
+                    _mm_setzero_si128() ) );
+    }
+    return _mm_cvtsi128_si32( sum ) +
+           _mm_cvtsi128_si32( _mm_srli_si128( sum, 8 ) ) +
+           filtered_block_row_c( mask, x, width, end - x );
+}
+
+// Exact unless the taps add up to more than 16 bits can hold
+static int blend_taps_fit_epi16( const filter_param_t * filter )
+{
+    int ii, sum = 0;
+
+    for( ii = 0; ii < 5; ii++ )
+    {
+        sum += abs( filter->tap[ii] );
+    }
+    return sum * 255 <= INT16_MAX;
+}
+
+__attribute__((target("sse2")))
+static void blend_row_sse2( const filter_param_t * filter, uint8_t * dst,
+                            const uint8_t * cur, int up2, int up1,
+                            int down1, int down2, int width )
+{
+    const int offset[5] = { up2, up1, 0, down1, down2 };
+    __m128i   zero      = _mm_setzero_si128();
+    __m128i   shift     = _mm_cvtsi32_si128( filter->normalize );
+    __m128i   tap[5];
+    int       ii, x = 0;
+
+    for( ii = 0; ii < 5; ii++ )
+    {
+        tap[ii] = _mm_set1_epi16( filter->tap[ii] );
+    }
+    if( !blend_taps_fit_epi16( filter ) )
+    {
+        blend_row_c( filter, dst, cur, up2, up1, down1, down2, width );
+        return;
+    }
+    for( ; x + 16 <= width; x += 16 )
+    {
+        __m128i lo = zero, hi = zero;
+
+        for( ii = 0; ii < 5; ii++ )
+        {
+            __m128i v = _mm_loadu_si128( (const __m128i *)&cur[x + offset[ii]] );
+            lo = _mm_add_epi16( lo, _mm_mullo_epi16(
+                                    _mm_unpacklo_epi8( v, zero ), tap[ii] ) );
+            hi = _mm_add_epi16( hi, _mm_mullo_epi16(
+                                    _mm_unpackhi_epi8( v, zero ), tap[ii] ) );
+        }
+        // Arithmetic shift and saturation do what hb_crop_table does
+        lo = _mm_sra_epi16( lo, shift );
+        hi = _mm_sra_epi16( hi, shift );
+        _mm_storeu_si128( (__m128i *)&dst[x], _mm_packus_epi16( lo, hi ) );
+    }
+    blend_row_c( filter, &dst[x], &cur[x], up2, up1, down1, down2, width - x );
+}
+
+// Negative sums crop to 0 whatever the rounding, the rest divides by 40
+// as (sum / 8) * 13108 >> 16, which is exact for sums this small
+__attribute__((target("sse2")))
+static inline __m128i cubic_epi16_sse2( __m128i a, __m128i b, __m128i c,
+                                        __m128i d )
+{
+    __m128i sum = _mm_sub_epi16(
+        _mm_mullo_epi16( _mm_add_epi16( b, c ), _mm_set1_epi16( 23 ) ),
+        _mm_mullo_epi16( _mm_add_epi16( a, d ), _mm_set1_epi16( 3 ) ) );
+
+    sum = _mm_max_epi16( sum, _mm_setzero_si128() );
+    return _mm_mulhi_epu16( _mm_srli_epi16( sum, 3 ),
+                            _mm_set1_epi16( 13108 ) );
+}
+
+__attribute__((target("sse2")))
+static void cubic_row_sse2( uint8_t * dst, const uint8_t * a,
+                            const uint8_t * b, const uint8_t * c,
+                            const uint8_t * d, int width )
+{
+    __m128i zero = _mm_setzero_si128();
+    int x;
+
+    for( x = 0; x + 16 <= width; x += 16 )
+    {
+        __m128i va = _mm_loadu_si128( (const __m128i *)&a[x] );
+        __m128i vb = _mm_loadu_si128( (const __m128i *)&b[x] );
+        __m128i vc = _mm_loadu_si128( (const __m128i *)&c[x] );
+        __m128i vd = _mm_loadu_si128( (const __m128i *)&d[x] );
+        __m128i lo, hi;
+
+        lo = cubic_epi16_sse2( _mm_unpacklo_epi8( va, zero ),
+                               _mm_unpacklo_epi8( vb, zero ),
+                               _mm_unpacklo_epi8( vc, zero ),
+                               _mm_unpacklo_epi8( vd, zero ) );
+        hi = cubic_epi16_sse2( _mm_unpackhi_epi8( va, zero ),
+                               _mm_unpackhi_epi8( vb, zero ),
+                               _mm_unpackhi_epi8( vc, zero ),
+                               _mm_unpackhi_epi8( vd, zero ) );
+        _mm_storeu_si128( (__m128i *)&dst[x], _mm_packus_epi16( lo, hi ) );
+    }
+    cubic_row_c( &dst[x], &a[x], &b[x], &c[x], &d[x], width - x );
+}
+
+__attribute__((target("avx2")))
+static inline __m256i load_epi16_avx2( const uint8_t * p )
+{
+    return _mm256_cvtepu8_epi16( _mm_loadu_si128( (const __m128i *)p ) );
+}
+
+__attribute__((target("avx2")))
+static inline void store_epi16_avx2( uint8_t * p, __m256i v )
+{
+    _mm_storeu_si128( (__m128i *)p,
+                      _mm_packus_epi16( _mm256_castsi256_si128( v ),
+                                        _mm256_extracti128_si256( v, 1 ) ) );
+}
+
+__attribute__((target("avx2")))
+static inline __m256i absdiff_epi16_avx2( __m256i a, __m256i b )
+{
+    return _mm256_abs_epi16( _mm256_sub_epi16( a, b ) );
+}
+
+__attribute__((target("avx2")))
+static void detect_row_avx2( const comb_param_t * param, uint8_t * mask,
+                             const uint8_t * prev, const uint8_t * cur,
+                             const uint8_t * next, int stride, int width )
+{
+    int     athresh  = CLAMP_THRESH( param->athresh, -256, 256 );
+    __m256i a        = _mm256_set1_epi16( athresh );
+    __m256i na       = _mm256_set1_epi16( -athresh );
+    __m256i m        = _mm256_set1_epi16( MIN( param->mthresh, 256 ) );
+    __m256i a6       = _mm256_set1_epi16(
+                            CLAMP_THRESH( param->athresh6, -1, 2048 ) );
+    __m256i sq       = _mm256_set1_epi32( param->athresh_squared );
+    int     motion   = param->mthresh > 0 && !param->force_motion;
+    int     x;
+
+    for( x = 0; x + 16 <= width; x += 16 )
+    {
+        __m256i c  = load_epi16_avx2( &cur[x] );
+        __m256i u1 = load_epi16_avx2( &cur[x - stride] );
+        __m256i d1 = load_epi16_avx2( &cur[x + stride] );
+        __m256i up = _mm256_sub_epi16( c, u1 );
+        __m256i dn = _mm256_sub_epi16( c, d1 );
+        __m256i comb, sp;
+
+        comb = _mm256_or_si256(
+            _mm256_and_si256( _mm256_cmpgt_epi16( up, a ),
+                              _mm256_cmpgt_epi16( dn, a ) ),
+            _mm256_and_si256( _mm256_cmpgt_epi16( na, up ),
+                              _mm256_cmpgt_epi16( na, dn ) ) );
+        if( _mm256_testz_si256( comb, comb ) )
+        {
+            continue;
+        }
+        if( motion )
+        {
+            __m256i m1, m2;
+
+            m1 = _mm256_and_si256( _mm256_and_si256(
+                _mm256_cmpgt_epi16( absdiff_epi16_avx2(
+                    load_epi16_avx2( &prev[x] ), c ), m ),
+                _mm256_cmpgt_epi16( absdiff_epi16_avx2(
+                    u1, load_epi16_avx2( &next[x - stride] ) ), m ) ),
+                _mm256_cmpgt_epi16( absdiff_epi16_avx2(
+                    d1, load_epi16_avx2( &next[x + stride] ) ), m ) );
+            m2 = _mm256_and_si256( _mm256_and_si256(
+                _mm256_cmpgt_epi16( absdiff_epi16_avx2(
+                    load_epi16_avx2( &next[x] ), c ), m ),
+                _mm256_cmpgt_epi16( absdiff_epi16_avx2(
+                    load_epi16_avx2( &prev[x - stride] ), u1 ), m ) ),
+                _mm256_cmpgt_epi16( absdiff_epi16_avx2(
+                    load_epi16_avx2( &prev[x + stride] ), d1 ), m ) );
+            comb = _mm256_and_si256( comb, _mm256_or_si256( m1, m2 ) );
+        }
+        switch( param->spatial_metric )
+        {
+            case 0:
+                sp = _mm256_and_si256(
+                    _mm256_cmpgt_epi16( _mm256_set1_epi16( 10 ),
+                        absdiff_epi16_avx2( c,
+                            load_epi16_avx2( &cur[x + 2 * stride] ) ) ),
+                    _mm256_cmpgt_epi16( _mm256_abs_epi16( dn ),
+                                        _mm256_set1_epi16( 15 ) ) );
+                break;
+            case 1:
+            {
+                // up * down needs 32 bits, the unpacks and the pack
+                // work within 128 bit lanes so they cancel out
+                __m256i lo = _mm256_mullo_epi16( up, dn );
+                __m256i hi = _mm256_mulhi_epi16( up, dn );
+                sp = _mm256_packs_epi32(
+                    _mm256_cmpgt_epi32( _mm256_unpacklo_epi16( lo, hi ), sq ),
+                    _mm256_cmpgt_epi32( _mm256_unpackhi_epi16( lo, hi ), sq ) );
+            } break;
+            case 2:
+            {
+                __m256i t = _mm256_sub_epi16(
+                    _mm256_add_epi16( _mm256_add_epi16(
+                        load_epi16_avx2( &cur[x - 2 * stride] ),
+                        _mm256_slli_epi16( c, 2 ) ),
+                        load_epi16_avx2( &cur[x + 2 * stride] ) ),
+                    _mm256_mullo_epi16( _mm256_add_epi16( u1, d1 ),
+                                        _mm256_set1_epi16( 3 ) ) );
+                sp = _mm256_cmpgt_epi16( _mm256_abs_epi16( t ), a6 );
+            } break;
+            default:
+                sp = _mm256_setzero_si256();
+                break;
+        }
+        comb = _mm256_and_si256( _mm256_and_si256( comb, sp ),
+                                 _mm256_set1_epi16( 1 ) );
+        store_epi16_avx2( &mask[x], comb );
+    }
+    _mm256_zeroupper();
+    detect_row_sse2( param, &mask[x], &prev[x], &cur[x], &next[x],
+                     stride, width - x );
+}
+
+__attribute__((target("avx2")))
+static inline __m256 gamma_load_avx2( const float * lut, const uint8_t * p )
+{
+    return _mm256_i32gather_ps( lut, _mm256_cvtepu8_epi32(
+                    _mm_loadl_epi64( (const __m128i *)p ) ), 4 );
+}
+
+__attribute__((target("avx2")))
+static inline __m256 gamma_absdiff_avx2( __m256 a, __m256 b )
+{
+    return _mm256_andnot_ps( _mm256_set1_ps( -0.f ), _mm256_sub_ps( a, b ) );
+}
+
+// Same float operations in the same order as the C version.  The gamma
+// values of the motion and spatial checks are only looked up for rows of
+// pixels that pass the first check.
+__attribute__((target("avx2")))
+static void detect_gamma_row_avx2( const gamma_comb_param_t * param,
+                                   uint8_t * mask, const uint8_t * prev,
+                                   const uint8_t * cur, const uint8_t * next,
+                                   int stride, int width )
+{
+    const float * lut = param->gamma_lut;
+    __m256 a      = _mm256_set1_ps( param->athresh );
+    __m256 na     = _mm256_set1_ps( -param->athresh );
+    __m256 m      = _mm256_set1_ps( param->mthresh );
+    __m256 a6     = _mm256_set1_ps( param->athresh6 );
+    int    motion = param->mthresh > 0 && !param->force_motion;
+    int    x, ii, bits;
+
+    for( x = 0; x + 8 <= width; x += 8 )
+    {
+        __m256 c  = gamma_load_avx2( lut, &cur[x] );
+        __m256 u1 = gamma_load_avx2( lut, &cur[x - stride] );
+        __m256 d1 = gamma_load_avx2( lut, &cur[x + stride] );
+        __m256 up = _mm256_sub_ps( c, u1 );
+        __m256 dn = _mm256_sub_ps( c, d1 );
+        __m256 comb, t;
+
+        comb = _mm256_or_ps(
+            _mm256_and_ps( _mm256_cmp_ps( up, a, _CMP_GT_OQ ),
+                           _mm256_cmp_ps( dn, a, _CMP_GT_OQ ) ),
+            _mm256_and_ps( _mm256_cmp_ps( up, na, _CMP_LT_OQ ),
+                           _mm256_cmp_ps( dn, na, _CMP_LT_OQ ) ) );
+        if( _mm256_movemask_ps( comb ) == 0 )
+        {
+            continue;
+        }
+        if( motion )
+        {
+            __m256 m1, m2;
+
+            m1 = _mm256_and_ps( _mm256_and_ps(
+                _mm256_cmp_ps( gamma_absdiff_avx2(
+                    gamma_load_avx2( lut, &prev[x] ), c ), m, _CMP_GT_OQ ),
+                _mm256_cmp_ps( gamma_absdiff_avx2(
+                    u1, gamma_load_avx2( lut, &next[x - stride] ) ), m,
+                    _CMP_GT_OQ ) ),
+                _mm256_cmp_ps( gamma_absdiff_avx2(
+                    d1, gamma_load_avx2( lut, &next[x + stride] ) ), m,
+                    _CMP_GT_OQ ) );
+            m2 = _mm256_and_ps( _mm256_and_ps(
+                _mm256_cmp_ps( gamma_absdiff_avx2(
+                    gamma_load_avx2( lut, &next[x] ), c ), m, _CMP_GT_OQ ),
+                _mm256_cmp_ps( gamma_absdiff_avx2(
+                    gamma_load_avx2( lut, &prev[x - stride] ), u1 ), m,
+                    _CMP_GT_OQ ) ),
+                _mm256_cmp_ps( gamma_absdiff_avx2(
+                    gamma_load_avx2( lut, &prev[x + stride] ), d1 ), m,
+                    _CMP_GT_OQ ) );
+            comb = _mm256_and_ps( comb, _mm256_or_ps( m1, m2 ) );
+        }
+        t = _mm256_sub_ps(
+            _mm256_add_ps( _mm256_add_ps(
+                gamma_load_avx2( lut, &cur[x - 2 * stride] ),
+                _mm256_mul_ps( _mm256_set1_ps( 4 ), c ) ),
+                gamma_load_avx2( lut, &cur[x + 2 * stride] ) ),
+            _mm256_mul_ps( _mm256_set1_ps( 3 ), _mm256_add_ps( u1, d1 ) ) );
+        comb = _mm256_and_ps( comb, _mm256_cmp_ps(
+                    gamma_absdiff_avx2( t, _mm256_setzero_ps() ), a6,
+                    _CMP_GT_OQ ) );
+        bits = _mm256_movemask_ps( comb );
+        for( ii = 0; ii < 8; ii++ )
+        {
+            mask[x + ii] = ( bits >> ii ) & 1;
+        }
+    }
+    _mm256_zeroupper();
+    detect_gamma_row_c( param, &mask[x], &prev[x], &cur[x], &next[x],
+                        stride, width - x );
+}
+
+__attribute__((target("avx2")))
+static int comb_block_row_avx2( const uint8_t * mask, int x, int width,
+                                int block_width )
+{
+    __m256i sum  = _mm256_setzero_si256();
+    int     end  = x + block_width;
+    int     last = MIN( end, width - 1 );
+    int     score = 0;
+
+    if( x == 0 && end > 0 )
+    {
+        score = comb_block_row_c( mask, 0, width, 1 );
+        x = 1;
+    }
+    for( ; x + 32 <= last; x += 32 )
+    {
+        __m256i v = _mm256_and_si256( _mm256_and_si256(
+            _mm256_loadu_si256( (const __m256i *)&mask[x - 1] ),
+            _mm256_loadu_si256( (const __m256i *)&mask[x] ) ),
+            _mm256_loadu_si256( (const __m256i *)&mask[x + 1] ) );
+        sum = _mm256_add_epi64( sum,
+                                _mm256_sad_epu8( v, _mm256_setzero_si256() ) );
+    }
+    sum = _mm256_add_epi64( sum, _mm256_srli_si256( sum, 8 ) );
+    score += _mm256_cvtsi256_si32( sum ) +
+             _mm_cvtsi128_si32( _mm256_extracti128_si256( sum, 1 ) );
+    _mm256_zeroupper();
+    return score + comb_block_row_sse2( mask, x, width, end - x );
+}
+
+__attribute__((target("avx2")))
+static int filtered_block_row_avx2( const uint8_t * mask, int x, int width,
+                                    int block_width )
+{
+    __m256i sum = _mm256_setzero_si256();
+    int     end = x + block_width;
+    int     score;
+
+    for( ; x + 32 <= end; x += 32 )
+    {
+        sum = _mm256_add_epi64( sum, _mm256_sad_epu8(
+                    _mm256_loadu_si256( (const __m256i *)&mask[x] ),
+                    _mm256_setzero_si256() ) );
+    }
+    sum = _mm256_add_epi64( sum, _mm256_srli_si256( sum, 8 ) );
+    score = _mm256_cvtsi256_si32( sum ) +
+            _mm_cvtsi128_si32( _mm256_extracti128_si256( sum, 1 ) );
+    _mm256_zeroupper();
+    return score + filtered_block_row_sse2( mask, x, width, end - x );
+}
+
+__attribute__((target("avx2")))
+static void blend_row_avx2( const filter_param_t * filter, uint8_t * dst,
+                            const uint8_t * cur, int up2, int up1,
+                            int down1, int down2, int width )
+{
+    const int offset[5] = { up2, up1, 0, down1, down2 };
+    __m128i   shift     = _mm_cvtsi32_si128( filter->normalize );
+    __m256i   tap[5];
+    int       ii, x = 0;
+
+    for( ii = 0; ii < 5; ii++ )
+    {
+        tap[ii] = _mm256_set1_epi16( filter->tap[ii] );
+    }
+    if( !blend_taps_fit_epi16( filter ) )
+    {
+        blend_row_c( filter, dst, cur, up2, up1, down1, down2, width );
+        return;
+    }
+    for( ; x + 16 <= width; x += 16 )
+    {
+        __m256i sum = _mm256_setzero_si256();
+
+        for( ii = 0; ii < 5; ii++ )
+        {
+            sum = _mm256_add_epi16( sum, _mm256_mullo_epi16(
+                        load_epi16_avx2( &cur[x + offset[ii]] ), tap[ii] ) );
+        }
+        store_epi16_avx2( &dst[x], _mm256_sra_epi16( sum, shift ) );
+    }
+    _mm256_zeroupper();
+    blend_row_c( filter, &dst[x], &cur[x], up2, up1, down1, down2, width - x );
+}
+
+__attribute__((target("avx2")))
+static void cubic_row_avx2( uint8_t * dst, const uint8_t * a,
+                            const uint8_t * b, const uint8_t * c,
+                            const uint8_t * d, int width )
+{
+    int x;
+
+    for( x = 0; x + 16 <= width; x += 16 )
+    {
+        __m256i sum = _mm256_sub_epi16(
+            _mm256_mullo_epi16( _mm256_add_epi16( load_epi16_avx2( &b[x] ),
+                                                  load_epi16_avx2( &c[x] ) ),
+                                _mm256_set1_epi16( 23 ) ),
+            _mm256_mullo_epi16( _mm256_add_epi16( load_epi16_avx2( &a[x] ),
+                                                  load_epi16_avx2( &d[x] ) ),
+                                _mm256_set1_epi16( 3 ) ) );
+
+        sum = _mm256_max_epi16( sum, _mm256_setzero_si256() );
+        store_epi16_avx2( &dst[x], _mm256_mulhi_epu16(
+                    _mm256_srli_epi16( sum, 3 ), _mm256_set1_epi16( 13108 ) ) );
+    }
+    _mm256_zeroupper();
+    cubic_row_c( &dst[x], &a[x], &b[x], &c[x], &d[x], width - x );
+}
+#endif // HB_SIMD_X86
+
+static const decomb_kernels_t decomb_kernels_c =
+{
+    detect_row_c,
+    detect_gamma_row_c,
+    comb_block_row_c,
+    filtered_block_row_c,
+    blend_row_c,
+    cubic_row_c,
+};
+
+#if HB_SIMD_X86
+static const decomb_kernels_t decomb_kernels_sse2 =
+{
+    detect_row_sse2,
+    detect_gamma_row_c,
+    comb_block_row_sse2,
+    filtered_block_row_sse2,
+    blend_row_sse2,
+    cubic_row_sse2,
+};
+
+static const decomb_kernels_t decomb_kernels_avx2 =
+{
+    detect_row_avx2,
+    detect_gamma_row_avx2,
+    comb_block_row_avx2,
+    filtered_block_row_avx2,
+    blend_row_avx2,
+    cubic_row_avx2,
+};
+#endif
+
+/*
+ * Returns the kernel sets the CPU supports, the C versions first and
+ * the fastest last, or NULL when 'index' is past the last one.
+ */
+const decomb_kernels_t * hb_decomb_kernels( int index, const char ** name )
+{
+    const decomb_kernels_t * sets[3];
+    const char             * names[3];
+    int                      count = 0;
+
+    sets[count] = &decomb_kernels_c;
+    names[count++] = "C";
+#if HB_SIMD_X86
+    if( hb_get_cpu_flags() & HB_CPU_FLAG_SSE2 )
+    {
+        sets[count] = &decomb_kernels_sse2;
+        names[count++] = "SSE2";
+    }
+    if( hb_get_cpu_flags() & HB_CPU_FLAG_AVX2 )
+    {
+        sets[count] = &decomb_kernels_avx2;
+        names[count++] = "AVX2";
+    }
+#endif
+    if( index < 0 || index >= count )
+    {
+        return NULL;
+    }
+    if( name != NULL )
+    {
+        *name = names[index];
+    }
+    return sets[index];
+}
+
+static void decomb_kernels_init( decomb_kernels_t * kernels )
+{
+    const decomb_kernels_t * k;
+    int ii;
+
+    for( ii = 0; ( k = hb_decomb_kernels( ii, NULL ) ) != NULL; ii++ )
+    {
+        *kernels = *k;
+    }
+}
+
+static void cubic_interpolate_line( const decomb_kernels_t * kernels,
+                                    uint8_t *dst,
+                                    uint8_t *cur,
+                                    int width,
+                                    int height,
+                                    int stride,
+                                    int y)
+{
+    uint8_t *a, *b, *c, *d;
+
+    if( y >= 3 )
+    {
+        /* Normal top*/
+        a = cur - 3*stride;
+        b = cur - stride;
+    }
+    else if( y == 2 || y == 1 )
+    {
+        /* There's only one sample above this pixel, use it twice. */
+        a = b = cur - stride;
+    }
+    else
+    {
+        /* No samples above, triple up on the one below. */
+        a = b = cur + stride;
+    }
+
+    if( y <= ( height - 4 ) )
+    {
+        /* Normal bottom*/
+        c = cur + stride;
+        d = cur + 3*stride;
+    }
+    else if( y == ( height - 3 ) || y == ( height - 2 ) )
+    {
+        /* There's only one sample below, use it twice. */
+        c = d = cur + stride;
+    }
+    else
+    {
+        /* No samples below, triple up on the one above. */
+        c = d = cur - stride;
+    }
+
+    kernels->cubic_row( dst, a, b, c, d, width );
+}
+
+static void blend_filter_line(const decomb_kernels_t *kernels,
+                               filter_param_t *filter,
                                uint8_t *dst,
                                uint8_t *cur,
                                int width,
@@ -436,8 +1325,6 @@ static void blend_filter_line(filter_param_t *filter,
                                int stride,
                                int y)
 {
-    int w = width;
-    int x;
     int up1, up2, down1, down2;
 
     if (y > 1 && y < (height - 2))
@@ -481,14 +1368,7 @@ static void blend_filter_line(filter_param_t *filter,
         return;
     }
 
-    for( x = 0; x < w; x++)
-    {
-        /* Low-pass 5-tap filter */
-        dst[0] = blend_filter_pixel(filter, cur[up2], cur[up1], cur[0],
-                                    cur[down1], cur[down2] );
-        dst++;
-        cur++;
-    }
+    kernels->blend_row(filter, dst, cur, up2, up1, down1, down2, width);
 }
 
 static void reset_combing_results( hb_filter_private_t * pv )
@@ -551,7 +1431,7 @@ static void check_filtered_combing_mask( hb_filter_private_t * pv, int segment,
     int threshold       = pv->block_threshold;
     int block_width     = pv->block_width;
     int block_height    = pv->block_height;
-    int block_x, block_y;
+    int block_y;
     int block_score = 0;
     uint8_t * mask_p;
     int x, y, pp;
@@ -574,13 +1454,10 @@ static void check_filtered_combing_mask( hb_filter_private_t * pv, int segment,
                 for( block_y = 0; block_y < block_height; block_y++ )
                 {
                     int my = y + block_y;
-                    mask_p = &pv->mask_filtered->plane[pp].data[my*stride + x];
+                    mask_p = &pv->mask_filtered->plane[pp].data[my*stride];
 
-                    for( block_x = 0; block_x < block_width; block_x++ )
-                    {
-                        block_score += mask_p[0];
-                        mask_p++;
-                    }
+                    block_score += pv->kernels.filtered_block_row(
+                                        mask_p, x, width, block_width );
                 }
 
                 if (pv->comb_check_complete)
@@ -619,7 +1496,7 @@ static void check_combing_mask( hb_filter_private_t * pv, int segment, int start
     int threshold       = pv->block_threshold;
     int block_width     = pv->block_width;
     int block_height    = pv->block_height;
-    int block_x, block_y;
+    int block_y;
     int block_score = 0;
     uint8_t * mask_p;
     int x, y, pp;
@@ -638,28 +1515,12 @@ static void check_combing_mask( hb_filter_private_t * pv, int segment, int start
                 for( block_y = 0; block_y < block_height; block_y++ )
                 {
                     int mask_y = y + block_y;
-                    mask_p = &pv->mask->plane[pp].data[mask_y * stride + x];
+                    mask_p = &pv->mask->plane[pp].data[mask_y * stride];
 
-                    for( block_x = 0; block_x < block_width; block_x++ )
-                    {
-                        /* We only want to mark a pixel in a block as combed
-                           if the adjacent pixels are as well. Got to
-                           handle the sides separately.       */
-                        if( (x + block_x) == 0 )
-                        {
-                            block_score += mask_p[0] & mask_p[1];
-                        }
-                        else if( (x + block_x) == (width -1) )
-                        {
-                            block_score += mask_p[-1] & mask_p[0];
-                        }
-                        else
-                        {
-                            block_score += mask_p[-1] & mask_p[0] & mask_p[1];
-                        }
-
-                        mask_p++;
-                    }
+                    /* We only want to mark a pixel in a block as combed
+                       if the adjacent pixels are as well. */
+                    block_score += pv->kernels.comb_block_row(
+                                        mask_p, x, width, block_width );
                 }
 
                 if (pv->comb_check_complete)
@@ -702,17 +1563,22 @@ static void detect_gamma_combed_segment( hb_filter_private_t * pv, int segment_s
        IsCombedTIVTC plugins.                       */
 
     /* Comb scoring algorithm */
+    gamma_comb_param_t param;
+    param.gamma_lut     = pv->gamma_lut;
     /* Motion threshold */
-    float mthresh         = (float)pv->motion_threshold / (float)255;
+    param.mthresh       = (float)pv->motion_threshold / (float)255;
     /* Spatial threshold */
-    float athresh         = (float)pv->spatial_threshold / (float)255;
-    float athresh6        = 6 *athresh;
+    param.athresh       = (float)pv->spatial_threshold / (float)255;
+    param.athresh6      = 6 *param.athresh;
+    param.force_motion  = pv->deinterlaced_frames == 0 &&
+                          pv->blended_frames == 0 &&
+                          pv->unfiltered_frames == 0;
 
     /* One pas for Y, one pass for U, one pass for V */
     int pp;
     for( pp = 0; pp < 1; pp++ )
     {
-        int x, y;
+        int y;
         int stride  = pv->ref[0]->plane[pp].stride;
         int width   = pv->ref[0]->plane[pp].width;
         int height  = pv->ref[0]->plane[pp].height;
@@ -727,12 +1593,6 @@ static void detect_gamma_combed_segment( hb_filter_private_t * pv, int segment_s
 
         for( y =  segment_start; y < segment_stop; y++ )
         {
-            /* These are just to make the buffer locations easier to read. */
-            int up_2    = -2 * stride ;
-            int up_1    = -1 * stride;
-            int down_1  =      stride;
-            int down_2  =  2 * stride;
-
             /* We need to examine a column of 5 pixels
                in the prev, cur, and next frames.      */
             uint8_t * prev = &pv->ref[0]->plane[pp].data[y * stride];
@@ -742,62 +1602,8 @@ static void detect_gamma_combed_segment( hb_filter_private_t * pv, int segment_s
 
             memset(mask, 0, stride);
 
-            for( x = 0; x < width; x++ )
-            {
-                float up_diff, down_diff;
-                up_diff   = pv->gamma_lut[cur[0]] - pv->gamma_lut[cur[up_1]];
-                down_diff = pv->gamma_lut[cur[0]] - pv->gamma_lut[cur[down_1]];
-
-                if( ( up_diff >  athresh && down_diff >  athresh ) ||
-                    ( up_diff < -athresh && down_diff < -athresh ) )
-                {
-                    /* The pixel above and below are different,
-                       and they change in the same "direction" too.*/
-                    int motion = 0;
-                    if( mthresh > 0 )
-                    {
-                        /* Make sure there's sufficient motion between frame t-1 to frame t+1. */
-                        if( fabs( pv->gamma_lut[prev[0]]      - pv->gamma_lut[cur[0]] ) > mthresh &&
-                            fabs( pv->gamma_lut[cur[up_1]]    - pv->gamma_lut[next[up_1]]    ) > mthresh &&
-                            fabs( pv->gamma_lut[cur[down_1]]  - pv->gamma_lut[next[down_1]]    ) > mthresh )
-                                motion++;
-                        if( fabs( pv->gamma_lut[next[0]]      - pv->gamma_lut[cur[0]] ) > mthresh &&
-                            fabs( pv->gamma_lut[prev[up_1]]   - pv->gamma_lut[cur[up_1]] ) > mthresh &&
-                            fabs( pv->gamma_lut[prev[down_1]] - pv->gamma_lut[cur[down_1]] ) > mthresh )
-                                motion++;
-
-                    }
-                    else
-                    {
-                        /* User doesn't want to check for motion,
-                           so move on to the spatial check.       */
-                        motion = 1;
-                    }
-
-                    if( motion || ( pv->deinterlaced_frames==0 && pv->blended_frames==0 && pv->unfiltered_frames==0) )
-                    {
-
-                        /* Tritical's noise-resistant combing scorer.
-                           The check is done on a bob+blur convolution. */
-                        float combing = fabs( pv->gamma_lut[cur[up_2]]
-                                         + ( 4 * pv->gamma_lut[cur[0]] )
-                                         + pv->gamma_lut[cur[down_2]]
-                                         - ( 3 * ( pv->gamma_lut[cur[up_1]]
-                                                 + pv->gamma_lut[cur[down_1]] ) ) );
-                        /* If the frame is sufficiently combed,
-                           then mark it down on the mask as 1. */
-                        if( combing > athresh6 )
-                        {
-                            mask[0] = 1;
-                        }
-                    }
-                }
-
-                cur++;
-                prev++;
-                next++;
-                mask++;
-            }
+            pv->kernels.detect_gamma_row( &param, mask, prev, cur, next,
+                                          stride, width );
         }
     }
 }
@@ -812,19 +1618,23 @@ static void detect_combed_segment( hb_filter_private_t * pv, int segment_start,
 
 
     /* Comb scoring algorithm */
-    int spatial_metric  = pv->spatial_metric;
+    comb_param_t param;
+    param.spatial_metric  = pv->spatial_metric;
     /* Motion threshold */
-    int mthresh         = pv->motion_threshold;
+    param.mthresh         = pv->motion_threshold;
     /* Spatial threshold */
-    int athresh         = pv->spatial_threshold;
-    int athresh_squared = athresh * athresh;
-    int athresh6        = 6 * athresh;
+    param.athresh         = pv->spatial_threshold;
+    param.athresh_squared = param.athresh * param.athresh;
+    param.athresh6        = 6 * param.athresh;
+    param.force_motion    = pv->deinterlaced_frames == 0 &&
+                            pv->blended_frames == 0 &&
+                            pv->unfiltered_frames == 0;
 
     /* One pas for Y, one pass for U, one pass for V */
     int pp;
     for( pp = 0; pp < 1; pp++ )
     {
-        int x, y;
+        int y;
         int stride  = pv->ref[0]->plane[pp].stride;
         int width   = pv->ref[0]->plane[pp].width;
         int height  = pv->ref[0]->plane[pp].height;
@@ -839,12 +1649,6 @@ static void detect_combed_segment( hb_filter_private_t * pv, int segment_start,
 
         for( y =  segment_start; y < segment_stop; y++ )
         {
-            /* These are just to make the buffer locations easier to read. */
-            int up_2    = -2 * stride ;
-            int up_1    = -1 * stride;
-            int down_1  =      stride;
-            int down_2  =  2 * stride;
-
             /* We need to examine a column of 5 pixels
                in the prev, cur, and next frames.      */
             uint8_t * prev = &pv->ref[0]->plane[pp].data[y * stride];
@@ -854,86 +1658,8 @@ static void detect_combed_segment( hb_filter_private_t * pv, int segment_start,
 
             memset(mask, 0, stride);
 
-            for( x = 0; x < width; x++ )
-            {
-                int up_diff = cur[0] - cur[up_1];
-                int down_diff = cur[0] - cur[down_1];
-
-                if( ( up_diff >  athresh && down_diff >  athresh ) ||
-                    ( up_diff < -athresh && down_diff < -athresh ) )
-                {
-                    /* The pixel above and below are different,
-                       and they change in the same "direction" too.*/
-                    int motion = 0;
-                    if( mthresh > 0 )
-                    {
-                        /* Make sure there's sufficient motion between frame t-1 to frame t+1. */
-                        if( abs( prev[0] - cur[0] ) > mthresh &&
-                            abs(  cur[up_1] - next[up_1]    ) > mthresh &&
-                            abs(  cur[down_1] - next[down_1]    ) > mthresh )
-                                motion++;
-                        if( abs(     next[0] - cur[0] ) > mthresh &&
-                            abs( prev[up_1] - cur[up_1] ) > mthresh &&
-                            abs( prev[down_1] - cur[down_1] ) > mthresh )
-                                motion++;
-                    }
-                    else
-                    {
-                        /* User doesn't want to check for motion,
-                           so move on to the spatial check.       */
-                        motion = 1;
-                    }
-
-                    if( motion || ( pv->deinterlaced_frames==0 && pv->blended_frames==0 && pv->unfiltered_frames==0) )
-                    {
-                           /* That means it's time for the spatial check.
-                              We've got several options here.             */
-                        if( spatial_metric == 0 )
-                        {
-                            /* Simple 32detect style comb detection */
-                            if( ( abs( cur[0] - cur[down_2] ) < 10  ) &&
-                                ( abs( cur[0] - cur[down_1] ) > 15 ) )
-                            {
-                                mask[0] = 1;
-                            }
-                        }
-                        else if( spatial_metric == 1 )
-                        {
-                            /* This, for comparison, is what IsCombed uses.
-                               It's better, but still noise senstive.      */
-                               int combing = ( cur[up_1] - cur[0] ) *
-                                             ( cur[down_1] - cur[0] );
-
-                               if( combing > athresh_squared )
-                               {
-                                   mask[0] = 1;
-                               }
-                        }
-                        else if( spatial_metric == 2 )
-                        {
-                            /* Tritical's noise-resistant combing scorer.
-                               The check is done on a bob+blur convolution. */
-                            int combing = abs( cur[up_2]
-                                             + ( 4 * cur[0] )
-                                             + cur[down_2]
-                                             - ( 3 * ( cur[up_1]
-                                                     + cur[down_1] ) ) );
-
-                            /* If the frame is sufficiently combed,
-                               then mark it down on the mask as 1. */
-                            if( combing > athresh6 )
-                            {
-                                mask[0] = 1;
-                            }
-                        }
-                    }
-                }
-
-                cur++;
-                prev++;
-                next++;
-                mask++;
-            }
+            pv->kernels.detect_row( &param, mask, prev, cur, next,
+                                    stride, width );
         }
     }
 }
@@ -1029,35 +1755,10 @@ static void eedi2_filter_thread( void *thread_args_v )
     pv = thread_args->pv;
     plane = thread_args->plane;
 
-    hb_log("eedi2 thread started for plane %d", plane);
-
-    while (1)
-    {
-        /*
-         * Wait here until there is work to do.
-         */
-        taskset_thread_wait4start( &pv->eedi2_taskset, plane );
-
-        if( taskset_thread_stop( &pv->eedi2_taskset, plane ) )
-        {
-            /*
-             * No more work to do, exit this thread.
-             */
-            break;
-        }
-
-        /*
-         * Process plane
-         */
-        eedi2_interpolate_plane( pv, plane );
-
-        /*
-         * Finished this segment, let everyone know.
-         */
-        taskset_thread_complete( &pv->eedi2_taskset, plane );
-    }
-
-    taskset_thread_complete( &pv->eedi2_taskset, plane );
+    /*
+     * Process plane
+     */
+    eedi2_interpolate_plane( pv, plane );
 }
 
 // Sets up the input field planes for EEDI2 in pv->eedi_half[SRCPF]
@@ -1088,308 +1789,230 @@ static void eedi2_planer( hb_filter_private_t * pv )
 static void mask_dilate_thread( void *thread_args_v )
 {
     hb_filter_private_t * pv;
-    int segment, segment_start, segment_stop;
+    int segment_start, segment_stop;
     decomb_thread_arg_t *thread_args = thread_args_v;
 
     pv = thread_args->pv;
-    segment = thread_args->segment;
 
-    hb_log("mask dilate thread started for segment %d", segment);
+    int xx, yy, pp;
 
-    while (1)
+    int count;
+    int dilation_threshold = 4;
+
+    for( pp = 0; pp < 1; pp++ )
     {
-        /*
-         * Wait here until there is work to do.
-         */
-        taskset_thread_wait4start( &pv->mask_dilate_taskset, segment );
+        int width = pv->mask_filtered->plane[pp].width;
+        int height = pv->mask_filtered->plane[pp].height;
+        int stride = pv->mask_filtered->plane[pp].stride;
 
-        if (taskset_thread_stop(&pv->mask_dilate_taskset, segment))
+        int start, stop, p, c, n;
+        segment_start = thread_args->segment_start[pp];
+        segment_stop = segment_start + thread_args->segment_height[pp];
+
+        if (segment_start == 0)
         {
-            /*
-             * No more work to do, exit this thread.
-             */
-            break;
+            start = 1;
+            p = 0;
+            c = 1;
+            n = 2;
         }
-
-        int xx, yy, pp;
-
-        int count;
-        int dilation_threshold = 4;
-
-        for( pp = 0; pp < 1; pp++ )
+        else
         {
-            int width = pv->mask_filtered->plane[pp].width;
-            int height = pv->mask_filtered->plane[pp].height;
-            int stride = pv->mask_filtered->plane[pp].stride;
-
-            int start, stop, p, c, n;
-            segment_start = thread_args->segment_start[pp];
-            segment_stop = segment_start + thread_args->segment_height[pp];
-
-            if (segment_start == 0)
-            {
-                start = 1;
-                p = 0;
-                c = 1;
-                n = 2;
-            }
-            else
-            {
-                start = segment_start;
-                p = segment_start - 1;
-                c = segment_start;
-                n = segment_start + 1;
-            }
+            start = segment_start;
+            p = segment_start - 1;
+            c = segment_start;
+            n = segment_start + 1;
+        }
 
-            if (segment_stop == height)
-            {
-                stop = height -1;
-            }
-            else
-            {
-                stop = segment_stop;
-            }
+        if (segment_stop == height)
+        {
+            stop = height -1;
+        }
+        else
+        {
+            stop = segment_stop;
+        }
 
-            uint8_t *curp = &pv->mask_filtered->plane[pp].data[p * stride + 1];
-            uint8_t *cur  = &pv->mask_filtered->plane[pp].data[c * stride + 1];
-            uint8_t *curn = &pv->mask_filtered->plane[pp].data[n * stride + 1];
-            uint8_t *dst = &pv->mask_temp->plane[pp].data[c * stride + 1];
+        uint8_t *curp = &pv->mask_filtered->plane[pp].data[p * stride + 1];
+        uint8_t *cur  = &pv->mask_filtered->plane[pp].data[c * stride + 1];
+        uint8_t *curn = &pv->mask_filtered->plane[pp].data[n * stride + 1];
+        uint8_t *dst = &pv->mask_temp->plane[pp].data[c * stride + 1];
 
-            for( yy = start; yy < stop; yy++ )
+        for( yy = start; yy < stop; yy++ )
+        {
+            for( xx = 1; xx < width - 1; xx++ )
             {
-                for( xx = 1; xx < width - 1; xx++ )
+                if (cur[xx])
                 {
-                    if (cur[xx])
-                    {
-                        dst[xx] = 1;
-                        continue;
-                    }
+                    dst[xx] = 1;
+                    continue;
+                }
 
-                    count = curp[xx-1] + curp[xx] + curp[xx+1] +
-                            cur [xx-1] +            cur [xx+1] +
-                            curn[xx-1] + curn[xx] + curn[xx+1];
+                count = curp[xx-1] + curp[xx] + curp[xx+1] +
+                        cur [xx-1] +            cur [xx+1] +
+                        curn[xx-1] + curn[xx] + curn[xx+1];
 
-                    dst[xx] = count >= dilation_threshold;
-                }
-                curp += stride;
-                cur += stride;
-                curn += stride;
-                dst += stride;
+                dst[xx] = count >= dilation_threshold;
             }
+            curp += stride;
+            cur += stride;
+            curn += stride;
+            dst += stride;
         }
-
-        taskset_thread_complete( &pv->mask_dilate_taskset, segment );
     }
-
-    /*
-     * Finished this segment, let everyone know.
-     */
-    taskset_thread_complete( &pv->mask_dilate_taskset, segment );
 }
 
 static void mask_erode_thread( void *thread_args_v )
 {
     hb_filter_private_t * pv;
-    int segment, segment_start, segment_stop;
+    int segment_start, segment_stop;
     decomb_thread_arg_t *thread_args = thread_args_v;
 
     pv = thread_args->pv;
-    segment = thread_args->segment;
 
-    hb_log("mask erode thread started for segment %d", segment);
+    int xx, yy, pp;
+
+    int count;
+    int erosion_threshold = 2;
 
-    while (1)
+    for( pp = 0; pp < 1; pp++ )
     {
-        /*
-         * Wait here until there is work to do.
-         */
-        taskset_thread_wait4start( &pv->mask_erode_taskset, segment );
+        int width = pv->mask_filtered->plane[pp].width;
+        int height = pv->mask_filtered->plane[pp].height;
+        int stride = pv->mask_filtered->plane[pp].stride;
+
+        int start, stop, p, c, n;
+        segment_start = thread_args->segment_start[pp];
+        segment_stop = segment_start + thread_args->segment_height[pp];
 
-        if( taskset_thread_stop( &pv->mask_erode_taskset, segment ) )
+        if (segment_start == 0)
         {
-            /*
-             * No more work to do, exit this thread.
-             */
-            break;
+            start = 1;
+            p = 0;
+            c = 1;
+            n = 2;
         }
-
-        int xx, yy, pp;
-
-        int count;
-        int erosion_threshold = 2;
-
-        for( pp = 0; pp < 1; pp++ )
+        else
         {
-            int width = pv->mask_filtered->plane[pp].width;
-            int height = pv->mask_filtered->plane[pp].height;
-            int stride = pv->mask_filtered->plane[pp].stride;
-
-            int start, stop, p, c, n;
-            segment_start = thread_args->segment_start[pp];
-            segment_stop = segment_start + thread_args->segment_height[pp];
-
-            if (segment_start == 0)
-            {
-                start = 1;
-                p = 0;
-                c = 1;
-                n = 2;
-            }
-            else
-            {
-                start = segment_start;
-                p = segment_start - 1;
-                c = segment_start;
-                n = segment_start + 1;
-            }
+            start = segment_start;
+            p = segment_start - 1;
+            c = segment_start;
+            n = segment_start + 1;
+        }
 
-            if (segment_stop == height)
-            {
-                stop = height -1;
-            }
-            else
-            {
-                stop = segment_stop;
-            }
+        if (segment_stop == height)
+        {
+            stop = height -1;
+        }
+        else
+        {
+            stop = segment_stop;
+        }
 
-            uint8_t *curp = &pv->mask_temp->plane[pp].data[p * stride + 1];
-            uint8_t *cur  = &pv->mask_temp->plane[pp].data[c * stride + 1];
-            uint8_t *curn = &pv->mask_temp->plane[pp].data[n * stride + 1];
-            uint8_t *dst = &pv->mask_filtered->plane[pp].data[c * stride + 1];
+        uint8_t *curp = &pv->mask_temp->plane[pp].data[p * stride + 1];
+        uint8_t *cur  = &pv->mask_temp->plane[pp].data[c * stride + 1];
+        uint8_t *curn = &pv->mask_temp->plane[pp].data[n * stride + 1];
+        uint8_t *dst = &pv->mask_filtered->plane[pp].data[c * stride + 1];
 
-            for( yy = start; yy < stop; yy++ )
+        for( yy = start; yy < stop; yy++ )
+        {
+            for( xx = 1; xx < width - 1; xx++ )
             {
-                for( xx = 1; xx < width - 1; xx++ )
+                if( cur[xx] == 0 )
                 {
-                    if( cur[xx] == 0 )
-                    {
-                        dst[xx] = 0;
-                        continue;
-                    }
+                    dst[xx] = 0;
+                    continue;
+                }
 
-                    count = curp[xx-1] + curp[xx] + curp[xx+1] +
-                            cur [xx-1] +            cur [xx+1] +
-                            curn[xx-1] + curn[xx] + curn[xx+1];
+                count = curp[xx-1] + curp[xx] + curp[xx+1] +
+                        cur [xx-1] +            cur [xx+1] +
+                        curn[xx-1] + curn[xx] + curn[xx+1];
 
-                    dst[xx] = count >= erosion_threshold;
-                }
-                curp += stride;
-                cur += stride;
-                curn += stride;
-                dst += stride;
+                dst[xx] = count >= erosion_threshold;
             }
+            curp += stride;
+            cur += stride;
+            curn += stride;
+            dst += stride;
         }
-
-        taskset_thread_complete( &pv->mask_erode_taskset, segment );
     }
-
-    /*
-     * Finished this segment, let everyone know.
-     */
-    taskset_thread_complete( &pv->mask_erode_taskset, segment );
 }
 
 static void mask_filter_thread( void *thread_args_v )
 {
     hb_filter_private_t * pv;
-    int segment, segment_start, segment_stop;
+    int segment_start, segment_stop;
     decomb_thread_arg_t *thread_args = thread_args_v;
 
     pv = thread_args->pv;
-    segment = thread_args->segment;
 
-    hb_log("mask filter thread started for segment %d", segment);
+    int xx, yy, pp;
 
-    while (1)
+    for( pp = 0; pp < 1; pp++ )
     {
-        /*
-         * Wait here until there is work to do.
-         */
-        taskset_thread_wait4start( &pv->mask_filter_taskset, segment );
+        int width = pv->mask->plane[pp].width;
+        int height = pv->mask->plane[pp].height;
+        int stride = pv->mask->plane[pp].stride;
+
+        int start, stop, p, c, n;
+        segment_start = thread_args->segment_start[pp];
+        segment_stop = segment_start + thread_args->segment_height[pp];
 
-        if( taskset_thread_stop( &pv->mask_filter_taskset, segment ) )
+        if (segment_start == 0)
         {
-            /*
-             * No more work to do, exit this thread.
-             */
-            break;
+            start = 1;
+            p = 0;
+            c = 1;
+            n = 2;
         }
-
-        int xx, yy, pp;
-
-        for( pp = 0; pp < 1; pp++ )
+        else
         {
-            int width = pv->mask->plane[pp].width;
-            int height = pv->mask->plane[pp].height;
-            int stride = pv->mask->plane[pp].stride;
+            start = segment_start;
+            p = segment_start - 1;
+            c = segment_start;
+            n = segment_start + 1;
+        }
 
-            int start, stop, p, c, n;
-            segment_start = thread_args->segment_start[pp];
-            segment_stop = segment_start + thread_args->segment_height[pp];
+        if (segment_stop == height)
+        {
+            stop = height - 1;
+        }
+        else
+        {
+            stop = segment_stop;
+        }
 
-            if (segment_start == 0)
-            {
-                start = 1;
-                p = 0;
-                c = 1;
-                n = 2;
-            }
-            else
-            {
-                start = segment_start;
-                p = segment_start - 1;
-                c = segment_start;
-                n = segment_start + 1;
-            }
+        uint8_t *curp = &pv->mask->plane[pp].data[p * stride + 1];
+        uint8_t *cur = &pv->mask->plane[pp].data[c * stride + 1];
+        uint8_t *curn = &pv->mask->plane[pp].data[n * stride + 1];
+        uint8_t *dst = (pv->filter_mode == FILTER_CLASSIC ) ?
+            &pv->mask_filtered->plane[pp].data[c * stride + 1] :
+            &pv->mask_temp->plane[pp].data[c * stride + 1] ;
 
-            if (segment_stop == height)
-            {
-                stop = height - 1;
-            }
-            else
+        for( yy = start; yy < stop; yy++ )
+        {
+            for( xx = 1; xx < width - 1; xx++ )
             {
-                stop = segment_stop;
-            }
+                int h_count, v_count;
 
-            uint8_t *curp = &pv->mask->plane[pp].data[p * stride + 1];
-            uint8_t *cur = &pv->mask->plane[pp].data[c * stride + 1];
-            uint8_t *curn = &pv->mask->plane[pp].data[n * stride + 1];
-            uint8_t *dst = (pv->filter_mode == FILTER_CLASSIC ) ?
-                &pv->mask_filtered->plane[pp].data[c * stride + 1] :
-                &pv->mask_temp->plane[pp].data[c * stride + 1] ;
+                h_count = cur[xx-1] & cur[xx] & cur[xx+1];
+                v_count = curp[xx] & cur[xx] & curn[xx];
 
-            for( yy = start; yy < stop; yy++ )
-            {
-                for( xx = 1; xx < width - 1; xx++ )
+                if (pv->filter_mode == FILTER_CLASSIC)
                 {
-                    int h_count, v_count;
-
-                    h_count = cur[xx-1] & cur[xx] & cur[xx+1];
-                    v_count = curp[xx] & cur[xx] & curn[xx];
-
-                    if (pv->filter_mode == FILTER_CLASSIC)
-                    {
-                        dst[xx] = h_count;
-                    }
-                    else
-                    {
-                        dst[xx] = h_count & v_count;
-                    }
+                    dst[xx] = h_count;
+                }
+                else
+                {
+                    dst[xx] = h_count & v_count;
                 }
-                curp += stride;
-                cur += stride;
-                curn += stride;
-                dst += stride;
             }
+            curp += stride;
+            cur += stride;
+            curn += stride;
+            dst += stride;
         }
-
-        taskset_thread_complete( &pv->mask_filter_taskset, segment );
     }
-
-    /*
-     * Finished this segment, let everyone know.
-     */
-    taskset_thread_complete( &pv->mask_filter_taskset, segment );
 }
 
 static void decomb_check_thread( void *thread_args_v )
@@ -1401,42 +2024,17 @@ static void decomb_check_thread( void *thread_args_v )
     pv = thread_args->pv;
     segment = thread_args->segment;
 
-    hb_log("decomb check thread started for segment %d", segment);
+    segment_start = thread_args->segment_start[0];
+    segment_stop = segment_start + thread_args->segment_height[0];
 
-    while (1)
+    if( pv->mode & MODE_FILTER )
     {
-        /*
-         * Wait here until there is work to do.
-         */
-        taskset_thread_wait4start( &pv->decomb_check_taskset, segment );
-
-        if( taskset_thread_stop( &pv->decomb_check_taskset, segment ) )
-        {
-            /*
-             * No more work to do, exit this thread.
-             */
-            break;
-        }
-
-        segment_start = thread_args->segment_start[0];
-        segment_stop = segment_start + thread_args->segment_height[0];
-
-        if( pv->mode & MODE_FILTER )
-        {
-            check_filtered_combing_mask(pv, segment, segment_start, segment_stop);
-        }
-        else
-        {
-            check_combing_mask(pv, segment, segment_start, segment_stop);
-        }
-
-        taskset_thread_complete( &pv->decomb_check_taskset, segment );
+        check_filtered_combing_mask(pv, segment, segment_start, segment_stop);
+    }
+    else
+    {
+        check_combing_mask(pv, segment, segment_start, segment_stop);
     }
-
-    /*
-     * Finished this segment, let everyone know.
-     */
-    taskset_thread_complete( &pv->decomb_check_taskset, segment );
 }
 
 /*
@@ -1445,55 +2043,29 @@ static void decomb_check_thread( void *thread_args_v )
 static void decomb_filter_thread( void *thread_args_v )
 {
     hb_filter_private_t * pv;
-    int segment, segment_start, segment_stop;
+    int segment_start, segment_stop;
     decomb_thread_arg_t *thread_args = thread_args_v;
 
     pv = thread_args->pv;
-    segment = thread_args->segment;
 
-    hb_log("decomb filter thread started for segment %d", segment);
-
-    while (1)
+    /*
+     * Process segment (for now just from luma)
+     */
+    int pp;
+    for( pp = 0; pp < 1; pp++)
     {
-        /*
-         * Wait here until there is work to do.
-         */
-        taskset_thread_wait4start( &pv->decomb_filter_taskset, segment );
+        segment_start = thread_args->segment_start[pp];
+        segment_stop = segment_start + thread_args->segment_height[pp];
 
-        if( taskset_thread_stop( &pv->decomb_filter_taskset, segment ) )
+        if( pv->mode & MODE_GAMMA )
         {
-            /*
-             * No more work to do, exit this thread.
-             */
-            break;
+            detect_gamma_combed_segment( pv, segment_start, segment_stop );
         }
-
-        /*
-         * Process segment (for now just from luma)
-         */
-        int pp;
-        for( pp = 0; pp < 1; pp++)
+        else
         {
-            segment_start = thread_args->segment_start[pp];
-            segment_stop = segment_start + thread_args->segment_height[pp];
-
-            if( pv->mode & MODE_GAMMA )
-            {
-                detect_gamma_combed_segment( pv, segment_start, segment_stop );
-            }
-            else
-            {
-                detect_combed_segment( pv, segment_start, segment_stop );
-            }
+            detect_combed_segment( pv, segment_start, segment_stop );
         }
-
-        taskset_thread_complete( &pv->decomb_filter_taskset, segment );
     }
-
-    /*
-     * Finished this segment, let everyone know.
-     */
-    taskset_thread_complete( &pv->decomb_filter_taskset, segment );
 }
 
 static int comb_segmenter( hb_filter_private_t * pv )
@@ -1709,120 +2281,91 @@ static void yadif_decomb_filter_thread( void *thread_args_v )
     pv = thread_args->pv;
     segment = thread_args->segment;
 
-    hb_log("yadif thread started for segment %d", segment);
+    yadif_work = &pv->yadif_arguments[segment];
 
-    while (1)
-    {
-        /*
-         * Wait here until there is work to do.
-         */
-        taskset_thread_wait4start( &pv->yadif_taskset, segment );
+    /*
+     * Process all three planes, but only this segment of it.
+     */
+    hb_buffer_t *dst;
+    int parity, tff, is_combed;
 
-        if( taskset_thread_stop( &pv->yadif_taskset, segment ) )
-        {
-            /*
-             * No more work to do, exit this thread.
-             */
-            break;
-        }
+    is_combed = pv->yadif_arguments[segment].is_combed;
+    dst = yadif_work->dst;
+    tff = yadif_work->tff;
+    parity = yadif_work->parity;
 
-        yadif_work = &pv->yadif_arguments[segment];
+    int pp;
+    for (pp = 0; pp < 3; pp++)
+    {
+        int yy;
+        int width = dst->plane[pp].width;
+        int stride = dst->plane[pp].stride;
+        int height = dst->plane[pp].height;
+        int penultimate = height - 2;
 
-        /*
-         * Process all three planes, but only this segment of it.
-         */
-        hb_buffer_t *dst;
-        int parity, tff, is_combed;
+        segment_start = thread_args->segment_start[pp];
+        segment_stop = segment_start + thread_args->segment_height[pp];
 
-        is_combed = pv->yadif_arguments[segment].is_combed;
-        dst = yadif_work->dst;
-        tff = yadif_work->tff;
-        parity = yadif_work->parity;
+        // Filter parity lines
+        int start = parity ? (segment_start + 1) & ~1 : segment_start | 1;
+        uint8_t *dst2 = &dst->plane[pp].data[start * stride];
+        uint8_t *prev = &pv->ref[0]->plane[pp].data[start * stride];
+        uint8_t *cur  = &pv->ref[1]->plane[pp].data[start * stride];
+        uint8_t *next = &pv->ref[2]->plane[pp].data[start * stride];
 
-        int pp;
-        for (pp = 0; pp < 3; pp++)
+        if( is_combed == 2 )
         {
-            int yy;
-            int width = dst->plane[pp].width;
-            int stride = dst->plane[pp].stride;
-            int height = dst->plane[pp].height;
-            int penultimate = height - 2;
-
-            segment_start = thread_args->segment_start[pp];
-            segment_stop = segment_start + thread_args->segment_height[pp];
-
-            // Filter parity lines
-            int start = parity ? (segment_start + 1) & ~1 : segment_start | 1;
-            uint8_t *dst2 = &dst->plane[pp].data[start * stride];
-            uint8_t *prev = &pv->ref[0]->plane[pp].data[start * stride];
-            uint8_t *cur  = &pv->ref[1]->plane[pp].data[start * stride];
-            uint8_t *next = &pv->ref[2]->plane[pp].data[start * stride];
-
-            if( is_combed == 2 )
+            /* These will be useful if we ever do temporal blending. */
+            for( yy = start; yy < segment_stop; yy += 2 )
             {
-                /* These will be useful if we ever do temporal blending. */
-                for( yy = start; yy < segment_stop; yy += 2 )
-                {
-                    /* This line gets blend filtered, not yadif filtered. */
-                    blend_filter_line(&filter, dst2, cur, width, height, stride, yy);
-                    dst2 += stride * 2;
-                    cur += stride * 2;
-                }
+                /* This line gets blend filtered, not yadif filtered. */
+                blend_filter_line(&pv->kernels, &filter, dst2, cur, width, height,
+                                  stride, yy);
+                dst2 += stride * 2;
+                cur += stride * 2;
             }
-            else if (pv->mode == MODE_CUBIC && is_combed)
+        }
+        else if (pv->mode == MODE_CUBIC && is_combed)
+        {
+            for( yy = start; yy < segment_stop; yy += 2 )
             {
-                for( yy = start; yy < segment_stop; yy += 2 )
-                {
-                    /* Just apply vertical cubic interpolation */
-                    cubic_interpolate_line(dst2, cur, width, height, stride, yy);
-                    dst2 += stride * 2;
-                    cur += stride * 2;
-                }
+                /* Just apply vertical cubic interpolation */
+                cubic_interpolate_line(&pv->kernels, dst2, cur, width, height,
+                                       stride, yy);
+                dst2 += stride * 2;
+                cur += stride * 2;
             }
-            else if ((pv->mode & MODE_YADIF) && is_combed == 1)
+        }
+        else if ((pv->mode & MODE_YADIF) && is_combed == 1)
+        {
+            for( yy = start; yy < segment_stop; yy += 2 )
             {
-                for( yy = start; yy < segment_stop; yy += 2 )
+                if( yy > 1 && yy < penultimate )
                 {
-                    if( yy > 1 && yy < penultimate )
-                    {
-                        // This isn't the top or bottom,
-                        // proceed as normal to yadif
-                        yadif_filter_line(pv, dst2, prev, cur, next, pp,
-                                          width, height, stride,
-                                          parity ^ tff, yy);
-                    }
-                    else
-                    {
-                        // parity == 0 (TFF), y1 = y0
-                        // parity == 1 (BFF), y0 = y1
-                        // parity == 0 (TFF), yu = yp
-                        // parity == 1 (BFF), yp = yu
-                        int yp = (yy ^ parity) * stride;
-                        memcpy(dst2, &pv->ref[1]->plane[pp].data[yp], width);
-                    }
-                    dst2 += stride * 2;
-                    prev += stride * 2;
-                    cur += stride * 2;
-                    next += stride * 2;
+                    // This isn't the top or bottom,
+                    // proceed as normal to yadif
+                    yadif_filter_line(pv, dst2, prev, cur, next, pp,
+                                      width, height, stride,
+                                      parity ^ tff, yy);
                 }
-            }
-            else
-            {
-                // No combing, copy frame
-                for( yy = start; yy < segment_stop; yy += 2 )
+                else
                 {
-                    memcpy(dst2, cur, width);
-                    dst2 += stride * 2;
-                    cur += stride * 2;
+                    // parity == 0 (TFF), y1 = y0
+                    // parity == 1 (BFF), y0 = y1
+                    // parity == 0 (TFF), yu = yp
+                    // parity == 1 (BFF), yp = yu
+                    int yp = (yy ^ parity) * stride;
+                    memcpy(dst2, &pv->ref[1]->plane[pp].data[yp], width);
                 }
+                dst2 += stride * 2;
+                prev += stride * 2;
+                cur += stride * 2;
+                next += stride * 2;
             }
-
-            // Copy unfiltered lines
-            start = !parity ? (segment_start + 1) & ~1 : segment_start | 1;
-            dst2 = &dst->plane[pp].data[start * stride];
-            prev = &pv->ref[0]->plane[pp].data[start * stride];
-            cur  = &pv->ref[1]->plane[pp].data[start * stride];
-            next = &pv->ref[2]->plane[pp].data[start * stride];
+        }
+        else
+        {
+            // No combing, copy frame
             for( yy = start; yy < segment_stop; yy += 2 )
             {
                 memcpy(dst2, cur, width);
@@ -1830,13 +2373,20 @@ static void yadif_decomb_filter_thread( void *thread_args_v )
                 cur += stride * 2;
             }
         }
-        taskset_thread_complete( &pv->yadif_taskset, segment );
-    }
 
-    /*
-     * Finished this segment, let everyone know.
-     */
-    taskset_thread_complete( &pv->yadif_taskset, segment );
+        // Copy unfiltered lines
+        start = !parity ? (segment_start + 1) & ~1 : segment_start | 1;
+        dst2 = &dst->plane[pp].data[start * stride];
+        prev = &pv->ref[0]->plane[pp].data[start * stride];
+        cur  = &pv->ref[1]->plane[pp].data[start * stride];
+        next = &pv->ref[2]->plane[pp].data[start * stride];
+        for( yy = start; yy < segment_stop; yy += 2 )
+        {
+            memcpy(dst2, cur, width);
+            dst2 += stride * 2;
+            cur += stride * 2;
+        }
+    }
 }
 
 static void yadif_filter( hb_filter_private_t * pv,
@@ -1970,6 +2520,7 @@ static int hb_decomb_init( hb_filter_object_t * filter,
     filter->private_data = calloc( 1, sizeof(struct hb_filter_private_s) );
     hb_filter_private_t * pv = filter->private_data;
 
+    decomb_kernels_init( &pv->kernels );
     build_gamma_lut( pv );
 
     pv->deinterlaced_frames = 0;
@@ -2652,6 +3203,9 @@ void hb_deinterlace(hb_buffer_t *dst, hb_buffer_t *src)
 {
     int pp;
     filter_param_t filter;
+    decomb_kernels_t kernels;
+
+    decomb_kernels_init(&kernels);
 
     filter.tap[0] = -1;
     filter.tap[1] = 4;
@@ -2678,7 +3232,8 @@ void hb_deinterlace(hb_buffer_t *dst, hb_buffer_t *src)
             memcpy(pdst, psrc, width);
             pdst += stride;
             psrc += stride;
-            blend_filter_line(&filter, pdst, psrc, width, height, stride, yy + 1);
+            blend_filter_line(&kernels, &filter, pdst, psrc, width, height,
+                              stride, yy + 1);
             pdst += stride;
             psrc += stride;
         }
@@ -0,0 +1,70 @@
+/* decomb.h
+
+   Copyright (c) 2003-2014 HandBrake Team
+   This file is part of the HandBrake source code
+   Homepage: <http://handbrake.fr/>.
+   It may be used under the terms of the GNU General Public License v2.
+   For full terms see the file COPYING file or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+#ifndef HB_DECOMB_H
+#define HB_DECOMB_H
+
+typedef struct
+{
+    int tap[5];
+    int normalize;
+} filter_param_t;
+
+// Comb detection thresholds, see detect_combed_segment()
+typedef struct
+{
+    int     spatial_metric;
+    int     mthresh;
+    int     athresh;
+    int     athresh_squared;
+    int     athresh6;
+    int     force_motion;   // no motion check until the first frame is out
+} comb_param_t;
+
+typedef struct
+{
+    const float * gamma_lut;
+    float         mthresh;
+    float         athresh;
+    float         athresh6;
+    int           force_motion;
+} gamma_comb_param_t;
+
+typedef void (detect_row_t)( const comb_param_t * param, uint8_t * mask,
+                             const uint8_t * prev, const uint8_t * cur,
+                             const uint8_t * next, int stride, int width );
+typedef void (detect_gamma_row_t)( const gamma_comb_param_t * param,
+                                   uint8_t * mask, const uint8_t * prev,
+                                   const uint8_t * cur, const uint8_t * next,
+                                   int stride, int width );
+typedef int  (block_row_t)( const uint8_t * mask, int x, int width,
+                            int block_width );
+typedef void (blend_row_t)( const filter_param_t * filter, uint8_t * dst,
+                            const uint8_t * cur, int up2, int up1,
+                            int down1, int down2, int width );
+typedef void (cubic_row_t)( uint8_t * dst, const uint8_t * a,
+                            const uint8_t * b, const uint8_t * c,
+                            const uint8_t * d, int width );
+
+// Per pixel loops, picked for the CPU by decomb_kernels_init()
+typedef struct
+{
+    detect_row_t       * detect_row;
+    detect_gamma_row_t * detect_gamma_row;
+    block_row_t        * comb_block_row;     // score of a row of a block
+    block_row_t        * filtered_block_row; // same, for the filtered mask
+    blend_row_t        * blend_row;
+    cubic_row_t        * cubic_row;
+} decomb_kernels_t;
+
+// Kernel sets the CPU supports, C first and fastest last.  NULL past the
+// last one.  hb-bench --check compares them.
+const decomb_kernels_t * hb_decomb_kernels( int index, const char ** name );
+
+#endif // HB_DECOMB_H
@@ -182,115 +182,88 @@ void yadif_filter_thread( void *thread_args_v )
 {
     yadif_arguments_t *yadif_work = NULL;
     hb_filter_private_t * pv;
-    int run = 1;
     int segment, segment_start, segment_stop;
     yadif_thread_arg_t *thread_args = thread_args_v;
 
     pv = thread_args->pv;
     segment = thread_args->segment;
 
-    hb_log("Yadif Deinterlace thread started for segment %d", segment);
+    yadif_work = &pv->yadif_arguments[segment];
 
-    while( run )
+    if( yadif_work->dst == NULL )
     {
-        /*
-         * Wait here until there is work to do.
-         */
-        taskset_thread_wait4start( &pv->yadif_taskset, segment );
-
+        hb_error( "Thread started when no work available" );
+        return;
+    }
 
-        if( taskset_thread_stop( &pv->yadif_taskset, segment ) )
+    /*
+     * Process all three planes, but only this segment of it.
+     */
+    int pp;
+    for(pp = 0; pp < 3; pp++)
+    {
+        hb_buffer_t *dst = yadif_work->dst;
+        int w = dst->plane[pp].width;
+        int s = dst->plane[pp].stride;
+        int h = dst->plane[pp].height;
+        int yy;
+        int parity = yadif_work->parity;
+        int tff = yadif_work->tff;
+        int penultimate = h - 2;
+
+        int segment_height = (h / pv->segments) & ~1;
+        segment_start = segment_height * segment;
+        if( segment == pv->segments - 1 )
         {
             /*
-             * No more work to do, exit this thread.
+             * Final segment
              */
-            run = 0;
-            goto report_completion;
+            segment_stop = h;
+        } else {
+            segment_stop = segment_height * ( segment + 1 );
         }
 
-        yadif_work = &pv->yadif_arguments[segment];
-
-        if( yadif_work->dst == NULL )
+        uint8_t *dst2 = &dst->plane[pp].data[segment_start * s];
+        uint8_t *prev = &pv->yadif_ref[0]->plane[pp].data[segment_start * s];
+        uint8_t *cur  = &pv->yadif_ref[1]->plane[pp].data[segment_start * s];
+        uint8_t *next = &pv->yadif_ref[2]->plane[pp].data[segment_start * s];
+        for( yy = segment_start; yy < segment_stop; yy++ )
         {
-            hb_error( "Thread started when no work available" );
-            goto report_completion;
-        }
-
-        /*
-         * Process all three planes, but only this segment of it.
-         */
-        int pp;
-        for(pp = 0; pp < 3; pp++)
-        {
-            hb_buffer_t *dst = yadif_work->dst;
-            int w = dst->plane[pp].width;
-            int s = dst->plane[pp].stride;
-            int h = dst->plane[pp].height;
-            int yy;
-            int parity = yadif_work->parity;
-            int tff = yadif_work->tff;
-            int penultimate = h - 2;
-
-            int segment_height = (h / pv->segments) & ~1;
-            segment_start = segment_height * segment;
-            if( segment == pv->segments - 1 )
-            {
-                /*
-                 * Final segment
-                 */
-                segment_stop = h;
-            } else {
-                segment_stop = segment_height * ( segment + 1 );
-            }
-
-            uint8_t *dst2 = &dst->plane[pp].data[segment_start * s];
-            uint8_t *prev = &pv->yadif_ref[0]->plane[pp].data[segment_start * s];
-            uint8_t *cur  = &pv->yadif_ref[1]->plane[pp].data[segment_start * s];
-            uint8_t *next = &pv->yadif_ref[2]->plane[pp].data[segment_start * s];
-            for( yy = segment_start; yy < segment_stop; yy++ )
+            if(((yy ^ parity) &  1))
             {
-                if(((yy ^ parity) &  1))
+                /* This is the bottom field when TFF and vice-versa.
+                   It's the field that gets filtered. Because yadif
+                   needs 2 lines above and below the one being filtered,
+                   we need to mirror the edges. When TFF, this means
+                   replacing the 2nd line with a copy of the 1st,
+                   and the last with the second-to-last.                  */
+                if( yy > 1 && yy < penultimate )
                 {
-                    /* This is the bottom field when TFF and vice-versa.
-                       It's the field that gets filtered. Because yadif
-                       needs 2 lines above and below the one being filtered,
-                       we need to mirror the edges. When TFF, this means
-                       replacing the 2nd line with a copy of the 1st,
-                       and the last with the second-to-last.                  */
-                    if( yy > 1 && yy < penultimate )
-                    {
-                        /* This isn't the top or bottom,
-                         * proceed as normal to yadif. */
-                        yadif_filter_line(pv, dst2, prev, cur, next, w, s,
-                                          parity ^ tff);
-                    }
-                    else
-                    {
-                        // parity == 0 (TFF), y1 = y0
-                        // parity == 1 (BFF), y0 = y1
-                        // parity == 0 (TFF), yu = yp
-                        // parity == 1 (BFF), yp = yu
-                        uint8_t *src  = &pv->yadif_ref[1]->plane[pp].data[(yy^parity)*s];
-                        memcpy(dst2, src, w);
-                    }
+                    /* This isn't the top or bottom,
+                     * proceed as normal to yadif. */
+                    yadif_filter_line(pv, dst2, prev, cur, next, w, s,
+                                      parity ^ tff);
                 }
                 else
                 {
-                    /* Preserve this field unfiltered */
-                    memcpy(dst2, cur, w);
+                    // parity == 0 (TFF), y1 = y0
+                    // parity == 1 (BFF), y0 = y1
+                    // parity == 0 (TFF), yu = yp
+                    // parity == 1 (BFF), yp = yu
+                    uint8_t *src  = &pv->yadif_ref[1]->plane[pp].data[(yy^parity)*s];
+                    memcpy(dst2, src, w);
                 }
-                dst2 += s;
-                prev += s;
-                cur += s;
-                next += s;
             }
+            else
+            {
+                /* Preserve this field unfiltered */
+                memcpy(dst2, cur, w);
+            }
+            dst2 += s;
+            prev += s;
+            cur += s;
+            next += s;
         }
-
-report_completion:
-        /*
-         * Finished this segment, let everyone know.
-         */
-        taskset_thread_complete( &pv->yadif_taskset, segment );
     }
 }
 
@@ -333,51 +306,24 @@ void deint_filter_thread( void *thread_args_v )
 {
     deint_arguments_t *args = NULL;
     hb_filter_private_t * pv;
-    int run = 1;
     int segment;
     deint_thread_arg_t *thread_args = thread_args_v;
 
     pv = thread_args->pv;
     segment = thread_args->segment;
 
-    hb_log("Fast Deinterlace thread started for segment %d", segment);
+    args = &pv->deint_arguments[segment];
 
-    while( run )
+    if( args->dst == NULL )
     {
-        /*
-         * Wait here until there is work to do.
-         */
-        taskset_thread_wait4start( &pv->deint_taskset, segment );
-
-
-        if( taskset_thread_stop( &pv->deint_taskset, segment ) )
-        {
-            /*
-             * No more work to do, exit this thread.
-             */
-            run = 0;
-            goto report_completion;
-        }
-
-        args = &pv->deint_arguments[segment];
-
-        if( args->dst == NULL )
-        {
-            // This can happen when flushing final buffers.
-            goto report_completion;
-        }
-
-        /*
-         * Process all three planes, but only this segment of it.
-         */
-        hb_deinterlace(args->dst, args->src);
-
-report_completion:
-        /*
-         * Finished this segment, let everyone know.
-         */
-        taskset_thread_complete( &pv->deint_taskset, segment );
+        // This can happen when flushing final buffers.
+        return;
     }
+
+    /*
+     * Process all three planes, but only this segment of it.
+     */
+    hb_deinterlace(args->dst, args->src);
 }
 
 /*
@@ -19,6 +19,11 @@
 
 #include "hb.h"
 #include "hbffmpeg.h"
+#include "taskset.h"
+
+#if HB_SIMD_X86
+#include <immintrin.h>
+#endif
 
 #define HQDN3D_SPATIAL_LUMA_DEFAULT    4.0f
 #define HQDN3D_SPATIAL_CHROMA_DEFAULT  3.0f
@@ -27,11 +32,60 @@
 #define ABS(A) ( (A) > 0 ? (A) : -(A) )
 #define MIN( a, b ) ( (a) > (b) ? (b) : (a) )
 
+// Planes are split into this many pixel wide bands for the vertical pass
+#define HQDN3D_BAND_ALIGN 16
+
+typedef void (hqdn3d_temporal_row_t)( unsigned char * src,
+                                      unsigned char * dst,
+                                      unsigned short * frame_ant,
+                                      int w,
+                                      short * temporal );
+
+typedef void (hqdn3d_spatial_row_t)( unsigned short * line_hor,
+                                     unsigned char * dst,
+                                     unsigned short * line_ant,
+                                     unsigned short * frame_ant,
+                                     int w,
+                                     short * spatial,
+                                     short * temporal );
+
+typedef struct
+{
+    hb_filter_private_t * pv;
+    int                   segment;
+} hqdn3d_thread_arg_t;
+
 struct hb_filter_private_s
 {
-    short            hqdn3d_coef[6][512*16];
+    // The extra entries keep 32 bit gathers of the last entry in bounds
+    short            hqdn3d_coef[6][512*16 + 2];
     unsigned short * hqdn3d_line;
     unsigned short * hqdn3d_frame[3];
+    unsigned short * hqdn3d_hor;        // horizontally filtered plane
+
+    hqdn3d_temporal_row_t * temporal_row;
+    hqdn3d_spatial_row_t  * spatial_row;
+
+    taskset_t        taskset;
+    int              thread_count;
+
+    // Plane processed by the current taskset cycle
+    int              pass;
+    unsigned char  * src;
+    unsigned char  * dst;
+    unsigned short * frame_ant;
+    int              w;
+    int              h;
+    short          * spatial;
+    short          * temporal;
+};
+
+enum
+{
+    HQDN3D_PASS_TEMPORAL,       // temporal only, split in rows
+    HQDN3D_PASS_HORIZONTAL,     // horizontal spatial, split in rows
+    HQDN3D_PASS_VERTICAL,       // vertical spatial and temporal, split in
+                                //  columns
 };
 
 static int hb_denoise_init( hb_filter_object_t * filter,
@@ -82,33 +136,6 @@ static inline unsigned int hqdn3d_lowpass_mul( int prev_mul,
     return curr_mul + coef[d];
 }
 
-static void hqdn3d_denoise_temporal( unsigned char * frame_src,
-                                     unsigned char * frame_dst,
-                                     unsigned short * frame_ant,
-                                     int w, int h,
-                                     short * temporal)
-{
-    int x, y;
-    unsigned int tmp;
-
-    temporal += 0x1000;
-
-    for( y = 0; y < h; y++ )
-    {
-        for( x = 0; x < w; x++ )
-        {
-            frame_ant[x] = tmp = hqdn3d_lowpass_mul( frame_ant[x],
-                                                     frame_src[x]<<8,
-                                                     temporal );
-            frame_dst[x] = (tmp+0x7F)>>8;
-        }
-
-        frame_src += w;
-        frame_dst += w;
-        frame_ant += w;
-    }
-}
-
 static void hqdn3d_denoise_spatial( unsigned char * frame_src,
                                     unsigned char * frame_dst,
                                     unsigned short * line_ant,
@@ -166,9 +193,318 @@ static void hqdn3d_denoise_spatial( unsigned char * frame_src,
     }
 }
 
-static void hqdn3d_denoise( unsigned char * frame_src,
+/*
+ * The spatial filter is separable into a horizontal recursion along each
+ * row and a vertical one down each column.  When threaded, the horizontal
+ * pass is done for all rows first, split in rows.  That leaves every pixel
+ * of the vertical and temporal passes independent of its neighbours in the
+ * row, so these are split in columns and vectorized.
+ *
+ * The filtered values never exceed 255<<8 by more than a few units, so
+ * storing them in 16 bits keeps the result bit-exact.
+ */
+static void hqdn3d_horizontal_row( unsigned char * src,
+                                   unsigned short * line_hor,
+                                   int w,
+                                   int first,
+                                   short * spatial )
+{
+    int x;
+    unsigned int pixel_ant;
+
+    pixel_ant = src[0]<<8;
+    if( first )
+    {
+        /* First line filters the pixel itself, the vertical pass
+         * has no top neighbor to do so */
+        for( x = 0; x < w; x++ )
+        {
+            line_hor[x] = pixel_ant = hqdn3d_lowpass_mul( pixel_ant,
+                                                          src[x]<<8,
+                                                          spatial );
+        }
+    }
+    else
+    {
+        line_hor[0] = pixel_ant;
+        for( x = 0; x < w-1; x++ )
+        {
+            line_hor[x+1] = pixel_ant = hqdn3d_lowpass_mul( pixel_ant,
+                                                            src[x+1]<<8,
+                                                            spatial );
+        }
+    }
+}
+
+/* Four lines at once, which hides the latency of the recursion */
+static void hqdn3d_horizontal_row4( unsigned char * src,
+                                    unsigned short * line_hor,
+                                    int w,
+                                    short * spatial )
+{
+    int x;
+    unsigned int pixel_ant0, pixel_ant1, pixel_ant2, pixel_ant3;
+
+    line_hor[0]   = pixel_ant0 = src[0]<<8;
+    line_hor[w]   = pixel_ant1 = src[w]<<8;
+    line_hor[2*w] = pixel_ant2 = src[2*w]<<8;
+    line_hor[3*w] = pixel_ant3 = src[3*w]<<8;
+    for( x = 1; x < w; x++ )
+    {
+        pixel_ant0 = hqdn3d_lowpass_mul( pixel_ant0, src[x]<<8, spatial );
+        pixel_ant1 = hqdn3d_lowpass_mul( pixel_ant1, src[w+x]<<8, spatial );
+        pixel_ant2 = hqdn3d_lowpass_mul( pixel_ant2, src[2*w+x]<<8, spatial );
+        pixel_ant3 = hqdn3d_lowpass_mul( pixel_ant3, src[3*w+x]<<8, spatial );
+        line_hor[x]     = pixel_ant0;
+        line_hor[w+x]   = pixel_ant1;
+        line_hor[2*w+x] = pixel_ant2;
+        line_hor[3*w+x] = pixel_ant3;
+    }
+}
+
+static void hqdn3d_temporal_row_c( unsigned char * src,
+                                   unsigned char * dst,
+                                   unsigned short * frame_ant,
+                                   int w,
+                                   short * temporal )
+{
+    int x;
+    unsigned int tmp;
+
+    for( x = 0; x < w; x++ )
+    {
+        frame_ant[x] = tmp = hqdn3d_lowpass_mul( frame_ant[x],
+                                                 src[x]<<8,
+                                                 temporal );
+        dst[x] = (tmp+0x7F)>>8;
+    }
+}
+
+static void hqdn3d_spatial_row_c( unsigned short * line_hor,
+                                  unsigned char * dst,
+                                  unsigned short * line_ant,
+                                  unsigned short * frame_ant,
+                                  int w,
+                                  short * spatial,
+                                  short * temporal )
+{
+    int x;
+    unsigned int tmp;
+
+    for( x = 0; x < w; x++ )
+    {
+        line_ant[x] = tmp =  hqdn3d_lowpass_mul( line_ant[x],
+                                                 line_hor[x],
+                                                 spatial );
+        frame_ant[x] = tmp = hqdn3d_lowpass_mul( frame_ant[x],
+                                                 tmp,
+                                                 temporal );
+        dst[x] = (tmp+0x7F)>>8;
+    }
+}
+
+#if HB_SIMD_X86
+/*
+ * AVX2 versions of the row kernels, 8 pixels at a time.  The coefficient
+ * lookups are 32 bit gathers from the 16 bit tables, sign extended from
+ * the low half.
+ */
+__attribute__((target("avx2")))
+static inline __m256i hqdn3d_lowpass_mul_avx2( __m256i prev_mul,
+                                               __m256i curr_mul,
+                                               short * coef )
+{
+    __m256i d = _mm256_srai_epi32( _mm256_sub_epi32( prev_mul, curr_mul ), 4 );
+    __m256i c = _mm256_i32gather_epi32( (const int *)coef, d, 2 );
+
+    c = _mm256_srai_epi32( _mm256_slli_epi32( c, 16 ), 16 );
+    return _mm256_add_epi32( curr_mul, c );
+}
+
+// Truncates 8 32 bit values to 16 bits
+__attribute__((target("avx2")))
+static inline __m128i hqdn3d_pack_avx2( __m256i v )
+{
+    v = _mm256_and_si256( v, _mm256_set1_epi32( 0xFFFF ) );
+    v = _mm256_packus_epi32( v, v );
+    v = _mm256_permute4x64_epi64( v, _MM_SHUFFLE( 3, 1, 2, 0 ) );
+    return _mm256_castsi256_si128( v );
+}
+
+__attribute__((target("avx2")))
+static inline void hqdn3d_store_dst_avx2( unsigned char * dst, __m256i tmp )
+{
+    __m128i d;
+
+    tmp = _mm256_srli_epi32( _mm256_add_epi32( tmp, _mm256_set1_epi32( 0x7F ) ),
+                             8 );
+    d = hqdn3d_pack_avx2( _mm256_and_si256( tmp, _mm256_set1_epi32( 0xFF ) ) );
+    _mm_storel_epi64( (__m128i *)dst, _mm_packus_epi16( d, d ) );
+}
+
+__attribute__((target("avx2")))
+static void hqdn3d_temporal_row_avx2( unsigned char * src,
+                                      unsigned char * dst,
+                                      unsigned short * frame_ant,
+                                      int w,
+                                      short * temporal )
+{
+    int x;
+
+    for( x = 0; x + 8 <= w; x += 8 )
+    {
+        __m256i cur = _mm256_cvtepu8_epi32(
+                        _mm_loadl_epi64( (const __m128i *)&src[x] ) );
+        __m256i ant = _mm256_cvtepu16_epi32(
+                        _mm_loadu_si128( (const __m128i *)&frame_ant[x] ) );
+        __m256i tmp;
+
+        tmp = hqdn3d_lowpass_mul_avx2( ant, _mm256_slli_epi32( cur, 8 ),
+                                       temporal );
+        _mm_storeu_si128( (__m128i *)&frame_ant[x], hqdn3d_pack_avx2( tmp ) );
+        hqdn3d_store_dst_avx2( &dst[x], tmp );
+    }
+    _mm256_zeroupper();
+    hqdn3d_temporal_row_c( &src[x], &dst[x], &frame_ant[x], w - x, temporal );
+}
+
+__attribute__((target("avx2")))
+static void hqdn3d_spatial_row_avx2( unsigned short * line_hor,
+                                     unsigned char * dst,
+                                     unsigned short * line_ant,
+                                     unsigned short * frame_ant,
+                                     int w,
+                                     short * spatial,
+                                     short * temporal )
+{
+    int x;
+
+    for( x = 0; x + 8 <= w; x += 8 )
+    {
+        __m256i hor  = _mm256_cvtepu16_epi32(
+                        _mm_loadu_si128( (const __m128i *)&line_hor[x] ) );
+        __m256i lant = _mm256_cvtepu16_epi32(
+                        _mm_loadu_si128( (const __m128i *)&line_ant[x] ) );
+        __m256i fant = _mm256_cvtepu16_epi32(
+                        _mm_loadu_si128( (const __m128i *)&frame_ant[x] ) );
+        __m256i tmp;
+
+        tmp = hqdn3d_lowpass_mul_avx2( lant, hor, spatial );
+        _mm_storeu_si128( (__m128i *)&line_ant[x], hqdn3d_pack_avx2( tmp ) );
+        tmp = hqdn3d_lowpass_mul_avx2( fant, tmp, temporal );
+        _mm_storeu_si128( (__m128i *)&frame_ant[x], hqdn3d_pack_avx2( tmp ) );
+        hqdn3d_store_dst_avx2( &dst[x], tmp );
+    }
+    _mm256_zeroupper();
+    hqdn3d_spatial_row_c( &line_hor[x], &dst[x], &line_ant[x], &frame_ant[x],
+                          w - x, spatial, temporal );
+}
+#endif // HB_SIMD_X86
+
+/* First line has no top neighbor, only the temporal filter */
+static void hqdn3d_first_row( unsigned short * line_hor,
+                              unsigned char * dst,
+                              unsigned short * line_ant,
+                              unsigned short * frame_ant,
+                              int w,
+                              short * temporal )
+{
+    int x;
+    unsigned int tmp;
+
+    for( x = 0; x < w; x++ )
+    {
+        line_ant[x] = line_hor[x];
+        frame_ant[x] = tmp = hqdn3d_lowpass_mul( frame_ant[x],
+                                                 line_hor[x],
+                                                 temporal );
+        dst[x] = (tmp+0x7F)>>8;
+    }
+}
+
+static void hqdn3d_slice( int size, int count, int index, int align,
+                          int * start, int * end )
+{
+    *start = (int64_t)size * index / count / align * align;
+    *end   = index == count - 1 ? size :
+             (int64_t)size * ( index + 1 ) / count / align * align;
+}
+
+static void hqdn3d_denoise_thread( void * thread_args_v )
+{
+    hqdn3d_thread_arg_t * thread_data = thread_args_v;
+    hb_filter_private_t * pv = thread_data->pv;
+    int segment = thread_data->segment;
+    int w = pv->w;
+    int y, start, end;
+
+    switch( pv->pass )
+    {
+        case HQDN3D_PASS_TEMPORAL:
+            hqdn3d_slice( pv->h, pv->thread_count, segment, 1, &start, &end );
+            for( y = start; y < end; y++ )
+            {
+                pv->temporal_row( pv->src + y*w,
+                                  pv->dst + y*w,
+                                  pv->frame_ant + y*w,
+                                  w,
+                                  pv->temporal );
+            }
+            break;
+
+        case HQDN3D_PASS_HORIZONTAL:
+            hqdn3d_slice( pv->h, pv->thread_count, segment, 1, &start, &end );
+            for( y = start; y < end; )
+            {
+                if( y > 0 && y + 4 <= end )
+                {
+                    hqdn3d_horizontal_row4( pv->src + y*w,
+                                            pv->hqdn3d_hor + y*w,
+                                            w,
+                                            pv->spatial );
+                    y += 4;
+                    continue;
+                }
+                hqdn3d_horizontal_row( pv->src + y*w,
+                                       pv->hqdn3d_hor + y*w,
+                                       w,
+                                       y == 0,
+                                       pv->spatial );
+                y++;
+            }
+            break;
+
+        case HQDN3D_PASS_VERTICAL:
+            hqdn3d_slice( w, pv->thread_count, segment, HQDN3D_BAND_ALIGN,
+                          &start, &end );
+            if( start >= end )
+            {
+                break;
+            }
+
+            hqdn3d_first_row( pv->hqdn3d_hor + start,
+                              pv->dst + start,
+                              pv->hqdn3d_line + start,
+                              pv->frame_ant + start,
+                              end - start,
+                              pv->temporal );
+            for( y = 1; y < pv->h; y++ )
+            {
+                pv->spatial_row( pv->hqdn3d_hor + y*w + start,
+                                 pv->dst + y*w + start,
+                                 pv->hqdn3d_line + start,
+                                 pv->frame_ant + y*w + start,
+                                 end - start,
+                                 pv->spatial,
+                                 pv->temporal );
+            }
+            break;
+    }
+}
+
+static void hqdn3d_denoise( hb_filter_private_t * pv,
+                            unsigned char * frame_src,
                             unsigned char * frame_dst,
-                            unsigned short * line_ant,
                             unsigned short ** frame_ant_ptr,
                             int w,
                             int h,
@@ -193,24 +529,37 @@ static void hqdn3d_denoise( unsigned char * frame_src,
         frame_ant = *frame_ant_ptr;
     }
 
-    /* If no spatial coefficients, do temporal denoise only */
-    if( spatial[0] )
+    pv->src       = frame_src;
+    pv->dst       = frame_dst;
+    pv->frame_ant = frame_ant;
+    pv->w         = w;
+    pv->h         = h;
+    pv->spatial   = spatial + 0x1000;
+    pv->temporal  = temporal + 0x1000;
+
+    if( spatial[0] && pv->thread_count == 1 )
     {
+        /* Single threaded, all passes at once saves a trip to memory */
         hqdn3d_denoise_spatial( frame_src,
                                 frame_dst,
-                                line_ant,
+                                pv->hqdn3d_line,
                                 frame_ant,
                                 w, h,
                                 spatial,
                                 temporal );
     }
+    else if( spatial[0] )
+    {
+        pv->pass = HQDN3D_PASS_HORIZONTAL;
+        taskset_cycle( &pv->taskset );
+        pv->pass = HQDN3D_PASS_VERTICAL;
+        taskset_cycle( &pv->taskset );
+    }
     else
     {
-        hqdn3d_denoise_temporal( frame_src,
-                                 frame_dst,
-                                 frame_ant,
-                                 w, h,
-                                 temporal);
+        /* No spatial coefficients, do temporal denoise only */
+        pv->pass = HQDN3D_PASS_TEMPORAL;
+        taskset_cycle( &pv->taskset );
     }
 }
 
@@ -286,7 +635,47 @@ static int hb_denoise_init( hb_filter_object_t * filter,
     hqdn3d_precalc_coef( pv->hqdn3d_coef[4], spatial_chroma_r );
     hqdn3d_precalc_coef( pv->hqdn3d_coef[5], temporal_chroma_r );
 
+    pv->temporal_row = hqdn3d_temporal_row_c;
+    pv->spatial_row  = hqdn3d_spatial_row_c;
+#if HB_SIMD_X86
+    if( hb_get_cpu_flags() & HB_CPU_FLAG_AVX2 )
+    {
+        pv->temporal_row = hqdn3d_temporal_row_avx2;
+        pv->spatial_row  = hqdn3d_spatial_row_avx2;
+    }
+#endif
+
+    int ii;
+    pv->thread_count = hb_get_cpu_count();
+    if( taskset_init( &pv->taskset, pv->thread_count,
+                      sizeof( hqdn3d_thread_arg_t ) ) == 0 )
+    {
+        hb_error( "denoise could not initialize taskset" );
+        goto fail;
+    }
+    for( ii = 0; ii < pv->thread_count; ii++ )
+    {
+        hqdn3d_thread_arg_t * thread_data;
+
+        thread_data = taskset_thread_args( &pv->taskset, ii );
+        thread_data->pv = pv;
+        thread_data->segment = ii;
+        if( taskset_thread_spawn( &pv->taskset, ii, "denoise_filter",
+                                  hqdn3d_denoise_thread,
+                                  HB_NORMAL_PRIORITY ) == 0 )
+        {
+            hb_error( "denoise could not spawn thread" );
+            goto fail;
+        }
+    }
+
     return 0;
+
+fail:
+    taskset_fini( &pv->taskset );
+    free( pv );
+    filter->private_data = NULL;
+    return -1;
 }
 
 static void hb_denoise_close( hb_filter_object_t * filter )
@@ -298,6 +687,8 @@ static void hb_denoise_close( hb_filter_object_t * filter )
         return;
     }
 
+    taskset_fini( &pv->taskset );
+
 	if( pv->hqdn3d_line )
     {
         free( pv->hqdn3d_line );
@@ -318,6 +709,11 @@ static void hb_denoise_close( hb_filter_object_t * filter )
         free( pv->hqdn3d_frame[2] );
         pv->hqdn3d_frame[2] = NULL;
     }
+    if( pv->hqdn3d_hor )
+    {
+        free( pv->hqdn3d_hor );
+        pv->hqdn3d_hor = NULL;
+    }
 
     free( pv );
     filter->private_data = NULL;
@@ -343,15 +739,20 @@ static int hb_denoise_work( hb_filter_object_t * filter,
     {
         pv->hqdn3d_line = malloc( in->plane[0].stride * sizeof(unsigned short) );
     }
+    if( !pv->hqdn3d_hor && pv->thread_count > 1 )
+    {
+        pv->hqdn3d_hor = malloc( in->plane[0].stride * in->plane[0].height *
+                                 sizeof(unsigned short) );
+    }
 
     int c, coef_index;
 
     for ( c = 0; c < 3; c++ )
     {
         coef_index = c * 2;
-        hqdn3d_denoise( in->plane[c].data,
+        hqdn3d_denoise( pv,
+                        in->plane[c].data,
                         out->plane[c].data,
-                        pv->hqdn3d_line,
                         &pv->hqdn3d_frame[c],
                         in->plane[c].stride,
                         in->plane[c].height,
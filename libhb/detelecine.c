@@ -9,6 +9,10 @@
 
 #include "hb.h"
 #include "hbffmpeg.h"
+#include "taskset.h"
+#if HB_SIMD_X86
+#include <immintrin.h>
+#endif
 
 /*
  *
@@ -57,6 +61,29 @@ struct pullup_frame
     struct pullup_buffer *buffer;
 };
 
+/*
+ * Computes a metric for 'blocks' 8x4 blocks side by side, from the field
+ * rows at 'a' and 'b' ('s' apart), into 'dest'.
+ */
+typedef void (pullup_metric_row_t)( int * dest, unsigned char * a,
+                                    unsigned char * b, int s, int blocks );
+
+/* One of the metrics pullup_submit_field() computes for a field */
+struct pullup_metric
+{
+    pullup_metric_row_t *func;  /* NULL if there is nothing to compute */
+    unsigned char *a, *b;
+    int *dest;
+};
+
+struct pullup_context;
+
+typedef struct pullup_thread_arg_s
+{
+    struct pullup_context *c;
+    int segment;
+} pullup_thread_arg_t;
+
 struct pullup_context
 {
     /* Public interface */
@@ -74,11 +101,15 @@ struct pullup_context
     struct pullup_field *first, *last, *head;
     struct pullup_buffer *buffers;
     int nbuffers;
-    int (*diff)(unsigned char *, unsigned char *, int);
-    int (*comb)(unsigned char *, unsigned char *, int);
-    int (*var)(unsigned char *, unsigned char *, int);
+    pullup_metric_row_t *diff;
+    pullup_metric_row_t *comb;
+    pullup_metric_row_t *var;
     int metric_w, metric_h, metric_len, metric_offset;
     struct pullup_frame *frame;
+    /* Rows of the metrics are split into segments computed in parallel */
+    struct pullup_metric metrics[3];
+    int segments;
+    taskset_t metric_taskset;
 };
 
 /*
@@ -163,6 +194,248 @@ static int pullup_var_y( unsigned char * a, unsigned char * b, int s )
     return 4*var;
 }
 
+#define PULLUP_METRIC_ROW_C( name, block )                                \
+static void name( int * dest, unsigned char * a, unsigned char * b,       \
+                  int s, int blocks )                                     \
+{                                                                         \
+    int x;                                                                \
+    for( x = 0; x < blocks; x++ )                                         \
+    {                                                                     \
+        dest[x] = block( a + 8*x, b + 8*x, s );                           \
+    }                                                                     \
+}
+
+PULLUP_METRIC_ROW_C( pullup_diff_y_row_c,   pullup_diff_y )
+PULLUP_METRIC_ROW_C( pullup_licomb_y_row_c, pullup_licomb_y )
+PULLUP_METRIC_ROW_C( pullup_var_y_row_c,    pullup_var_y )
+
+#if HB_SIMD_X86
+/*
+ * The SIMD rows do 2 (SSE2) or 4 (AVX2) blocks per register and leave
+ * the blocks past the last full register to the versions below them.
+ *
+ * diff and var are sums of absolute differences, which psadbw computes
+ * for each 8 pixel half of a register.  licomb widens pixels to 16 bits,
+ * where each term is at most 2*255 and the sum of a column of a block at
+ * most 4*4*255, so the per pixel sums can't overflow before they are
+ * added up in 32 bits.
+ */
+__attribute__((target("sse2")))
+static void pullup_diff_y_row_sse2( int * dest, unsigned char * a,
+                                    unsigned char * b, int s, int blocks )
+{
+    int x, i;
+
+    for( x = 0; x + 2 <= blocks; x += 2 )
+    {
+        __m128i sum = _mm_setzero_si128();
+
+        for( i = 0; i < 4; i++ )
+        {
+            sum = _mm_add_epi64( sum, _mm_sad_epu8(
+                    _mm_loadu_si128( (const __m128i *)(a + i*s + 8*x) ),
+                    _mm_loadu_si128( (const __m128i *)(b + i*s + 8*x) ) ) );
+        }
+        dest[x]   = _mm_cvtsi128_si32( sum );
+        dest[x+1] = _mm_cvtsi128_si32( _mm_srli_si128( sum, 8 ) );
+    }
+    pullup_diff_y_row_c( dest + x, a + 8*x, b + 8*x, s, blocks - x );
+}
+
+__attribute__((target("sse2")))
+static inline __m128i pullup_load_epi16_sse2( const unsigned char * p )
+{
+    return _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i *)p ),
+                              _mm_setzero_si128() );
+}
+
+__attribute__((target("sse2")))
+static inline __m128i pullup_comb_epi16_sse2( __m128i a, __m128i b,
+                                              __m128i c )
+{
+    __m128i v = _mm_sub_epi16( _mm_sub_epi16( _mm_add_epi16( a, a ), b ), c );
+    return _mm_max_epi16( v, _mm_sub_epi16( _mm_setzero_si128(), v ) );
+}
+
+__attribute__((target("sse2")))
+static void pullup_licomb_y_row_sse2( int * dest, unsigned char * a,
+                                      unsigned char * b, int s, int blocks )
+{
+    __m128i ones = _mm_set1_epi16( 1 );
+    int x, i;
+
+    for( x = 0; x + 2 <= blocks; x += 2 )
+    {
+        __m128i sum[2], lo, hi;
+        int h;
+
+        for( h = 0; h < 2; h++ )
+        {
+            unsigned char * pa = a + 8*(x+h);
+            unsigned char * pb = b + 8*(x+h);
+            __m128i bu = pullup_load_epi16_sse2( pb - s );
+
+            sum[h] = _mm_setzero_si128();
+            for( i = 0; i < 4; i++ )
+            {
+                __m128i va = pullup_load_epi16_sse2( pa + i*s );
+                __m128i vb = pullup_load_epi16_sse2( pb + i*s );
+                __m128i ad = pullup_load_epi16_sse2( pa + (i+1)*s );
+
+                sum[h] = _mm_add_epi16( sum[h],
+                                        pullup_comb_epi16_sse2( va, bu, vb ) );
+                sum[h] = _mm_add_epi16( sum[h],
+                                        pullup_comb_epi16_sse2( vb, va, ad ) );
+                bu = vb;
+            }
+        }
+        // Add up the 8 columns of each block
+        lo = _mm_madd_epi16( sum[0], ones );
+        hi = _mm_madd_epi16( sum[1], ones );
+        lo = _mm_add_epi32( _mm_unpacklo_epi32( lo, hi ),
+                            _mm_unpackhi_epi32( lo, hi ) );
+        lo = _mm_add_epi32( lo, _mm_srli_si128( lo, 8 ) );
+        _mm_storel_epi64( (__m128i *)(dest + x), lo );
+    }
+    pullup_licomb_y_row_c( dest + x, a + 8*x, b + 8*x, s, blocks - x );
+}
+
+__attribute__((target("sse2")))
+static void pullup_var_y_row_sse2( int * dest, unsigned char * a,
+                                   unsigned char * b, int s, int blocks )
+{
+    int x, i;
+
+    for( x = 0; x + 2 <= blocks; x += 2 )
+    {
+        __m128i sum = _mm_setzero_si128();
+
+        for( i = 0; i < 3; i++ )
+        {
+            sum = _mm_add_epi64( sum, _mm_sad_epu8(
+                    _mm_loadu_si128( (const __m128i *)(a + i*s + 8*x) ),
+                    _mm_loadu_si128( (const __m128i *)(a + (i+1)*s + 8*x) ) ) );
+        }
+        dest[x]   = 4 * _mm_cvtsi128_si32( sum );
+        dest[x+1] = 4 * _mm_cvtsi128_si32( _mm_srli_si128( sum, 8 ) );
+    }
+    pullup_var_y_row_c( dest + x, a + 8*x, b + 8*x, s, blocks - x );
+}
+
+// Stores the low 32 bits of each 64 bit lane of 'v'
+__attribute__((target("avx2")))
+static inline void pullup_store_epi64_avx2( int * dest, __m256i v )
+{
+    v = _mm256_permutevar8x32_epi32( v, _mm256_setr_epi32( 0, 2, 4, 6,
+                                                           0, 2, 4, 6 ) );
+    _mm_storeu_si128( (__m128i *)dest, _mm256_castsi256_si128( v ) );
+}
+
+__attribute__((target("avx2")))
+static void pullup_diff_y_row_avx2( int * dest, unsigned char * a,
+                                    unsigned char * b, int s, int blocks )
+{
+    int x, i;
+
+    for( x = 0; x + 4 <= blocks; x += 4 )
+    {
+        __m256i sum = _mm256_setzero_si256();
+
+        for( i = 0; i < 4; i++ )
+        {
+            sum = _mm256_add_epi64( sum, _mm256_sad_epu8(
+                    _mm256_loadu_si256( (const __m256i *)(a + i*s + 8*x) ),
+                    _mm256_loadu_si256( (const __m256i *)(b + i*s + 8*x) ) ) );
+        }
+        pullup_store_epi64_avx2( dest + x, sum );
+    }
+    _mm256_zeroupper();
+    pullup_diff_y_row_sse2( dest + x, a + 8*x, b + 8*x, s, blocks - x );
+}
+
+__attribute__((target("avx2")))
+static inline __m256i pullup_load_epi16_avx2( const unsigned char * p )
+{
+    return _mm256_cvtepu8_epi16( _mm_loadu_si128( (const __m128i *)p ) );
+}
+
+__attribute__((target("avx2")))
+static inline __m256i pullup_comb_epi16_avx2( __m256i a, __m256i b,
+                                              __m256i c )
+{
+    return _mm256_abs_epi16( _mm256_sub_epi16(
+                _mm256_sub_epi16( _mm256_add_epi16( a, a ), b ), c ) );
+}
+
+__attribute__((target("avx2")))
+static void pullup_licomb_y_row_avx2( int * dest, unsigned char * a,
+                                      unsigned char * b, int s, int blocks )
+{
+    __m256i ones = _mm256_set1_epi16( 1 );
+    int x, i;
+
+    for( x = 0; x + 4 <= blocks; x += 4 )
+    {
+        // Blocks x and x+1 in sum[0], one per 128 bit lane, and so on
+        __m256i sum[2], v;
+        int h;
+
+        for( h = 0; h < 2; h++ )
+        {
+            unsigned char * pa = a + 8*(x+2*h);
+            unsigned char * pb = b + 8*(x+2*h);
+            __m256i bu = pullup_load_epi16_avx2( pb - s );
+
+            sum[h] = _mm256_setzero_si256();
+            for( i = 0; i < 4; i++ )
+            {
+                __m256i va = pullup_load_epi16_avx2( pa + i*s );
+                __m256i vb = pullup_load_epi16_avx2( pb + i*s );
+                __m256i ad = pullup_load_epi16_avx2( pa + (i+1)*s );
+
+                sum[h] = _mm256_add_epi16( sum[h],
+                                           pullup_comb_epi16_avx2( va, bu, vb ) );
+                sum[h] = _mm256_add_epi16( sum[h],
+                                           pullup_comb_epi16_avx2( vb, va, ad ) );
+                bu = vb;
+            }
+        }
+        // Lane sums end up as blocks x, x+2 in the low lane, x+1, x+3
+        // in the high one
+        v = _mm256_hadd_epi32( _mm256_madd_epi16( sum[0], ones ),
+                               _mm256_madd_epi16( sum[1], ones ) );
+        v = _mm256_hadd_epi32( v, v );
+        v = _mm256_permutevar8x32_epi32( v, _mm256_setr_epi32( 0, 4, 1, 5,
+                                                               0, 4, 1, 5 ) );
+        _mm_storeu_si128( (__m128i *)(dest + x), _mm256_castsi256_si128( v ) );
+    }
+    _mm256_zeroupper();
+    pullup_licomb_y_row_sse2( dest + x, a + 8*x, b + 8*x, s, blocks - x );
+}
+
+__attribute__((target("avx2")))
+static void pullup_var_y_row_avx2( int * dest, unsigned char * a,
+                                   unsigned char * b, int s, int blocks )
+{
+    int x, i;
+
+    for( x = 0; x + 4 <= blocks; x += 4 )
+    {
+        __m256i sum = _mm256_setzero_si256();
+
+        for( i = 0; i < 3; i++ )
+        {
+            sum = _mm256_add_epi64( sum, _mm256_sad_epu8(
+                    _mm256_loadu_si256( (const __m256i *)(a + i*s + 8*x) ),
+                    _mm256_loadu_si256( (const __m256i *)(a + (i+1)*s + 8*x) ) ) );
+        }
+        pullup_store_epi64_avx2( dest + x, _mm256_slli_epi64( sum, 2 ) );
+    }
+    _mm256_zeroupper();
+    pullup_var_y_row_sse2( dest + x, a + 8*x, b + 8*x, s, blocks - x );
+}
+#endif // HB_SIMD_X86
+
 static void pullup_alloc_metrics( struct pullup_context * c,
                                   struct pullup_field * f )
 {
@@ -171,20 +444,20 @@ static void pullup_alloc_metrics( struct pullup_context * c,
     f->var   = calloc( c->metric_len, sizeof(int) );
 }
 
-static void pullup_compute_metric( struct pullup_context * c,
-                                   struct pullup_field * fa, int pa,
-                                   struct pullup_field * fb, int pb,
-                                   int (* func)( unsigned char *,
-                                                 unsigned char *, int),
-                                   int * dest )
+/*
+ * Sets up 'm' to compute 'func' between field 'pa' of 'fa' and field
+ * 'pb' of 'fb' into 'dest', which pullup_compute_metrics() then does.
+ */
+static void pullup_setup_metric( struct pullup_context * c,
+                                 struct pullup_metric * m,
+                                 struct pullup_field * fa, int pa,
+                                 struct pullup_field * fb, int pb,
+                                 pullup_metric_row_t * func,
+                                 int * dest )
 {
-    unsigned char *a, *b;
-    int x, y;
-    int mp    = c->metric_plane;
-    int xstep = c->bpp[mp];
-    int ystep = c->stride[mp]<<3;
-    int s     = c->stride[mp]<<1; /* field stride */
-    int w     = c->metric_w*xstep;
+    int mp = c->metric_plane;
+
+    m->func = NULL;
 
     if( !fa->buffer || !fb->buffer ) return;
 
@@ -195,19 +468,53 @@ static void pullup_compute_metric( struct pullup_context * c,
         return;
     }
 
-    a = fa->buffer->planes[mp] + pa * c->stride[mp] + c->metric_offset;
-    b = fb->buffer->planes[mp] + pb * c->stride[mp] + c->metric_offset;
+    m->func = func;
+    m->a    = fa->buffer->planes[mp] + pa * c->stride[mp] + c->metric_offset;
+    m->b    = fb->buffer->planes[mp] + pb * c->stride[mp] + c->metric_offset;
+    m->dest = dest;
+}
 
-    for( y = c->metric_h; y; y-- )
+/*
+ * Computes this segment of the rows of blocks of all the metrics.
+ */
+static void pullup_metric_thread( void * thread_args_v )
+{
+    pullup_thread_arg_t   * thread_args = thread_args_v;
+    struct pullup_context * c = thread_args->c;
+    int segment = thread_args->segment;
+    int mp      = c->metric_plane;
+    int ystep   = c->stride[mp]<<3;
+    int s       = c->stride[mp]<<1; /* field stride */
+    int start   = c->metric_h *  segment      / c->segments;
+    int stop    = c->metric_h * (segment + 1) / c->segments;
+    int i, y;
+
+    for( i = 0; i < 3; i++ )
     {
-        for( x = 0; x < w; x += xstep )
+        struct pullup_metric * m = &c->metrics[i];
+
+        if( m->func == NULL ) continue;
+
+        for( y = start; y < stop; y++ )
         {
-            *dest++ = func( a + x, b + x, s );
+            m->func( m->dest + y * c->metric_w, m->a + y * ystep,
+                     m->b + y * ystep, s, c->metric_w );
         }
-        a += ystep; b += ystep;
     }
 }
 
+static void pullup_compute_metrics( struct pullup_context * c )
+{
+    if( c->segments == 1 )
+    {
+        pullup_thread_arg_t thread_args = { c, 0 };
+        pullup_metric_thread( &thread_args );
+        return;
+    }
+    /* Allow the taskset threads to make one pass over the data. */
+    taskset_cycle( &c->metric_taskset );
+}
+
 static struct pullup_field * pullup_make_field_queue( struct pullup_context * c,
                                                       int len )
 {
@@ -553,9 +860,57 @@ void pullup_init_context( struct pullup_context * c )
 
     if( c->format == PULLUP_FMT_Y )
     {
-        c->diff = pullup_diff_y;
-        c->comb = pullup_licomb_y;
-        c->var  = pullup_var_y;
+        c->diff = pullup_diff_y_row_c;
+        c->comb = pullup_licomb_y_row_c;
+        c->var  = pullup_var_y_row_c;
+#if HB_SIMD_X86
+        if( hb_get_cpu_flags() & HB_CPU_FLAG_AVX2 )
+        {
+            c->diff = pullup_diff_y_row_avx2;
+            c->comb = pullup_licomb_y_row_avx2;
+            c->var  = pullup_var_y_row_avx2;
+        }
+        else if( hb_get_cpu_flags() & HB_CPU_FLAG_SSE2 )
+        {
+            c->diff = pullup_diff_y_row_sse2;
+            c->comb = pullup_licomb_y_row_sse2;
+            c->var  = pullup_var_y_row_sse2;
+        }
+#endif
+    }
+
+    /*
+     * Setup metric taskset.  The metrics are cheap, so give each
+     * segment a fair number of rows rather than a thread per CPU.
+     */
+    c->segments = MIN( hb_get_cpu_count(), c->metric_h / 16 );
+    if( c->segments < 1 )
+    {
+        c->segments = 1;
+    }
+    if( c->segments > 1 )
+    {
+        int ii;
+
+        if( taskset_init( &c->metric_taskset, c->segments,
+                          sizeof( pullup_thread_arg_t ) ) == 0 )
+        {
+            hb_error( "pullup could not initialize taskset" );
+            c->segments = 1;
+            return;
+        }
+        for( ii = 0; ii < c->segments; ii++ )
+        {
+            pullup_thread_arg_t *thread_args;
+
+            thread_args = taskset_thread_args( &c->metric_taskset, ii );
+            thread_args->c = c;
+            thread_args->segment = ii;
+
+            taskset_thread_spawn( &c->metric_taskset, ii,
+                                  "pullup_metric_segment",
+                                  pullup_metric_thread, HB_NORMAL_PRIORITY );
+        }
     }
 }
 
@@ -563,6 +918,11 @@ void pullup_free_context( struct pullup_context * c )
 {
     struct pullup_field * f;
 
+    if( c->segments > 1 )
+    {
+        taskset_fini( &c->metric_taskset );
+    }
+
     free( c->buffers );
 
     f = c->head->next;
@@ -570,11 +930,13 @@ void pullup_free_context( struct pullup_context * c )
     {
         free( f->diffs );
         free( f->comb );
+        free( f->var );
         f = f->next;
         free( f->prev );
     }
     free( f->diffs );
     free( f->comb );
+    free( f->var );
     free(f);
 
     free( c->frame );
@@ -780,12 +1142,13 @@ void pullup_submit_field( struct pullup_context * c,
     f->breaks = 0;
     f->affinity = 0;
 
-    pullup_compute_metric( c, f, parity, f->prev->prev,
-                           parity, c->diff, f->diffs );
-    pullup_compute_metric( c, parity?f->prev:f, 0,
-                           parity?f:f->prev, 1, c->comb, f->comb );
-    pullup_compute_metric( c, f, parity, f,
-                           -1, c->var, f->var );
+    pullup_setup_metric( c, &c->metrics[0], f, parity, f->prev->prev,
+                         parity, c->diff, f->diffs );
+    pullup_setup_metric( c, &c->metrics[1], parity?f->prev:f, 0,
+                         parity?f:f->prev, 1, c->comb, f->comb );
+    pullup_setup_metric( c, &c->metrics[2], f, parity, f,
+                         -1, c->var, f->var );
+    pullup_compute_metrics( c );
 
     /* Advance the circular list */
     if( !c->first ) c->first = c->head;
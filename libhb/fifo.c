@@ -10,6 +10,10 @@
 #include "hb.h"
 #include "openclwrapper.h"
 
+#if defined(USE_PTHREAD)
+#include <pthread.h>
+#endif
+
 #ifndef SYS_DARWIN
 #include <malloc.h>
 #endif
@@ -33,12 +37,44 @@ struct hb_fifo_s
     hb_buffer_t  * first;
     hb_buffer_t  * last;
 
+    // Single producer / single consumer fifos (hb_fifo_init_spsc) keep
+    // their buffers in a lock-free ring.  'first', 'last' and 'size' then
+    // only describe the overflow list that takes buffer chains which do
+    // not fit in the ring.  The lock is only taken to touch the overflow
+    // list or to sleep/wake on the condition variables.
+    int            spsc;
+    hb_buffer_t ** ring;
+    uint32_t       ring_mask;
+    uint32_t       head;        // written by the consumer only
+    uint32_t       tail;        // written by the producer only
+
+    // Adaptive fifos (hb_fifo_set_adaptive) move their capacity between
+    // min_capacity and max_capacity while the job runs
+    const char   * name;
+    uint32_t       min_capacity;
+    uint32_t       max_capacity;
+    int64_t        memory_budget;
+    int            producer_blocked; // since the consumer last starved
+
+    // Statistics, see hb_fifo_log_stats()
+    uint64_t       pushes;
+    uint64_t       occupancy_sum;   // buffers queued, sampled at every push
+    uint32_t       occupancy_max;
+    uint32_t       empty_waits;     // consumer found the fifo empty
+    uint32_t       full_waits;      // producer found the fifo full
+    uint32_t       grows;
+    uint32_t       shrinks;
+
 #if defined(HB_FIFO_DEBUG)
     // Fifo list for debugging
     hb_fifo_t    * next;
 #endif
 };
 
+#define fifo_load(p)     __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define fifo_store(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define fifo_fence()     __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
 #if defined(HB_FIFO_DEBUG)
 static hb_fifo_t fifo_list = 
 {
@@ -60,21 +96,123 @@ static hb_fifo_t fifo_list =
  * too much memory. */
 #define BUFFER_POOL_MAX_ELEMENTS 32
 
+/* every thread that allocates or frees buffers keeps a small "magazine" of
+ * free buffers per pool size so that most hb_buffer_init / hb_buffer_close
+ * calls don't touch the shared pools (and their locks) at all.  a magazine
+ * that runs empty is refilled from the shared pool in one batch, a full one
+ * spills half its buffers back to the shared pool in one batch.  large
+ * buffers are limited by BUFFER_MAGAZINE_MAX_BYTES so that threads don't
+ * hoard lots of video frames. */
+#define BUFFER_MAGAZINE_MAX_ELEMENTS 16
+#define BUFFER_MAGAZINE_MAX_BYTES    (4 << 20)
+
+typedef struct
+{
+    hb_buffer_t * list;
+    int           count;
+    hb_buffer_pool_stats_t stats;
+} buffer_magazine_t;
+
+typedef struct buffer_cache_s
+{
+    buffer_magazine_t mag[MAX_BUFFER_POOLS];
+    // Set while the owning thread or hb_buffer_pool_free() uses the
+    // magazines.  The owner only tries to take it and bypasses its
+    // magazines when that fails.
+    int busy;
+    struct buffer_cache_s * prev;
+    struct buffer_cache_s * next;
+} buffer_cache_t;
+
 struct hb_buffer_pools_s
 {
     int64_t allocated;
     hb_lock_t *lock;
     hb_fifo_t *pool[MAX_BUFFER_POOLS];
+    // statistics of threads that have exited or flushed their magazines
+    hb_buffer_pool_stats_t stats[MAX_BUFFER_POOLS];
+    // magazines of all running threads, protected by 'lock'
+    buffer_cache_t *caches;
 #if defined(HB_BUFFER_DEBUG)
     hb_list_t *alloc_list;
 #endif
 } buffers;
 
+#if defined(USE_PTHREAD)
+static pthread_key_t  buffer_cache_key;
+static pthread_once_t buffer_cache_once = PTHREAD_ONCE_INIT;
+#endif
+
+static void buffer_cache_flush_locked( buffer_cache_t * cache );
+static void buffer_cache_close( void * _cache );
+
+static void buffer_cache_key_init( void )
+{
+#if defined(USE_PTHREAD)
+    pthread_key_create( &buffer_cache_key, buffer_cache_close );
+#endif
+}
+
+// Returns the calling thread's magazines, creating them on first use.
+// Returns NULL if thread local storage isn't available.
+static buffer_cache_t * buffer_cache_self( void )
+{
+#if defined(USE_PTHREAD)
+    buffer_cache_t * cache = pthread_getspecific( buffer_cache_key );
+    if ( cache == NULL )
+    {
+        cache = calloc( sizeof( buffer_cache_t ), 1 );
+        if ( cache != NULL )
+        {
+            pthread_setspecific( buffer_cache_key, cache );
+
+            // Register it so that hb_buffer_pool_free() can flush it
+            hb_lock( buffers.lock );
+            cache->next = buffers.caches;
+            if ( buffers.caches != NULL )
+            {
+                buffers.caches->prev = cache;
+            }
+            buffers.caches = cache;
+            hb_unlock( buffers.lock );
+        }
+    }
+    return cache;
+#else
+    return NULL;
+#endif
+}
+
+static inline int buffer_cache_trylock( buffer_cache_t * cache )
+{
+    return __atomic_exchange_n( &cache->busy, 1, __ATOMIC_ACQUIRE ) == 0;
+}
+
+static inline void buffer_cache_unlock( buffer_cache_t * cache )
+{
+    __atomic_store_n( &cache->busy, 0, __ATOMIC_RELEASE );
+}
+
+static inline int buffer_magazine_max( int pool_index )
+{
+    return MAX( 1, MIN( BUFFER_MAGAZINE_MAX_ELEMENTS,
+                        BUFFER_MAGAZINE_MAX_BYTES >> pool_index ) );
+}
+
+static inline void buffers_allocated_add( int64_t size )
+{
+    __atomic_add_fetch( &buffers.allocated, size, __ATOMIC_RELAXED );
+}
+
 
 void hb_buffer_pool_init( void )
 {
     buffers.lock = hb_lock_init();
     buffers.allocated = 0;
+    memset( buffers.stats, 0, sizeof( buffers.stats ) );
+#if defined(USE_PTHREAD)
+    pthread_once( &buffer_cache_once, buffer_cache_key_init );
+#endif
 
 #if defined(HB_BUFFER_DEBUG)
     buffers.alloc_list = hb_list_init();
@@ -246,11 +384,37 @@ void hb_buffer_pool_free( void )
 {
     int i;
     int count;
-    int64_t freed = 0;
+    int64_t freed = 0, allocated;
     hb_buffer_t *b;
+    buffer_cache_t *cache;
 
     hb_lock(buffers.lock);
 
+    // Buffers cached by any thread would otherwise look leaked.  A thread
+    // that finds its magazines busy meanwhile uses the shared pools.
+    for ( cache = buffers.caches; cache != NULL; cache = cache->next )
+    {
+        while ( !buffer_cache_trylock( cache ) )
+        {
+            hb_snooze( 1 );
+        }
+        buffer_cache_flush_locked( cache );
+        buffer_cache_unlock( cache );
+    }
+
+    for( i = BUFFER_POOL_FIRST; i <= BUFFER_POOL_LAST; ++i)
+    {
+        hb_buffer_pool_stats_t * st = &buffers.stats[i];
+        if ( st->hits + st->refills + st->misses )
+        {
+            hb_deep_log( 2, "buffer pool %8d: %"PRIu64" hits, %"PRIu64" refills, "
+                    "%"PRIu64" misses, %"PRIu64" spills, %"PRIu64" frees",
+                    buffers.pool[i]->buffer_size, st->hits, st->refills,
+                    st->misses, st->spills, st->frees );
+        }
+    }
+    memset( buffers.stats, 0, sizeof( buffers.stats ) );
+
 #if defined(HB_BUFFER_DEBUG)
     hb_deep_log(2, "leaked %d buffers", hb_list_count(buffers.alloc_list));
     for (i = 0; i < hb_list_count(buffers.alloc_list); i++)
@@ -294,23 +458,292 @@ void hb_buffer_pool_free( void )
         }
     }
 
+    // Other threads may still allocate and free buffers, so only take
+    // away what was freed here
+    allocated = __atomic_load_n( &buffers.allocated, __ATOMIC_RELAXED );
+    buffers_allocated_add( -freed );
     hb_deep_log( 2, "Allocated %"PRId64" bytes of buffers on this pass and Freed %"PRId64" bytes, "
-           "%"PRId64" bytes leaked", buffers.allocated, freed, buffers.allocated - freed);
-    buffers.allocated = 0;
+           "%"PRId64" bytes leaked", allocated, freed, allocated - freed);
     hb_unlock(buffers.lock);
 }
 
-static hb_fifo_t *size_to_pool( int size )
+static int size_to_pool_index( int size )
 {
     int i;
     for ( i = BUFFER_POOL_FIRST; i <= BUFFER_POOL_LAST; ++i )
     {
         if ( size <= (1 << i) )
         {
-            return buffers.pool[i];
+            return i;
         }
     }
-    return NULL;
+    return -1;
+}
+
+static hb_fifo_t *size_to_pool( int size )
+{
+    int i = size_to_pool_index( size );
+    return i < 0 ? NULL : buffers.pool[i];
+}
+
+// Releases the memory of a buffer that isn't going back to a pool
+static void buffer_free( hb_buffer_t * b )
+{
+    if( b->data )
+    {
+        if (b->cl.buffer != NULL)
+        {
+            /* OpenCL */
+            if (hb_cl_free_mapped_buffer(b->cl.buffer, b->data) == 0)
+            {
+                hb_log("hb_buffer_pool_free: bad free %p -> buffer %p map %p",
+                       b, b->cl.buffer, b->data);
+            }
+        }
+        else
+        {
+            free(b->data);
+        }
+        buffers_allocated_add( -b->alloc );
+    }
+    free( b );
+}
+
+// Pulls up to 'count' buffers out of a buffer pool with a single lock.
+// Returns them as a list and the number of buffers in '*got'.
+static hb_buffer_t * pool_get_list( hb_fifo_t * f, int count, int * got )
+{
+    hb_buffer_t * head, * b;
+    int           n = 0;
+
+    hb_lock( f->lock );
+    head = b = f->first;
+    if ( b != NULL )
+    {
+        for ( n = 1; n < count && b->next != NULL; n++ )
+        {
+            b = b->next;
+        }
+        f->first = b->next;
+        b->next  = NULL;
+        f->size -= n;
+    }
+    hb_unlock( f->lock );
+
+    *got = n;
+    return head;
+}
+
+// Returns as many buffers of list 'b' to a buffer pool as fit with
+// a single lock.  Returns the list of buffers that did not fit.
+static hb_buffer_t * pool_put_list( hb_fifo_t * f, hb_buffer_t * b )
+{
+    hb_buffer_t * tail;
+    int           n;
+
+    hb_lock( f->lock );
+    if ( b != NULL && f->size < f->capacity )
+    {
+        hb_buffer_t * head = b;
+
+        tail = b;
+        for ( n = 1; f->size + n < f->capacity && tail->next != NULL; n++ )
+        {
+            tail = tail->next;
+        }
+        b = tail->next;
+        tail->next = f->first;
+        if ( f->size == 0 )
+        {
+            f->last = tail;
+        }
+        f->first = head;
+        f->size += n;
+    }
+    hb_unlock( f->lock );
+
+    return b;
+}
+
+// Takes a free buffer of pool 'i' from the calling thread's magazine,
+// refilling the magazine from the shared pool if it is empty.
+static hb_buffer_t * buffer_cache_get( buffer_cache_t * cache, int i )
+{
+    buffer_magazine_t * m;
+    hb_buffer_t       * b;
+
+    if ( cache == NULL || !buffer_cache_trylock( cache ) )
+    {
+        return hb_fifo_get( buffers.pool[i] );
+    }
+
+    m = &cache->mag[i];
+    if ( m->count == 0 )
+    {
+        m->list = pool_get_list( buffers.pool[i],
+                                 ( buffer_magazine_max( i ) + 1 ) / 2,
+                                 &m->count );
+        if ( m->count == 0 )
+        {
+            m->stats.misses++;
+            buffer_cache_unlock( cache );
+            return NULL;
+        }
+        m->stats.refills++;
+    }
+    else
+    {
+        m->stats.hits++;
+    }
+
+    b = m->list;
+    m->list = b->next;
+    b->next = NULL;
+    m->count--;
+    buffer_cache_unlock( cache );
+
+    return b;
+}
+
+// Puts a free buffer of pool 'i' in the calling thread's magazine,
+// spilling half of a full magazine back to the shared pool first.
+static void buffer_cache_put( buffer_cache_t * cache, int i, hb_buffer_t * b )
+{
+    buffer_magazine_t * m;
+
+    if ( cache == NULL || !buffer_cache_trylock( cache ) )
+    {
+        if ( pool_put_list( buffers.pool[i], b ) != NULL )
+        {
+            buffer_free( b );
+        }
+        return;
+    }
+
+    m = &cache->mag[i];
+    if ( m->count >= buffer_magazine_max( i ) )
+    {
+        hb_buffer_t * spill, * tail;
+        int           n, keep = m->count / 2;
+
+        tail = m->list;
+        for ( n = 1; n < keep; n++ )
+        {
+            tail = tail->next;
+        }
+        if ( keep > 0 )
+        {
+            spill = tail->next;
+            tail->next = NULL;
+        }
+        else
+        {
+            spill = m->list;
+            m->list = NULL;
+        }
+        m->count = keep;
+        m->stats.spills++;
+
+        spill = pool_put_list( buffers.pool[i], spill );
+        while ( spill != NULL )
+        {
+            hb_buffer_t * next = spill->next;
+            buffer_free( spill );
+            m->stats.frees++;
+            spill = next;
+        }
+    }
+
+    b->next = m->list;
+    m->list = b;
+    m->count++;
+    buffer_cache_unlock( cache );
+}
+
+// Returns all buffers of a thread's magazines to the shared pools
+// and accumulates its statistics.  Must be called with buffers.lock
+// held and the magazines taken.
+static void buffer_cache_flush_locked( buffer_cache_t * cache )
+{
+    int i;
+
+    for ( i = BUFFER_POOL_FIRST; i <= BUFFER_POOL_LAST; ++i )
+    {
+        buffer_magazine_t * m = &cache->mag[i];
+        hb_buffer_t       * b;
+
+        b = pool_put_list( buffers.pool[i], m->list );
+        while ( b != NULL )
+        {
+            hb_buffer_t * next = b->next;
+            buffer_free( b );
+            m->stats.frees++;
+            b = next;
+        }
+        m->list  = NULL;
+        m->count = 0;
+
+        buffers.stats[i].hits    += m->stats.hits;
+        buffers.stats[i].refills += m->stats.refills;
+        buffers.stats[i].misses  += m->stats.misses;
+        buffers.stats[i].spills  += m->stats.spills;
+        buffers.stats[i].frees   += m->stats.frees;
+        memset( &m->stats, 0, sizeof( m->stats ) );
+    }
+}
+
+// Thread exit destructor of the magazines
+static void buffer_cache_close( void * _cache )
+{
+    buffer_cache_t * cache = _cache;
+
+    hb_lock( buffers.lock );
+    if ( cache->prev != NULL )
+    {
+        cache->prev->next = cache->next;
+    }
+    else
+    {
+        buffers.caches = cache->next;
+    }
+    if ( cache->next != NULL )
+    {
+        cache->next->prev = cache->prev;
+    }
+    // Nobody else can hold the magazines while buffers.lock is held
+    buffer_cache_flush_locked( cache );
+    hb_unlock( buffers.lock );
+    free( cache );
+}
+
+/*
+ * Copies the counters of up to 'count' pools to 'stats' and returns how
+ * many were copied.  Only the calling thread's magazines are counted
+ * until the other threads exit.  Reported by hb-bench --pools.
+ */
+int hb_buffer_pool_get_stats( hb_buffer_pool_stats_t * stats, int count )
+{
+    int i, n = 0;
+    buffer_cache_t * cache = buffer_cache_self();
+
+    hb_lock( buffers.lock );
+    if ( cache != NULL )
+    {
+        // Only this thread and hb_buffer_pool_free() take the magazines,
+        // and the latter holds buffers.lock
+        buffer_cache_trylock( cache );
+        buffer_cache_flush_locked( cache );
+        buffer_cache_unlock( cache );
+    }
+    for ( i = BUFFER_POOL_FIRST; i <= BUFFER_POOL_LAST && n < count; ++i )
+    {
+        stats[n] = buffers.stats[i];
+        stats[n].buffer_size = buffers.pool[i]->buffer_size;
+        n++;
+    }
+    hb_unlock( buffers.lock );
+
+    return n;
 }
 
 hb_buffer_t * hb_buffer_init_internal( int size , int needsMapped )
@@ -322,11 +755,12 @@ hb_buffer_t * hb_buffer_init_internal( int size , int needsMapped )
     // sometimes we feed data to these libraries starting from arbitrary
     // points within the buffer.
     int alloc = size + 16;
-    hb_fifo_t *buffer_pool = size_to_pool( alloc );
+    int pool_index = size_to_pool_index( alloc );
+    hb_fifo_t *buffer_pool = pool_index < 0 ? NULL : buffers.pool[pool_index];
 
     if( buffer_pool )
     {
-        b = hb_fifo_get( buffer_pool );
+        b = buffer_cache_get( buffer_cache_self(), pool_index );
 
         /* OpenCL */
         if (b != NULL && needsMapped && b->cl.buffer == NULL)
@@ -426,9 +860,7 @@ hb_buffer_t * hb_buffer_init_internal( int size , int needsMapped )
             free( b );
             return NULL;
         }
-        hb_lock(buffers.lock);
-        buffers.allocated += b->alloc;
-        hb_unlock(buffers.lock);
+        buffers_allocated_add( b->alloc );
     }
     b->s.start = AV_NOPTS_VALUE;
     b->s.stop = AV_NOPTS_VALUE;
@@ -455,9 +887,7 @@ void hb_buffer_realloc( hb_buffer_t * b, int size )
         b->data  = realloc( b->data, size );
         b->alloc = size;
 
-        hb_lock(buffers.lock);
-        buffers.allocated += size - orig;
-        hb_unlock(buffers.lock);
+        buffers_allocated_add( size - orig );
     }
 }
 
@@ -475,6 +905,53 @@ void hb_buffer_reduce( hb_buffer_t * b, int size )
     }
 }
 
+// Frames cropped in place (see hb_frame_buffer_crop) keep the plane
+// layout of the frame they were cut from.  Returns the size the frame
+// takes in the layout hb_buffer_init_planes() gives it, or 0 when it is
+// already laid out that way.
+static int frame_buffer_packed_size( const hb_buffer_t * b )
+{
+    hb_buffer_t packed = *b;
+    int p, size = 0;
+
+    hb_buffer_init_planes( &packed );
+    if ( memcmp( packed.plane, b->plane, sizeof( b->plane ) ) == 0 )
+        return 0;
+
+    for ( p = 0; p < 4; p++ )
+    {
+        if ( packed.plane[p].data != NULL )
+        {
+            size = MAX( size, packed.plane[p].data + packed.plane[p].size -
+                              packed.data );
+        }
+    }
+    return size;
+}
+
+static void frame_buffer_copy_planes( hb_buffer_t * dst,
+                                      const hb_buffer_t * src )
+{
+    int p, y;
+
+    for ( p = 0; p < 4; p++ )
+    {
+        if ( src->plane[p].data == NULL || dst->plane[p].data == NULL )
+            continue;
+
+        int       len = av_image_get_linesize( src->f.fmt, src->f.width, p );
+        uint8_t * d   = dst->plane[p].data;
+        uint8_t * s   = src->plane[p].data;
+
+        for ( y = 0; y < src->plane[p].height; y++ )
+        {
+            memcpy( d, s, len );
+            d += dst->plane[p].stride;
+            s += src->plane[p].stride;
+        }
+    }
+}
+
 hb_buffer_t * hb_buffer_dup( const hb_buffer_t * src )
 {
 
@@ -483,14 +960,26 @@ hb_buffer_t * hb_buffer_dup( const hb_buffer_t * src )
     if ( src == NULL )
         return NULL;
 
-    buf = hb_buffer_init( src->size );
-    if ( buf )
+    if ( src->s.type == FRAME_BUF && frame_buffer_packed_size( src ) > 0 )
+    {
+        buf = hb_frame_buffer_init( src->f.fmt, src->f.width, src->f.height );
+        if ( buf )
+        {
+            frame_buffer_copy_planes( buf, src );
+            buf->s = src->s;
+        }
+    }
+    else
     {
-        memcpy( buf->data, src->data, src->size );
-        buf->s = src->s;
-        buf->f = src->f;
-        if ( buf->s.type == FRAME_BUF )
-            hb_buffer_init_planes( buf );
+        buf = hb_buffer_init( src->size );
+        if ( buf )
+        {
+            memcpy( buf->data, src->data, src->size );
+            buf->s = src->s;
+            buf->f = src->f;
+            if ( buf->s.type == FRAME_BUF )
+                hb_buffer_init_planes( buf );
+        }
     }
 
 #ifdef USE_QSV
@@ -500,11 +989,62 @@ hb_buffer_t * hb_buffer_dup( const hb_buffer_t * src )
     return buf;
 }
 
+/*
+ * Returns a reference to the data of 'src' that can be passed on and
+ * closed independently of it.  The reference has settings, format and
+ * planes of its own, but no subtitles.  The data is shared, so neither
+ * 'src' nor the reference may modify it afterwards.
+ */
+hb_buffer_t * hb_buffer_ref( hb_buffer_t * src )
+{
+    hb_buffer_t * owner, * buf;
+
+    if ( src == NULL )
+        return NULL;
+
+    buf = malloc( sizeof( hb_buffer_t ) );
+    if ( buf == NULL )
+    {
+        hb_log( "out of memory" );
+        return NULL;
+    }
+    owner = src->shared != NULL ? src->shared : src;
+    __atomic_add_fetch( &owner->refs, 1, __ATOMIC_RELAXED );
+
+    *buf = *src;
+    buf->alloc   = 0;
+    buf->palette = NULL;
+    buf->sub     = NULL;
+    buf->next    = NULL;
+    buf->shared  = owner;
+    buf->refs    = 0;
+    memset( &buf->cl, 0, sizeof( buf->cl ) );
+
+    return buf;
+}
+
 int hb_buffer_copy(hb_buffer_t * dst, const hb_buffer_t * src)
 {
     if (src == NULL || dst == NULL)
         return -1;
 
+    if (src->s.type == FRAME_BUF)
+    {
+        int size = frame_buffer_packed_size(src);
+        if (size > 0)
+        {
+            if (dst->alloc < size)
+                return -1;
+
+            dst->size = size;
+            dst->s = src->s;
+            dst->f = src->f;
+            hb_buffer_init_planes(dst);
+            frame_buffer_copy_planes(dst, src);
+            return 0;
+        }
+    }
+
     if ( dst->size < src->size )
         return -1;
 
@@ -599,6 +1139,55 @@ hb_buffer_t * hb_frame_buffer_init( int pix_fmt, int width, int height )
     return buf;
 }
 
+/*
+ * Crops a frame in place by moving its plane pointers, no pixels are
+ * copied and the planes keep the strides of the full frame.  Returns -1,
+ * leaving the frame as it was, if the crop is outside the frame, doesn't
+ * fall on chroma samples or the format isn't planar.
+ */
+int hb_frame_buffer_crop( hb_buffer_t * buf, int top, int left,
+                          int width, int height )
+{
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(buf->f.fmt);
+    uint8_t done[4] = {0,};
+    int p, c;
+
+    if (desc == NULL || !(desc->flags & AV_PIX_FMT_FLAG_PLANAR) ||
+        (desc->flags & AV_PIX_FMT_FLAG_HWACCEL))
+    {
+        return -1;
+    }
+    if (top < 0 || left < 0 || width <= 0 || height <= 0 ||
+        top  + height > buf->f.height || left + width > buf->f.width ||
+        (top  & ((1 << desc->log2_chroma_h) - 1)) ||
+        (left & ((1 << desc->log2_chroma_w) - 1)))
+    {
+        return -1;
+    }
+
+    for (c = 0; c < desc->nb_components; c++)
+    {
+        // Components sharing a plane (e.g. NV12 chroma) move it once
+        p = desc->comp[c].plane;
+        if (done[p])
+        {
+            continue;
+        }
+        done[p] = 1;
+        int x = hb_image_width(buf->f.fmt, left, p) *
+                (desc->comp[c].step_minus1 + 1);
+        int y = hb_image_height(buf->f.fmt, top, p);
+
+        buf->plane[p].data  += y * buf->plane[p].stride + x;
+        buf->plane[p].width  = hb_image_width(buf->f.fmt, width, p);
+        buf->plane[p].height = hb_image_height(buf->f.fmt, height, p);
+    }
+    buf->f.width  = width;
+    buf->f.height = height;
+
+    return 0;
+}
+
 // this routine reallocs a buffer for an uncompressed YUV420 video frame
 // with dimensions width x height.
 void hb_video_buffer_realloc( hb_buffer_t * buf, int width, int height )
@@ -661,54 +1250,69 @@ void hb_buffer_swap_copy( hb_buffer_t *src, hb_buffer_t *dst )
     src->cl.buffer_location = loc;
 }
 
+// Returns a buffer that nothing refers to any more to its pool.
+// Its 'next' and 'sub' must already be taken care of.
+static void buffer_release( hb_buffer_t * b, buffer_cache_t ** cache )
+{
+    int pool_index = size_to_pool_index( b->alloc );
+
+#if defined(HB_BUFFER_DEBUG)
+    hb_lock(buffers.lock);
+    hb_list_rem(buffers.alloc_list, b);
+    hb_unlock(buffers.lock);
+#endif
+
+    if( pool_index >= 0 && b->data )
+    {
+        if ( *cache == NULL )
+        {
+            *cache = buffer_cache_self();
+        }
+        buffer_cache_put( *cache, pool_index, b );
+        return;
+    }
+    // this size doesn't use a pool, free the buf
+    buffer_free( b );
+}
+
 // Frees the specified buffer list.
 void hb_buffer_close( hb_buffer_t ** _b )
 {
     hb_buffer_t * b = *_b;
+    buffer_cache_t * cache = NULL;
 
     while( b )
     {
         hb_buffer_t * next = b->next;
-        hb_fifo_t *buffer_pool = size_to_pool( b->alloc );
 
         b->next = NULL;
 
-#if defined(HB_BUFFER_DEBUG)
-        hb_lock(buffers.lock);
-        hb_list_rem(buffers.alloc_list, b);
-        hb_unlock(buffers.lock);
-#endif
         // Close any attached subtitle buffers
         hb_buffer_close( &b->sub );
 
-        if( buffer_pool && b->data && !hb_fifo_is_full( buffer_pool ) )
+        if( b->shared != NULL )
         {
-            hb_fifo_push_head( buffer_pool, b );
+            // A reference, drop it from the buffer it points to.  The
+            // owner may still be in use elsewhere, so its list and
+            // subtitles are left alone; they were closed with the owner.
+            hb_buffer_t * owner = b->shared;
+            free( b );
+            if( __atomic_fetch_sub( &owner->refs, 1, __ATOMIC_ACQ_REL ) == 0 )
+            {
+                buffer_release( owner, &cache );
+            }
             b = next;
             continue;
         }
-        // either the pool is full or this size doesn't use a pool
-        // free the buf 
-        if( b->data )
+        if( __atomic_load_n( &b->refs, __ATOMIC_ACQUIRE ) > 0 &&
+            __atomic_fetch_sub( &b->refs, 1, __ATOMIC_ACQ_REL ) > 0 )
         {
-            if (b->cl.buffer != NULL)
-            {
-                /* OpenCL */
-                if (hb_cl_free_mapped_buffer(b->cl.buffer, b->data) == 0)
-                {
-                    hb_log("hb_buffer_pool_free: bad free %p -> buffer %p map %p",
-                           b, b->cl.buffer, b->data);
-                }
-            }
-            else
-            {
-                free(b->data);
-            }
-            hb_lock(buffers.lock);
-            buffers.allocated -= b->alloc;
-            hb_unlock(buffers.lock);
+            // The last reference returns it to the pool
+            b = next;
+            continue;
         }
-        free( b );
+
+        buffer_release( b, &cache );
         b = next;
     }
 
@@ -846,6 +1450,293 @@ void hb_image_close(hb_image_t **_image)
     }
 }
 
+/*
+ * Adaptive capacity
+ *
+ * A consumer that starves after its producer was held back by the
+ * capacity would have kept going with more room, so the capacity doubles
+ * (up to max_capacity).  A consumer starving behind a producer that is
+ * simply slower doesn't grow the fifo.  While more buffer memory than the
+ * budget is allocated, every push halves the capacity again (down to the
+ * capacity the fifo was created with).
+ */
+static inline int fifo_over_budget( hb_fifo_t * f )
+{
+    return f->memory_budget > 0 &&
+           __atomic_load_n( &buffers.allocated, __ATOMIC_RELAXED ) >
+           f->memory_budget;
+}
+
+// Called with the lock held by a consumer that found the fifo empty
+static void fifo_starved( hb_fifo_t * f )
+{
+    f->empty_waits++;
+    if( f->producer_blocked && f->capacity < f->max_capacity &&
+        !fifo_over_budget( f ) )
+    {
+        fifo_store( &f->capacity, MIN( f->capacity * 2, f->max_capacity ) );
+        f->grows++;
+    }
+    f->producer_blocked = 0;
+}
+
+// Called with the lock held by a producer that found the fifo full
+static void fifo_blocked( hb_fifo_t * f )
+{
+    f->full_waits++;
+    f->producer_blocked = 1;
+}
+
+// Called by the producer for every push with the number of buffers that
+// were queued.  Regular fifos call it with the lock held.
+static void fifo_sample( hb_fifo_t * f, uint32_t count )
+{
+    f->pushes++;
+    f->occupancy_sum += count;
+    if( count > f->occupancy_max )
+    {
+        f->occupancy_max = count;
+    }
+}
+
+// Called by the producer without the lock
+static void fifo_check_budget( hb_fifo_t * f )
+{
+    if( fifo_load( &f->capacity ) > f->min_capacity && fifo_over_budget( f ) )
+    {
+        hb_lock( f->lock );
+        if( f->capacity > f->min_capacity )
+        {
+            fifo_store( &f->capacity,
+                        MAX( f->capacity / 2, f->min_capacity ) );
+            f->shrinks++;
+        }
+        hb_unlock( f->lock );
+    }
+}
+
+/*
+ * Single producer / single consumer fifo
+ *
+ * Most fifos in the transcode pipeline have exactly one thread pushing
+ * into them and one thread pulling out.  For those we avoid taking the
+ * fifo lock for every buffer by storing buffer pointers in a power of 2
+ * ring indexed by free running 'head' (consumer) and 'tail' (producer)
+ * counters.
+ *
+ * hb_fifo_push() accepts buffer chains of any length and must never block,
+ * so buffers that do not fit in the ring go to the (locked) overflow list.
+ * Once the overflow list is non-empty, the producer keeps appending to it
+ * until the consumer has drained it.  The consumer only takes from the
+ * overflow list when the ring is empty, so buffer order is preserved.
+ *
+ * Sleeping uses the same condition variables as regular fifos.  A waiter
+ * publishes its wait flag before re-checking the fifo and the other side
+ * checks the flag after publishing its update, so at least one of them
+ * sees the other and wakeups can't be lost.
+ */
+static inline uint32_t spsc_ring_count( hb_fifo_t * f )
+{
+    return fifo_load( &f->tail ) - fifo_load( &f->head );
+}
+
+static inline uint32_t spsc_count( hb_fifo_t * f )
+{
+    return spsc_ring_count( f ) + fifo_load( &f->size );
+}
+
+// Producer side.  Signals a sleeping consumer if necessary.
+static void spsc_wake_empty( hb_fifo_t * f )
+{
+    fifo_fence();
+    if( fifo_load( &f->wait_empty ) )
+    {
+        hb_lock( f->lock );
+        f->wait_empty = 0;
+        hb_cond_signal( f->cond_empty );
+        hb_unlock( f->lock );
+    }
+}
+
+// Consumer side.  Signals a sleeping producer if necessary.
+static void spsc_wake_full( hb_fifo_t * f )
+{
+    fifo_fence();
+    if( fifo_load( &f->wait_full ) &&
+        spsc_count( f ) <= fifo_load( &f->capacity ) - f->thresh )
+    {
+        hb_lock( f->lock );
+        f->wait_full = 0;
+        hb_cond_signal( f->cond_full );
+        hb_unlock( f->lock );
+    }
+}
+
+static void spsc_push( hb_fifo_t * f, hb_buffer_t * b )
+{
+    hb_buffer_t * next;
+
+    fifo_sample( f, spsc_count( f ) );
+    while( b )
+    {
+        next    = b->next;
+        b->next = NULL;
+
+        uint32_t tail = f->tail;
+        if( fifo_load( &f->size ) == 0 &&
+            tail - fifo_load( &f->head ) <= f->ring_mask )
+        {
+            f->ring[tail & f->ring_mask] = b;
+            fifo_store( &f->tail, tail + 1 );
+        }
+        else
+        {
+            hb_lock( f->lock );
+            if( f->size > 0 )
+            {
+                f->last->next = b;
+            }
+            else
+            {
+                f->first = b;
+            }
+            f->last = b;
+            fifo_store( &f->size, f->size + 1 );
+            hb_unlock( f->lock );
+        }
+        b = next;
+    }
+    spsc_wake_empty( f );
+    fifo_check_budget( f );
+}
+
+// Returns the n'th (0 or 1) buffer in the fifo without removing it
+static hb_buffer_t * spsc_see( hb_fifo_t * f, uint32_t n )
+{
+    hb_buffer_t * b;
+    uint32_t      count = spsc_ring_count( f );
+
+    if( count > n )
+    {
+        return f->ring[( f->head + n ) & f->ring_mask];
+    }
+    if( fifo_load( &f->size ) == 0 )
+    {
+        return NULL;
+    }
+    // The overflow list is non-empty, so everything the producer put in
+    // the ring before it is now visible.  Re-read the ring count.
+    count = spsc_ring_count( f );
+    if( count > n )
+    {
+        return f->ring[( f->head + n ) & f->ring_mask];
+    }
+
+    hb_lock( f->lock );
+    b = f->first;
+    for( n -= count; b && n > 0; n-- )
+    {
+        b = b->next;
+    }
+    hb_unlock( f->lock );
+
+    return b;
+}
+
+static hb_buffer_t * spsc_get( hb_fifo_t * f )
+{
+    hb_buffer_t * b;
+    uint32_t      head = f->head;
+
+    if( head == fifo_load( &f->tail ) )
+    {
+        if( fifo_load( &f->size ) == 0 )
+        {
+            return NULL;
+        }
+        // See spsc_see()
+        if( head == fifo_load( &f->tail ) )
+        {
+            hb_lock( f->lock );
+            b        = f->first;
+            f->first = b->next;
+            b->next  = NULL;
+            fifo_store( &f->size, f->size - 1 );
+            hb_unlock( f->lock );
+
+            spsc_wake_full( f );
+            return b;
+        }
+    }
+    b = f->ring[head & f->ring_mask];
+    fifo_store( &f->head, head + 1 );
+
+    spsc_wake_full( f );
+    return b;
+}
+
+static hb_buffer_t * spsc_wait_empty( hb_fifo_t * f, int see )
+{
+    hb_buffer_t * b;
+
+    b = see ? spsc_see( f, 0 ) : spsc_get( f );
+    if( b == NULL )
+    {
+        hb_lock( f->lock );
+        fifo_store( &f->wait_empty, 1 );
+        fifo_fence();
+        if( spsc_count( f ) == 0 )
+        {
+            fifo_starved( f );
+            hb_cond_timedwait( f->cond_empty, f->lock, FIFO_TIMEOUT );
+        }
+        hb_unlock( f->lock );
+        b = see ? spsc_see( f, 0 ) : spsc_get( f );
+    }
+    return b;
+}
+
+static int spsc_full_wait( hb_fifo_t * f )
+{
+    if( spsc_count( f ) >= fifo_load( &f->capacity ) )
+    {
+        hb_lock( f->lock );
+        fifo_store( &f->wait_full, 1 );
+        fifo_fence();
+        if( spsc_count( f ) >= f->capacity )
+        {
+            fifo_blocked( f );
+            hb_cond_timedwait( f->cond_full, f->lock, FIFO_TIMEOUT );
+        }
+        hb_unlock( f->lock );
+    }
+    return spsc_count( f ) < fifo_load( &f->capacity );
+}
+
+static int spsc_size_bytes( hb_fifo_t * f )
+{
+    int           ret = 0;
+    uint32_t      ii, head, tail;
+    hb_buffer_t * link;
+
+    head = fifo_load( &f->head );
+    tail = fifo_load( &f->tail );
+    for( ii = head; ii != tail; ii++ )
+    {
+        ret += f->ring[ii & f->ring_mask]->size;
+    }
+    hb_lock( f->lock );
+    link = f->first;
+    while ( link )
+    {
+        ret += link->size;
+        link = link->next;
+    }
+    hb_unlock( f->lock );
+
+    return ret;
+}
+
 hb_fifo_t * hb_fifo_init( int capacity, int thresh )
 {
     hb_fifo_t * f;
@@ -864,11 +1755,80 @@ hb_fifo_t * hb_fifo_init( int capacity, int thresh )
     return f;
 }
 
+// Creates a fifo that must only ever be pushed by one thread and
+// pulled by one (other) thread.  See the description of spsc_push().
+hb_fifo_t * hb_fifo_init_spsc( int capacity, int thresh )
+{
+    hb_fifo_t * f;
+    uint32_t    ring_size = 1;
+
+    while ( ring_size < capacity )
+    {
+        ring_size <<= 1;
+    }
+
+    f            = hb_fifo_init( capacity, thresh );
+    f->ring      = calloc( sizeof( hb_buffer_t * ), ring_size );
+    f->ring_mask = ring_size - 1;
+    f->spsc      = 1;
+
+    return f;
+}
+
+/*
+ * Lets the capacity of 'f' grow up to 'max_capacity' while its consumer
+ * starves and shrink back while more than 'memory_budget' bytes of
+ * buffers are allocated, see fifo_starved().  'name' identifies the fifo
+ * in hb_fifo_log_stats().  Must be called before the fifo is used.
+ */
+void hb_fifo_set_adaptive( hb_fifo_t * f, const char * name,
+                           int max_capacity, int64_t memory_budget )
+{
+    f->name          = name;
+    f->min_capacity  = f->capacity;
+    f->max_capacity  = MAX( max_capacity, f->capacity );
+    f->memory_budget = memory_budget;
+
+    if ( f->spsc && f->ring_mask + 1 < f->max_capacity )
+    {
+        uint32_t ring_size = f->ring_mask + 1;
+
+        while ( ring_size < f->max_capacity )
+        {
+            ring_size <<= 1;
+        }
+        free( f->ring );
+        f->ring      = calloc( sizeof( hb_buffer_t * ), ring_size );
+        f->ring_mask = ring_size - 1;
+    }
+}
+
+// Logs the occupancy statistics of a fifo named by hb_fifo_set_adaptive()
+void hb_fifo_log_stats( hb_fifo_t * f )
+{
+    if ( f == NULL || f->name == NULL )
+    {
+        return;
+    }
+    hb_log( "fifo: %s: %"PRIu64" pushes, %.1f queued on average, %u max, "
+            "capacity %u (%u-%u, grew %u, shrank %u times), "
+            "consumer starved %u, producer blocked %u times",
+            f->name, f->pushes,
+            f->pushes ? (double)f->occupancy_sum / f->pushes : 0.,
+            f->occupancy_max, f->capacity, f->min_capacity, f->max_capacity,
+            f->grows, f->shrinks, f->empty_waits, f->full_waits );
+}
+
 int hb_fifo_size_bytes( hb_fifo_t * f )
 {
     int ret = 0;
     hb_buffer_t * link;
 
+    if ( f->spsc )
+    {
+        return spsc_size_bytes( f );
+    }
+
     hb_lock( f->lock );
     link = f->first;
     while ( link )
@@ -885,6 +1845,11 @@ int hb_fifo_size( hb_fifo_t * f )
 {
     int ret;
 
+    if ( f->spsc )
+    {
+        return spsc_count( f );
+    }
+
     hb_lock( f->lock );
     ret = f->size;
     hb_unlock( f->lock );
@@ -896,6 +1861,11 @@ int hb_fifo_is_full( hb_fifo_t * f )
 {
     int ret;
 
+    if ( f->spsc )
+    {
+        return spsc_count( f ) >= f->capacity;
+    }
+
     hb_lock( f->lock );
     ret = ( f->size >= f->capacity );
     hb_unlock( f->lock );
@@ -907,6 +1877,11 @@ float hb_fifo_percent_full( hb_fifo_t * f )
 {
     float ret;
 
+    if ( f->spsc )
+    {
+        return spsc_count( f ) / f->capacity;
+    }
+
     hb_lock( f->lock );
     ret = f->size / f->capacity;
     hb_unlock( f->lock );
@@ -920,9 +1895,15 @@ hb_buffer_t * hb_fifo_get_wait( hb_fifo_t * f )
 {
     hb_buffer_t * b;
 
+    if ( f->spsc )
+    {
+        return spsc_wait_empty( f, 0 );
+    }
+
     hb_lock( f->lock );
     if( f->size < 1 )
     {
+        fifo_starved( f );
         f->wait_empty = 1;
         hb_cond_timedwait( f->cond_empty, f->lock, FIFO_TIMEOUT );
         if( f->size < 1 )
@@ -950,6 +1931,11 @@ hb_buffer_t * hb_fifo_get( hb_fifo_t * f )
 {
     hb_buffer_t * b;
 
+    if ( f->spsc )
+    {
+        return spsc_get( f );
+    }
+
     hb_lock( f->lock );
     if( f->size < 1 )
     {
@@ -974,9 +1960,15 @@ hb_buffer_t * hb_fifo_see_wait( hb_fifo_t * f )
 {
     hb_buffer_t * b;
 
+    if ( f->spsc )
+    {
+        return spsc_wait_empty( f, 1 );
+    }
+
     hb_lock( f->lock );
     if( f->size < 1 )
     {
+        fifo_starved( f );
         f->wait_empty = 1;
         hb_cond_timedwait( f->cond_empty, f->lock, FIFO_TIMEOUT );
         if( f->size < 1 )
@@ -997,6 +1989,11 @@ hb_buffer_t * hb_fifo_see( hb_fifo_t * f )
 {
     hb_buffer_t * b;
 
+    if ( f->spsc )
+    {
+        return spsc_see( f, 0 );
+    }
+
     hb_lock( f->lock );
     if( f->size < 1 )
     {
@@ -1013,6 +2010,11 @@ hb_buffer_t * hb_fifo_see2( hb_fifo_t * f )
 {
     hb_buffer_t * b;
 
+    if ( f->spsc )
+    {
+        return spsc_see( f, 1 );
+    }
+
     hb_lock( f->lock );
     if( f->size < 2 )
     {
@@ -1031,9 +2033,15 @@ int hb_fifo_full_wait( hb_fifo_t * f )
 {
     int result;
 
+    if ( f->spsc )
+    {
+        return spsc_full_wait( f );
+    }
+
     hb_lock( f->lock );
     if( f->size >= f->capacity )
     {
+        fifo_blocked( f );
         f->wait_full = 1;
         hb_cond_timedwait( f->cond_full, f->lock, FIFO_TIMEOUT );
     }
@@ -1051,12 +2059,21 @@ void hb_fifo_push_wait( hb_fifo_t * f, hb_buffer_t * b )
         return;
     }
 
+    if ( f->spsc )
+    {
+        spsc_full_wait( f );
+        spsc_push( f, b );
+        return;
+    }
+
     hb_lock( f->lock );
     if( f->size >= f->capacity )
     {
+        fifo_blocked( f );
         f->wait_full = 1;
         hb_cond_timedwait( f->cond_full, f->lock, FIFO_TIMEOUT );
     }
+    fifo_sample( f, f->size );
     if( f->size > 0 )
     {
         f->last->next = b;
@@ -1078,6 +2095,7 @@ void hb_fifo_push_wait( hb_fifo_t * f, hb_buffer_t * b )
         hb_cond_signal( f->cond_empty );
     }
     hb_unlock( f->lock );
+    fifo_check_budget( f );
 }
 
 // Appends the specified packet list to the end of the specified FIFO.
@@ -1088,7 +2106,14 @@ void hb_fifo_push( hb_fifo_t * f, hb_buffer_t * b )
         return;
     }
 
+    if ( f->spsc )
+    {
+        spsc_push( f, b );
+        return;
+    }
+
     hb_lock( f->lock );
+    fifo_sample( f, f->size );
     if( f->size > 0 )
     {
         f->last->next = b;
@@ -1110,6 +2135,7 @@ void hb_fifo_push( hb_fifo_t * f, hb_buffer_t * b )
         hb_cond_signal( f->cond_empty );
     }
     hb_unlock( f->lock );
+    fifo_check_budget( f );
 }
 
 // Prepends the specified packet list to the start of the specified FIFO.
@@ -1123,6 +2149,15 @@ void hb_fifo_push_head( hb_fifo_t * f, hb_buffer_t * b )
         return;
     }
 
+    if ( f->spsc )
+    {
+        // Nobody but the consumer could safely put buffers back at the
+        // head, and none of the spsc fifos need it.
+        hb_error( "hb_fifo_push_head: not supported on spsc fifo %p", f );
+        spsc_push( f, b );
+        return;
+    }
+
     hb_lock( f->lock );
 
     /*
@@ -1190,6 +2225,7 @@ void hb_fifo_close( hb_fifo_t ** _f )
     hb_lock_close( &f->lock );
     hb_cond_close( &f->cond_empty );
     hb_cond_close( &f->cond_full );
+    free( f->ring );
 
 #if defined(HB_FIFO_DEBUG)
     // Remove the fifo from the global fifo list
@@ -10,6 +10,7 @@
 #include "hb.h"
 #include "opencl.h"
 #include "hbffmpeg.h"
+#include "taskset.h"
 #include <stdio.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -71,8 +72,35 @@ struct hb_handle_s
 
     // power management opaque pointer
     void *system_sleep_opaque;
+
+    /* Previews stored by the scan thread, least recently used first */
+    hb_lock_t    * preview_lock;
+    hb_list_t    * preview_list;
+    int64_t        preview_cache_size;
+    int64_t        preview_cache_used;
+
+    /* Pipeline stages of the running job, see hb_stage_register() */
+    hb_lock_t    * stage_lock;
+    hb_list_t    * stage_list;
+
+    /* Timeline of the pipeline, see hb_set_trace_file() */
+    hb_trace_t   * trace;
+
+    /* Measure the CPU time of pipeline stages, see hb_set_stage_cpu_time() */
+    int            stage_cpu_time;
 } ;
 
+typedef struct
+{
+    int       title;
+    int       preview;
+    int       size;
+    uint8_t * data;
+} hb_preview_entry_t;
+
+/* Default byte budget of the in-memory preview store */
+#define HB_PREVIEW_CACHE_SIZE (256 * 1024 * 1024)
+
 hb_work_object_t * hb_objects = NULL;
 int hb_instance_counter = 0;
 
@@ -417,6 +445,13 @@ hb_handle_t * hb_init( int verbose, int update_check )
 
     h->pause_lock = hb_lock_init();
 
+    h->preview_lock       = hb_lock_init();
+    h->preview_list       = hb_list_init();
+    h->preview_cache_size = HB_PREVIEW_CACHE_SIZE;
+
+    h->stage_lock = hb_lock_init();
+    h->stage_list = hb_list_init();
+
     h->interjob = calloc( sizeof( hb_interjob_t ), 1 );
 
     /* Start library thread */
@@ -489,6 +524,13 @@ hb_handle_t * hb_init_dl( int verbose, int update_check )
 
     h->pause_lock = hb_lock_init();
 
+    h->preview_lock       = hb_lock_init();
+    h->preview_list       = hb_list_init();
+    h->preview_cache_size = HB_PREVIEW_CACHE_SIZE;
+
+    h->stage_lock = hb_lock_init();
+    h->stage_list = hb_list_init();
+
     /* Start library thread */
     hb_log( "hb_init: starting libhb thread" );
     h->die         = 0;
@@ -543,6 +585,17 @@ void hb_remove_previews( hb_handle_t * h )
     int             i, count, len;
     DIR           * dir;
     struct dirent * entry;
+    hb_preview_entry_t * preview;
+
+    hb_lock( h->preview_lock );
+    while( ( preview = hb_list_item( h->preview_list, 0 ) ) )
+    {
+        hb_list_rem( h->preview_list, preview );
+        free( preview->data );
+        free( preview );
+    }
+    h->preview_cache_used = 0;
+    hb_unlock( h->preview_lock );
 
     memset( dirname, 0, 1024 );
     hb_get_temporary_directory( dirname );
@@ -633,7 +686,57 @@ hb_title_set_t * hb_get_title_set( hb_handle_t * h )
     return &h->title_set;
 }
 
-int hb_save_preview( hb_handle_t * h, int title, int preview, hb_buffer_t *buf )
+/**
+ * Sets the byte budget of the in-memory preview store.
+ * @param h Handle to hb_handle_t
+ * @param size Budget in bytes.  Previews that don't fit are written to
+ *             temporary files.  0 stores all previews in temporary files.
+ */
+void hb_set_preview_cache_size( hb_handle_t * h, int64_t size )
+{
+    hb_lock( h->preview_lock );
+    h->preview_cache_size = size;
+    hb_unlock( h->preview_lock );
+}
+
+/**
+ * Writes a timeline of the jobs started from now on to a trace file.
+ * @param h Handle to hb_handle_t
+ * @param path Chrome trace event file, see trace.c.  NULL stops tracing.
+ */
+void hb_set_trace_file( hb_handle_t * h, const char * path )
+{
+    hb_trace_close( &h->trace );
+    if ( path != NULL )
+    {
+        h->trace = hb_trace_open( path );
+    }
+}
+
+hb_trace_t * hb_get_trace( hb_handle_t * h )
+{
+    return h->trace;
+}
+
+/**
+ * Measures the thread CPU time of the pipeline stages of the jobs started
+ * from now on, see hb_get_stages_json().  It is always measured while a
+ * trace file is set.
+ * @param h Handle to hb_handle_t
+ * @param enable 0 or 1
+ */
+void hb_set_stage_cpu_time( hb_handle_t * h, int enable )
+{
+    h->stage_cpu_time = enable;
+}
+
+int hb_get_stage_cpu_time( hb_handle_t * h )
+{
+    return h->stage_cpu_time || h->trace != NULL;
+}
+
+static int preview_write_file( hb_handle_t * h, int title, int preview,
+                               const uint8_t * data, int size )
 {
     FILE * file;
     char   filename[1024];
@@ -647,45 +750,156 @@ int hb_save_preview( hb_handle_t * h, int title, int preview, hb_buffer_t *buf )
         hb_error( "hb_save_preview: fopen failed (%s)", filename );
         return -1;
     }
-
-    int pp, hh;
-    for( pp = 0; pp < 3; pp++ )
+    if ( fwrite( data, size, 1, file ) != 1 )
     {
-        uint8_t *data = buf->plane[pp].data;
-        int stride = buf->plane[pp].stride;
-        int w = buf->plane[pp].width;
-        int h = buf->plane[pp].height;
-
-        for( hh = 0; hh < h; hh++ )
-        {
-            fwrite( data, w, 1, file );
-            data += stride;
-        }
+        hb_error( "hb_save_preview: fwrite failed (%s)", filename );
+        fclose( file );
+        return -1;
     }
     fclose( file );
     return 0;
 }
 
-hb_buffer_t * hb_read_preview(hb_handle_t * h, hb_title_t *title, int preview)
+static int preview_read_file( hb_handle_t * h, int title, int preview,
+                              uint8_t * data, int size )
 {
     FILE * file;
     char   filename[1024];
 
     hb_get_tempory_filename(h, filename, "%d_%d_%d",
-                            hb_get_instance_id(h), title->index, preview);
+                            hb_get_instance_id(h), title, preview);
 
     file = hb_fopen(filename, "rb");
     if (!file)
     {
         hb_error( "hb_read_preview: fopen failed (%s)", filename );
-        return NULL;
+        return -1;
+    }
+    if ( fread( data, size, 1, file ) != 1 )
+    {
+        hb_error( "hb_read_preview: fread failed (%s)", filename );
+        fclose( file );
+        return -1;
     }
+    fclose(file);
+    return 0;
+}
 
-    hb_buffer_t * buf;
-    buf = hb_frame_buffer_init(AV_PIX_FMT_YUV420P,
-                               title->geometry.width, title->geometry.height);
+/*
+ * Takes the preview out of the in-memory store.  Returns NULL if it
+ * isn't there.  Must be called with preview_lock held.
+ */
+static hb_preview_entry_t * preview_cache_remove( hb_handle_t * h,
+                                                  int title, int preview )
+{
+    hb_preview_entry_t * entry;
+    int                  ii;
+
+    for ( ii = 0; ( entry = hb_list_item( h->preview_list, ii ) ); ii++ )
+    {
+        if ( entry->title == title && entry->preview == preview )
+        {
+            hb_list_rem( h->preview_list, entry );
+            h->preview_cache_used -= entry->size;
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Adds the preview to the in-memory store, writing the least recently
+ * used previews to temporary files until it fits.  Takes ownership of
+ * entry.
+ */
+static void preview_cache_add( hb_handle_t * h, hb_preview_entry_t * entry )
+{
+    hb_preview_entry_t * old;
+    hb_list_t          * evicted = hb_list_init();
 
+    hb_lock( h->preview_lock );
+    old = preview_cache_remove( h, entry->title, entry->preview );
+    if ( old != NULL )
+    {
+        free( old->data );
+        free( old );
+    }
+    if ( entry->size > h->preview_cache_size )
+    {
+        hb_list_add( evicted, entry );
+    }
+    else
+    {
+        while ( h->preview_cache_used + entry->size > h->preview_cache_size &&
+                ( old = hb_list_item( h->preview_list, 0 ) ) )
+        {
+            hb_list_rem( h->preview_list, old );
+            h->preview_cache_used -= old->size;
+            hb_list_add( evicted, old );
+        }
+        hb_list_add( h->preview_list, entry );
+        h->preview_cache_used += entry->size;
+    }
+    hb_unlock( h->preview_lock );
+
+    // Do the file I/O without holding the lock
+    while ( ( old = hb_list_item( evicted, 0 ) ) )
+    {
+        hb_list_rem( evicted, old );
+        preview_write_file( h, old->title, old->preview, old->data, old->size );
+        free( old->data );
+        free( old );
+    }
+    hb_list_close( &evicted );
+}
+
+int hb_save_preview( hb_handle_t * h, int title, int preview, hb_buffer_t *buf )
+{
+    hb_preview_entry_t * entry;
+    uint8_t            * dst;
+    int                  pp, hh, size = 0;
+
+    for( pp = 0; pp < 3; pp++ )
+    {
+        size += buf->plane[pp].width * buf->plane[pp].height;
+    }
+
+    entry = calloc( 1, sizeof( hb_preview_entry_t ) );
+    entry->title   = title;
+    entry->preview = preview;
+    entry->size    = size;
+    entry->data    = dst = malloc( size );
+    if ( entry->data == NULL )
+    {
+        hb_error( "hb_save_preview: out of memory" );
+        free( entry );
+        return -1;
+    }
+
+    // Planes are stored back to back without padding
+    for( pp = 0; pp < 3; pp++ )
+    {
+        uint8_t *data = buf->plane[pp].data;
+        int stride = buf->plane[pp].stride;
+        int w = buf->plane[pp].width;
+        int h = buf->plane[pp].height;
+
+        for( hh = 0; hh < h; hh++ )
+        {
+            memcpy( dst, data, w );
+            dst += w;
+            data += stride;
+        }
+    }
+
+    preview_cache_add( h, entry );
+    return 0;
+}
+
+static void preview_unpack( hb_buffer_t * buf, const uint8_t * src )
+{
     int pp, hh;
+
     for (pp = 0; pp < 3; pp++)
     {
         uint8_t *data = buf->plane[pp].data;
@@ -695,11 +909,53 @@ hb_buffer_t * hb_read_preview(hb_handle_t * h, hb_title_t *title, int preview)
 
         for (hh = 0; hh < h; hh++)
         {
-            fread(data, w, 1, file);
+            memcpy(data, src, w);
+            src += w;
             data += stride;
         }
     }
-    fclose(file);
+}
+
+hb_buffer_t * hb_read_preview(hb_handle_t * h, hb_title_t *title, int preview)
+{
+    hb_preview_entry_t * entry;
+    hb_buffer_t        * buf;
+    uint8_t            * packed;
+    int                  pp, size = 0;
+
+    buf = hb_frame_buffer_init(AV_PIX_FMT_YUV420P,
+                               title->geometry.width, title->geometry.height);
+    for (pp = 0; pp < 3; pp++)
+    {
+        size += buf->plane[pp].width * buf->plane[pp].height;
+    }
+
+    hb_lock( h->preview_lock );
+    entry = preview_cache_remove( h, title->index, preview );
+    if ( entry != NULL )
+    {
+        // Most recently used previews go to the end of the list
+        hb_list_add( h->preview_list, entry );
+        h->preview_cache_used += entry->size;
+        if ( entry->size == size )
+        {
+            preview_unpack( buf, entry->data );
+            hb_unlock( h->preview_lock );
+            return buf;
+        }
+    }
+    hb_unlock( h->preview_lock );
+
+    packed = malloc( size );
+    if ( packed == NULL ||
+         preview_read_file( h, title->index, preview, packed, size ) < 0 )
+    {
+        free( packed );
+        hb_buffer_close( &buf );
+        return NULL;
+    }
+    preview_unpack( buf, packed );
+    free( packed );
 
     return buf;
 }
@@ -1320,6 +1576,7 @@ static void hb_add_internal( hb_handle_t * h, hb_job_t * job )
     job_copy->list_chapter = hb_chapter_list_copy( job->list_chapter );
     job_copy->list_audio = hb_audio_list_copy( job->list_audio );
     job_copy->list_attachment = hb_attachment_list_copy( job->list_attachment );
+    job_copy->list_rendition = hb_rendition_list_copy( job->list_rendition );
     job_copy->metadata = hb_metadata_copy( job->metadata );
 
     if (job->encoder_preset != NULL)
@@ -1514,6 +1771,84 @@ void hb_get_state( hb_handle_t * h, hb_state_t * s )
     hb_unlock( h->state_lock );
 }
 
+/*
+ * Makes the statistics of a pipeline stage visible through
+ * hb_get_stage_stats() while its thread runs.
+ */
+void hb_stage_register( hb_handle_t * h, hb_stage_stats_t * stats )
+{
+    hb_lock( h->stage_lock );
+    hb_list_add( h->stage_list, stats );
+    hb_unlock( h->stage_lock );
+}
+
+/*
+ * Logs the totals of a stage registered with hb_stage_register() and
+ * removes it.  Called once the stage's thread has stopped.
+ */
+void hb_stage_close( hb_handle_t * h, hb_stage_stats_t * stats )
+{
+    int64_t total;
+    char    cpu[32] = "";
+    int     found = 0;
+    int     ii;
+
+    hb_lock( h->stage_lock );
+    for ( ii = 0; ii < hb_list_count( h->stage_list ); ii++ )
+    {
+        if ( hb_list_item( h->stage_list, ii ) == stats )
+        {
+            hb_list_rem( h->stage_list, stats );
+            found = 1;
+            break;
+        }
+    }
+    hb_unlock( h->stage_lock );
+
+    if ( !found )
+    {
+        return;
+    }
+    total = stats->busy + stats->wait_in + stats->wait_out;
+    if ( stats->measure_cpu )
+    {
+        snprintf( cpu, sizeof( cpu ), ", cpu %.2f s",
+                  MAX( stats->cpu, 0 ) / 1e6 );
+    }
+    hb_log( "stage: %s: %"PRId64" buffers, %"PRId64" bytes, busy %.2f s "
+            "(%.0f%%), waiting for input %.2f s, for output %.2f s%s",
+            stats->name, stats->frames, stats->bytes, stats->busy / 1e6,
+            total > 0 ? 100. * stats->busy / total : 0.,
+            stats->wait_in / 1e6, stats->wait_out / 1e6, cpu );
+}
+
+/*
+ * Copies the statistics of up to 'count' stages of the running job to
+ * 'stats' and returns the number of stages, which can be more than 'count'.
+ */
+int hb_get_stage_stats( hb_handle_t * h, hb_stage_stats_t * stats, int count )
+{
+    hb_stage_stats_t * stage;
+    int                ii, total;
+
+    hb_lock( h->stage_lock );
+    for ( ii = 0; ii < count &&
+                  ( stage = hb_list_item( h->stage_list, ii ) ); ii++ )
+    {
+        stats[ii].name     = stage->name;
+        stats[ii].busy     = __atomic_load_n( &stage->busy, __ATOMIC_RELAXED );
+        stats[ii].wait_in  = __atomic_load_n( &stage->wait_in, __ATOMIC_RELAXED );
+        stats[ii].wait_out = __atomic_load_n( &stage->wait_out, __ATOMIC_RELAXED );
+        stats[ii].frames   = __atomic_load_n( &stage->frames, __ATOMIC_RELAXED );
+        stats[ii].bytes    = __atomic_load_n( &stage->bytes, __ATOMIC_RELAXED );
+        stats[ii].cpu      = __atomic_load_n( &stage->cpu, __ATOMIC_RELAXED );
+    }
+    total = hb_list_count( h->stage_list );
+    hb_unlock( h->stage_lock );
+
+    return total;
+}
+
 void hb_get_state2( hb_handle_t * h, hb_state_t * s )
 {
     hb_lock( h->state_lock );
@@ -1540,6 +1875,7 @@ void hb_close( hb_handle_t ** _h )
 {
     hb_handle_t * h = *_h;
     hb_title_t * title;
+    hb_preview_entry_t * preview;
 
     h->die = 1;
     
@@ -1555,6 +1891,19 @@ void hb_close( hb_handle_t ** _h )
     hb_list_close( &h->jobs );
     hb_lock_close( &h->state_lock );
     hb_lock_close( &h->pause_lock );
+    hb_lock( h->preview_lock );
+    while( ( preview = hb_list_item( h->preview_list, 0 ) ) )
+    {
+        hb_list_rem( h->preview_list, preview );
+        free( preview->data );
+        free( preview );
+    }
+    hb_unlock( h->preview_lock );
+    hb_list_close( &h->preview_list );
+    hb_lock_close( &h->preview_lock );
+    hb_list_close( &h->stage_list );
+    hb_lock_close( &h->stage_lock );
+    hb_trace_close( &h->trace );
 
     hb_system_sleep_opaque_close(&h->system_sleep_opaque);
 
@@ -1619,6 +1968,8 @@ int hb_global_init()
 #ifdef USE_QSV
     hb_register(&hb_encqsv);
 #endif
+    hb_register(&hb_encchunk);
+    hb_register(&hb_decchunk);
     
     hb_common_global_init();
 
@@ -1627,6 +1978,11 @@ int hb_global_init()
      */
     hb_buffer_pool_init();
 
+    /*
+     * Initialise the worker pool shared by all tasksets
+     */
+    taskset_pool_init();
+
     return result;
 }
 
@@ -1639,6 +1995,8 @@ void hb_global_close()
     DIR * dir;
     struct dirent * entry;
     
+    taskset_pool_close();
+
     /* Find and remove temp folder */
     memset( dirname, 0, 1024 );
     hb_get_temporary_directory( dirname );
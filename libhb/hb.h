@@ -50,6 +50,10 @@ void          hb_scan( hb_handle_t *, const char * path,
                        int title_index, int preview_count,
                        int store_previews, uint64_t min_duration );
 void          hb_scan_stop( hb_handle_t * );
+/* hb_scan_cache_enable()
+   Enable or disable reusing the scan results of unchanged files from
+   previous scans. Enabled by default. */
+void          hb_scan_cache_enable( int enable );
 uint64_t      hb_first_duration( hb_handle_t * );
 
 /* hb_get_titles()
@@ -71,6 +75,19 @@ int           hb_save_preview( hb_handle_t * h, int title, int preview,
                                hb_buffer_t *buf );
 hb_buffer_t * hb_read_preview( hb_handle_t * h, hb_title_t *title,
                                int preview );
+/* hb_set_preview_cache_size()
+   Previews are kept in memory up to this many bytes, the least recently
+   used ones go to temporary files.  0 keeps all of them in files. */
+void          hb_set_preview_cache_size( hb_handle_t * h, int64_t size );
+/* hb_set_trace_file()
+   Writes a Chrome trace (chrome://tracing, ui.perfetto.dev) of when every
+   pipeline stage worked on each buffer of the jobs started afterwards. */
+void          hb_set_trace_file( hb_handle_t * h, const char * path );
+/* hb_set_stage_cpu_time()
+   Measures the CPU time of every pipeline stage of the jobs started
+   afterwards.  Costs a system call per buffer, on by default when
+   tracing. */
+void          hb_set_stage_cpu_time( hb_handle_t * h, int enable );
 hb_image_t  * hb_get_preview2(hb_handle_t * h, int title_idx, int picture,
                               hb_geometry_settings_t *geo, int deinterlace);
 void          hb_set_anamorphic_size2(hb_geometry_t *src_geo,
@@ -80,6 +80,69 @@ static json_t* hb_state_to_dict( hb_state_t * state)
     return dict;
 }
 
+/**
+ * Convert the stage statistics of the running job to a jansson array
+ * @param h - Pointer to an hb_handle_t hb instance
+ */
+static json_t* hb_stages_to_array( hb_handle_t * h )
+{
+    hb_stage_stats_t *stats = NULL;
+    json_t *array = json_array();
+    json_error_t error;
+    int ii, count, size = 0;
+
+    // Stages can start between the calls, retry until they all fit
+    while ((count = hb_get_stage_stats(h, stats, size)) > size)
+    {
+        hb_stage_stats_t *tmp;
+
+        size = count + 8;
+        tmp = realloc(stats, size * sizeof(hb_stage_stats_t));
+        if (tmp == NULL)
+        {
+            hb_error("hb_stages_to_array: out of memory");
+            count = size = 0;
+            break;
+        }
+        stats = tmp;
+    }
+    for (ii = 0; ii < count; ii++)
+    {
+        json_t *stage = json_pack_ex(&error, 0,
+            "{s:o, s:o, s:o, s:o, s:o, s:o, s:o}",
+            "Name",     json_string(stats[ii].name),
+            "Busy",     json_real(stats[ii].busy / 1e6),
+            "WaitIn",   json_real(stats[ii].wait_in / 1e6),
+            "WaitOut",  json_real(stats[ii].wait_out / 1e6),
+            "Cpu",      json_real(MAX(stats[ii].cpu, 0) / 1e6),
+            "Frames",   json_integer(stats[ii].frames),
+            "Bytes",    json_integer(stats[ii].bytes));
+        if (stage == NULL)
+        {
+            hb_error("json pack failure: %s", error.text);
+            continue;
+        }
+        json_array_append_new(array, stage);
+    }
+    free(stats);
+    return array;
+}
+
+/**
+ * Get the statistics of the running job's pipeline stages, see
+ * hb_stage_stats_t.  Unlike hb_get_state_json() this leaves the state
+ * alone, so it can be polled alongside hb_get_state().
+ * @param h - Pointer to an hb_handle_t hb instance
+ */
+char* hb_get_stages_json( hb_handle_t * h )
+{
+    json_t *array = hb_stages_to_array(h);
+    char *json_stages = json_dumps(array, JSON_INDENT(4)|JSON_PRESERVE_ORDER);
+    json_decref(array);
+
+    return json_stages;
+}
+
 /**
  * Get the current state of an hb instance as a json string
  * @param h - Pointer to an hb_handle_t hb instance
@@ -91,6 +154,13 @@ char* hb_get_state_json( hb_handle_t * h )
     hb_get_state(h, &state);
     json_t *dict = hb_state_to_dict(&state);
 
+    // Where the running job spends its time, seconds per stage
+    json_t *working = json_object_get(dict, "Working");
+    if (working != NULL)
+    {
+        json_object_set_new(working, "Stages", hb_stages_to_array(h));
+    }
+
     char *json_state = json_dumps(dict, JSON_INDENT(4)|JSON_PRESERVE_ORDER);
     json_decref(dict);
 
@@ -483,6 +553,11 @@ char* hb_job_to_json( const hb_job_t * job )
         json_object_set_new(video_dict, "Turbo",
                             json_boolean(job->fastfirstpass));
     }
+    if (job->chunk_count > 1)
+    {
+        json_object_set_new(video_dict, "Chunks",
+                            json_integer(job->chunk_count));
+    }
     if (job->encoder_preset != NULL)
     {
         json_object_set_new(video_dict, "Preset",
@@ -508,6 +583,32 @@ char* hb_job_to_json( const hb_job_t * job )
         json_object_set_new(video_dict, "Options",
                             json_string(job->encoder_options));
     }
+    if (hb_list_count(job->list_rendition) > 0)
+    {
+        json_t *rendition_list = json_array();
+        for (ii = 0; ii < hb_list_count(job->list_rendition); ii++)
+        {
+            json_t *rendition_dict;
+            hb_rendition_t *rendition = hb_list_item(job->list_rendition, ii);
+
+            rendition_dict = json_pack_ex(&error, 0, "{s:o, s:o, s:o}",
+                                "File",     json_string(rendition->file),
+                                "Width",    json_integer(rendition->width),
+                                "Height",   json_integer(rendition->height));
+            if (rendition->vquality >= 0)
+            {
+                json_object_set_new(rendition_dict, "Quality",
+                                    json_real(rendition->vquality));
+            }
+            else
+            {
+                json_object_set_new(rendition_dict, "Bitrate",
+                                    json_integer(rendition->vbitrate));
+            }
+            json_array_append_new(rendition_list, rendition_dict);
+        }
+        json_object_set_new(video_dict, "Renditions", rendition_list);
+    }
     json_t *meta_dict = json_object_get(dict, "MetaData");
     if (job->metadata->name != NULL)
     {
@@ -716,8 +817,8 @@ hb_job_t* hb_json_to_job( hb_handle_t * h, const char * json_job )
     // PAR {Num, Den}
     "s?{s:i, s:i},"
     // Video {Codec, Quality, Bitrate, Preset, Tune, Profile, Level,
-    //        Options, TwoPass, Turbo, ColorMatrixCode}
-    "s:{s:i, s?f, s?i, s?s, s?s, s?s, s?s, s?s, s?b, s?b, s?i},"
+    //        Options, TwoPass, Turbo, ColorMatrixCode, Chunks}
+    "s:{s:i, s?f, s?i, s?s, s?s, s?s, s?s, s?s, s?b, s?b, s?i, s?i},"
     // Audio {CopyMask, FallbackEncoder}
     "s?{s?i, s?i},"
     // Subtitle {Search {Enable, Forced, Default, Burn}}
@@ -762,6 +863,7 @@ hb_job_t* hb_json_to_job( hb_handle_t * h, const char * json_job )
             "TwoPass",              unpack_b(&job->twopass),
             "Turbo",                unpack_b(&job->fastfirstpass),
             "ColorMatrixCode",      unpack_i(&job->color_matrix_code),
+            "Chunks",               unpack_i(&job->chunk_count),
         "Audio",
             "CopyMask",             unpack_i(&job->acodec_copy_mask),
             "FallbackEncoder",      unpack_i(&job->acodec_fallback),
@@ -1056,6 +1158,58 @@ hb_job_t* hb_json_to_job( hb_handle_t * h, const char * json_job )
             }
         }
     }
+
+    // process rendition list
+    json_t * rendition_list = NULL;
+    result = json_unpack_ex(dict, &error, 0, "{s:{s?o}}",
+                            "Video", "Renditions", unpack_o(&rendition_list));
+    if (result < 0)
+    {
+        hb_error("json unpack failure: %s", error.text);
+        hb_job_close(&job);
+        return NULL;
+    }
+    if (json_is_array(rendition_list))
+    {
+        int ii;
+        json_t *rendition_dict;
+        json_array_foreach(rendition_list, ii, rendition_dict)
+        {
+            hb_rendition_t *rendition;
+            char *file = NULL;
+            int width = 0, height = 0;
+            double quality = -1.0;
+            int bitrate = 0;
+
+            result = json_unpack_ex(rendition_dict, &error, 0,
+                                    "{s:s, s:i, s:i, s?f, s?i}",
+                                    "File",     unpack_s(&file),
+                                    "Width",    unpack_i(&width),
+                                    "Height",   unpack_i(&height),
+                                    "Quality",  unpack_f(&quality),
+                                    "Bitrate",  unpack_i(&bitrate));
+            if (result < 0)
+            {
+                hb_error("json unpack failure: %s", error.text);
+                hb_job_close(&job);
+                return NULL;
+            }
+            rendition = hb_job_add_rendition(job, file, width, height);
+            // Without rate control settings of its own, a rendition
+            // uses the job's
+            if (rendition != NULL &&
+                json_object_get(rendition_dict, "Quality") != NULL)
+            {
+                rendition->vquality = quality;
+            }
+            else if (rendition != NULL &&
+                     json_object_get(rendition_dict, "Bitrate") != NULL)
+            {
+                rendition->vquality = -1.0;
+                rendition->vbitrate = bitrate;
+            }
+        }
+    }
     json_decref(dict);
 
     return job;
@@ -35,12 +35,91 @@ void hb_list_empty( hb_list_t ** );
 hb_title_t * hb_title_init( char * dvd, int index );
 void         hb_title_close( hb_title_t ** );
 
+/***********************************************************************
+ * trace.c
+ **********************************************************************/
+typedef struct hb_trace_s hb_trace_t;
+
+hb_trace_t * hb_trace_open( const char * path );
+void         hb_trace_close( hb_trace_t ** );
+int          hb_trace_process( hb_trace_t *, const char * name );
+int          hb_trace_thread( hb_trace_t *, int pid, const char * name );
+void         hb_trace_event( hb_trace_t *, int pid, int tid, const char * name,
+                             const char * cat, uint64_t start, uint64_t end,
+                             int64_t sequence, int64_t pts );
+
 /***********************************************************************
  * hb.c
  **********************************************************************/
 int  hb_get_pid( hb_handle_t * );
 void hb_set_state( hb_handle_t *, hb_state_t * );
 
+/*
+ * Where a pipeline stage (the thread of a work object or filter) spent
+ * its time, in microseconds, and the buffers and bytes it took in.
+ * Only the stage's thread updates it.
+ */
+typedef struct
+{
+    const char * name;
+    int64_t      busy;      // in the work function
+    int64_t      wait_in;   // waiting for a buffer to work on
+    int64_t      wait_out;  // waiting for room in the output fifo
+    int64_t      frames;
+    int64_t      bytes;
+    int64_t      cpu;       // thread CPU time up to the last buffer taken in
+    int          measure_cpu; // 'cpu' is only kept when traced or enabled
+                              // with hb_set_stage_cpu_time()
+
+    // Timeline, see hb_set_trace_file()
+    hb_trace_t * trace;
+    int          trace_pid;
+    int          trace_tid;
+} hb_stage_stats_t;
+
+// The counters only have one writer but are stored atomically so
+// hb_get_stage_stats() can read them while the job runs.
+// Adds the time since 'start' to 'counter', returns the current time.
+static inline uint64_t hb_stage_lap( int64_t * counter, uint64_t start )
+{
+    uint64_t now = hb_get_time_us();
+
+    __atomic_store_n( counter, *counter + (int64_t)( now - start ),
+                      __ATOMIC_RELAXED );
+    return now;
+}
+
+static inline void hb_stage_count( hb_stage_stats_t * stats, int size )
+{
+    __atomic_store_n( &stats->frames, stats->frames + 1, __ATOMIC_RELAXED );
+    __atomic_store_n( &stats->bytes, stats->bytes + size, __ATOMIC_RELAXED );
+    if ( stats->measure_cpu )
+    {
+        // A system call, too slow to make for every buffer of every job
+        __atomic_store_n( &stats->cpu, hb_get_thread_cpu_us(),
+                          __ATOMIC_RELAXED );
+    }
+}
+
+// Adds the time from 'start' to 'end' spent on the buffer with the given
+// sequence number and start time to the stage's timeline, if traced
+static inline void hb_stage_trace( hb_stage_stats_t * stats, const char * cat,
+                                   uint64_t start, uint64_t end,
+                                   int64_t sequence, int64_t pts )
+{
+    if ( stats->trace != NULL )
+    {
+        hb_trace_event( stats->trace, stats->trace_pid, stats->trace_tid,
+                        stats->name, cat, start, end, sequence, pts );
+    }
+}
+
+void hb_stage_register( hb_handle_t *, hb_stage_stats_t * );
+void hb_stage_close( hb_handle_t *, hb_stage_stats_t * );
+int  hb_get_stage_stats( hb_handle_t *, hb_stage_stats_t * stats, int count );
+hb_trace_t * hb_get_trace( hb_handle_t * );
+int  hb_get_stage_cpu_time( hb_handle_t * );
+
 /***********************************************************************
  * fifo.c
  **********************************************************************/
@@ -147,22 +226,48 @@ struct hb_buffer_s
     //   associated video packets.
     hb_buffer_t * sub;
 
+    // References made by hb_buffer_ref():
+    //   'shared' is the buffer whose data a reference points to.  'refs'
+    //   counts the references that are still open besides the buffer
+    //   itself, the last one of them to be closed returns the data to
+    //   the pool.  Shared data is read-only.
+    hb_buffer_t * shared;
+    int           refs;
+
     // Packets in a list:
     //   the next packet in the list
     hb_buffer_t * next;
 };
 
+/*
+ * Buffer pool usage counters, accumulated over all threads since the
+ * last hb_buffer_pool_free().
+ */
+typedef struct hb_buffer_pool_stats_s
+{
+    int           buffer_size;
+    uint64_t      hits;     // allocations served by a thread's magazine
+    uint64_t      refills;  // magazine refills from the shared pool
+    uint64_t      misses;   // allocations that had to malloc
+    uint64_t      spills;   // full magazines returned to the shared pool
+    uint64_t      frees;    // buffers freed because the shared pool was full
+} hb_buffer_pool_stats_t;
+
 void hb_buffer_pool_init( void );
 void hb_buffer_pool_free( void );
+int  hb_buffer_pool_get_stats( hb_buffer_pool_stats_t * stats, int count );
 
 hb_buffer_t * hb_buffer_init( int size );
 hb_buffer_t * hb_frame_buffer_init( int pix_fmt, int w, int h);
+int           hb_frame_buffer_crop( hb_buffer_t * b, int top, int left,
+                                    int w, int h );
 void          hb_buffer_init_planes( hb_buffer_t * b );
 void          hb_buffer_realloc( hb_buffer_t *, int size );
 void          hb_video_buffer_realloc( hb_buffer_t * b, int w, int h );
 void          hb_buffer_reduce( hb_buffer_t * b, int size );
 void          hb_buffer_close( hb_buffer_t ** );
 hb_buffer_t * hb_buffer_dup( const hb_buffer_t * src );
+hb_buffer_t * hb_buffer_ref( hb_buffer_t * src );
 int           hb_buffer_copy( hb_buffer_t * dst, const hb_buffer_t * src );
 void          hb_buffer_swap_copy( hb_buffer_t *src, hb_buffer_t *dst );
 void          hb_buffer_move_subs( hb_buffer_t * dst, hb_buffer_t * src );
@@ -170,6 +275,10 @@ hb_image_t  * hb_image_init(int pix_fmt, int width, int height);
 hb_image_t  * hb_buffer_to_image(hb_buffer_t *buf);
 
 hb_fifo_t   * hb_fifo_init( int capacity, int thresh );
+hb_fifo_t   * hb_fifo_init_spsc( int capacity, int thresh );
+void          hb_fifo_set_adaptive( hb_fifo_t * f, const char * name,
+                                    int max_capacity, int64_t memory_budget );
+void          hb_fifo_log_stats( hb_fifo_t * f );
 int           hb_fifo_size( hb_fifo_t * );
 int           hb_fifo_size_bytes( hb_fifo_t * );
 int           hb_fifo_is_full( hb_fifo_t * );
@@ -261,6 +370,46 @@ hb_work_object_t * hb_muxer_init( hb_job_t * );
 hb_work_object_t * hb_get_work( int );
 hb_work_object_t * hb_codec_decoder( int );
 hb_work_object_t * hb_codec_encoder( int );
+hb_work_object_t * hb_video_encoder( int );
+void               hb_work_run_job( hb_job_t * );
+
+/***********************************************************************
+ * chunk.c
+ **********************************************************************/
+typedef struct hb_chunk_s hb_chunk_t;
+
+int                hb_chunk_init( hb_job_t * job );
+void               hb_chunk_close( hb_job_t * job );
+hb_work_object_t * hb_chunk_writer_init( hb_job_t * job );
+
+/***********************************************************************
+ * rendition.c
+ **********************************************************************/
+typedef struct hb_rendition_private_s hb_rendition_private_t;
+
+hb_work_object_t * hb_rendition_fanout_init( hb_job_t * job );
+void               hb_rendition_fanout_close( hb_job_t * job );
+
+/***********************************************************************
+ * writebehind.c
+ **********************************************************************/
+typedef struct hb_write_behind_s hb_write_behind_t;
+
+hb_write_behind_t * hb_write_behind_open( const char * path, int64_t budget );
+int                 hb_write_behind_write( hb_write_behind_t *, int64_t pos,
+                                           const uint8_t * data, int size );
+int                 hb_write_behind_sync( hb_write_behind_t * );
+int                 hb_write_behind_close( hb_write_behind_t ** );
+
+/***********************************************************************
+ * scan_cache.c
+ **********************************************************************/
+typedef struct hb_scan_cache_s hb_scan_cache_t;
+
+hb_scan_cache_t * hb_scan_cache_open( const char * path, int preview_count );
+int               hb_scan_cache_apply( hb_scan_cache_t *, hb_title_t * title );
+void              hb_scan_cache_store( hb_scan_cache_t *, hb_title_t * title );
+void              hb_scan_cache_close( hb_scan_cache_t ** );
 
 /***********************************************************************
  * sync.c
@@ -427,7 +576,10 @@ enum
     WORK_ENCAVCODEC_AUDIO,
     WORK_MUX,
     WORK_READER,
-    WORK_DECPGSSUB
+    WORK_DECPGSSUB,
+    WORK_ENCCHUNK,
+    WORK_FANOUT,
+    WORK_DECCHUNK
 };
 
 extern hb_filter_object_t hb_filter_detelecine;
@@ -7,6 +7,7 @@
    For full terms see the file COPYING file or visit http://www.gnu.org/licenses/gpl-2.0.html
  */
 
+#include <errno.h>
 #include <ogg/ogg.h>
 #include "libavformat/avformat.h"
 #include "libavutil/avstring.h"
@@ -15,6 +16,14 @@
 #include "hb.h"
 #include "lang.h"
 
+// Output is written by a thread of its own, see writebehind.c
+#define MUX_WRITE_BUFFER_SIZE  (1 << 16)
+#define MUX_WRITE_BEHIND_BUDGET (32 << 20)
+
+// Media data is moved in chunks of this size when the moov atom reserved
+// for MP4 fast start turns out too small
+#define MP4_MOVE_CHUNK_SIZE (4 << 20)
+
 struct hb_mux_data_s
 {
     enum
@@ -47,8 +56,27 @@ struct hb_mux_object_s
     hb_mux_data_t    ** tracks;
 
     int64_t             delay;
+
+    hb_write_behind_t * wb;
+    int64_t             wb_pos;
+    int64_t             wb_size;
+
+    // MP4 fast start, room reserved for the moov atom after the ftyp atom
+    int64_t             moov_reserved;
+    int64_t             ftyp_size;
+    int                 journal_on;     // hold writes, see mp4_finish_moov()
+    hb_list_t         * journal;        // list of mux_chunk_t
 };
 
+// A write held back while the MP4 trailer is written
+typedef struct
+{
+    int64_t   pos;
+    int       size;
+    int       alloc;
+    uint8_t * data;
+} mux_chunk_t;
+
 enum
 {
     META_TITLE,
@@ -107,6 +135,550 @@ static char* lookup_lang_code(int mux, char *iso639_2)
     return out;
 }
 
+static int journal_write(hb_mux_object_t *m, int64_t pos,
+                         const uint8_t *buf, int size)
+{
+    mux_chunk_t *chunk;
+    int ii;
+
+    // Writes that overwrite or extend a held chunk are merged into it,
+    // e.g. atom sizes patched after their content was written
+    for (ii = 0; ii < hb_list_count(m->journal); ii++)
+    {
+        chunk = hb_list_item(m->journal, ii);
+        if (pos >= chunk->pos && pos <= chunk->pos + chunk->size)
+        {
+            break;
+        }
+    }
+    if (ii == hb_list_count(m->journal))
+    {
+        chunk = calloc(1, sizeof(mux_chunk_t));
+        if (chunk == NULL)
+        {
+            return ENOMEM;
+        }
+        chunk->pos = pos;
+        hb_list_add(m->journal, chunk);
+    }
+    int64_t end = pos - chunk->pos + size;
+    if (end > chunk->alloc)
+    {
+        int alloc = MAX(end, 2 * chunk->alloc);
+        uint8_t *data = realloc(chunk->data, alloc);
+        if (data == NULL)
+        {
+            return ENOMEM;
+        }
+        chunk->data  = data;
+        chunk->alloc = alloc;
+    }
+    memcpy(chunk->data + pos - chunk->pos, buf, size);
+    chunk->size = MAX(chunk->size, end);
+    return 0;
+}
+
+static void journal_close(hb_mux_object_t *m)
+{
+    mux_chunk_t *chunk;
+
+    if (m->journal == NULL)
+    {
+        return;
+    }
+    while ((chunk = hb_list_item(m->journal, 0)) != NULL)
+    {
+        hb_list_rem(m->journal, chunk);
+        free(chunk->data);
+        free(chunk);
+    }
+    hb_list_close(&m->journal);
+}
+
+// Writes at a position of the file libavformat sees.  Everything after
+// the ftyp atom moves up by the room reserved for the moov atom.
+static int mux_write_at(hb_mux_object_t *m, int64_t pos,
+                        const uint8_t *buf, int size)
+{
+    int err;
+
+    if (m->moov_reserved > 0 && m->ftyp_size == 0 && pos == 0)
+    {
+        if (size >= 8 && !memcmp(buf + 4, "ftyp", 4))
+        {
+            m->ftyp_size = AV_RB32(buf);
+        }
+        else
+        {
+            hb_log("muxavformat: no ftyp atom, not reserving moov space");
+            m->moov_reserved = 0;
+        }
+    }
+    if (pos < m->ftyp_size && pos + size > m->ftyp_size)
+    {
+        int len = m->ftyp_size - pos;
+        err = hb_write_behind_write(m->wb, pos, buf, len);
+        if (err)
+        {
+            return err;
+        }
+        pos  += len;
+        buf  += len;
+        size -= len;
+    }
+    if (pos >= m->ftyp_size)
+    {
+        pos += m->moov_reserved;
+    }
+    return hb_write_behind_write(m->wb, pos, buf, size);
+}
+
+static int avformatWrite(void *opaque, uint8_t *buf, int size)
+{
+    hb_mux_object_t *m = opaque;
+    int err;
+
+    if (m->journal_on)
+    {
+        err = journal_write(m, m->wb_pos, buf, size);
+    }
+    else
+    {
+        err = mux_write_at(m, m->wb_pos, buf, size);
+    }
+    if (err)
+    {
+        return AVERROR(err);
+    }
+    m->wb_pos += size;
+    if (m->wb_pos > m->wb_size)
+    {
+        m->wb_size = m->wb_pos;
+    }
+    return size;
+}
+
+static int64_t avformatSeek(void *opaque, int64_t offset, int whence)
+{
+    hb_mux_object_t *m = opaque;
+
+    switch (whence & ~AVSEEK_FORCE)
+    {
+        case AVSEEK_SIZE:
+            return m->wb_size;
+        case SEEK_SET:
+            m->wb_pos = offset;
+            break;
+        case SEEK_CUR:
+            m->wb_pos += offset;
+            break;
+        case SEEK_END:
+            m->wb_pos = m->wb_size + offset;
+            break;
+        default:
+            return AVERROR(EINVAL);
+    }
+    return m->wb_pos;
+}
+
+static int avformatOpenIO(hb_mux_object_t *m, const char *filename)
+{
+    uint8_t *buffer;
+
+    m->wb = hb_write_behind_open(filename, MUX_WRITE_BEHIND_BUDGET);
+    if (m->wb == NULL)
+    {
+        return -1;
+    }
+    buffer = av_malloc(MUX_WRITE_BUFFER_SIZE);
+    if (buffer != NULL)
+    {
+        m->oc->pb = avio_alloc_context(buffer, MUX_WRITE_BUFFER_SIZE, 1, m,
+                                       NULL, avformatWrite, avformatSeek);
+    }
+    if (m->oc->pb == NULL)
+    {
+        av_free(buffer);
+        hb_write_behind_close(&m->wb);
+        return -1;
+    }
+    return 0;
+}
+
+// Returns 0 or the errno of the first write that failed
+static int avformatCloseIO(hb_mux_object_t *m)
+{
+    int err = 0;
+
+    if (m->oc != NULL && m->oc->pb != NULL)
+    {
+        avio_flush(m->oc->pb);
+        av_freep(&m->oc->pb->buffer);
+        av_freep(&m->oc->pb);
+    }
+    if (m->wb != NULL)
+    {
+        err = hb_write_behind_close(&m->wb);
+    }
+    return err;
+}
+
+// Copies the atoms in 'in' to 'out' (which must have room for twice
+// 'size' bytes), adding 'shift' to the chunk offsets of the sample tables.
+// Offsets that no longer fit in 32 bits turn stco atoms into co64 atoms.
+// Returns the size of the copy or -1 if the atoms can't be parsed.
+static int64_t mp4_copy_atoms(const uint8_t *in, int64_t size, uint8_t *out,
+                              int64_t shift)
+{
+    int64_t pos = 0, len = 0;
+
+    while (pos < size)
+    {
+        const uint8_t *atom = in + pos;
+        const uint8_t *type = atom + 4;
+        int64_t atom_size, count, ii;
+
+        if (size - pos < 8)
+        {
+            return -1;
+        }
+        atom_size = AV_RB32(atom);
+        if (atom_size < 8 || atom_size > size - pos)
+        {
+            return -1;
+        }
+        if (!memcmp(type, "moov", 4) || !memcmp(type, "trak", 4) ||
+            !memcmp(type, "mdia", 4) || !memcmp(type, "minf", 4) ||
+            !memcmp(type, "stbl", 4))
+        {
+            int64_t child = mp4_copy_atoms(atom + 8, atom_size - 8,
+                                           out + len + 8, shift);
+            if (child < 0 || child + 8 > UINT32_MAX)
+            {
+                return -1;
+            }
+            AV_WB32(out + len, child + 8);
+            memcpy(out + len + 4, type, 4);
+            len += child + 8;
+        }
+        else if (!memcmp(type, "stco", 4) || !memcmp(type, "co64", 4))
+        {
+            int wide = !memcmp(type, "co64", 4);
+            int in_width = wide ? 8 : 4;
+
+            if (atom_size < 16)
+            {
+                return -1;
+            }
+            count = AV_RB32(atom + 12);
+            if (16 + count * in_width > atom_size)
+            {
+                return -1;
+            }
+            for (ii = 0; ii < count && !wide; ii++)
+            {
+                wide = AV_RB32(atom + 16 + 4 * ii) + shift > UINT32_MAX;
+            }
+            AV_WB32(out + len, 16 + count * (wide ? 8 : 4));
+            memcpy(out + len + 4, wide ? "co64" : "stco", 4);
+            memcpy(out + len + 8, atom + 8, 8);
+            for (ii = 0; ii < count; ii++)
+            {
+                int64_t offset = in_width == 8 ? AV_RB64(atom + 16 + 8 * ii) :
+                                                 AV_RB32(atom + 16 + 4 * ii);
+                if (wide)
+                    AV_WB64(out + len + 16 + 8 * ii, offset + shift);
+                else
+                    AV_WB32(out + len + 16 + 4 * ii, offset + shift);
+            }
+            len += 16 + count * (wide ? 8 : 4);
+        }
+        else
+        {
+            memcpy(out + len, atom, atom_size);
+            len += atom_size;
+        }
+        pos += atom_size;
+    }
+    return len;
+}
+
+static int mp4_file_write(FILE *file, int64_t pos, const void *data,
+                          int64_t size)
+{
+    errno = 0;
+    if (fseeko(file, pos, SEEK_SET) != 0 ||
+        fwrite(data, 1, size, file) != size)
+    {
+        return errno ? errno : EIO;
+    }
+    return 0;
+}
+
+// Moves [start, end) of the file up by 'delta' bytes, or down if negative
+static int mp4_move_data(FILE *file, int64_t start, int64_t end, int64_t delta)
+{
+    uint8_t *buf = malloc(MP4_MOVE_CHUNK_SIZE);
+    int64_t done = 0;
+    int err = 0;
+
+    if (buf == NULL)
+    {
+        return ENOMEM;
+    }
+    // Moving up goes back to front and moving down front to back, so
+    // nothing is overwritten before it is moved
+    while (done < end - start && !err)
+    {
+        int len = MIN(end - start - done, MP4_MOVE_CHUNK_SIZE);
+        int64_t pos = delta > 0 ? end - done - len : start + done;
+        done += len;
+        errno = 0;
+        if (fseeko(file, pos, SEEK_SET) != 0 ||
+            fread(buf, 1, len, file) != len)
+        {
+            err = errno ? errno : EIO;
+            break;
+        }
+        err = mp4_file_write(file, pos + delta, buf, len);
+    }
+    free(buf);
+    return err;
+}
+
+/*
+ * Used when the moov atom can't be put in front of the media data.  The
+ * media data is moved back down to where libavformat's offsets expect it
+ * and the moov is written unchanged after it, as if no room had been
+ * reserved.  What is left of the old end of the file becomes a free atom.
+ */
+static int mp4_moov_at_end(FILE *file, int64_t ftyp, int64_t reserved,
+                           int64_t data_end, const mux_chunk_t *moov,
+                           int64_t moov_size)
+{
+    int64_t end = moov->pos + moov_size, file_end = data_end + reserved;
+    uint8_t free_atom[16] = { 0 };
+    int err;
+
+    hb_log("muxavformat: writing moov atom at the end of the file");
+    err = mp4_move_data(file, ftyp + reserved, data_end + reserved,
+                        -reserved);
+    if (!err)
+    {
+        err = mp4_file_write(file, moov->pos, moov->data, moov_size);
+    }
+    if (!err && end < file_end)
+    {
+        // A free atom takes at least 8 bytes, so a smaller leftover
+        // grows the file
+        int64_t size = file_end - end;
+        if (size < 8)
+        {
+            size += 8;
+        }
+        AV_WB32(free_atom, size);
+        memcpy(free_atom + 4, "free", 4);
+        err = mp4_file_write(file, end, free_atom,
+                             size <= sizeof(free_atom) ? size : 8);
+    }
+    return err;
+}
+
+/*
+ * Puts the moov atom libavformat wrote at the end of the file into the
+ * room reserved for it after the ftyp atom, with its chunk offsets moved
+ * to where the media data really is, and marks what is left of the room
+ * as a free atom.  If the moov doesn't fit, the media data is moved up to
+ * make room, the way the mp4 "faststart" flag would have done.  A moov
+ * that can't be rewritten stays at the end, see mp4_moov_at_end().
+ *
+ * 'data_end' is where the media data ended before the trailer was
+ * written (in libavformat's view of the file, see mux_write_at()).
+ */
+static int mp4_finish_moov(hb_mux_object_t *m, const char *path,
+                           int64_t data_end)
+{
+    int64_t ftyp = m->ftyp_size, reserved = m->moov_reserved;
+    int64_t moov_size = 0, len, shift;
+    mux_chunk_t *chunk, *moov = NULL;
+    uint8_t *out = NULL, free_atom[8];
+    FILE *file;
+    int ii, err = 0;
+
+    file = hb_fopen(path, "r+b");
+    if (file == NULL)
+    {
+        return errno ? errno : EIO;
+    }
+
+    // Everything but the moov goes where mux_write_at() would have put it,
+    // e.g. the size of the mdat atom
+    for (ii = 0; ii < hb_list_count(m->journal) && !err; ii++)
+    {
+        chunk = hb_list_item(m->journal, ii);
+        if (moov == NULL && chunk->size >= 8 &&
+            !memcmp(chunk->data + 4, "moov", 4) &&
+            AV_RB32(chunk->data) <= chunk->size)
+        {
+            moov = chunk;
+            moov_size = AV_RB32(chunk->data);
+            continue;
+        }
+        err = mp4_file_write(file, chunk->pos < ftyp ? chunk->pos :
+                                   chunk->pos + reserved,
+                             chunk->data, chunk->size);
+    }
+    if (err)
+    {
+        goto done;
+    }
+    if (moov == NULL)
+    {
+        hb_error("muxavformat: no moov atom written");
+        AV_WB32(free_atom, reserved);
+        memcpy(free_atom + 4, "free", 4);
+        err = mp4_file_write(file, ftyp, free_atom, 8);
+        goto done;
+    }
+
+    // The moov is only lost on I/O errors.  If it can't be rewritten for
+    // the front, it goes to the end of the file as written.
+    out = malloc(2 * moov_size);
+    if (out == NULL)
+    {
+        hb_error("muxavformat: out of memory moving moov atom");
+        err = mp4_moov_at_end(file, ftyp, reserved, data_end, moov,
+                              moov_size);
+        goto done;
+    }
+    // Find room that fits the moov exactly or with a free atom after it.
+    // Moving the offsets can widen them, so settle on the room first.
+    shift = reserved;
+    while (1)
+    {
+        len = mp4_copy_atoms(moov->data, moov_size, out, shift);
+        if (len < 0 || shift > UINT32_MAX)
+        {
+            hb_error("muxavformat: could not parse moov atom");
+            err = mp4_moov_at_end(file, ftyp, reserved, data_end, moov,
+                                  moov_size);
+            goto done;
+        }
+        if (len == shift || len + 8 <= shift)
+        {
+            break;
+        }
+        shift = len > shift ? len : len + 8;
+    }
+    if (shift > reserved)
+    {
+        hb_log("muxavformat: moov atom (%"PRId64" bytes) did not fit in "
+               "%"PRId64" bytes reserved, moving media data",
+               len, reserved);
+        err = mp4_move_data(file, ftyp + reserved, data_end + reserved,
+                            shift - reserved);
+    }
+    else
+    {
+        hb_log("muxavformat: moov atom (%"PRId64" bytes) written in "
+               "%"PRId64" bytes reserved", len, reserved);
+    }
+    if (!err)
+    {
+        err = mp4_file_write(file, ftyp, out, len);
+    }
+    if (!err && shift > len)
+    {
+        AV_WB32(free_atom, shift - len);
+        memcpy(free_atom + 4, "free", 4);
+        err = mp4_file_write(file, ftyp + len, free_atom, 8);
+    }
+
+done:
+    free(out);
+    if (fclose(file) != 0 && !err)
+    {
+        err = errno ? errno : EIO;
+    }
+    return err;
+}
+
+/*
+ * Estimates the size of the moov atom for the job from its duration and
+ * track layout, erring on the large side.  A moov that doesn't fit in the
+ * room reserved falls back to moving the media data, see avformatEnd().
+ */
+static int64_t mp4_estimate_moov(hb_job_t *job)
+{
+    hb_title_t *title = job->title;
+    int64_t duration = 0, size;
+    double frames;
+    int ii;
+
+    // Duration of the output, in 90 kHz ticks
+    if (job->pts_to_stop > 0)
+    {
+        duration = job->pts_to_stop;
+    }
+    else if (job->frame_to_stop > 0 && job->vrate.num > 0)
+    {
+        duration = (int64_t)job->frame_to_stop * 90000 *
+                   job->vrate.den / job->vrate.num;
+    }
+    else if (job->chapter_start > 0 && job->chapter_end >= job->chapter_start)
+    {
+        for (ii = job->chapter_start; ii <= job->chapter_end; ii++)
+        {
+            hb_chapter_t *chapter = hb_list_item(job->list_chapter, ii - 1);
+            if (chapter != NULL)
+            {
+                duration += chapter->duration;
+            }
+        }
+    }
+    if (duration <= 0 && title != NULL)
+    {
+        duration = title->duration;
+    }
+    if (duration <= 0)
+    {
+        return 0;
+    }
+
+    // Video: stts, stsz, stco, ctts and stss entries per frame,
+    // stts collapses for constant frame rate
+    frames = job->vrate.den > 0 ?
+             (double)duration * job->vrate.num / job->vrate.den / 90000 : 0;
+    size = frames * (job->cfr == 1 ? 20 : 28) + 1024;
+
+    // Audio: stsz and stco entries per frame
+    for (ii = 0; ii < hb_list_count(job->list_audio); ii++)
+    {
+        hb_audio_t *audio = hb_list_item(job->list_audio, ii);
+        int samplerate = audio->config.out.samplerate > 0 ?
+                         audio->config.out.samplerate :
+                         audio->config.in.samplerate;
+        int samples = audio->config.out.samples_per_frame > 0 ?
+                      audio->config.out.samples_per_frame : 1024;
+
+        frames = (double)duration * samplerate / samples / 90000;
+        size += frames * 14 + 1024;
+    }
+
+    // Subtitles: a sample and a gap every couple of seconds
+    size += hb_list_count(job->list_subtitle) *
+            (duration / (2 * 90000) * 32 + 1024);
+
+    // Chapter track
+    if (job->chapter_markers)
+    {
+        size += hb_list_count(job->list_chapter) * 64 + 1024;
+    }
+
+    size = size * 11 / 10 + 32 * 1024;
+    return MAX(size, 64 * 1024);
+}
+
 /**********************************************************************
  * avformatInit
  **********************************************************************
@@ -155,6 +727,19 @@ static int avformatInit( hb_mux_object_t * m )
 
             av_dict_set(&av_opts, "brand", "mp42", 0);
             if (job->mp4_optimize)
+            {
+                // Rather than let libavformat rewrite the whole file to
+                // move the moov atom to the front, leave room for it
+                m->moov_reserved = mp4_estimate_moov(job);
+            }
+            if (m->moov_reserved > 0)
+            {
+                hb_log("muxavformat: reserving %"PRId64" bytes for moov",
+                       m->moov_reserved);
+                m->journal = hb_list_init();
+                av_dict_set(&av_opts, "movflags", "+disable_chpl", 0);
+            }
+            else if (job->mp4_optimize)
                 av_dict_set(&av_opts, "movflags", "faststart+disable_chpl", 0);
             else
                 av_dict_set(&av_opts, "movflags", "+disable_chpl", 0);
@@ -182,11 +767,10 @@ static int avformatInit( hb_mux_object_t * m )
         goto error;
     }
     av_strlcpy(m->oc->filename, job->file, sizeof(m->oc->filename));
-    ret = avio_open2(&m->oc->pb, job->file, AVIO_FLAG_WRITE,
-                     &m->oc->interrupt_callback, NULL);
+    ret = avformatOpenIO(m, job->file);
     if( ret < 0 )
     {
-        hb_error( "avio_open2 failed, errno %d", ret);
+        hb_error( "muxavformat: could not open %s", job->file);
         goto error;
     }
 
@@ -907,6 +1491,8 @@ static int avformatInit( hb_mux_object_t * m )
 error:
     free(job->mux_data);
     job->mux_data = NULL;
+    avformatCloseIO(m);
+    journal_close(m);
     avformat_free_context(m->oc);
     *job->done_error = HB_ERROR_INIT;
     *job->die = 1;
@@ -1297,8 +1883,38 @@ static int avformatEnd(hb_mux_object_t *m)
         }
     }
 
-    av_write_trailer(m->oc);
-    avio_close(m->oc->pb);
+    // The trailer may read the file back (e.g. mp4 "faststart"), so get
+    // everything onto the disk first and write the rest straight through
+    avio_flush(m->oc->pb);
+    hb_write_behind_sync(m->wb);
+    int err;
+    if (m->moov_reserved > 0)
+    {
+        // Hold the trailer's writes back, the moov atom goes to the front
+        int64_t data_end = m->wb_size;
+        m->journal_on = 1;
+        av_write_trailer(m->oc);
+        avio_flush(m->oc->pb);
+        m->journal_on = 0;
+        err = avformatCloseIO(m);
+        if (!err)
+        {
+            err = mp4_finish_moov(m, job->file, data_end);
+        }
+    }
+    else
+    {
+        av_write_trailer(m->oc);
+        err = avformatCloseIO(m);
+    }
+    journal_close(m);
+    if (err)
+    {
+        hb_error("avformatEnd: writing %s failed with error '%s'",
+                 job->file, strerror(err));
+        *job->done_error = HB_ERROR_UNKNOWN;
+        *job->die = 1;
+    }
     avformat_free_context(m->oc);
     free(m->tracks);
     m->oc = NULL;
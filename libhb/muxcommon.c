@@ -470,8 +470,9 @@ void muxClose( hb_work_object_t * w )
         // Update state before closing muxer.  Closing the muxer
         // may initiate optimization which can take a while and
         // we want the muxing state to be visible while this is
-        // happening.
-        if( job->pass == 0 || job->pass == 2 )
+        // happening.  Renditions finish alongside the job that
+        // reports the state.
+        if( ( job->pass == 0 || job->pass == 2 ) && job->rendition == NULL )
         {
             /* Update the UI */
             hb_state_t state;
@@ -54,6 +54,10 @@
 #include "hbffmpeg.h"
 #include "taskset.h"
 
+#if HB_SIMD_X86
+#include <immintrin.h>
+#endif
+
 #define NLMEANS_STRENGTH_LUMA_DEFAULT      8
 #define NLMEANS_STRENGTH_CHROMA_DEFAULT    8
 #define NLMEANS_ORIGIN_TUNE_LUMA_DEFAULT   1
@@ -85,6 +89,7 @@
 
 #define NLMEANS_FRAMES_MAX  32
 #define NLMEANS_EXPSIZE     128
+#define NLMEANS_TILE_ROWS   32
 
 typedef struct
 {
@@ -95,8 +100,9 @@ typedef struct
     int w;
     int h;
     int border;
-    hb_lock_t *mutex;
     int prefiltered;
+    uint8_t *mem_pre_buf;   // prefilter output, kept with mem across frames
+    int      mem_size;
 } BorderedPlane;
 
 typedef struct
@@ -108,17 +114,34 @@ typedef struct
     hb_buffer_settings_t s;
 } Frame;
 
-struct PixelSum
-{
-    float weight_sum;
-    float pixel_sum;
-};
+typedef void (nlmeans_integral_row_t)(const uint8_t *p1,
+                                      const uint8_t *p2,
+                                      uint32_t *out,
+                                      const uint32_t *prev,
+                                      int w);
+
+typedef void (nlmeans_accumulate_row_t)(const uint32_t *integral_ptr1,
+                                        const uint32_t *integral_ptr2,
+                                        int n,
+                                        const uint8_t *compare,
+                                        float *weight_sum,
+                                        float *pixel_sum,
+                                        int count,
+                                        const float *exptable,
+                                        float weight_fact_table,
+                                        int diff_max);
 
 typedef struct
 {
     hb_filter_private_t *pv;
     int segment;
-    hb_buffer_t *out;
+
+    // Tile scratch, kept across frames
+    float    *weight_sum;
+    float    *pixel_sum;
+    uint32_t *integral_mem;
+    int       scratch_w;
+    int       scratch_n;
 } nlmeans_thread_arg_t;
 
 struct hb_filter_private_s
@@ -130,10 +153,21 @@ struct hb_filter_private_s
     int    nframes[3];     // temporal search depth in frames
     int    prefilter[3];   // prefilter mode, can improve weight analysis
 
+    float  exptable[3][NLMEANS_EXPSIZE];
+    float  weight_fact_table[3];
+    int    diff_max[3];
+
+    nlmeans_integral_row_t   *integral_row;
+    nlmeans_accumulate_row_t *accumulate_row;
+
     Frame      *frame;
     int         next_frame;
     int         max_frames;
 
+    // Frame being filtered, its rows are split among the tasks
+    hb_buffer_t *out;
+    int          out_nframes[3]; // 0 if the plane is already done
+
     taskset_t   taskset;
     int         thread_count;
     nlmeans_thread_arg_t **thread_data;
@@ -203,6 +237,7 @@ static void nlmeans_deborder(BorderedPlane *src,
 
 }
 
+// The bordered plane keeps its memory from frame to frame
 static void nlmeans_alloc(uint8_t *src,
                           int src_w,
                           int src_s,
@@ -213,7 +248,15 @@ static void nlmeans_alloc(uint8_t *src,
     int bw = src_w + 2 * border;
     int bh = src_h + 2 * border;
 
-    uint8_t *mem   = malloc(bw * bh * sizeof(uint8_t));
+    if (dst->mem == NULL || dst->mem_size != bw * bh)
+    {
+        free(dst->mem);
+        free(dst->mem_pre_buf);
+        dst->mem         = malloc(bw * bh * sizeof(uint8_t));
+        dst->mem_pre_buf = NULL;
+        dst->mem_size    = bw * bh;
+    }
+    uint8_t *mem   = dst->mem;
     uint8_t *image = mem + border + bw * border;
 
     // Copy main image
@@ -222,11 +265,11 @@ static void nlmeans_alloc(uint8_t *src,
         memcpy(image + y * bw, src + y * src_s, src_w);
     }
 
-    dst->mem       = mem;
-    dst->image     = image;
-    dst->w         = src_w;
-    dst->h         = src_h;
-    dst->border    = border;
+    dst->image       = image;
+    dst->w           = src_w;
+    dst->h           = src_h;
+    dst->border      = border;
+    dst->prefiltered = 0;
 
     nlmeans_border(dst->mem, dst->w, dst->h, dst->border);
     dst->mem_pre   = dst->mem;
@@ -468,10 +511,8 @@ static void nlmeans_filter_edgeboost(uint8_t *src,
 static void nlmeans_prefilter(BorderedPlane *src,
                               int filter_type)
 {
-    hb_lock(src->mutex);
     if (src->prefiltered)
     {
-        hb_unlock(src->mutex);
         return;
     }
 
@@ -491,7 +532,11 @@ static void nlmeans_prefilter(BorderedPlane *src,
         int bh         = h + 2 * border;
 
         // Duplicate plane
-        uint8_t *mem_pre = malloc(bw * bh * sizeof(uint8_t));
+        if (src->mem_pre_buf == NULL)
+        {
+            src->mem_pre_buf = malloc(bw * bh * sizeof(uint8_t));
+        }
+        uint8_t *mem_pre = src->mem_pre_buf;
         uint8_t *image_pre = mem_pre + border + bw * border;
         for (int y = 0; y < h; y++)
         {
@@ -565,24 +610,273 @@ static void nlmeans_prefilter(BorderedPlane *src,
 
     }
     src->prefiltered = 1;
-    hb_unlock(src->mutex);
 }
 
-static void nlmeans_plane(Frame *frame,
-                          int prefilter,
-                          int plane,
-                          int nframes,
-                          uint8_t *dst,
-                          int w,
-                          int s,
-                          int h,
-                          double h_param,
-                          double origin_tune,
-                          int n,
-                          int r)
+/*
+ * Integral of the squared differences between two rows, added to the
+ * previous row of the integral image.  out[-1] is set to 0.
+ */
+static void nlmeans_integral_row_c(const uint8_t *p1,
+                                   const uint8_t *p2,
+                                   uint32_t *out,
+                                   const uint32_t *prev,
+                                   int w)
+{
+    uint32_t sum = 0;
+
+    out[-1] = 0;
+    for (int x = 0; x < w; x++)
+    {
+        int diff = p1[x] - p2[x];
+        sum += diff * diff;
+        out[x] = sum + prev[x];
+    }
+}
+
+/*
+ * Weights 'count' patches of one row against the patches displaced by
+ * (dx, dy), looking up exp(-diff) in the table.
+ */
+static void nlmeans_accumulate_row_c(const uint32_t *integral_ptr1,
+                                     const uint32_t *integral_ptr2,
+                                     int n,
+                                     const uint8_t *compare,
+                                     float *weight_sum,
+                                     float *pixel_sum,
+                                     int count,
+                                     const float *exptable,
+                                     float weight_fact_table,
+                                     int diff_max)
+{
+    for (int x = 0; x < count; x++)
+    {
+        // Difference between patches
+        int diff = (uint32_t)(integral_ptr2[x+n] - integral_ptr2[x] - integral_ptr1[x+n] + integral_ptr1[x]);
+
+        // Sum pixel with weight
+        if (diff < diff_max)
+        {
+            int diffidx = diff * weight_fact_table;
+
+            //float weight = exp(-diff*weightFact);
+            float weight = exptable[diffidx];
+
+            weight_sum[x] += weight;
+            pixel_sum[x]  += weight * compare[x];
+        }
+    }
+}
+
+#if HB_SIMD_X86
+/*
+ * SSE2 version of the integral row, 8 pixels at a time.  Squares of
+ * 8 bit differences fit in 16 unsigned bits, so pmullw computes them
+ * without SSE4.1's pmulld.  There is no SSE2 accumulate kernel: it
+ * would have to look up the exp table one lane at a time, which is
+ * what the C kernel does.
+ */
+__attribute__((target("sse2")))
+static void nlmeans_integral_row_sse2(const uint8_t *p1,
+                                      const uint8_t *p2,
+                                      uint32_t *out,
+                                      const uint32_t *prev,
+                                      int w)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i carry = _mm_setzero_si128();
+    int x;
+
+    out[-1] = 0;
+    for (x = 0; x + 8 <= w; x += 8)
+    {
+        __m128i a = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)&p1[x]), zero);
+        __m128i b = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)&p2[x]), zero);
+        __m128i d = _mm_sub_epi16(a, b);
+        __m128i q = _mm_mullo_epi16(d, d);
+        __m128i lo = _mm_unpacklo_epi16(q, zero);
+        __m128i hi = _mm_unpackhi_epi16(q, zero);
+
+        lo = _mm_add_epi32(lo, _mm_slli_si128(lo, 4));
+        lo = _mm_add_epi32(lo, _mm_slli_si128(lo, 8));
+        lo = _mm_add_epi32(lo, carry);
+        carry = _mm_shuffle_epi32(lo, 0xFF);
+        hi = _mm_add_epi32(hi, _mm_slli_si128(hi, 4));
+        hi = _mm_add_epi32(hi, _mm_slli_si128(hi, 8));
+        hi = _mm_add_epi32(hi, carry);
+        carry = _mm_shuffle_epi32(hi, 0xFF);
+
+        _mm_storeu_si128((__m128i*)&out[x],
+            _mm_add_epi32(lo, _mm_loadu_si128((const __m128i*)&prev[x])));
+        _mm_storeu_si128((__m128i*)&out[x+4],
+            _mm_add_epi32(hi, _mm_loadu_si128((const __m128i*)&prev[x+4])));
+    }
+
+    uint32_t sum = _mm_cvtsi128_si32(carry);
+    for (; x < w; x++)
+    {
+        int diff = p1[x] - p2[x];
+        sum += diff * diff;
+        out[x] = sum + prev[x];
+    }
+}
+
+/*
+ * AVX2 versions of the row kernels, 8 pixels at a time.  Each lane does
+ * the same integer and single precision operations as the C versions, so
+ * the results are identical.
+ */
+__attribute__((target("avx2")))
+static void nlmeans_integral_row_avx2(const uint8_t *p1,
+                                      const uint8_t *p2,
+                                      uint32_t *out,
+                                      const uint32_t *prev,
+                                      int w)
 {
+    __m256i carry = _mm256_setzero_si256();
+    __m256i last  = _mm256_set1_epi32(7);
+    int x;
+
+    out[-1] = 0;
+    for (x = 0; x + 8 <= w; x += 8)
+    {
+        __m256i a = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)&p1[x]));
+        __m256i b = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)&p2[x]));
+        __m256i d = _mm256_sub_epi32(a, b);
+        __m256i v = _mm256_mullo_epi32(d, d);
+        __m256i t;
+
+        // Prefix sum within each 128 bit lane, then carry into the upper lane
+        v = _mm256_add_epi32(v, _mm256_slli_si256(v, 4));
+        v = _mm256_add_epi32(v, _mm256_slli_si256(v, 8));
+        t = _mm256_shuffle_epi32(v, 0xFF);
+        v = _mm256_add_epi32(v, _mm256_permute2x128_si256(t, t, 0x08));
+        v = _mm256_add_epi32(v, carry);
+        carry = _mm256_permutevar8x32_epi32(v, last);
+
+        t = _mm256_loadu_si256((const __m256i*)&prev[x]);
+        _mm256_storeu_si256((__m256i*)&out[x], _mm256_add_epi32(v, t));
+    }
+
+    uint32_t sum = _mm_cvtsi128_si32(_mm256_castsi256_si128(carry));
+    for (; x < w; x++)
+    {
+        int diff = p1[x] - p2[x];
+        sum += diff * diff;
+        out[x] = sum + prev[x];
+    }
+}
+
+__attribute__((target("avx2")))
+static void nlmeans_accumulate_row_avx2(const uint32_t *integral_ptr1,
+                                        const uint32_t *integral_ptr2,
+                                        int n,
+                                        const uint8_t *compare,
+                                        float *weight_sum,
+                                        float *pixel_sum,
+                                        int count,
+                                        const float *exptable,
+                                        float weight_fact_table,
+                                        int diff_max)
+{
+    const __m256i max  = _mm256_set1_epi32(diff_max);
+    const __m256  fact = _mm256_set1_ps(weight_fact_table);
+    int x;
+
+    for (x = 0; x + 8 <= count; x += 8)
+    {
+        __m256i diff, mask, idx;
+        __m256  weight, pixel;
+
+        diff = _mm256_sub_epi32(
+                   _mm256_loadu_si256((const __m256i*)&integral_ptr2[x+n]),
+                   _mm256_loadu_si256((const __m256i*)&integral_ptr2[x]));
+        diff = _mm256_sub_epi32(diff,
+                   _mm256_loadu_si256((const __m256i*)&integral_ptr1[x+n]));
+        diff = _mm256_add_epi32(diff,
+                   _mm256_loadu_si256((const __m256i*)&integral_ptr1[x]));
+
+        // Most patches are too different to contribute anything
+        mask = _mm256_cmpgt_epi32(max, diff);
+        if (_mm256_testz_si256(mask, mask))
+        {
+            continue;
+        }
+
+        // Patches that don't contribute get a weight of 0, which leaves
+        // the sums unchanged
+        idx    = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(diff), fact));
+        weight = _mm256_mask_i32gather_ps(_mm256_setzero_ps(), exptable, idx,
+                                          _mm256_castsi256_ps(mask), 4);
+        pixel  = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(
+                     _mm_loadl_epi64((const __m128i*)&compare[x])));
+
+        _mm256_storeu_ps(&weight_sum[x],
+                         _mm256_add_ps(_mm256_loadu_ps(&weight_sum[x]), weight));
+        _mm256_storeu_ps(&pixel_sum[x],
+                         _mm256_add_ps(_mm256_loadu_ps(&pixel_sum[x]),
+                                       _mm256_mul_ps(weight, pixel)));
+    }
+    nlmeans_accumulate_row_c(integral_ptr1 + x, integral_ptr2 + x, n,
+                             compare + x, weight_sum + x, pixel_sum + x,
+                             count - x, exptable, weight_fact_table, diff_max);
+}
+#endif // HB_SIMD_X86
+
+static int nlmeans_alloc_scratch(nlmeans_thread_arg_t *thread_data,
+                                 int w,
+                                 int n)
+{
+    if (thread_data->scratch_w >= w && thread_data->scratch_n >= n)
+    {
+        return 0;
+    }
+    w = MAX(w, thread_data->scratch_w);
+    n = MAX(n, thread_data->scratch_n);
+
+    free(thread_data->weight_sum);
+    free(thread_data->pixel_sum);
+    free(thread_data->integral_mem);
+    thread_data->scratch_w    = 0;
+    thread_data->scratch_n    = 0;
+    thread_data->weight_sum   = malloc(NLMEANS_TILE_ROWS * w * sizeof(float));
+    thread_data->pixel_sum    = malloc(NLMEANS_TILE_ROWS * w * sizeof(float));
+    thread_data->integral_mem = malloc((w + 2 * 16) * (NLMEANS_TILE_ROWS + n) *
+                                       sizeof(uint32_t));
+    if (thread_data->weight_sum   == NULL ||
+        thread_data->pixel_sum    == NULL ||
+        thread_data->integral_mem == NULL)
+    {
+        return -1;
+    }
+    thread_data->scratch_w = w;
+    thread_data->scratch_n = n;
+    return 0;
+}
+
+/*
+ * Filters the patches whose top rows are ya..yb-1, i.e. output rows
+ * ya+n_half..yb-1+n_half.  The integral image only covers the rows
+ * the tile needs, starting from 0 at row ya-1, so the patch differences
+ * are the same as with an integral of the whole plane.
+ */
+static void nlmeans_plane_tile(nlmeans_thread_arg_t *thread_data,
+                               int plane,
+                               int nframes,
+                               uint8_t *dst,
+                               int w,
+                               int s,
+                               int h,
+                               int ya,
+                               int yb)
+{
+    hb_filter_private_t *pv = thread_data->pv;
+    Frame *frame = pv->frame;
+    double origin_tune = pv->origin_tune[plane];
+    int n = pv->patch_size[plane];
+    int r = pv->range[plane];
     int n_half = (n-1) /2;
     int r_half = (r-1) /2;
+    int rows = yb - ya;
 
     // Source image
     uint8_t *src     = frame[0].plane[plane].image;
@@ -590,32 +884,23 @@ static void nlmeans_plane(Frame *frame,
     int border       = frame[0].plane[plane].border;
     int src_w        = frame[0].plane[plane].w + 2 * border;
 
-    // Allocate temporary pixel sums
-    struct PixelSum *tmp_data = calloc(w * h, sizeof(struct PixelSum));
+    // Temporary pixel sums
+    float *weight_sum = thread_data->weight_sum;
+    float *pixel_sum  = thread_data->pixel_sum;
+    memset(weight_sum, 0, rows * w * sizeof(float));
+    memset(pixel_sum,  0, rows * w * sizeof(float));
 
-    // Allocate integral image
+    // Integral image
     int integral_stride = w + 2 * 16;
-    uint32_t *integral_mem = malloc(integral_stride * (h+1) * sizeof(uint32_t));
-    uint32_t *integral     = integral_mem + integral_stride + 16;
-
-    // Precompute exponential table
-    float exptable[NLMEANS_EXPSIZE];
-    const float weight_factor       = 1.0/n/n / (h_param * h_param);
-    const float min_weight_in_table = 0.0005;
-    const float stretch             = NLMEANS_EXPSIZE / (-log(min_weight_in_table));
-    const float weight_fact_table   = weight_factor * stretch;
-    const int   diff_max            = NLMEANS_EXPSIZE / weight_fact_table;
-    for (int i = 0; i < NLMEANS_EXPSIZE; i++)
-    {
-        exptable[i] = exp(-i/stretch);
-    }
-    exptable[NLMEANS_EXPSIZE-1] = 0;
+    uint32_t *integral  = thread_data->integral_mem + integral_stride + 16;
+
+    const float *exptable         = pv->exptable[plane];
+    const float weight_fact_table = pv->weight_fact_table[plane];
+    const int   diff_max          = pv->diff_max[plane];
 
     // Iterate through available frames
     for (int f = 0; f < nframes; f++)
     {
-        nlmeans_prefilter(&frame[f].plane[plane], prefilter);
-
         // Compare image
         uint8_t *compare     = frame[f].plane[plane].image;
         uint8_t *compare_pre = frame[f].plane[plane].image_pre;
@@ -631,13 +916,15 @@ static void nlmeans_plane(Frame *frame,
                 // Apply special weight tuning to origin patch
                 if (dx == 0 && dy == 0 && f == 0)
                 {
-                    // TODO: Parallelize this
-                    for (int y = n_half; y < h-n + n_half; y++)
+                    for (int y = ya + n_half; y < yb + n_half && y < h-n + n_half; y++)
                     {
+                        float *ws = weight_sum + (y - ya - n_half)*w;
+                        float *ps = pixel_sum  + (y - ya - n_half)*w;
+
                         for (int x = n_half; x < w-n + n_half; x++)
                         {
-                            tmp_data[y*w + x].weight_sum += origin_tune;
-                            tmp_data[y*w + x].pixel_sum  += origin_tune * src[y*src_w + x];
+                            ws[x] += origin_tune;
+                            ps[x] += origin_tune * src[y*src_w + x];
                         }
                     }
                     continue;
@@ -645,69 +932,61 @@ static void nlmeans_plane(Frame *frame,
 
                 // Build integral
                 memset(integral-1 - integral_stride, 0, (w+1) * sizeof(uint32_t));
-                for (int y = 0; y < h; y++)
+                for (int y = 0; y < rows + n - 1; y++)
                 {
-                    const uint8_t *p1 = src_pre + y*src_w;
-                    const uint8_t *p2 = compare_pre + (y+dy)*compare_w + dx;
-                    uint32_t *out = integral + (y*integral_stride) - 1;
-
-                    *out++ = 0;
-
-                    for (int x = 0; x < w; x++)
-                    {
-                        int diff = *p1++ - *p2++;
-                        *out = *(out-1) + diff * diff;
-                        out++;
-                    }
-
-                    if (y > 0)
-                    {
-                        out = integral + y*integral_stride;
-
-                        for (int x = 0; x < w; x++)
-                        {
-                            *out += *(out - integral_stride);
-                            out++;
-                        }
-                    }
+                    pv->integral_row(src_pre + (ya+y)*src_w,
+                                     compare_pre + (ya+y+dy)*compare_w + dx,
+                                     integral + y*integral_stride,
+                                     integral + (y-1)*integral_stride,
+                                     w);
                 }
 
                 // Average displacement
-                // TODO: Parallelize this
-                for (int y = 0; y <= h-n; y++)
+                for (int y = 0; y < rows; y++)
                 {
-                    const uint32_t *integral_ptr1 = integral + (y  -1)*integral_stride - 1;
-                    const uint32_t *integral_ptr2 = integral + (y+n-1)*integral_stride - 1;
-
-                    for (int x = 0; x <= w-n; x++)
-                    {
-                        int xc = x + n_half;
-                        int yc = y + n_half;
-
-                        // Difference between patches
-                        int diff = (uint32_t)(integral_ptr2[n] - integral_ptr2[0] - integral_ptr1[n] + integral_ptr1[0]);
-
-                        // Sum pixel with weight
-                        if (diff < diff_max)
-                        {
-                            int diffidx = diff * weight_fact_table;
-
-                            //float weight = exp(-diff*weightFact);
-                            float weight = exptable[diffidx];
-
-                            tmp_data[yc*w + xc].weight_sum += weight;
-                            tmp_data[yc*w + xc].pixel_sum  += weight * compare[(yc+dy)*compare_w + xc + dx];
-                        }
-
-                        integral_ptr1++;
-                        integral_ptr2++;
-                    }
+                    int yc = ya + y + n_half;
+
+                    pv->accumulate_row(integral + (y  -1)*integral_stride - 1,
+                                       integral + (y+n-1)*integral_stride - 1,
+                                       n,
+                                       compare + (yc+dy)*compare_w + n_half + dx,
+                                       weight_sum + y*w + n_half,
+                                       pixel_sum  + y*w + n_half,
+                                       w-n + 1,
+                                       exptable,
+                                       weight_fact_table,
+                                       diff_max);
                 }
             }
         }
     }
 
-    // Copy edges
+    // Copy main image
+    uint8_t result;
+    for (int y = 0; y < rows; y++)
+    {
+        int yc = ya + y + n_half;
+
+        for (int x = n_half; x < w-n_half; x++)
+        {
+            result = (uint8_t)(pixel_sum[y*w + x] / weight_sum[y*w + x]);
+            *(dst + yc*s + x) = result ? result : *(src + yc*src_w + x);
+        }
+    }
+}
+
+// Copies the rows and columns that patches can't be centered on
+static void nlmeans_plane_edges(BorderedPlane *plane,
+                                uint8_t *dst,
+                                int w,
+                                int s,
+                                int h,
+                                int n)
+{
+    int n_half = (n-1) /2;
+    uint8_t *src = plane->image;
+    int src_w    = plane->w + 2 * plane->border;
+
     for (int y = 0; y < h; y++)
     {
         for (int x = 0; x < n_half; x++)
@@ -721,21 +1000,26 @@ static void nlmeans_plane(Frame *frame,
         memcpy(dst +       y*s, src - (y+1)*src_w, w);
         memcpy(dst + (h-y-1)*s, src + (y+h)*src_w, w);
     }
+}
 
-    // Copy main image
-    uint8_t result;
-    for (int y = n_half; y < h-n_half; y++)
+// Copies the source pixels of the output rows filtered from the patches
+// whose top rows are ya..yb-1, see nlmeans_plane_tile()
+static void nlmeans_copy_band(BorderedPlane *plane,
+                              uint8_t *dst,
+                              int w,
+                              int s,
+                              int n,
+                              int ya,
+                              int yb)
+{
+    int n_half = (n-1) /2;
+    uint8_t *src = plane->image;
+    int src_w    = plane->w + 2 * plane->border;
+
+    for (int y = ya + n_half; y < yb + n_half; y++)
     {
-        for (int x = n_half; x < w-n_half; x++)
-        {
-            result = (uint8_t)(tmp_data[y*w + x].pixel_sum / tmp_data[y*w + x].weight_sum);
-            *(dst + y*s + x) = result ? result : *(src + y*src_w + x);
-        }
+        memcpy(dst + y*s + n_half, src + y*src_w + n_half, w - 2*n_half);
     }
-
-    free(tmp_data);
-    free(integral_mem);
-
 }
 
 static int nlmeans_init(hb_filter_object_t *filter,
@@ -801,17 +1085,43 @@ static int nlmeans_init(hb_filter_object_t *filter,
         if (pv->max_frames < pv->nframes[c]) pv->max_frames = pv->nframes[c];
     }
 
-    pv->thread_count = hb_get_cpu_count();
-    pv->frame = calloc(pv->thread_count + pv->max_frames, sizeof(Frame));
-    for (int ii = 0; ii < pv->thread_count + pv->max_frames; ii++)
+    // Precompute exponential tables
+    for (int c = 0; c < 3; c++)
     {
-        for (int c = 0; c < 3; c++)
+        const float weight_factor       = 1.0/pv->patch_size[c]/pv->patch_size[c] / (pv->strength[c] * pv->strength[c]);
+        const float min_weight_in_table = 0.0005;
+        const float stretch             = NLMEANS_EXPSIZE / (-log(min_weight_in_table));
+        const float weight_fact_table   = weight_factor * stretch;
+        const int   diff_max            = NLMEANS_EXPSIZE / weight_fact_table;
+        for (int i = 0; i < NLMEANS_EXPSIZE; i++)
         {
-            pv->frame[ii].plane[c].mutex = hb_lock_init();
+            pv->exptable[c][i] = exp(-i/stretch);
         }
+        pv->exptable[c][NLMEANS_EXPSIZE-1] = 0;
+        pv->weight_fact_table[c] = weight_fact_table;
+        pv->diff_max[c]          = diff_max;
     }
 
-    pv->thread_data = malloc(pv->thread_count * sizeof(nlmeans_thread_arg_t*));
+    pv->integral_row   = nlmeans_integral_row_c;
+    pv->accumulate_row = nlmeans_accumulate_row_c;
+#if HB_SIMD_X86
+    if (hb_get_cpu_flags() & HB_CPU_FLAG_AVX2)
+    {
+        pv->integral_row   = nlmeans_integral_row_avx2;
+        pv->accumulate_row = nlmeans_accumulate_row_avx2;
+    }
+    else if (hb_get_cpu_flags() & HB_CPU_FLAG_SSE2)
+    {
+        pv->integral_row   = nlmeans_integral_row_sse2;
+    }
+#endif
+
+    // Only the frames searched are kept, every frame is split into
+    // rows among the tasks
+    pv->thread_count = hb_get_cpu_count();
+    pv->frame = calloc(pv->max_frames, sizeof(Frame));
+
+    pv->thread_data = calloc(pv->thread_count, sizeof(nlmeans_thread_arg_t*));
     if (taskset_init(&pv->taskset, pv->thread_count,
                      sizeof(nlmeans_thread_arg_t)) == 0)
     {
@@ -842,6 +1152,7 @@ static int nlmeans_init(hb_filter_object_t *filter,
 fail:
     taskset_fini(&pv->taskset);
     free(pv->thread_data);
+    free(pv->frame);
     free(pv);
     return -1;
 }
@@ -855,30 +1166,19 @@ static void nlmeans_close(hb_filter_object_t *filter)
         return;
     }
 
-    taskset_fini(&pv->taskset);
-    for (int c = 0; c < 3; c++)
+    for (int ii = 0; ii < pv->thread_count; ii++)
     {
-        for (int f = 0; f < pv->nframes[c]; f++)
-        {
-            if (pv->frame[f].plane[c].mem_pre != NULL &&
-                pv->frame[f].plane[c].mem_pre != pv->frame[f].plane[c].mem)
-            {
-                free(pv->frame[f].plane[c].mem_pre);
-                pv->frame[f].plane[c].mem_pre = NULL;
-            }
-            if (pv->frame[f].plane[c].mem != NULL)
-            {
-                free(pv->frame[f].plane[c].mem);
-                pv->frame[f].plane[c].mem = NULL;
-            }
-        }
+        free(pv->thread_data[ii]->weight_sum);
+        free(pv->thread_data[ii]->pixel_sum);
+        free(pv->thread_data[ii]->integral_mem);
     }
-
-    for (int ii = 0; ii < pv->thread_count + pv->max_frames; ii++)
+    taskset_fini(&pv->taskset);
+    for (int f = 0; f < pv->max_frames; f++)
     {
         for (int c = 0; c < 3; c++)
         {
-            hb_lock_close(&pv->frame[ii].plane[c].mutex);
+            free(pv->frame[f].plane[c].mem_pre_buf);
+            free(pv->frame[f].plane[c].mem);
         }
     }
 
@@ -893,62 +1193,44 @@ static void nlmeans_filter_thread(void *thread_args_v)
     nlmeans_thread_arg_t *thread_data = thread_args_v;
     hb_filter_private_t *pv = thread_data->pv;
     int segment = thread_data->segment;
+    hb_buffer_t *buf = pv->out;
 
-    hb_log("NLMeans Denoise thread started for segment %d", segment);
-
-    while (1)
+    for (int c = 0; c < 3; c++)
     {
-        // Wait until there is work to do.
-        taskset_thread_wait4start(&pv->taskset, segment);
-
-        if (taskset_thread_stop(&pv->taskset, segment))
+        if (pv->out_nframes[c] == 0)
         {
-            break;
+            continue;
         }
 
-        Frame *frame = &pv->frame[segment];
-        hb_buffer_t *buf;
-        buf = hb_frame_buffer_init(frame->fmt, frame->width, frame->height);
+        int w = buf->plane[c].width;
+        int h = buf->plane[c].height;
+        int n = pv->patch_size[c];
 
-        for (int c = 0; c < 3; c++)
+        // Split the rows patches can be centered on among the tasks
+        int rows = h - n + 1;
+        if (rows <= 0)
         {
-            if (pv->strength[c] == 0)
-            {
-                nlmeans_deborder(&frame->plane[c], buf->plane[c].data,
-                                 buf->plane[c].width, buf->plane[c].stride,
-                                 buf->plane[c].height);
-                continue;
-            }
-            if (pv->prefilter[c] & NLMEANS_PREFILTER_MODE_PASSTHRU)
-            {
-                nlmeans_prefilter(&pv->frame->plane[c], pv->prefilter[c]);
-                nlmeans_deborder(&frame->plane[c], buf->plane[c].data,
-                                 buf->plane[c].width, buf->plane[c].stride,
-                                 buf->plane[c].height);
-                continue;
-            }
-
-            // Process current plane
-            nlmeans_plane(frame,
-                          pv->prefilter[c],
-                          c,
-                          pv->nframes[c],
-                          buf->plane[c].data,
-                          buf->plane[c].width,
-                          buf->plane[c].stride,
-                          buf->plane[c].height,
-                          pv->strength[c],
-                          pv->origin_tune[c],
-                          pv->patch_size[c],
-                          pv->range[c]);
+            continue;
         }
-        buf->s = pv->frame[segment].s;
-        thread_data->out = buf;
+        int ya = rows *  segment      / pv->thread_count;
+        int yb = rows * (segment + 1) / pv->thread_count;
 
-        // Finished this segment, notify.
-        taskset_thread_complete(&pv->taskset, segment);
+        if (nlmeans_alloc_scratch(thread_data, w, n) < 0)
+        {
+            // Pass the band through unfiltered rather than leaving it
+            // uninitialized
+            hb_error("nlmeans could not allocate scratch buffers");
+            nlmeans_copy_band(&pv->frame[0].plane[c], buf->plane[c].data,
+                              w, buf->plane[c].stride, n, ya, yb);
+            continue;
+        }
+        for (int y = ya; y < yb; y += NLMEANS_TILE_ROWS)
+        {
+            nlmeans_plane_tile(thread_data, c, pv->out_nframes[c],
+                               buf->plane[c].data, w, buf->plane[c].stride, h,
+                               y, MIN(y + NLMEANS_TILE_ROWS, yb));
+        }
     }
-    taskset_thread_complete(&pv->taskset, segment);
 }
 
 static void nlmeans_add_frame(hb_filter_private_t *pv, hb_buffer_t *buf)
@@ -971,110 +1253,75 @@ static void nlmeans_add_frame(hb_filter_private_t *pv, hb_buffer_t *buf)
     pv->next_frame++;
 }
 
-static hb_buffer_t * nlmeans_filter(hb_filter_private_t *pv)
+// Filters the oldest frame against the frames that follow it
+static hb_buffer_t * nlmeans_filter_frame(hb_filter_private_t *pv)
 {
-    if (pv->next_frame < pv->max_frames + pv->thread_count)
-        return NULL;
+    Frame *frame = &pv->frame[0];
+    hb_buffer_t *buf;
+    int run = 0;
 
-    taskset_cycle(&pv->taskset);
+    buf = hb_frame_buffer_init(frame->fmt, frame->width, frame->height);
 
-    // Free buffers that are not needed for next taskset cycle
     for (int c = 0; c < 3; c++)
     {
-        for (int t = 0; t < pv->thread_count; t++)
+        pv->out_nframes[c] = 0;
+        if (pv->strength[c] == 0)
         {
-            // Release last frame in buffer
-            if (pv->frame[t].plane[c].mem_pre != NULL &&
-                pv->frame[t].plane[c].mem_pre != pv->frame[t].plane[c].mem)
-            {
-                free(pv->frame[t].plane[c].mem_pre);
-                pv->frame[t].plane[c].mem_pre = NULL;
-            }
-            if (pv->frame[t].plane[c].mem != NULL)
-            {
-                free(pv->frame[t].plane[c].mem);
-                pv->frame[t].plane[c].mem = NULL;
-            }
+            nlmeans_deborder(&frame->plane[c], buf->plane[c].data,
+                             buf->plane[c].width, buf->plane[c].stride,
+                             buf->plane[c].height);
+            continue;
         }
-    }
-    // Shift frames in buffer down
-    for (int f = 0; f < pv->max_frames; f++)
-    {
-        // Don't move the mutex!
-        Frame frame = pv->frame[f];
-        pv->frame[f] = pv->frame[f+pv->thread_count];
-        for (int c = 0; c < 3; c++)
+        if (pv->prefilter[c] & NLMEANS_PREFILTER_MODE_PASSTHRU)
         {
-            pv->frame[f].plane[c].mutex = frame.plane[c].mutex;
-            pv->frame[f+pv->thread_count].plane[c].mem_pre = NULL;
-            pv->frame[f+pv->thread_count].plane[c].mem = NULL;
+            nlmeans_prefilter(&frame->plane[c], pv->prefilter[c]);
+            nlmeans_deborder(&frame->plane[c], buf->plane[c].data,
+                             buf->plane[c].width, buf->plane[c].stride,
+                             buf->plane[c].height);
+            continue;
         }
-    }
-    pv->next_frame -= pv->thread_count;
 
-    // Collect results from taskset
-    hb_buffer_t *last = NULL, *out = NULL;
-    for (int t = 0; t < pv->thread_count; t++)
-    {
-        if (out == NULL)
-        {
-            out = last = pv->thread_data[t]->out;
-        }
-        else
+        int nframes = pv->next_frame;
+        if (pv->nframes[c] < nframes)
+            nframes = pv->nframes[c];
+
+        // Prefilter here so that the tasks don't have to coordinate
+        for (int f = 0; f < nframes; f++)
         {
-            last->next = pv->thread_data[t]->out;
-            last = pv->thread_data[t]->out;
+            nlmeans_prefilter(&pv->frame[f].plane[c], pv->prefilter[c]);
         }
+        nlmeans_plane_edges(&frame->plane[c], buf->plane[c].data,
+                            buf->plane[c].width, buf->plane[c].stride,
+                            buf->plane[c].height, pv->patch_size[c]);
+        pv->out_nframes[c] = nframes;
+        run = 1;
     }
-    return out;
+
+    if (run)
+    {
+        pv->out = buf;
+        taskset_cycle(&pv->taskset);
+        pv->out = NULL;
+    }
+    buf->s = frame->s;
+
+    // Shift frames in buffer down, the memory of the frame just
+    // filtered is reused for the next one
+    Frame done = pv->frame[0];
+    memmove(&pv->frame[0], &pv->frame[1], (pv->max_frames - 1) * sizeof(Frame));
+    pv->frame[pv->max_frames - 1] = done;
+    pv->next_frame--;
+
+    return buf;
 }
 
 static hb_buffer_t * nlmeans_filter_flush(hb_filter_private_t *pv)
 {
-    hb_buffer_t *out = NULL, *last = NULL;
+    hb_buffer_t *out = NULL, *last = NULL, *buf;
 
-    for (int f = 0; f < pv->next_frame; f++)
+    while (pv->next_frame > 0)
     {
-        Frame *frame = &pv->frame[f];
-        hb_buffer_t *buf;
-        buf = hb_frame_buffer_init(frame->fmt, frame->width, frame->height);
-
-        for (int c = 0; c < 3; c++)
-        {
-            if (pv->strength[c] == 0)
-            {
-                nlmeans_deborder(&frame->plane[c], buf->plane[c].data,
-                                 buf->plane[c].width, buf->plane[c].stride,
-                                 buf->plane[c].height);
-                continue;
-            }
-            if (pv->prefilter[c] & NLMEANS_PREFILTER_MODE_PASSTHRU)
-            {
-                nlmeans_prefilter(&pv->frame[f].plane[c], pv->prefilter[c]);
-                nlmeans_deborder(&frame->plane[c], buf->plane[c].data,
-                                 buf->plane[c].width, buf->plane[c].stride,
-                                 buf->plane[c].height);
-                continue;
-            }
-
-            int nframes = pv->next_frame - f;
-            if (pv->nframes[c] < nframes)
-                nframes = pv->nframes[c];
-            // Process current plane
-            nlmeans_plane(frame,
-                          pv->prefilter[c],
-                          c,
-                          nframes,
-                          buf->plane[c].data,
-                          buf->plane[c].width,
-                          buf->plane[c].stride,
-                          buf->plane[c].height,
-                          pv->strength[c],
-                          pv->origin_tune[c],
-                          pv->patch_size[c],
-                          pv->range[c]);
-        }
-        buf->s = frame->s;
+        buf = nlmeans_filter_frame(pv);
         if (out == NULL)
         {
             out = last = buf;
@@ -1117,7 +1364,11 @@ static int nlmeans_work(hb_filter_object_t *filter,
     }
 
     nlmeans_add_frame(pv, in);
-    *buf_out = nlmeans_filter(pv);
+    *buf_out = NULL;
+    if (pv->next_frame == pv->max_frames)
+    {
+        *buf_out = nlmeans_filter_frame(pv);
+    }
 
     return HB_FILTER_OK;
 }
@@ -194,6 +194,39 @@ uint64_t hb_get_time_us()
 #endif
 }
 
+/************************************************************************
+ * hb_get_thread_cpu_us()
+ ************************************************************************
+ * CPU time (user and system) used by the calling thread in microseconds,
+ * or -1 where the system can't tell.
+ ************************************************************************/
+int64_t hb_get_thread_cpu_us()
+{
+#if defined(SYS_MINGW)
+    FILETIME creation, exit, kernel, user;
+
+    if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user))
+    {
+        return -1;
+    }
+    // 100 ns units
+    return (int64_t)((((uint64_t)kernel.dwHighDateTime << 32) |
+                      kernel.dwLowDateTime) +
+                     (((uint64_t)user.dwHighDateTime << 32) |
+                      user.dwLowDateTime)) / 10;
+#elif defined(CLOCK_THREAD_CPUTIME_ID)
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+    {
+        return -1;
+    }
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+    return -1;
+#endif
+}
+
 /************************************************************************
  * hb_snooze()
  ************************************************************************
@@ -229,6 +262,7 @@ struct
         uint32_t buf4[12];
     };
     int count;
+    int flags;
 } hb_cpu_info;
 
 int hb_get_cpu_count()
@@ -236,6 +270,11 @@ int hb_get_cpu_count()
     return hb_cpu_info.count;
 }
 
+int hb_get_cpu_flags()
+{
+    return hb_cpu_info.flags;
+}
+
 int hb_get_cpu_platform()
 {
     return hb_cpu_info.platform;
@@ -291,6 +330,27 @@ static void init_cpu_info()
     hb_cpu_info.name     = NULL;
     hb_cpu_info.count    = init_cpu_count();
     hb_cpu_info.platform = HB_CPU_PLATFORM_UNSPECIFIED;
+    hb_cpu_info.flags    = 0;
+
+#if ARCH_X86_64 || ARCH_X86_32
+    {
+        // libavutil also checks that the OS saves the AVX registers
+        int av_flags = av_get_cpu_flags();
+
+        if (av_flags & AV_CPU_FLAG_SSE2)
+            hb_cpu_info.flags |= HB_CPU_FLAG_SSE2;
+        if (av_flags & AV_CPU_FLAG_SSSE3)
+            hb_cpu_info.flags |= HB_CPU_FLAG_SSSE3;
+        if (av_flags & AV_CPU_FLAG_SSE4)
+            hb_cpu_info.flags |= HB_CPU_FLAG_SSE4_1;
+        if (av_flags & AV_CPU_FLAG_AVX)
+            hb_cpu_info.flags |= HB_CPU_FLAG_AVX;
+#ifdef AV_CPU_FLAG_AVX2
+        if (av_flags & AV_CPU_FLAG_AVX2)
+            hb_cpu_info.flags |= HB_CPU_FLAG_AVX2;
+#endif
+    }
+#endif // ARCH_X86_64 || ARCH_X86_32
 
     if (av_get_cpu_flags() & AV_CPU_FLAG_SSE)
     {
@@ -511,6 +571,54 @@ void hb_get_temporary_directory( char path[512] )
     snprintf(path, 512, "%s/hb.%d", base, (int)getpid());
 }
 
+/************************************************************************
+ * Get a directory for HB's persistent caches
+ ************************************************************************
+ * Unlike the temporary directory this one survives the process and is
+ * shared by all HB instances of the user.  It is not created here.
+ ***********************************************************************/
+void hb_get_cache_directory( char path[512] )
+{
+    char base[512];
+    char *p;
+
+#if defined( SYS_CYGWIN ) || defined( SYS_MINGW )
+    if( (p = getenv( "LOCALAPPDATA" ) ) != NULL ||
+        (p = getenv( "APPDATA" ) ) != NULL )
+    {
+        snprintf( base, 512, "%s", p );
+    }
+    else
+    {
+        int i_size = GetTempPath( 512, base );
+        if( i_size <= 0 || i_size >= 512 )
+        {
+            if( getcwd( base, 512 ) == NULL )
+                strcpy( base, "c:" ); /* Bad fallback but ... */
+        }
+    }
+
+    while( ( p = strchr( base, '\\' ) ) )
+        *p = '/';
+#elif defined( SYS_DARWIN )
+    if( (p = getenv( "HOME" ) ) != NULL )
+        snprintf( base, 512, "%s/Library/Caches", p );
+    else
+        strcpy( base, "/tmp" );
+#else
+    if( (p = getenv( "XDG_CACHE_HOME" ) ) != NULL && p[0] == '/' )
+        snprintf( base, 512, "%s", p );
+    else if( (p = getenv( "HOME" ) ) != NULL )
+        snprintf( base, 512, "%s/.cache", p );
+    else
+        strcpy( base, "/tmp" );
+#endif
+    if( base[strlen(base)-1] == '/' )
+        base[strlen(base)-1] = '\0';
+
+    snprintf(path, 512, "%s/HandBrake", base);
+}
+
 /************************************************************************
  * Get a tempory filename for HB
  ***********************************************************************/
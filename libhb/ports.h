@@ -34,7 +34,21 @@ enum hb_cpu_platform
     HB_CPU_PLATFORM_INTEL_SLM,
     HB_CPU_PLATFORM_INTEL_HSW,
 };
+
+// instruction set extensions usable by SIMD code paths
+#define HB_CPU_FLAG_SSE2    0x0001
+#define HB_CPU_FLAG_SSSE3   0x0002
+#define HB_CPU_FLAG_SSE4_1  0x0004
+#define HB_CPU_FLAG_AVX     0x0008
+#define HB_CPU_FLAG_AVX2    0x0010
+
+// x86 intrinsics are available, code using them must still check
+// hb_get_cpu_flags() before running
+#if (ARCH_X86_64 || ARCH_X86_32) && defined(__GNUC__)
+#define HB_SIMD_X86 1
+#endif
 int         hb_get_cpu_count();
+int         hb_get_cpu_flags();
 int         hb_get_cpu_platform();
 const char* hb_get_cpu_name();
 const char* hb_get_cpu_platform_name();
@@ -46,6 +60,8 @@ const char* hb_get_cpu_platform_name();
 uint64_t hb_get_date();
 // provide time in us
 uint64_t hb_get_time_us();
+// provide the calling thread's CPU time in us, -1 if unknown
+int64_t  hb_get_thread_cpu_us();
 
 void     hb_snooze( int delay );
 int      hb_platform_init();
@@ -94,6 +110,7 @@ int hb_dvd_region(char *device, int *region_mask);
  * File utils
  ***********************************************************************/
 void hb_get_temporary_directory( char path[512] );
+void hb_get_cache_directory( char path[512] );
 void hb_get_tempory_filename( hb_handle_t *, char name[1024],
                               char * fmt, ... );
 
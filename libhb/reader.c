@@ -43,6 +43,9 @@ struct hb_work_private_s
     hb_dvd_t     * dvd;
     hb_stream_t  * stream;
 
+    hb_stage_stats_t * stats;
+    uint64_t           stage_time;
+
     stream_timing_t *stream_timing;
     int64_t        scr_offset;
     hb_psdemux_t   demux;
@@ -195,8 +198,17 @@ static void hb_reader_close( hb_work_object_t * w )
     free( r );
 }
 
-static void push_buf( const hb_work_private_t *r, hb_fifo_t *fifo, hb_buffer_t *buf )
+static void push_buf( hb_work_private_t *r, hb_fifo_t *fifo, hb_buffer_t *buf )
 {
+    int64_t  sequence = buf->sequence, pts = buf->s.start;
+    uint64_t start = r->stage_time;
+
+    // Everything since the last push was reading and demuxing
+    r->stage_time = hb_stage_lap( &r->stats->busy, r->stage_time );
+    hb_stage_count( r->stats, buf->size );
+    hb_stage_trace( r->stats, "work", start, r->stage_time, sequence, pts );
+    start = r->stage_time;
+
     while ( !*r->die && !r->job->done )
     {
         if ( hb_fifo_full_wait( fifo ) )
@@ -210,6 +222,8 @@ static void push_buf( const hb_work_private_t *r, hb_fifo_t *fifo, hb_buffer_t *
     {
         hb_buffer_close( &buf );
     }
+    r->stage_time = hb_stage_lap( &r->stats->wait_out, r->stage_time );
+    hb_stage_trace( r->stats, "wait", start, r->stage_time, sequence, pts );
 }
 
 static int is_audio( hb_work_private_t *r, int id )
@@ -358,6 +372,9 @@ void ReadLoop( void * _w )
     int            chapter_end = r->job->chapter_end;
     uint8_t        done = 0;
 
+    r->stats      = &w->stats;
+    r->stage_time = hb_get_time_us();
+
     if (r->bd)
     {
         if( !hb_bd_start( r->bd, r->title ) )
@@ -745,6 +762,12 @@ static void UpdateState( hb_work_private_t  * r, int64_t start)
     uint64_t now;
     double avg;
 
+    if( r->job->chunk != NULL )
+    {
+        // Video segments don't report progress, their main job does
+        return;
+    }
+
     now = hb_get_date();
     if( !r->st_first )
     {
@@ -11,12 +11,29 @@
 #include "hbffmpeg.h"
 #include <ass/ass.h>
 
+#if HB_SIMD_X86
+#include <immintrin.h>
+#endif
+
+typedef void (blend_row_t)( uint8_t * dst, const uint8_t * src,
+                            const uint8_t * alpha, int width );
+
+typedef struct
+{
+    int x0, y0;
+    int x1, y1;
+} ssa_rect_t;
+
 struct hb_filter_private_s
 {
     // Common
     int               crop[4];
     int               type;
 
+    // Blend kernels, the second one takes every other alpha value
+    blend_row_t     * blend_row;
+    blend_row_t     * blend_row_x2;
+
     // VOBSUB
     hb_list_t       * sub_list; // List of active subs
 
@@ -25,6 +42,10 @@ struct hb_filter_private_s
     ASS_Renderer    * renderer;
     ASS_Track       * ssaTrack;
     uint8_t           script_initialized;
+    hb_buffer_t     * ssa_canvas;   // Composited ASS_Images, reused
+    ssa_rect_t      * ssa_rects;    // Bounding rect of each cluster
+    int             * ssa_cluster;  // Cluster of each ASS_Image
+    int               ssa_alloc;
 
     // SRT
     int               line;
@@ -92,15 +113,197 @@ hb_filter_object_t hb_filter_render_sub =
     .close         = hb_rendersub_close,
 };
 
-static void blend( hb_buffer_t *dst, hb_buffer_t *src, int left, int top )
+/*
+ * Blending computes (dst * (255 - alpha) + src * alpha) / 255 for each
+ * pixel.  The SIMD versions divide by 255 exactly using
+ * t / 255 == (t * 0x8081) >> 23, which holds for all t <= 255 * 255,
+ * so every version gives the same result as the C version.
+ */
+static void blend_row_c( uint8_t * dst, const uint8_t * src,
+                         const uint8_t * alpha, int width )
 {
-    int xx, yy;
+    int x;
+
+    for( x = 0; x < width; x++ )
+    {
+        dst[x] = ( (uint16_t)dst[x] * ( 255 - alpha[x] ) +
+                   (uint16_t)src[x] * alpha[x] ) / 255;
+    }
+}
+
+static void blend_row_x2_c( uint8_t * dst, const uint8_t * src,
+                            const uint8_t * alpha, int width )
+{
+    int x;
+
+    for( x = 0; x < width; x++ )
+    {
+        dst[x] = ( (uint16_t)dst[x] * ( 255 - alpha[x << 1] ) +
+                   (uint16_t)src[x] * alpha[x << 1] ) / 255;
+    }
+}
+
+#if HB_SIMD_X86
+__attribute__((target("sse2")))
+static inline __m128i blend_epi16_sse2( __m128i d, __m128i s, __m128i a )
+{
+    __m128i t;
+
+    t = _mm_add_epi16( _mm_mullo_epi16( d, _mm_sub_epi16(
+                                        _mm_set1_epi16( 255 ), a ) ),
+                       _mm_mullo_epi16( s, a ) );
+    return _mm_srli_epi16( _mm_mulhi_epu16( t, _mm_set1_epi16( 0x8081 ) ), 7 );
+}
+
+__attribute__((target("sse2")))
+static inline void blend_store_sse2( uint8_t * dst, const uint8_t * src,
+                                     __m128i a )
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i d    = _mm_loadu_si128( (const __m128i *)dst );
+    __m128i s    = _mm_loadu_si128( (const __m128i *)src );
+    __m128i lo, hi;
+
+    lo = blend_epi16_sse2( _mm_unpacklo_epi8( d, zero ),
+                           _mm_unpacklo_epi8( s, zero ),
+                           _mm_unpacklo_epi8( a, zero ) );
+    hi = blend_epi16_sse2( _mm_unpackhi_epi8( d, zero ),
+                           _mm_unpackhi_epi8( s, zero ),
+                           _mm_unpackhi_epi8( a, zero ) );
+    _mm_storeu_si128( (__m128i *)dst, _mm_packus_epi16( lo, hi ) );
+}
+
+// Subtitle bitmaps are mostly transparent, skip the parts that are.
+__attribute__((target("sse2")))
+static void blend_row_sse2( uint8_t * dst, const uint8_t * src,
+                            const uint8_t * alpha, int width )
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i a;
+    int x;
+
+    for( x = 0; x + 16 <= width; x += 16 )
+    {
+        a = _mm_loadu_si128( (const __m128i *)&alpha[x] );
+        if( _mm_movemask_epi8( _mm_cmpeq_epi8( a, zero ) ) != 0xFFFF )
+        {
+            blend_store_sse2( &dst[x], &src[x], a );
+        }
+    }
+    blend_row_c( &dst[x], &src[x], &alpha[x], width - x );
+}
+
+__attribute__((target("sse2")))
+static void blend_row_x2_sse2( uint8_t * dst, const uint8_t * src,
+                               const uint8_t * alpha, int width )
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i mask = _mm_set1_epi16( 0xFF );
+    __m128i a;
+    int x;
+
+    for( x = 0; x + 16 <= width; x += 16 )
+    {
+        a = _mm_packus_epi16(
+            _mm_and_si128( _mm_loadu_si128( (const __m128i *)&alpha[2*x] ),
+                           mask ),
+            _mm_and_si128( _mm_loadu_si128( (const __m128i *)&alpha[2*x+16] ),
+                           mask ) );
+        if( _mm_movemask_epi8( _mm_cmpeq_epi8( a, zero ) ) != 0xFFFF )
+        {
+            blend_store_sse2( &dst[x], &src[x], a );
+        }
+    }
+    blend_row_x2_c( &dst[x], &src[x], &alpha[2*x], width - x );
+}
+
+__attribute__((target("avx2")))
+static inline __m256i blend_epi16_avx2( __m256i d, __m256i s, __m256i a )
+{
+    __m256i t;
+
+    t = _mm256_add_epi16( _mm256_mullo_epi16( d, _mm256_sub_epi16(
+                                        _mm256_set1_epi16( 255 ), a ) ),
+                          _mm256_mullo_epi16( s, a ) );
+    return _mm256_srli_epi16( _mm256_mulhi_epu16( t,
+                                        _mm256_set1_epi16( 0x8081 ) ), 7 );
+}
+
+// The unpacks and the pack work within 128 bit lanes, so they cancel out
+__attribute__((target("avx2")))
+static inline void blend_store_avx2( uint8_t * dst, const uint8_t * src,
+                                     __m256i a )
+{
+    __m256i zero = _mm256_setzero_si256();
+    __m256i d    = _mm256_loadu_si256( (const __m256i *)dst );
+    __m256i s    = _mm256_loadu_si256( (const __m256i *)src );
+    __m256i lo, hi;
+
+    lo = blend_epi16_avx2( _mm256_unpacklo_epi8( d, zero ),
+                           _mm256_unpacklo_epi8( s, zero ),
+                           _mm256_unpacklo_epi8( a, zero ) );
+    hi = blend_epi16_avx2( _mm256_unpackhi_epi8( d, zero ),
+                           _mm256_unpackhi_epi8( s, zero ),
+                           _mm256_unpackhi_epi8( a, zero ) );
+    _mm256_storeu_si256( (__m256i *)dst, _mm256_packus_epi16( lo, hi ) );
+}
+
+__attribute__((target("avx2")))
+static void blend_row_avx2( uint8_t * dst, const uint8_t * src,
+                            const uint8_t * alpha, int width )
+{
+    __m256i a;
+    int x;
+
+    for( x = 0; x + 32 <= width; x += 32 )
+    {
+        a = _mm256_loadu_si256( (const __m256i *)&alpha[x] );
+        if( !_mm256_testz_si256( a, a ) )
+        {
+            blend_store_avx2( &dst[x], &src[x], a );
+        }
+    }
+    _mm256_zeroupper();
+    blend_row_sse2( &dst[x], &src[x], &alpha[x], width - x );
+}
+
+__attribute__((target("avx2")))
+static void blend_row_x2_avx2( uint8_t * dst, const uint8_t * src,
+                               const uint8_t * alpha, int width )
+{
+    __m256i mask = _mm256_set1_epi16( 0xFF );
+    __m256i a;
+    int x;
+
+    for( x = 0; x + 32 <= width; x += 32 )
+    {
+        a = _mm256_packus_epi16(
+            _mm256_and_si256(
+                _mm256_loadu_si256( (const __m256i *)&alpha[2*x] ), mask ),
+            _mm256_and_si256(
+                _mm256_loadu_si256( (const __m256i *)&alpha[2*x+32] ), mask ) );
+        if( !_mm256_testz_si256( a, a ) )
+        {
+            // Put the packed alpha back in pixel order
+            a = _mm256_permute4x64_epi64( a, 0xD8 );
+            blend_store_avx2( &dst[x], &src[x], a );
+        }
+    }
+    _mm256_zeroupper();
+    blend_row_x2_sse2( &dst[x], &src[x], &alpha[2*x], width - x );
+}
+#endif // HB_SIMD_X86
+
+static void blend( hb_filter_private_t * pv, hb_buffer_t *dst,
+                   hb_buffer_t *src, int left, int top )
+{
+    int yy;
     int ww, hh;
     int x0, y0;
     uint8_t *y_in, *y_out;
     uint8_t *u_in, *u_out;
     uint8_t *v_in, *v_out;
-    uint8_t *a_in, alpha;
+    uint8_t *a_in;
 
     x0 = y0 = 0;
     if( left < 0 )
@@ -128,16 +331,10 @@ static void blend( hb_buffer_t *dst, hb_buffer_t *src, int left, int top )
         y_in   = src->plane[0].data + yy * src->plane[0].stride;
         y_out   = dst->plane[0].data + ( yy + top ) * dst->plane[0].stride;
         a_in = src->plane[3].data + yy * src->plane[3].stride;
-        for( xx = x0; xx < ww; xx++ )
-        {
-            alpha = a_in[xx];
-            /*
-             * Merge the luminance and alpha with the picture
-             */
-            y_out[left + xx] =
-                ( (uint16_t)y_out[left + xx] * ( 255 - alpha ) +
-                     (uint16_t)y_in[xx] * alpha ) / 255;
-        }
+        /*
+         * Merge the luminance and alpha with the picture
+         */
+        pv->blend_row( y_out + left + x0, y_in + x0, a_in + x0, ww - x0 );
     }
 
     // Blend U & V
@@ -149,6 +346,10 @@ static void blend( hb_buffer_t *dst, hb_buffer_t *src, int left, int top )
     if( dst->plane[1].width < dst->plane[0].width )
         wshift = 1;
 
+    blend_row_t * blend_row = wshift ? pv->blend_row_x2 : pv->blend_row;
+    int cx0 = x0 >> wshift;
+    int cww = ( ww >> wshift ) - cx0;
+
     for( yy = y0 >> hshift; yy < hh >> hshift; yy++ )
     {
         u_in = src->plane[1].data + yy * src->plane[1].stride;
@@ -157,20 +358,13 @@ static void blend( hb_buffer_t *dst, hb_buffer_t *src, int left, int top )
         v_out = dst->plane[2].data + ( yy + ( top >> hshift ) ) * dst->plane[2].stride;
         a_in = src->plane[3].data + ( yy << hshift ) * src->plane[3].stride;
 
-        for( xx = x0 >> wshift; xx < ww >> wshift; xx++ )
-        {
-            alpha = a_in[xx << wshift];
-
-            // Blend averge U and alpha
-            u_out[(left >> wshift) + xx] =
-                ( (uint16_t)u_out[(left >> wshift) + xx] * ( 255 - alpha ) +
-                  (uint16_t)u_in[xx] * alpha ) / 255;
+        // Blend averge U and alpha
+        blend_row( u_out + ( left >> wshift ) + cx0, u_in + cx0,
+                   a_in + ( cx0 << wshift ), cww );
 
-            // Blend V and alpha
-            v_out[(left >> wshift) + xx] =
-                ( (uint16_t)v_out[(left >> wshift) + xx] * ( 255 - alpha ) +
-                  (uint16_t)v_in[xx] * alpha ) / 255;
-        }
+        // Blend V and alpha
+        blend_row( v_out + ( left >> wshift ) + cx0, v_in + cx0,
+                   a_in + ( cx0 << wshift ), cww );
     }
 }
 
@@ -255,7 +449,7 @@ static void ApplySub( hb_filter_private_t * pv, hb_buffer_t * buf, hb_buffer_t *
         left = sub->f.x;
     }
 
-    blend( buf, sub, left, top );
+    blend( pv, buf, sub, left, top );
 }
 
 // Assumes that the input buffer has the same dimensions
@@ -354,26 +548,110 @@ static int vobsub_work( hb_filter_object_t * filter,
     return HB_FILTER_OK;
 }
 
-static uint8_t ssaAlpha( ASS_Image *frame, int x, int y )
+/*
+ * libass returns a list of ASS_Images per frame, typically a glyph, an
+ * outline and a shadow bitmap for every line of text, which overlap.
+ * Rather than blending each of them into the picture, overlapping images
+ * are grouped into clusters and composited in order into a canvas the
+ * size of the cluster's bounding rect.  The canvas is then blended into
+ * the picture once.
+ */
+static int ssa_rect_overlap( const ssa_rect_t * a, const ssa_rect_t * b )
 {
-    unsigned frameA = ( frame->color ) & 0xff;
-    unsigned gliphA = frame->bitmap[y*frame->stride + x];
-
-    // Alpha for this pixel is the frame opacity (255 - frameA)
-    // multiplied by the gliph alfa (gliphA) for this pixel
-    unsigned alpha = (255 - frameA) * gliphA >> 8;
+    return b->x0 < b->x1 &&
+           a->x0 < b->x1 && b->x0 < a->x1 &&
+           a->y0 < b->y1 && b->y0 < a->y1;
+}
 
-    return (uint8_t)alpha;
+static void ssa_rect_union( ssa_rect_t * a, const ssa_rect_t * b )
+{
+    a->x0 = MIN( a->x0, b->x0 );
+    a->y0 = MIN( a->y0, b->y0 );
+    a->x1 = MAX( a->x1, b->x1 );
+    a->y1 = MAX( a->y1, b->y1 );
 }
 
-static hb_buffer_t * RenderSSAFrame( hb_filter_private_t * pv, ASS_Image * frame )
+// Returns the number of clusters, pv->ssa_cluster[ii] is the cluster of
+// the ii'th image or -1 if the image is empty.
+static int ssa_cluster_images( hb_filter_private_t * pv, ASS_Image * frameList )
 {
-    hb_buffer_t *sub;
-    int xx, yy;
+    ASS_Image * frame;
+    ssa_rect_t  rect;
+    int         count, ii, jj, kk, merged;
+
+    count = 0;
+    for( frame = frameList; frame; frame = frame->next )
+    {
+        count++;
+    }
+    if( count > pv->ssa_alloc )
+    {
+        free( pv->ssa_rects );
+        free( pv->ssa_cluster );
+        pv->ssa_rects   = malloc( count * sizeof( ssa_rect_t ) );
+        pv->ssa_cluster = malloc( count * sizeof( int ) );
+        if( pv->ssa_rects == NULL || pv->ssa_cluster == NULL )
+        {
+            pv->ssa_alloc = 0;
+            return 0;
+        }
+        pv->ssa_alloc = count;
+    }
+
+    // Clusters that get merged into a later one are left with an empty rect
+    kk = 0;
+    for( ii = 0, frame = frameList; frame; ii++, frame = frame->next )
+    {
+        if( frame->w <= 0 || frame->h <= 0 )
+        {
+            pv->ssa_cluster[ii] = -1;
+            continue;
+        }
+        rect.x0 = frame->dst_x + pv->crop[2];
+        rect.y0 = frame->dst_y + pv->crop[0];
+        rect.x1 = rect.x0 + frame->w;
+        rect.y1 = rect.y0 + frame->h;
+        do
+        {
+            merged = 0;
+            for( jj = 0; jj < kk; jj++ )
+            {
+                if( ssa_rect_overlap( &rect, &pv->ssa_rects[jj] ) )
+                {
+                    int ll;
+
+                    ssa_rect_union( &rect, &pv->ssa_rects[jj] );
+                    memset( &pv->ssa_rects[jj], 0, sizeof( ssa_rect_t ) );
+                    for( ll = 0; ll < ii; ll++ )
+                    {
+                        if( pv->ssa_cluster[ll] == jj )
+                            pv->ssa_cluster[ll] = kk;
+                    }
+                    merged = 1;
+                }
+            }
+        } while( merged );
+        pv->ssa_rects[kk] = rect;
+        pv->ssa_cluster[ii] = kk++;
+    }
 
+    return kk;
+}
+
+/*
+ * Composites 'frame' over the canvas, the top left of the canvas being
+ * at (x0, y0) in the picture.  Where the canvas is still transparent the
+ * frame is simply copied.  Elsewhere the colors are mixed so that blending
+ * the canvas gives the same result as blending the two images one after
+ * the other, up to rounding.
+ */
+static void ssa_composite( hb_buffer_t * canvas, ASS_Image * frame,
+                           int x0, int y0 )
+{
     unsigned r = ( frame->color >> 24 ) & 0xff;
     unsigned g = ( frame->color >> 16 ) & 0xff;
     unsigned b = ( frame->color >>  8 ) & 0xff;
+    unsigned frameA = ( frame->color ) & 0xff;
 
     int yuv = hb_rgb2yuv((r << 16) | (g << 8) | b );
 
@@ -381,62 +659,128 @@ static hb_buffer_t * RenderSSAFrame( hb_filter_private_t * pv, ASS_Image * frame
     unsigned frameV = (yuv >> 8 ) & 0xff;
     unsigned frameU = (yuv >> 0 ) & 0xff;
 
-    sub = hb_frame_buffer_init( AV_PIX_FMT_YUVA420P, frame->w, frame->h );
-    if( sub == NULL )
-        return NULL;
-
-    uint8_t *y_out, *u_out, *v_out, *a_out;
-    y_out = sub->plane[0].data;
-    u_out = sub->plane[1].data;
-    v_out = sub->plane[2].data;
-    a_out = sub->plane[3].data;
+    int left = frame->dst_x - x0;
+    int top  = frame->dst_y - y0;
+    int xx, yy;
 
     for( yy = 0; yy < frame->h; yy++ )
     {
-        for( xx = 0; xx < frame->w; xx++ )
+        int       cy      = top + yy;
+        int       chroma  = ( cy & 1 ) == 0;
+        int       cx;
+        uint8_t * gliph   = frame->bitmap + yy * frame->stride;
+        uint8_t * y_out   = canvas->plane[0].data + cy * canvas->plane[0].stride;
+        uint8_t * u_out   = canvas->plane[1].data + ( cy >> 1 ) * canvas->plane[1].stride;
+        uint8_t * v_out   = canvas->plane[2].data + ( cy >> 1 ) * canvas->plane[2].stride;
+        uint8_t * a_out   = canvas->plane[3].data + cy * canvas->plane[3].stride;
+
+        for( xx = 0, cx = left; xx < frame->w; xx++, cx++ )
         {
-            y_out[xx] = frameY;
-            if( ( yy & 1 ) == 0 )
+            // Alpha for this pixel is the frame opacity (255 - frameA)
+            // multiplied by the gliph alfa for this pixel
+            unsigned alpha = ( 255 - frameA ) * gliph[xx] >> 8;
+            unsigned ca    = a_out[cx];
+
+            if( alpha == 0 )
+                continue;
+
+            if( ca == 0 )
             {
-                u_out[xx>>1] = frameU;
-                v_out[xx>>1] = frameV;
+                y_out[cx] = frameY;
+                a_out[cx] = alpha;
+                if( chroma && ( cx & 1 ) == 0 )
+                {
+                    u_out[cx >> 1] = frameU;
+                    v_out[cx >> 1] = frameV;
+                }
+            }
+            else
+            {
+                // Weights of the canvas and the frame color, they add
+                // up to 255 times the resulting alpha
+                unsigned wc = ca * ( 255 - alpha );
+                unsigned wf = alpha * 255;
+                unsigned w  = wc + wf;
+
+                y_out[cx] = ( y_out[cx] * wc + frameY * wf + w / 2 ) / w;
+                a_out[cx] = ( w + 127 ) / 255;
+                if( chroma && ( cx & 1 ) == 0 )
+                {
+                    u_out[cx >> 1] = ( u_out[cx >> 1] * wc + frameU * wf +
+                                       w / 2 ) / w;
+                    v_out[cx >> 1] = ( v_out[cx >> 1] * wc + frameV * wf +
+                                       w / 2 ) / w;
+                }
             }
-            a_out[xx] = ssaAlpha( frame, xx, yy );;
-        }
-        y_out += sub->plane[0].stride;
-        if( ( yy & 1 ) == 0 )
-        {
-            u_out += sub->plane[1].stride;
-            v_out += sub->plane[2].stride;
         }
-        a_out += sub->plane[3].stride;
     }
-    sub->f.width = frame->w;
-    sub->f.height = frame->h;
-    sub->f.x = frame->dst_x + pv->crop[2];
-    sub->f.y = frame->dst_y + pv->crop[0];
-
-    return sub;
 }
 
 static void ApplySSASubs( hb_filter_private_t * pv, hb_buffer_t * buf )
 {
     ASS_Image *frameList;
-    hb_buffer_t *sub;
+    hb_buffer_t *canvas;
+    int count, ii, kk;
 
     frameList = ass_render_frame( pv->renderer, pv->ssaTrack,
                                   buf->s.start / 90, NULL );
     if ( !frameList )
         return;
 
-    ASS_Image *frame;
-    for (frame = frameList; frame; frame = frame->next) {
-        sub = RenderSSAFrame( pv, frame );
-        if( sub )
+    count = ssa_cluster_images( pv, frameList );
+    for( kk = 0; kk < count; kk++ )
+    {
+        ssa_rect_t * rect = &pv->ssa_rects[kk];
+        ASS_Image  * frame;
+
+        if( rect->x1 <= rect->x0 )
+            continue;
+
+        // Start the canvas on even coordinates so that its chroma
+        // lines up with the picture's
+        int x0 = rect->x0 & ~1;
+        int y0 = rect->y0 & ~1;
+        int w  = rect->x1 - x0;
+        int h  = rect->y1 - y0;
+
+        canvas = pv->ssa_canvas;
+        if( canvas == NULL ||
+            canvas->plane[0].width < w || canvas->plane[0].height < h )
         {
-            ApplySub( pv, buf, sub );
-            hb_buffer_close( &sub );
+            int alloc_w = w, alloc_h = h;
+
+            if( canvas != NULL )
+            {
+                alloc_w = MAX( w, canvas->plane[0].width );
+                alloc_h = MAX( h, canvas->plane[0].height );
+                hb_buffer_close( &pv->ssa_canvas );
+            }
+            canvas = hb_frame_buffer_init( AV_PIX_FMT_YUVA420P,
+                                           alloc_w, alloc_h );
+            pv->ssa_canvas = canvas;
+            if( canvas == NULL )
+                return;
+        }
+        for( ii = 0; ii < h; ii++ )
+        {
+            memset( canvas->plane[3].data + ii * canvas->plane[3].stride,
+                    0, w );
+        }
+
+        for( ii = 0, frame = frameList; frame; ii++, frame = frame->next )
+        {
+            if( pv->ssa_cluster[ii] == kk )
+            {
+                ssa_composite( canvas, frame, x0 - pv->crop[2],
+                                              y0 - pv->crop[0] );
+            }
         }
+
+        canvas->f.width = w;
+        canvas->f.height = h;
+        canvas->f.x = x0;
+        canvas->f.y = y0;
+        ApplySub( pv, buf, canvas );
     }
 }
 
@@ -534,6 +878,10 @@ static void ssa_close( hb_filter_object_t * filter )
         ass_renderer_done( pv->renderer );
     if ( pv->ssa )
         ass_library_done( pv->ssa );
+    if ( pv->ssa_canvas )
+        hb_buffer_close( &pv->ssa_canvas );
+    free( pv->ssa_rects );
+    free( pv->ssa_cluster );
 
     free( pv );
     filter->private_data = NULL;
@@ -860,6 +1208,21 @@ static int hb_rendersub_init( hb_filter_object_t * filter,
         return 1;
     }
 
+    pv->blend_row    = blend_row_c;
+    pv->blend_row_x2 = blend_row_x2_c;
+#if HB_SIMD_X86
+    if( hb_get_cpu_flags() & HB_CPU_FLAG_AVX2 )
+    {
+        pv->blend_row    = blend_row_avx2;
+        pv->blend_row_x2 = blend_row_x2_avx2;
+    }
+    else if( hb_get_cpu_flags() & HB_CPU_FLAG_SSE2 )
+    {
+        pv->blend_row    = blend_row_sse2;
+        pv->blend_row_x2 = blend_row_x2_sse2;
+    }
+#endif
+
     switch( pv->type )
     {
         case VOBSUB:
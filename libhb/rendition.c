@@ -0,0 +1,411 @@
+/* rendition.c
+
+   Copyright (c) 2003-2014 HandBrake Team
+   This file is part of the HandBrake source code
+   Homepage: <http://handbrake.fr/>.
+   It may be used under the terms of the GNU General Public License v2.
+   For full terms see the file COPYING file or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*
+ * Multiple outputs from one decode.
+ *
+ * The renditions of a job (job->list_rendition) are encoded from the
+ * frames at the end of the job's filter chain, so the source is read,
+ * decoded and filtered only once for all of them.
+ *
+ * The fan-out work object sits between the filters and the job's video
+ * encoder.  It hands every rendition a reference to each frame (see
+ * hb_buffer_ref()) rather than a copy and passes the frame itself on to
+ * the encoder.  Every rendition runs a branch of its own in a thread:
+ * a scaler to the rendition's size, the video encoder and a muxer that
+ * writes the rendition's file.  The branch is driven by a sub-job that
+ * carries the rendition's settings.
+ *
+ * A slow rendition holds back the job through its fifo, like any other
+ * stage of the pipeline would.
+ */
+
+#include "hb.h"
+
+// Frames a rendition may fall behind the fan-out
+#define RENDITION_FIFO      8
+#define RENDITION_FIFO_WAKE 7
+
+// Frames between the fan-out and the job's video encoder
+#define FANOUT_FIFO         4
+#define FANOUT_FIFO_WAKE    3
+
+struct hb_rendition_private_s
+{
+    int                  index;
+    hb_job_t           * job;       // sub-job with the rendition's settings
+    hb_fifo_t          * fifo_in;   // references to the filtered frames
+
+    hb_filter_object_t * scale;
+    hb_work_object_t   * encoder;
+    hb_work_object_t   * muxer;
+
+    hb_thread_t        * thread;
+    volatile int         done;
+};
+
+struct hb_work_private_s
+{
+    hb_job_t           * job;
+};
+
+/***********************************************************************
+ * Rendition set up
+ **********************************************************************/
+static hb_job_t * rendition_job_copy( hb_job_t * job, hb_rendition_t * r )
+{
+    hb_job_t * copy;
+    int64_t    num, den;
+
+    copy = calloc( sizeof( hb_job_t ), 1 );
+    memcpy( copy, job, sizeof( hb_job_t ) );
+
+    // Video only, the chapters are kept for the chapter markers
+    copy->list_chapter    = hb_chapter_list_copy( job->list_chapter );
+    copy->list_audio      = hb_list_init();
+    copy->list_subtitle   = hb_list_init();
+    copy->list_attachment = hb_list_init();
+    copy->list_filter     = hb_list_init();
+    copy->list_rendition  = hb_list_init();
+    copy->metadata        = hb_metadata_copy( job->metadata );
+
+    if( job->encoder_preset != NULL )
+        copy->encoder_preset = strdup( job->encoder_preset );
+    if( job->encoder_tune != NULL )
+        copy->encoder_tune = strdup( job->encoder_tune );
+    if( job->encoder_options != NULL )
+        copy->encoder_options = strdup( job->encoder_options );
+    if( job->encoder_profile != NULL )
+        copy->encoder_profile = strdup( job->encoder_profile );
+    if( job->encoder_level != NULL )
+        copy->encoder_level = strdup( job->encoder_level );
+    copy->file = strdup( r->file );
+
+    // Keep the display aspect of the job's output
+    copy->width  = r->width  & ~1;
+    copy->height = r->height & ~1;
+    hb_reduce64( &num, &den,
+                 (int64_t)job->par.num * job->width  * copy->height,
+                 (int64_t)job->par.den * job->height * copy->width );
+    hb_limit_rational64( &num, &den, num, den,
+                         job->vcodec == HB_VCODEC_FFMPEG_MPEG4 ? 255 : 65535 );
+    copy->par.num = num;
+    copy->par.den = den;
+
+    copy->vquality       = r->vquality;
+    copy->vbitrate       = r->vbitrate;
+    copy->twopass        = 0;
+    copy->use_opencl     = 0;
+    copy->use_hwd        = 0;
+    copy->use_decomb     = 0;
+    copy->use_detelecine = 0;
+    copy->chunk_count    = 0;
+    copy->list_chunk     = NULL;
+    copy->chunk          = NULL;
+    copy->rendition      = r;
+    copy->list_work      = NULL;
+    copy->mux_data       = NULL;
+    copy->fifo_mpeg2     = NULL;
+    copy->fifo_raw       = NULL;
+    copy->fifo_sync      = NULL;
+    copy->fifo_render    = NULL;
+    copy->fifo_mpeg4     = NULL;
+    copy->fifo_fanout    = NULL;
+    copy->done           = 0;
+    memset( &copy->config, 0, sizeof( copy->config ) );
+
+    return copy;
+}
+
+static int rendition_init( hb_job_t * job, hb_rendition_t * r, int index )
+{
+    hb_rendition_private_t * pv;
+    hb_filter_init_t         init;
+
+    pv = calloc( 1, sizeof( hb_rendition_private_t ) );
+    r->priv   = pv;
+    pv->index = index;
+    pv->job   = rendition_job_copy( job, r );
+    pv->fifo_in = hb_fifo_init_spsc( RENDITION_FIFO, RENDITION_FIFO_WAKE );
+
+    // The frames have been cropped and scaled to the job's size
+    // by the job's filters already
+    pv->scale = hb_filter_init( HB_FILTER_CROP_SCALE );
+    pv->scale->settings = hb_strdup_printf( "%d:%d:0:0:0:0",
+                                            pv->job->width, pv->job->height );
+    memset( &init, 0, sizeof( init ) );
+    init.job             = pv->job;
+    init.pix_fmt         = AV_PIX_FMT_YUV420P;
+    init.geometry.width  = job->width;
+    init.geometry.height = job->height;
+    init.geometry.par    = job->par;
+    init.vrate           = job->vrate;
+    init.cfr             = job->cfr;
+    if( pv->scale->init( pv->scale, &init ) )
+    {
+        hb_error( "rendition %d: failed to initialize scaler", index );
+        return 1;
+    }
+
+    pv->encoder = hb_video_encoder( job->vcodec );
+    if( pv->encoder == NULL )
+    {
+        hb_error( "rendition %d: no video encoder", index );
+        return 1;
+    }
+    pv->encoder->config = &pv->job->config;
+    pv->encoder->done   = &pv->done;
+    if( pv->encoder->init( pv->encoder, pv->job ) )
+    {
+        hb_error( "rendition %d: failed to initialize video encoder", index );
+        // Nothing to close
+        free( pv->encoder );
+        pv->encoder = NULL;
+        return 1;
+    }
+
+    // The muxer requires track information that's set up by the
+    // encoder init routine, so it comes last.
+    pv->muxer = hb_muxer_init( pv->job );
+    if( pv->muxer == NULL )
+    {
+        hb_error( "rendition %d: failed to initialize muxer", index );
+        return 1;
+    }
+
+    hb_log( "rendition %d: %s, %d * %d", index, pv->job->file,
+            pv->job->width, pv->job->height );
+
+    return 0;
+}
+
+static void rendition_close( hb_rendition_t * r )
+{
+    hb_rendition_private_t * pv = r->priv;
+
+    if( pv == NULL )
+        return;
+
+    if( pv->thread != NULL )
+    {
+        hb_thread_close( &pv->thread );
+    }
+    if( pv->muxer != NULL )
+    {
+        pv->muxer->close( pv->muxer );
+        free( pv->muxer );
+    }
+    if( pv->encoder != NULL )
+    {
+        pv->encoder->close( pv->encoder );
+        free( pv->encoder );
+    }
+    if( pv->scale != NULL )
+    {
+        pv->scale->close( pv->scale );
+        hb_filter_close( &pv->scale );
+    }
+    hb_fifo_close( &pv->fifo_in );
+    hb_job_close( &pv->job );
+
+    free( pv );
+    r->priv = NULL;
+}
+
+/***********************************************************************
+ * Rendition branch
+ **********************************************************************/
+/*
+ * Passes a chain of encoded frames to the muxer.  Returns the muxer's
+ * status.
+ */
+static int rendition_mux( hb_rendition_private_t * pv, hb_buffer_t * buf )
+{
+    hb_buffer_t * next;
+    int           status = HB_WORK_OK;
+
+    while( buf != NULL )
+    {
+        next = buf->next;
+        buf->next = NULL;
+        if( status == HB_WORK_OK )
+        {
+            status = pv->muxer->work( pv->muxer, &buf, NULL );
+        }
+        hb_buffer_close( &buf );
+        buf = next;
+    }
+    return status;
+}
+
+static void rendition_thread( void * _pv )
+{
+    hb_rendition_private_t * pv = _pv;
+    hb_job_t               * job = pv->job;
+    hb_buffer_t            * in, * out;
+    int                      status = HB_WORK_OK, eof = 0;
+
+    while( !*job->die && !eof && status == HB_WORK_OK )
+    {
+        in = hb_fifo_get_wait( pv->fifo_in );
+        if( in == NULL )
+            continue;
+
+        eof = in->size <= 0;
+        out = NULL;
+        pv->scale->work( pv->scale, &in, &out );
+        hb_buffer_close( &in );
+        if( out == NULL )
+            continue;
+
+        in  = out;
+        out = NULL;
+        pv->encoder->work( pv->encoder, &in, &out );
+        // Same as the work loop, chapter marks are kept if
+        // the encoder doesn't delay the frame
+        if( out != NULL && in != NULL && out->s.start == in->s.start )
+        {
+            out->s.new_chap = in->s.new_chap;
+        }
+        hb_buffer_close( &in );
+
+        status = rendition_mux( pv, out );
+    }
+    // Keeps the fan-out from waiting on the fifo, what is left
+    // in it is closed with it
+    pv->done = 1;
+    hb_deep_log( 2, "rendition %d: done", pv->index );
+}
+
+/***********************************************************************
+ * Fan-out
+ **********************************************************************/
+static void fanout_push( hb_work_object_t * w, hb_rendition_private_t * pv,
+                         hb_buffer_t * buf )
+{
+    while( !*w->done && !*w->private_data->job->die && !pv->done )
+    {
+        if( hb_fifo_full_wait( pv->fifo_in ) )
+        {
+            hb_fifo_push( pv->fifo_in, buf );
+            return;
+        }
+    }
+    hb_buffer_close( &buf );
+}
+
+static int fanoutInit( hb_work_object_t * w, hb_job_t * job )
+{
+    hb_rendition_t * r;
+    int              ii;
+
+    w->private_data = calloc( sizeof( hb_work_private_t ), 1 );
+    w->private_data->job = job;
+
+    for( ii = 0; ii < hb_list_count( job->list_rendition ); ii++ )
+    {
+        r = hb_list_item( job->list_rendition, ii );
+        if( rendition_init( job, r, ii + 1 ) )
+        {
+            return 1;
+        }
+    }
+    for( ii = 0; ii < hb_list_count( job->list_rendition ); ii++ )
+    {
+        r = hb_list_item( job->list_rendition, ii );
+        r->priv->thread = hb_thread_init( "rendition", rendition_thread,
+                                          r->priv, HB_LOW_PRIORITY );
+    }
+    return 0;
+}
+
+static int fanoutWork( hb_work_object_t * w, hb_buffer_t ** buf_in,
+                       hb_buffer_t ** buf_out )
+{
+    hb_job_t       * job = w->private_data->job;
+    hb_buffer_t    * in = *buf_in;
+    hb_rendition_t * r;
+    int              ii;
+
+    for( ii = 0; ii < hb_list_count( job->list_rendition ); ii++ )
+    {
+        r = hb_list_item( job->list_rendition, ii );
+        fanout_push( w, r->priv, hb_buffer_ref( in ) );
+    }
+
+    *buf_out = in;
+    *buf_in  = NULL;
+
+    return in->size <= 0 ? HB_WORK_DONE : HB_WORK_OK;
+}
+
+static void fanoutClose( hb_work_object_t * w )
+{
+    free( w->private_data );
+    w->private_data = NULL;
+}
+
+/*
+ * Returns the work object that shares the frames of 'job' with its
+ * renditions, NULL if the job has none or they are not supported.
+ * Its fifo_out is the input of the job's video encoder.
+ */
+hb_work_object_t * hb_rendition_fanout_init( hb_job_t * job )
+{
+    hb_work_object_t * w;
+    const char       * reason = NULL;
+
+    if( hb_list_count( job->list_rendition ) == 0 || job->rendition != NULL )
+        return NULL;
+
+    if( job->pass != 0 || job->indepth_scan )
+        reason = "multi-pass encodes or subtitle scans";
+    else if( job->list_chunk != NULL )
+        reason = "segmented encodes";
+    else if( job->vcodec & HB_VCODEC_QSV_MASK )
+        reason = "this video encoder";
+#ifdef USE_QSV
+    else if( hb_qsv_decode_is_enabled( job ) )
+        reason = "QSV decoding";
+#endif
+    if( reason != NULL )
+    {
+        hb_log( "rendition: renditions are not supported for %s", reason );
+        return NULL;
+    }
+
+    job->fifo_fanout = hb_fifo_init_spsc( FANOUT_FIFO, FANOUT_FIFO_WAKE );
+
+    w = calloc( sizeof( hb_work_object_t ), 1 );
+    w->id           = WORK_FANOUT;
+    w->name         = "Rendition fan-out";
+    w->init         = fanoutInit;
+    w->work         = fanoutWork;
+    w->close        = fanoutClose;
+    w->fifo_out     = job->fifo_fanout;
+
+    return w;
+}
+
+/*
+ * Waits for the renditions to finish their files and releases them.
+ * Must be called once the fan-out and the video encoder have stopped.
+ */
+void hb_rendition_fanout_close( hb_job_t * job )
+{
+    hb_rendition_t * r;
+    int              ii;
+
+    for( ii = 0; ii < hb_list_count( job->list_rendition ); ii++ )
+    {
+        r = hb_list_item( job->list_rendition, ii );
+        rendition_close( r );
+    }
+    hb_fifo_close( &job->fifo_fanout );
+}
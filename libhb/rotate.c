@@ -71,7 +71,6 @@ void rotate_filter_thread( void *thread_args_v )
 {
     rotate_arguments_t *rotate_work = NULL;
     hb_filter_private_t * pv;
-    int run = 1;
     int plane;
     int segment, segment_start, segment_stop;
     rotate_thread_arg_t *thread_args = thread_args_v;
@@ -84,98 +83,73 @@ void rotate_filter_thread( void *thread_args_v )
     pv = thread_args->pv;
     segment = thread_args->segment;
 
-    hb_log("Rotate thread started for segment %d", segment);
-
-    while( run )
+    rotate_work = &pv->rotate_arguments[segment];
+    if( rotate_work->dst == NULL )
     {
-        /*
-         * Wait here until there is work to do.
-         */
-        taskset_thread_wait4start( &pv->rotate_taskset, segment );
+        hb_error( "Thread started when no work available" );
+        hb_snooze(500);
+        return;
+    }
+    
+    /*
+     * Process all three planes, but only this segment of it.
+     */
+    dst_buf = rotate_work->dst;
+    src_buf = rotate_work->src;
+    for( plane = 0; plane < 3; plane++)
+    {
+        int dst_stride, src_stride;
+
+        dst = dst_buf->plane[plane].data;
+        dst_stride = dst_buf->plane[plane].stride;
+        src_stride = src_buf->plane[plane].stride;
 
-        if( taskset_thread_stop( &pv->rotate_taskset, segment ) )
+        int h = src_buf->plane[plane].height;
+        int w = src_buf->plane[plane].width;
+        segment_start = ( h / pv->cpu_count ) * segment;
+        if( segment == pv->cpu_count - 1 )
         {
             /*
-             * No more work to do, exit this thread.
+             * Final segment
              */
-            run = 0;
-            goto report_completion;
-        } 
-
-        rotate_work = &pv->rotate_arguments[segment];
-        if( rotate_work->dst == NULL )
-        {
-            hb_error( "Thread started when no work available" );
-            hb_snooze(500);
-            goto report_completion;
+            segment_stop = h;
+        } else {
+            segment_stop = ( h / pv->cpu_count ) * ( segment + 1 );
         }
-        
-        /*
-         * Process all three planes, but only this segment of it.
-         */
-        dst_buf = rotate_work->dst;
-        src_buf = rotate_work->src;
-        for( plane = 0; plane < 3; plane++)
-        {
-            int dst_stride, src_stride;
-
-            dst = dst_buf->plane[plane].data;
-            dst_stride = dst_buf->plane[plane].stride;
-            src_stride = src_buf->plane[plane].stride;
 
-            int h = src_buf->plane[plane].height;
-            int w = src_buf->plane[plane].width;
-            segment_start = ( h / pv->cpu_count ) * segment;
-            if( segment == pv->cpu_count - 1 )
-            {
-                /*
-                 * Final segment
-                 */
-                segment_stop = h;
-            } else {
-                segment_stop = ( h / pv->cpu_count ) * ( segment + 1 );
-            }
+        for( y = segment_start; y < segment_stop; y++ )
+        {
+            uint8_t * cur;
+            int x, xo, yo;
 
-            for( y = segment_start; y < segment_stop; y++ )
+            cur = &src_buf->plane[plane].data[y * src_stride];
+            for( x = 0; x < w; x++)
             {
-                uint8_t * cur;
-                int x, xo, yo;
-
-                cur = &src_buf->plane[plane].data[y * src_stride];
-                for( x = 0; x < w; x++)
+                if( pv->mode & 1 )
+                {
+                    yo = h - y - 1;
+                }
+                else
+                {
+                    yo = y;
+                }
+                if( pv->mode & 2 )
                 {
-                    if( pv->mode & 1 )
-                    {
-                        yo = h - y - 1;
-                    }
-                    else
-                    {
-                        yo = y;
-                    }
-                    if( pv->mode & 2 )
-                    {
-                        xo = w - x - 1;
-                    }
-                    else
-                    {
-                        xo = x;
-                    }
-                    if( pv->mode & 4 ) // Rotate 90 clockwise
-                    {
-                        int tmp = xo;
-                        xo = h - yo - 1;
-                        yo = tmp;
-                    }
-                    dst[yo*dst_stride + xo] = cur[x];
+                    xo = w - x - 1;
                 }
+                else
+                {
+                    xo = x;
+                }
+                if( pv->mode & 4 ) // Rotate 90 clockwise
+                {
+                    int tmp = xo;
+                    xo = h - yo - 1;
+                    yo = tmp;
+                }
+                dst[yo*dst_stride + xo] = cur[x];
             }
         }
-
-report_completion:
-        /*
-         * Finished this segment, let everyone know.
-         */
-        taskset_thread_complete( &pv->rotate_taskset, segment );
     }
 }
 
@@ -10,6 +10,7 @@
 #include "hb.h"
 #include "opencl.h"
 #include "hbffmpeg.h"
+#include "taskset.h"
 
 typedef struct
 {
@@ -27,6 +28,7 @@ typedef struct
 
     int            preview_count;
     int            store_previews;
+    int            parallel_titles;
 
     uint64_t       min_title_duration;
 
@@ -35,14 +37,18 @@ typedef struct
 #define PREVIEW_READ_THRESH (1024 * 1024 * 10)
 
 static void ScanFunc( void * );
-static int  DecodePreviews( hb_scan_t *, hb_title_t * title, int flush );
+static void ScanBatchTitles( hb_scan_t * );
+static void ScanTitles( hb_scan_t * );
+static int  ScanTitle( hb_scan_t *, hb_title_t * title );
+static int  DecodePreviews( hb_scan_t *, hb_title_t * title, int flush,
+                            int previews_only );
 static void LookForAudio( hb_title_t * title, hb_buffer_t * b );
 static int  AllAudioOK( hb_title_t * title );
 static void UpdateState1(hb_scan_t *scan, int title);
 static void UpdateState2(hb_scan_t *scan, int title);
 static void UpdateState3(hb_scan_t *scan, int preview);
 
-static const char *aspect_to_string(hb_rational_t *dar)
+static const char *aspect_to_string(hb_rational_t *dar, char arstr[32])
 {
     double aspect = (double)dar->num / dar->den;
     switch ( (int)(aspect * 9.) )
@@ -50,7 +56,6 @@ static const char *aspect_to_string(hb_rational_t *dar)
         case 9 * 4 / 3:    return "4:3";
         case 9 * 16 / 9:   return "16:9";
     }
-    static char arstr[32];
     if (aspect >= 1)
         sprintf(arstr, "%.2f:1", aspect);
     else
@@ -154,17 +159,7 @@ static void ScanFunc( void * _data )
         else
         {
             /* Scan all titles */
-            for( i = 0; i < hb_batch_title_count( data->batch ); i++ )
-            {
-                hb_title_t * title;
-
-                UpdateState1(data, i + 1);
-                title = hb_batch_title_scan( data->batch, i + 1 );
-                if ( title != NULL )
-                {
-                    hb_list_add( data->title_set->list_title, title );
-                }
-            }
+            ScanBatchTitles( data );
         }
     }
     else
@@ -185,80 +180,34 @@ static void ScanFunc( void * _data )
         }
     }
 
-    for( i = 0; i < hb_list_count( data->title_set->list_title ); )
+    if ( data->batch && hb_list_count( data->title_set->list_title ) > 1 )
     {
-        int j, npreviews;
-        hb_audio_t * audio;
-
-        if ( *data->die )
-        {
-            goto finish;
-        }
-        title = hb_list_item( data->title_set->list_title, i );
-
-        UpdateState2(data, i + 1);
-
-        /* Decode previews */
-        /* this will also detect more AC3 / DTS information */
-        npreviews = DecodePreviews( data, title, 1 );
-        if (npreviews < 2)
-        {
-            npreviews = DecodePreviews( data, title, 0 );
-        }
-        if (npreviews == 0)
+        ScanTitles( data );
+    }
+    else
+    {
+        for( i = 0; i < hb_list_count( data->title_set->list_title ); )
         {
-            /* TODO: free things */
-            hb_list_rem( data->title_set->list_title, title );
-            for( j = 0; j < hb_list_count( title->list_audio ); j++)
+            if ( *data->die )
             {
-                audio = hb_list_item( title->list_audio, j );
-                if ( audio->priv.scan_cache )
-                {
-                    hb_fifo_flush( audio->priv.scan_cache );
-                    hb_fifo_close( &audio->priv.scan_cache );
-                }
+                goto finish;
             }
-            hb_title_close( &title );
-            continue;
-        }
+            title = hb_list_item( data->title_set->list_title, i );
 
-        /* Make sure we found audio rates and bitrates */
-        for( j = 0; j < hb_list_count( title->list_audio ); )
-        {
-            audio = hb_list_item( title->list_audio, j );
-            if ( audio->priv.scan_cache )
-            {
-                hb_fifo_flush( audio->priv.scan_cache );
-                hb_fifo_close( &audio->priv.scan_cache );
-            }
-            if( !audio->config.in.bitrate )
-            {
-                hb_log( "scan: removing audio 0x%x because no bitrate found",
-                        audio->id );
-                hb_list_rem( title->list_audio, audio );
-                free( audio );
-                continue;
-            }
-            j++;
-        }
+            UpdateState2(data, i + 1);
 
-        if ( data->dvd || data->bd )
-        {
-            // The subtitle width and height needs to be set to the 
-            // title widht and height for DVDs.  title width and
-            // height don't get set until we decode previews, so
-            // we can't set subtitle width/height till we get here.
-            for( j = 0; j < hb_list_count( title->list_subtitle ); j++ )
+            if ( !ScanTitle( data, title ) )
             {
-                hb_subtitle_t *subtitle = hb_list_item( title->list_subtitle, j );
-                if ( subtitle->source == VOBSUB || subtitle->source == PGSSUB )
-                {
-                    subtitle->width = title->geometry.width;
-                    subtitle->height = title->geometry.height;
-                }
+                hb_list_rem( data->title_set->list_title, title );
+                hb_title_close( &title );
+                continue;
             }
+            i++;
         }
-        i++;
+    }
+    if ( *data->die )
+    {
+        goto finish;
     }
 
     data->title_set->feature = feature;
@@ -294,6 +243,237 @@ finish:
     hb_buffer_pool_free();
 }
 
+typedef struct
+{
+    hb_scan_t    * data;
+    hb_lock_t    * lock;
+    int            count;
+    int            next;        // next title to scan, updated atomically
+    int            done;        // titles finished, protected by lock
+    hb_title_t  ** titles;
+    int          * keep;
+} title_scan_t;
+
+/*
+ * Runs 'func' on up to one taskset thread per cpu.  The threads pull
+ * titles from 'ts' until all are done.
+ */
+static void RunTitleScan( title_scan_t * ts, thread_func_t * func )
+{
+    taskset_t taskset;
+    int       ii, thread_count = MIN( hb_get_cpu_count(), ts->count );
+
+    if ( thread_count > 1 &&
+         taskset_init( &taskset, thread_count, sizeof( title_scan_t * ) ) )
+    {
+        for ( ii = 0; ii < thread_count; ii++ )
+        {
+            *(title_scan_t **)taskset_thread_args( &taskset, ii ) = ts;
+            taskset_thread_spawn( &taskset, ii, "scan_title", func,
+                                  HB_NORMAL_PRIORITY );
+        }
+        taskset_cycle( &taskset );
+        taskset_fini( &taskset );
+    }
+    else
+    {
+        func( &ts );
+    }
+}
+
+static void BatchTitleScanThread( void * thread_args_v )
+{
+    title_scan_t * ts = *(title_scan_t **)thread_args_v;
+    int            i;
+
+    while ( !*ts->data->die &&
+            ( i = __atomic_fetch_add( &ts->next, 1, __ATOMIC_RELAXED ) ) <
+              ts->count )
+    {
+        ts->titles[i] = hb_batch_title_scan( ts->data->batch, i + 1 );
+
+        hb_lock( ts->lock );
+        UpdateState1( ts->data, ++ts->done );
+        hb_unlock( ts->lock );
+    }
+}
+
+/*
+ * Opens every file of the batch concurrently.  The titles are added in
+ * directory order no matter which file finished first.
+ */
+static void ScanBatchTitles( hb_scan_t * data )
+{
+    title_scan_t ts;
+    int          i;
+
+    memset( &ts, 0, sizeof( ts ) );
+    ts.data   = data;
+    ts.lock   = hb_lock_init();
+    ts.count  = hb_batch_title_count( data->batch );
+    ts.titles = calloc( ts.count, sizeof( hb_title_t * ) );
+
+    RunTitleScan( &ts, BatchTitleScanThread );
+
+    for( i = 0; i < ts.count; i++ )
+    {
+        if ( ts.titles[i] != NULL )
+        {
+            hb_list_add( data->title_set->list_title, ts.titles[i] );
+        }
+    }
+    free( ts.titles );
+    hb_lock_close( &ts.lock );
+}
+
+static void ScanTitlesThread( void * thread_args_v )
+{
+    title_scan_t * ts = *(title_scan_t **)thread_args_v;
+    int            i;
+
+    while ( !*ts->data->die &&
+            ( i = __atomic_fetch_add( &ts->next, 1, __ATOMIC_RELAXED ) ) <
+              ts->count )
+    {
+        ts->keep[i] = ScanTitle( ts->data, ts->titles[i] );
+
+        hb_lock( ts->lock );
+        UpdateState2( ts->data, ++ts->done );
+        hb_unlock( ts->lock );
+    }
+}
+
+/*
+ * Decodes the previews of several files concurrently.  Titles without
+ * previews are removed afterwards so the order of the list doesn't
+ * depend on which title finished first.
+ */
+static void ScanTitles( hb_scan_t * data )
+{
+    title_scan_t ts;
+    int          i;
+
+    memset( &ts, 0, sizeof( ts ) );
+    ts.data   = data;
+    ts.lock   = hb_lock_init();
+    ts.count  = hb_list_count( data->title_set->list_title );
+    ts.titles = calloc( ts.count, sizeof( hb_title_t * ) );
+    ts.keep   = calloc( ts.count, sizeof( int ) );
+    for( i = 0; i < ts.count; i++ )
+    {
+        ts.titles[i] = hb_list_item( data->title_set->list_title, i );
+    }
+
+    data->parallel_titles = 1;
+    RunTitleScan( &ts, ScanTitlesThread );
+    data->parallel_titles = 0;
+
+    for( i = 0; i < ts.count && !*data->die; i++ )
+    {
+        if ( !ts.keep[i] )
+        {
+            hb_list_rem( data->title_set->list_title, ts.titles[i] );
+            hb_title_close( &ts.titles[i] );
+        }
+    }
+    free( ts.titles );
+    free( ts.keep );
+    hb_lock_close( &ts.lock );
+}
+
+/***********************************************************************
+ * ScanTitle
+ ***********************************************************************
+ * Decodes the previews of a title and fills in what they tell us.
+ * Returns 0 if no preview could be decoded and the title should be
+ * dropped.
+ **********************************************************************/
+static int ScanTitle( hb_scan_t * data, hb_title_t * title )
+{
+    int j, npreviews;
+    hb_audio_t * audio;
+    hb_scan_cache_t * cache = NULL;
+
+    /* Reuse the results of a previous scan of the same file */
+    if ( data->stream || data->batch )
+    {
+        cache = hb_scan_cache_open( title->path, data->preview_count );
+    }
+    if ( hb_scan_cache_apply( cache, title ) )
+    {
+        hb_scan_cache_close( &cache );
+        if ( data->store_previews )
+        {
+            /* The preview pictures themselves aren't cached */
+            DecodePreviews( data, title, 1, 1 );
+        }
+        return 1;
+    }
+
+    /* Decode previews */
+    /* this will also detect more AC3 / DTS information */
+    npreviews = DecodePreviews( data, title, 1, 0 );
+    if (npreviews < 2 && !*data->die)
+    {
+        npreviews = DecodePreviews( data, title, 0, 0 );
+    }
+    if (npreviews == 0)
+    {
+        /* TODO: free things */
+        for( j = 0; j < hb_list_count( title->list_audio ); j++)
+        {
+            audio = hb_list_item( title->list_audio, j );
+            if ( audio->priv.scan_cache )
+            {
+                hb_fifo_flush( audio->priv.scan_cache );
+                hb_fifo_close( &audio->priv.scan_cache );
+            }
+        }
+        hb_scan_cache_close( &cache );
+        return 0;
+    }
+
+    /* Make sure we found audio rates and bitrates */
+    for( j = 0; j < hb_list_count( title->list_audio ); )
+    {
+        audio = hb_list_item( title->list_audio, j );
+        if ( audio->priv.scan_cache )
+        {
+            hb_fifo_flush( audio->priv.scan_cache );
+            hb_fifo_close( &audio->priv.scan_cache );
+        }
+        if( !audio->config.in.bitrate )
+        {
+            hb_log( "scan: removing audio 0x%x because no bitrate found",
+                    audio->id );
+            hb_list_rem( title->list_audio, audio );
+            free( audio );
+            continue;
+        }
+        j++;
+    }
+
+    if ( data->dvd || data->bd )
+    {
+        // The subtitle width and height needs to be set to the 
+        // title widht and height for DVDs.  title width and
+        // height don't get set until we decode previews, so
+        // we can't set subtitle width/height till we get here.
+        for( j = 0; j < hb_list_count( title->list_subtitle ); j++ )
+        {
+            hb_subtitle_t *subtitle = hb_list_item( title->list_subtitle, j );
+            if ( subtitle->source == VOBSUB || subtitle->source == PGSSUB )
+            {
+                subtitle->width = title->geometry.width;
+                subtitle->height = title->geometry.height;
+            }
+        }
+    }
+    hb_scan_cache_store( cache, title );
+    hb_scan_cache_close( &cache );
+    return 1;
+}
+
 // -----------------------------------------------
 // stuff related to cropping
 
@@ -479,397 +659,660 @@ static int is_close_to( int val, int target, int thresh )
     return diff < thresh;
 }
 
-/***********************************************************************
- * DecodePreviews
- ***********************************************************************
- * Decode 10 pictures for the given title.
- * It assumes that data->reader and data->vts have successfully been
- * DVDOpen()ed and ifoOpen()ed.
- **********************************************************************/
-static int DecodePreviews( hb_scan_t * data, hb_title_t * title, int flush )
+typedef struct
 {
-    int             i, npreviews = 0, abort = 0;
-    hb_buffer_t   * buf, * buf_es;
-    hb_list_t     * list_es;
-    int progressive_count = 0;
-    int pulldown_count = 0;
-    int doubled_frame_count = 0;
-    int interlaced_preview_count = 0;
-    int frame_wait = 0;
-    int cc_wait = 10;
-    hb_stream_t  * stream = NULL;
-    info_list_t * info_list = calloc( data->preview_count+1, sizeof(*info_list) );
-    crop_record_t *crops = crop_record_init( data->preview_count );
+    int            valid;
+    hb_work_info_t info;
+    int            pulldown;
+    int            doubled;
+    int            progressive;
+    int            interlaced;
+    int            crop_valid;
+    int            crop[4];
+} preview_result_t;
 
-    list_es  = hb_list_init();
+typedef struct
+{
+    hb_scan_t        * data;
+    hb_title_t       * title;
+    int                flush;
+    int                previews_only; // only store the previews
+    hb_lock_t        * lock;
+    int                next;        // next preview to decode, updated atomically
+    int                abort_at;    // first preview that could not be read
+    int                done;        // previews finished, protected by lock
+    int                audio_busy;  // a thread is probing audio, protected by lock
+    preview_result_t * results;
+} preview_scan_t;
 
-    if( data->batch )
+typedef struct
+{
+    preview_scan_t   * ps;
+    hb_title_t         shadow;      // this thread's copy of ps->title
+    int                subtitle_count;
+    hb_stream_t      * stream;
+    hb_work_object_t * vid_decoder;
+    hb_list_t        * list_es;
+    int                frame_wait;
+    int                cc_wait;
+} preview_thread_t;
+
+/*
+ * Only one thread at a time feeds audio packets to LookForAudio.  The
+ * audio scan caches need contiguous data, and LookForAudio changes the
+ * title's audio list.
+ */
+static int AcquireAudio( preview_scan_t * ps )
+{
+    int probing = 0;
+
+    hb_lock( ps->lock );
+    if ( !ps->audio_busy && !AllAudioOK( ps->title ) )
     {
-        hb_log( "scan: decoding previews for title %d (%s)", title->index, title->path );
+        ps->audio_busy = probing = 1;
     }
-    else
+    hb_unlock( ps->lock );
+
+    return probing;
+}
+
+static void ReleaseAudio( preview_scan_t * ps, int probing )
+{
+    int j;
+
+    if ( !probing )
+        return;
+
+    /* Make sure we found audio rates and bitrates */
+    for( j = 0; j < hb_list_count( ps->title->list_audio ); j++ )
     {
-        hb_log( "scan: decoding previews for title %d", title->index );
+        hb_audio_t * audio = hb_list_item( ps->title->list_audio, j );
+        if ( audio->priv.scan_cache )
+        {
+            hb_fifo_flush( audio->priv.scan_cache );
+        }
     }
+    hb_lock( ps->lock );
+    ps->audio_busy = 0;
+    hb_unlock( ps->lock );
+}
+
+/***********************************************************************
+ * DecodePreview
+ ***********************************************************************
+ * Decodes preview i of the title and records what it finds in r.
+ * Returns -1 if no more data could be read, 0 otherwise.
+ **********************************************************************/
+static int DecodePreview( preview_thread_t * pt, int i, int probing,
+                          preview_result_t * r )
+{
+    hb_scan_t        * data        = pt->ps->data;
+    hb_title_t       * title       = pt->ps->title;
+    hb_stream_t      * stream      = pt->stream;
+    hb_work_object_t * vid_decoder = pt->vid_decoder;
+    hb_list_t        * list_es     = pt->list_es;
+    hb_buffer_t      * buf, * buf_es;
+    int                abort = 0;
 
     if (data->bd)
     {
-        hb_bd_start( data->bd, title );
-        hb_log( "scan: title angle(s) %d", title->angle_count );
+        if( !hb_bd_seek( data->bd, (float) ( i + 1 ) / ( data->preview_count + 1.0 ) ) )
+      {
+          return 0;
+      }
     }
-    else if (data->dvd)
-    {
-        hb_dvd_start( data->dvd, title, 1 );
-        title->angle_count = hb_dvd_angle_count( data->dvd );
-        hb_log( "scan: title angle(s) %d", title->angle_count );
-    }
-    else if (data->batch)
+    if (data->dvd)
     {
-        stream = hb_stream_open( title->path, title, 0 );
+        if( !hb_dvd_seek( data->dvd, (float) ( i + 1 ) / ( data->preview_count + 1.0 ) ) )
+      {
+          return 0;
+      }
     }
-    else if (data->stream)
+    else if (stream)
     {
-        stream = hb_stream_open( data->path, title, 0 );
+        /* we start reading streams at zero rather than 1/11 because
+         * short streams may have only one sequence header in the entire
+         * file and we need it to decode any previews.
+         *
+         * Also, seeking to position 0 loses the palette of avi files
+         * so skip initial seek */
+        if (i != 0)
+        {
+            if (!hb_stream_seek(stream,
+                                (float)i / (data->preview_count + 1.0)))
+            {
+                return 0;
+            }
+        }
+        else
+        {
+            hb_stream_set_need_keyframe(stream, 1);
+        }
     }
 
-    if (title->video_codec == WORK_NONE)
-    {
-        hb_error("No video decoder set!");
-        return 0;
-    }
-    hb_work_object_t *vid_decoder = hb_get_work(title->video_codec);
-    vid_decoder->codec_param = title->video_codec_param;
-    vid_decoder->title = title;
-    vid_decoder->init( vid_decoder, NULL );
+    hb_deep_log( 2, "scan: preview %d", i + 1 );
 
-    for( i = 0; i < data->preview_count; i++ )
+    if (pt->ps->flush && vid_decoder->flush)
+        vid_decoder->flush( vid_decoder );
+    if (title->flags & HBTF_NO_IDR)
     {
-        int j;
+        pt->frame_wait = 100;
+    }
 
-        UpdateState3(data, i + 1);
+    hb_buffer_t * vid_buf = NULL;
 
-        if ( *data->die )
-        {
-            free( info_list );
-            crop_record_free( crops );
-            return 0;
-        }
+    int total_read = 0, packets = 0;
+    while (total_read < PREVIEW_READ_THRESH ||
+          (probing && !AllAudioOK(title) && packets < 10000))
+    {
         if (data->bd)
         {
-            if( !hb_bd_seek( data->bd, (float) ( i + 1 ) / ( data->preview_count + 1.0 ) ) )
+          if( (buf = hb_bd_read( data->bd )) == NULL )
           {
-              continue;
+              if ( vid_buf )
+              {
+                break;
+              }
+              hb_log( "Warning: Could not read data for preview %d, skipped", i + 1 );
+              abort = 1;
+              goto skip_preview;
           }
         }
-        if (data->dvd)
+        else if (data->dvd)
         {
-            if( !hb_dvd_seek( data->dvd, (float) ( i + 1 ) / ( data->preview_count + 1.0 ) ) )
+          if( (buf = hb_dvd_read( data->dvd )) == NULL )
           {
-              continue;
+              if ( vid_buf )
+              {
+                break;
+              }
+              hb_log( "Warning: Could not read data for preview %d, skipped", i + 1 );
+              abort = 1;
+              goto skip_preview;
           }
         }
         else if (stream)
         {
-            /* we start reading streams at zero rather than 1/11 because
-             * short streams may have only one sequence header in the entire
-             * file and we need it to decode any previews.
-             *
-             * Also, seeking to position 0 loses the palette of avi files
-             * so skip initial seek */
-            if (i != 0)
-            {
-                if (!hb_stream_seek(stream,
-                                    (float)i / (data->preview_count + 1.0)))
-                {
-                    continue;
-                }
-            }
-            else
-            {
-                hb_stream_set_need_keyframe(stream, 1);
-            }
+          if ( (buf = hb_stream_read(stream)) == NULL )
+          {
+              if ( vid_buf )
+              {
+                break;
+              }
+              hb_log( "Warning: Could not read data for preview %d, skipped", i + 1 );
+              abort = 1;
+              goto skip_preview;
+          }
         }
-
-        hb_deep_log( 2, "scan: preview %d", i + 1 );
-
-        if (flush && vid_decoder->flush)
-            vid_decoder->flush( vid_decoder );
-        if (title->flags & HBTF_NO_IDR)
+        else
         {
-            frame_wait = 100;
+            // Silence compiler warning
+            buf = NULL;
+            hb_error( "Error: This can't happen!" );
+            abort = 1;
+            goto skip_preview;
         }
 
-        hb_buffer_t * vid_buf = NULL;
-
-        int total_read = 0, packets = 0;
-        while (total_read < PREVIEW_READ_THRESH ||
-              (!AllAudioOK(title) && packets < 10000)) 
+        if (buf->size <= 0)
         {
-            if (data->bd)
-            {
-              if( (buf = hb_bd_read( data->bd )) == NULL )
-              {
-                  if ( vid_buf )
-                  {
-                    break;
-                  }
-                  hb_log( "Warning: Could not read data for preview %d, skipped", i + 1 );
-                  abort = 1;
-                  goto skip_preview;
-              }
-            }
-            else if (data->dvd)
-            {
-              if( (buf = hb_dvd_read( data->dvd )) == NULL )
-              {
-                  if ( vid_buf )
-                  {
-                    break;
-                  }
-                  hb_log( "Warning: Could not read data for preview %d, skipped", i + 1 );
-                  abort = 1;
-                  goto skip_preview;
-              }
-            }
-            else if (stream)
-            {
-              if ( (buf = hb_stream_read(stream)) == NULL )
-              {
-                  if ( vid_buf )
-                  {
-                    break;
-                  }
-                  hb_log( "Warning: Could not read data for preview %d, skipped", i + 1 );
-                  abort = 1;
-                  goto skip_preview;
-              }
-            }
-            else
-            {
-                // Silence compiler warning
-                buf = NULL;
-                hb_error( "Error: This can't happen!" );
-                abort = 1;
-                goto skip_preview;
-            }
-
-            if (buf->size <= 0)
-            {
-                hb_log( "Warning: Could not read data for preview %d, skipped", i + 1 );
-                abort = 1;
-                goto skip_preview;
-            }
-            total_read += buf->size;
-            packets++;
+            hb_log( "Warning: Could not read data for preview %d, skipped", i + 1 );
+            abort = 1;
+            goto skip_preview;
+        }
+        total_read += buf->size;
+        packets++;
 
-            (hb_demux[title->demuxer])(buf, list_es, 0 );
+        (hb_demux[title->demuxer])(buf, list_es, 0 );
 
-            while( ( buf_es = hb_list_item( list_es, 0 ) ) )
+        while( ( buf_es = hb_list_item( list_es, 0 ) ) )
+        {
+            hb_list_rem( list_es, buf_es );
+            if( buf_es->s.id == title->video_id && vid_buf == NULL )
             {
-                hb_list_rem( list_es, buf_es );
-                if( buf_es->s.id == title->video_id && vid_buf == NULL )
+                vid_decoder->work( vid_decoder, &buf_es, &vid_buf );
+                // There are 2 conditions we decode additional
+                // video frames for during scan.
+                // 1. We did not detect IDR frames, so the initial video
+                //    frames may be corrupt.  We docode extra frames to
+                //    increase the probability of a complete preview frame
+                // 2. Some frames do not contain CC data, even though
+                //    CCs are present in the stream.  So we need to decode
+                //    additional frames to find the CCs.
+                if (vid_buf != NULL && (pt->frame_wait || pt->cc_wait))
                 {
-                    vid_decoder->work( vid_decoder, &buf_es, &vid_buf );
-                    // There are 2 conditions we decode additional
-                    // video frames for during scan.
-                    // 1. We did not detect IDR frames, so the initial video
-                    //    frames may be corrupt.  We docode extra frames to
-                    //    increase the probability of a complete preview frame
-                    // 2. Some frames do not contain CC data, even though
-                    //    CCs are present in the stream.  So we need to decode
-                    //    additional frames to find the CCs.
-                    if (vid_buf != NULL && (frame_wait || cc_wait))
+                    if (vid_buf->s.frametype == HB_FRAME_I)
+                        pt->frame_wait = 0;
+                    if (pt->frame_wait || pt->cc_wait)
                     {
-                        if (vid_buf->s.frametype == HB_FRAME_I)
-                            frame_wait = 0;
-                        if (frame_wait || cc_wait)
-                        {
-                            hb_buffer_close(&vid_buf);
-                            if (frame_wait) frame_wait--;
-                            if (cc_wait) cc_wait--;
-                        }
+                        hb_buffer_close(&vid_buf);
+                        if (pt->frame_wait) pt->frame_wait--;
+                        if (pt->cc_wait) pt->cc_wait--;
                     }
                 }
-                else if( ! AllAudioOK( title ) ) 
-                {
-                    LookForAudio( title, buf_es );
-                    buf_es = NULL;
-                }
-                if ( buf_es )
-                    hb_buffer_close( &buf_es );
             }
-
-            if( vid_buf && AllAudioOK( title ) )
-                break;
+            else if( probing && ! AllAudioOK( title ) )
+            {
+                LookForAudio( title, buf_es );
+                buf_es = NULL;
+            }
+            if ( buf_es )
+                hb_buffer_close( &buf_es );
         }
 
-        if( ! vid_buf )
-        {
-            hb_log( "scan: could not get a decoded picture" );
-            continue;
-        }
+        if( vid_buf && ( !probing || AllAudioOK( title ) ) )
+            break;
+    }
 
-        /* Get size and rate infos */
+    if( ! vid_buf )
+    {
+        hb_log( "scan: could not get a decoded picture" );
+        return 0;
+    }
 
-        hb_work_info_t vid_info;
-        if( !vid_decoder->info( vid_decoder, &vid_info ) )
-        {
-            /*
-             * Could not fill vid_info, don't continue and try to use vid_info
-             * in this case.
-             */
-            if (vid_buf)
-            {
-                hb_buffer_close( &vid_buf );
-            }
-            hb_log( "scan: could not get a video information" );
-            continue;
-        }
+    if( pt->ps->previews_only )
+    {
+        hb_save_preview( data->h, title->index, i, vid_buf );
+        r->valid = 1;
+        goto skip_preview;
+    }
 
-        remember_info( info_list, &vid_info );
+    /* Get size and rate infos */
 
-        if( is_close_to( vid_info.rate.den, 900900, 100 ) &&
-            ( vid_buf->s.flags & PIC_FLAG_REPEAT_FIRST_FIELD ) )
+    hb_work_info_t vid_info;
+    if( !vid_decoder->info( vid_decoder, &vid_info ) )
+    {
+        /*
+         * Could not fill vid_info, don't continue and try to use vid_info
+         * in this case.
+         */
+        if (vid_buf)
         {
-            /* Potentially soft telecine material */
-            pulldown_count++;
+            hb_buffer_close( &vid_buf );
         }
+        hb_log( "scan: could not get a video information" );
+        return 0;
+    }
 
-        if( vid_buf->s.flags & PIC_FLAG_REPEAT_FRAME )
-        {
-            // AVCHD-Lite specifies that all streams are
-            // 50 or 60 fps.  To produce 25 or 30 fps, camera
-            // makers are repeating all frames.
-            doubled_frame_count++;
-        }
+    r->info = vid_info;
 
-        if( is_close_to( vid_info.rate.den, 1126125, 100 ) )
-        {
-            // Frame FPS is 23.976 (meaning it's progressive), so start keeping
-            // track of how many are reporting at that speed. When enough 
-            // show up that way, we want to make that the overall title FPS.
-            progressive_count++;
-        }
+    if( is_close_to( vid_info.rate.den, 900900, 100 ) &&
+        ( vid_buf->s.flags & PIC_FLAG_REPEAT_FIRST_FIELD ) )
+    {
+        /* Potentially soft telecine material */
+        r->pulldown = 1;
+    }
 
-        while( ( buf_es = hb_list_item( list_es, 0 ) ) )
-        {
-            hb_list_rem( list_es, buf_es );
-            hb_buffer_close( &buf_es );
-        }
+    if( vid_buf->s.flags & PIC_FLAG_REPEAT_FRAME )
+    {
+        // AVCHD-Lite specifies that all streams are
+        // 50 or 60 fps.  To produce 25 or 30 fps, camera
+        // makers are repeating all frames.
+        r->doubled = 1;
+    }
 
-        /* Check preview for interlacing artifacts */
-        if( hb_detect_comb( vid_buf, 10, 30, 9, 10, 30, 9 ) )
-        {
-            hb_deep_log( 2, "Interlacing detected in preview frame %i", i+1);
-            interlaced_preview_count++;
-        }
-        
-        if( data->store_previews )
-        {
-            hb_save_preview( data->h, title->index, i, vid_buf );
-        }
+    if( is_close_to( vid_info.rate.den, 1126125, 100 ) )
+    {
+        // Frame FPS is 23.976 (meaning it's progressive), so start keeping
+        // track of how many are reporting at that speed. When enough 
+        // show up that way, we want to make that the overall title FPS.
+        r->progressive = 1;
+    }
 
-        /* Detect black borders */
+    while( ( buf_es = hb_list_item( list_es, 0 ) ) )
+    {
+        hb_list_rem( list_es, buf_es );
+        hb_buffer_close( &buf_es );
+    }
+
+    /* Check preview for interlacing artifacts */
+    if( hb_detect_comb( vid_buf, 10, 30, 9, 10, 30, 9 ) )
+    {
+        hb_deep_log( 2, "Interlacing detected in preview frame %i", i+1);
+        r->interlaced = 1;
+    }
+    
+    if( data->store_previews )
+    {
+        hb_save_preview( data->h, title->index, i, vid_buf );
+    }
+
+    /* Detect black borders */
 
-        int top, bottom, left, right;
-        int h4 = vid_info.geometry.height / 4, w4 = vid_info.geometry.width / 4;
+    int top, bottom, left, right;
+    int h4 = vid_info.geometry.height / 4, w4 = vid_info.geometry.width / 4;
 
-        // When widescreen content is matted to 16:9 or 4:3 there's sometimes
-        // a thin border on the outer edge of the matte. On TV content it can be
-        // "line 21" VBI data that's normally hidden in the overscan. For HD
-        // content it can just be a diagnostic added in post production so that
-        // the frame borders are visible. We try to ignore these borders so
-        // we can crop the matte. The border width depends on the resolution
-        // (12 pixels on 1080i looks visually the same as 4 pixels on 480i)
-        // so we allow the border to be up to 1% of the frame height.
-        const int border = vid_info.geometry.height / 100;
+    // When widescreen content is matted to 16:9 or 4:3 there's sometimes
+    // a thin border on the outer edge of the matte. On TV content it can be
+    // "line 21" VBI data that's normally hidden in the overscan. For HD
+    // content it can just be a diagnostic added in post production so that
+    // the frame borders are visible. We try to ignore these borders so
+    // we can crop the matte. The border width depends on the resolution
+    // (12 pixels on 1080i looks visually the same as 4 pixels on 480i)
+    // so we allow the border to be up to 1% of the frame height.
+    const int border = vid_info.geometry.height / 100;
 
-        for ( top = border; top < h4; ++top )
+    for ( top = border; top < h4; ++top )
+    {
+        if ( ! row_all_dark( vid_buf, top ) )
+            break;
+    }
+    if ( top <= border )
+    {
+        // we never made it past the border region - see if the rows we
+        // didn't check are dark or if we shouldn't crop at all.
+        for ( top = 0; top < border; ++top )
         {
             if ( ! row_all_dark( vid_buf, top ) )
                 break;
         }
-        if ( top <= border )
+        if ( top >= border )
         {
-            // we never made it past the border region - see if the rows we
-            // didn't check are dark or if we shouldn't crop at all.
-            for ( top = 0; top < border; ++top )
-            {
-                if ( ! row_all_dark( vid_buf, top ) )
-                    break;
-            }
-            if ( top >= border )
-            {
-                top = 0;
-            }
+            top = 0;
         }
-        for ( bottom = border; bottom < h4; ++bottom )
+    }
+    for ( bottom = border; bottom < h4; ++bottom )
+    {
+        if ( ! row_all_dark( vid_buf, vid_info.geometry.height - 1 - bottom ) )
+            break;
+    }
+    if ( bottom <= border )
+    {
+        for ( bottom = 0; bottom < border; ++bottom )
         {
             if ( ! row_all_dark( vid_buf, vid_info.geometry.height - 1 - bottom ) )
                 break;
         }
-        if ( bottom <= border )
+        if ( bottom >= border )
         {
-            for ( bottom = 0; bottom < border; ++bottom )
-            {
-                if ( ! row_all_dark( vid_buf, vid_info.geometry.height - 1 - bottom ) )
-                    break;
-            }
-            if ( bottom >= border )
+            bottom = 0;
+        }
+    }
+    for ( left = 0; left < w4; ++left )
+    {
+        if ( ! column_all_dark( vid_buf, top, bottom, left ) )
+            break;
+    }
+    for ( right = 0; right < w4; ++right )
+    {
+        if ( ! column_all_dark( vid_buf, top, bottom, vid_info.geometry.width - 1 - right ) )
+            break;
+    }
+
+    // only record the result if all the crops are less than a quarter of
+    // the frame otherwise we can get fooled by frames with a lot of black
+    // like titles, credits & fade-thru-black transitions.
+    if ( top < h4 && bottom < h4 && left < w4 && right < w4 )
+    {
+        r->crop_valid = 1;
+        r->crop[0] = top;
+        r->crop[1] = bottom;
+        r->crop[2] = left;
+        r->crop[3] = right;
+    }
+    r->valid = 1;
+
+skip_preview:
+    if (vid_buf)
+    {
+        hb_buffer_close( &vid_buf );
+    }
+    return abort ? -1 : 0;
+}
+
+/*
+ * Each thread decodes previews with its own stream and video decoder,
+ * pulling the next preview number until all are done.
+ */
+static void DecodePreviewsThread( void * thread_args_v )
+{
+    preview_thread_t * pt    = thread_args_v;
+    preview_scan_t   * ps    = pt->ps;
+    hb_scan_t        * data  = ps->data;
+    hb_title_t       * title = ps->title;
+    int                i, probing;
+
+    if (data->batch)
+    {
+        pt->stream = hb_stream_open( title->path, &pt->shadow, 0 );
+    }
+    else if (data->stream)
+    {
+        pt->stream = hb_stream_open( data->path, &pt->shadow, 0 );
+    }
+
+    pt->vid_decoder = hb_get_work(title->video_codec);
+    pt->vid_decoder->codec_param = title->video_codec_param;
+    pt->vid_decoder->title = &pt->shadow;
+    pt->vid_decoder->init( pt->vid_decoder, NULL );
+    pt->list_es = hb_list_init();
+    pt->cc_wait = ps->previews_only ? 0 : 10;
+
+    while ( !*data->die &&
+            ( i = __atomic_fetch_add( &ps->next, 1, __ATOMIC_RELAXED ) ) <
+              __atomic_load_n( &ps->abort_at, __ATOMIC_RELAXED ) )
+    {
+        probing = ps->previews_only ? 0 : AcquireAudio( ps );
+        if ( DecodePreview( pt, i, probing, &ps->results[i] ) < 0 )
+        {
+            hb_lock( ps->lock );
+            if ( i < ps->abort_at )
             {
-                bottom = 0;
+                __atomic_store_n( &ps->abort_at, i, __ATOMIC_RELAXED );
             }
+            hb_unlock( ps->lock );
         }
-        for ( left = 0; left < w4; ++left )
+        ReleaseAudio( ps, probing );
+
+        hb_lock( ps->lock );
+        ps->done++;
+        if ( !data->parallel_titles )
         {
-            if ( ! column_all_dark( vid_buf, top, bottom, left ) )
-                break;
+            UpdateState3( data, ps->done );
         }
-        for ( right = 0; right < w4; ++right )
+        hb_unlock( ps->lock );
+    }
+
+    pt->vid_decoder->close( pt->vid_decoder );
+    free( pt->vid_decoder );
+    pt->vid_decoder = NULL;
+
+    if (pt->stream != NULL)
+    {
+        hb_stream_close(&pt->stream);
+    }
+    hb_buffer_t * buf_es;
+    while( ( buf_es = hb_list_item( pt->list_es, 0 ) ) )
+    {
+        hb_list_rem( pt->list_es, buf_es );
+        hb_buffer_close( &buf_es );
+    }
+    hb_list_close( &pt->list_es );
+}
+
+/*
+ * Hands closed captions a thread's decoder found over to the title.
+ */
+static void MergeSubtitles( hb_title_t * title, preview_thread_t * pt )
+{
+    hb_subtitle_t * subtitle, * cc;
+    int             i;
+
+    while ( ( subtitle = hb_list_item( pt->shadow.list_subtitle,
+                                       pt->subtitle_count ) ) )
+    {
+        hb_list_rem( pt->shadow.list_subtitle, subtitle );
+        for ( i = 0; ( cc = hb_list_item( title->list_subtitle, i ) ); i++ )
         {
-            if ( ! column_all_dark( vid_buf, top, bottom, vid_info.geometry.width - 1 - right ) )
+            if ( cc->source == CC608SUB )
                 break;
         }
-
-        // only record the result if all the crops are less than a quarter of
-        // the frame otherwise we can get fooled by frames with a lot of black
-        // like titles, credits & fade-thru-black transitions.
-        if ( top < h4 && bottom < h4 && left < w4 && right < w4 )
+        if ( cc != NULL )
         {
-            record_crop( crops, top, bottom, left, right );
+            free( subtitle );
+            continue;
         }
-        ++npreviews;
+        subtitle->track = hb_list_count( title->list_subtitle );
+        hb_list_add( title->list_subtitle, subtitle );
+    }
+    hb_list_close( &pt->shadow.list_subtitle );
+    hb_list_close( &pt->shadow.list_audio );
+}
 
-skip_preview:
-        /* Make sure we found audio rates and bitrates */
-        for( j = 0; j < hb_list_count( title->list_audio ); j++ )
+/***********************************************************************
+ * DecodePreviews
+ ***********************************************************************
+ * Decode 10 pictures for the given title.
+ * It assumes that data->reader and data->vts have successfully been
+ * DVDOpen()ed and ifoOpen()ed.
+ *
+ * Previews of files are decoded concurrently, each thread reading
+ * through its own stream.  Discs have a single reader, so their
+ * previews are decoded one after another.  Results are combined in
+ * preview order either way.
+ *
+ * With 'previews_only' the title, already filled in from the scan
+ * cache, is left alone and the previews are only stored.
+ **********************************************************************/
+static int DecodePreviews( hb_scan_t * data, hb_title_t * title, int flush,
+                           int previews_only )
+{
+    int             i, j, npreviews = 0;
+    int progressive_count = 0;
+    int pulldown_count = 0;
+    int doubled_frame_count = 0;
+    int interlaced_preview_count = 0;
+    int thread_count = 1;
+    preview_scan_t  ps;
+    taskset_t       taskset;
+    preview_thread_t * pt;
+    info_list_t * info_list = calloc( data->preview_count+1, sizeof(*info_list) );
+    crop_record_t *crops = crop_record_init( data->preview_count );
+
+    if( data->batch )
+    {
+        hb_log( "scan: decoding previews for title %d (%s)", title->index, title->path );
+    }
+    else
+    {
+        hb_log( "scan: decoding previews for title %d", title->index );
+    }
+
+    if (data->bd)
+    {
+        hb_bd_start( data->bd, title );
+        hb_log( "scan: title angle(s) %d", title->angle_count );
+    }
+    else if (data->dvd)
+    {
+        hb_dvd_start( data->dvd, title, 1 );
+        title->angle_count = hb_dvd_angle_count( data->dvd );
+        hb_log( "scan: title angle(s) %d", title->angle_count );
+    }
+    else if (data->batch || data->stream)
+    {
+        thread_count = MIN( hb_get_cpu_count(), data->preview_count );
+    }
+
+    if (title->video_codec == WORK_NONE)
+    {
+        hb_error("No video decoder set!");
+        free( info_list );
+        crop_record_free( crops );
+        return 0;
+    }
+
+    memset( &ps, 0, sizeof( ps ) );
+    ps.data     = data;
+    ps.title    = title;
+    ps.flush    = flush;
+    ps.previews_only = previews_only;
+    ps.lock     = hb_lock_init();
+    ps.abort_at = data->preview_count;
+    ps.results  = calloc( data->preview_count, sizeof( preview_result_t ) );
+
+    if ( thread_count < 1 ||
+         !taskset_init( &taskset, thread_count, sizeof( preview_thread_t ) ) )
+    {
+        hb_error( "scan: preview taskset init failed" );
+        thread_count = 0;
+    }
+    for ( i = 0; i < thread_count; i++ )
+    {
+        pt = taskset_thread_args( &taskset, i );
+        pt->ps = &ps;
+
+        /*
+         * The stream and the decoder of each thread see a private copy
+         * of the title, so that the closed captions the decoder finds
+         * and the audio ids the stream selects don't change under the
+         * other threads.
+         */
+        pt->shadow = *title;
+        pt->shadow.list_audio = hb_list_init();
+        for ( j = 0; j < hb_list_count( title->list_audio ); j++ )
         {
-            hb_audio_t * audio = hb_list_item( title->list_audio, j );
-            if ( audio->priv.scan_cache )
-            {
-                hb_fifo_flush( audio->priv.scan_cache );
-            }
+            hb_list_add( pt->shadow.list_audio,
+                         hb_list_item( title->list_audio, j ) );
         }
-        if (vid_buf)
+        pt->shadow.list_subtitle = hb_list_init();
+        for ( j = 0; j < hb_list_count( title->list_subtitle ); j++ )
         {
-            hb_buffer_close( &vid_buf );
+            hb_list_add( pt->shadow.list_subtitle,
+                         hb_list_item( title->list_subtitle, j ) );
         }
-        if (abort)
+        pt->subtitle_count = hb_list_count( title->list_subtitle );
+        taskset_thread_spawn( &taskset, i, "scan_preview",
+                              DecodePreviewsThread, HB_NORMAL_PRIORITY );
+    }
+    if ( thread_count > 0 )
+    {
+        taskset_cycle( &taskset );
+        for ( i = 0; i < thread_count; i++ )
         {
-            break;
+            MergeSubtitles( title, taskset_thread_args( &taskset, i ) );
         }
+        taskset_fini( &taskset );
     }
-    UpdateState3(data, i);
+    hb_lock_close( &ps.lock );
 
-    vid_decoder->close( vid_decoder );
-    free( vid_decoder );
+    if ( *data->die )
+    {
+        free( ps.results );
+        free( info_list );
+        crop_record_free( crops );
+        return 0;
+    }
+    if ( !data->parallel_titles )
+    {
+        UpdateState3(data, ps.done);
+    }
 
-    if (stream != NULL)
+    for ( i = 0; i < ps.abort_at; i++ )
     {
-        hb_stream_close(&stream);
+        preview_result_t * r = &ps.results[i];
+
+        if ( !r->valid )
+            continue;
+        if ( previews_only )
+        {
+            ++npreviews;
+            continue;
+        }
+
+        remember_info( info_list, &r->info );
+        pulldown_count           += r->pulldown;
+        doubled_frame_count      += r->doubled;
+        progressive_count        += r->progressive;
+        interlaced_preview_count += r->interlaced;
+        if ( r->crop_valid )
+        {
+            record_crop( crops, r->crop[0], r->crop[1], r->crop[2], r->crop[3] );
+        }
+        ++npreviews;
     }
+    free( ps.results );
 
-    if ( npreviews )
+    if ( npreviews && !previews_only )
     {
         // use the most common frame info for our final title dimensions
         hb_work_info_t vid_info;
@@ -980,12 +1423,13 @@ skip_preview:
             title->crop[3] = EVEN( crops->r[i] );
         }
 
+        char arstr[32];
         hb_log( "scan: %d previews, %dx%d, %.3f fps, autocrop = %d/%d/%d/%d, "
                 "aspect %s, PAR %d:%d",
                 npreviews, title->geometry.width, title->geometry.height,
                 (float)title->vrate.num / title->vrate.den,
                 title->crop[0], title->crop[1], title->crop[2], title->crop[3],
-                aspect_to_string(&title->dar),
+                aspect_to_string(&title->dar, arstr),
                 title->geometry.par.num, title->geometry.par.den);
 
         if( interlaced_preview_count >= ( npreviews / 2 ) )
@@ -1002,12 +1446,6 @@ skip_preview:
     crop_record_free( crops );
     free( info_list );
 
-    while( ( buf_es = hb_list_item( list_es, 0 ) ) )
-    {
-        hb_list_rem( list_es, buf_es );
-        hb_buffer_close( &buf_es );
-    }
-    hb_list_close( &list_es );
     if (data->bd)
       hb_bd_stop( data->bd );
     if (data->dvd)
@@ -0,0 +1,556 @@
+/* scan_cache.c
+
+   Copyright (c) 2003-2014 HandBrake Team
+   This file is part of the HandBrake source code
+   Homepage: <http://handbrake.fr/>.
+   It may be used under the terms of the GNU General Public License v2.
+   For full terms see the file COPYING file or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*
+ * Persistent scan cache for file sources.
+ *
+ * Decoding previews (crop, interlace and pulldown detection) and probing
+ * the audio tracks are by far the most expensive parts of scanning a
+ * file.  Their results are saved per source file as json under
+ * hb_get_cache_directory()/scan and reused when the same, unchanged,
+ * file is scanned again.
+ *
+ * A cache entry is only used when the path, size, mtime and a hash of
+ * the beginning, middle and end of the file all match, and it was made
+ * by the same build with the same preview count.
+ *
+ * The entry holds the title as hb_title_to_json() prints it plus a
+ * "Scan" dict with the internal fields the public form doesn't carry.
+ * Stream discovery (hb_stream_open / hb_stream_title_scan) still runs on
+ * a hit, it is cheap and it sets up the demuxer state that isn't cached.
+ */
+
+#include <jansson.h>
+#include "hb.h"
+#include "hb_json.h"
+#include "opencl.h"
+#include "audio_remap.h"
+
+#define SCAN_CACHE_VERSION     1
+#define SCAN_CACHE_HASH_BLOCK  (64 * 1024)
+
+struct hb_scan_cache_s
+{
+    char     * path;
+    char       filename[1024];
+    int64_t    size;
+    int64_t    mtime;
+    char       hash[17];
+    int        preview_count;
+    json_t   * entry;           // cached entry, NULL on a miss
+};
+
+static int scan_cache_enabled = 1;
+static int scan_cache_sequence;     // makes temporary file names unique
+
+void hb_scan_cache_enable( int enable )
+{
+    scan_cache_enabled = enable;
+}
+
+static uint64_t fnv1a( uint64_t hash, const uint8_t * data, size_t len )
+{
+    size_t ii;
+
+    for( ii = 0; ii < len; ii++ )
+    {
+        hash ^= data[ii];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/*
+ * Hash the file size and a block from the start, middle and end of the
+ * file.  Reading the whole file would cost as much as the scan itself.
+ */
+static int hash_file( const char * path, int64_t size, char hash[17] )
+{
+    uint8_t  * block;
+    uint64_t   h = 0xcbf29ce484222325ULL;
+    int64_t    pos[3];
+    FILE     * file;
+    int        ii;
+
+    file = hb_fopen( path, "rb" );
+    if( file == NULL )
+        return -1;
+
+    block = malloc( SCAN_CACHE_HASH_BLOCK );
+    if( block == NULL )
+    {
+        fclose( file );
+        return -1;
+    }
+
+    pos[0] = 0;
+    pos[1] = size / 2;
+    pos[2] = size - SCAN_CACHE_HASH_BLOCK;
+    h = fnv1a( h, (uint8_t*)&size, sizeof(size) );
+    for( ii = 0; ii < 3; ii++ )
+    {
+        size_t len;
+
+        if( pos[ii] < 0 )
+            pos[ii] = 0;
+        if( fseeko( file, pos[ii], SEEK_SET ) != 0 )
+            break;
+        len = fread( block, 1, SCAN_CACHE_HASH_BLOCK, file );
+        h = fnv1a( h, block, len );
+    }
+    free( block );
+    fclose( file );
+
+    if( ii < 3 )
+        return -1;
+
+    snprintf( hash, 17, "%016"PRIx64, h );
+    return 0;
+}
+
+static json_t * chan_map_to_json( hb_chan_map_t * map )
+{
+    if( map == &hb_libav_chan_map )
+        return json_string( "libav" );
+    if( map == &hb_liba52_chan_map )
+        return json_string( "liba52" );
+    if( map == &hb_vorbis_chan_map )
+        return json_string( "vorbis" );
+    if( map == &hb_aac_chan_map )
+        return json_string( "aac" );
+    return json_null();
+}
+
+static hb_chan_map_t * json_to_chan_map( json_t * name )
+{
+    const char * s = json_string_value( name );
+
+    if( s == NULL )
+        return NULL;
+    if( !strcmp( s, "libav" ) )
+        return &hb_libav_chan_map;
+    if( !strcmp( s, "liba52" ) )
+        return &hb_liba52_chan_map;
+    if( !strcmp( s, "vorbis" ) )
+        return &hb_vorbis_chan_map;
+    if( !strcmp( s, "aac" ) )
+        return &hb_aac_chan_map;
+    return NULL;
+}
+
+static int entry_matches( hb_scan_cache_t * c, json_t * entry )
+{
+    json_int_t   version, build, size, mtime, preview_count;
+    const char * path, * hash;
+    json_error_t error;
+
+    if( json_unpack_ex( entry, &error, 0, "{s:I, s:I, s:s, s:I, s:I, s:s, s:I}",
+                        "Version",      &version,
+                        "Build",        &build,
+                        "Path",         &path,
+                        "Size",         &size,
+                        "MTime",        &mtime,
+                        "Hash",         &hash,
+                        "PreviewCount", &preview_count ) < 0 )
+    {
+        hb_deep_log( 2, "scan cache: bad entry %s (%s)",
+                     c->filename, error.text );
+        return 0;
+    }
+    return version       == SCAN_CACHE_VERSION &&
+           build         == HB_PROJECT_BUILD &&
+           size          == c->size &&
+           mtime         == c->mtime &&
+           preview_count == c->preview_count &&
+           !strcmp( path, c->path ) &&
+           !strcmp( hash, c->hash );
+}
+
+/***********************************************************************
+ * hb_scan_cache_open
+ ***********************************************************************
+ * Looks up the cache entry of source file 'path'.  Returns NULL if the
+ * cache is disabled or 'path' is not a regular file.
+ **********************************************************************/
+hb_scan_cache_t * hb_scan_cache_open( const char * path, int preview_count )
+{
+    hb_scan_cache_t * c;
+    hb_stat_t         st;
+    char              dir[512];
+    FILE            * file;
+
+    if( !scan_cache_enabled || path == NULL )
+        return NULL;
+    if( hb_stat( path, &st ) != 0 || !S_ISREG( st.st_mode ) )
+        return NULL;
+
+    c = calloc( sizeof( hb_scan_cache_t ), 1 );
+    if( c == NULL )
+        return NULL;
+    c->path          = strdup( path );
+    c->size          = st.st_size;
+    c->mtime         = st.st_mtime;
+    c->preview_count = preview_count;
+    if( hash_file( path, c->size, c->hash ) != 0 )
+    {
+        hb_scan_cache_close( &c );
+        return NULL;
+    }
+
+    hb_get_cache_directory( dir );
+    snprintf( c->filename, sizeof( c->filename ), "%s/scan/%016"PRIx64".json",
+              dir, fnv1a( 0xcbf29ce484222325ULL,
+                          (const uint8_t*)path, strlen( path ) ) );
+
+    file = hb_fopen( c->filename, "rb" );
+    if( file != NULL )
+    {
+        json_error_t error;
+        json_t * entry = json_loadf( file, 0, &error );
+        fclose( file );
+
+        if( entry != NULL && entry_matches( c, entry ) )
+        {
+            c->entry = entry;
+        }
+        else
+        {
+            json_decref( entry );
+        }
+    }
+    return c;
+}
+
+void hb_scan_cache_close( hb_scan_cache_t ** _c )
+{
+    hb_scan_cache_t * c = *_c;
+
+    if( c == NULL )
+        return;
+    json_decref( c->entry );
+    free( c->path );
+    free( c );
+    *_c = NULL;
+}
+
+/***********************************************************************
+ * hb_scan_cache_apply
+ ***********************************************************************
+ * Fills in the preview and audio probe results of 'title' from the
+ * cache.  Returns 1 on success.  On failure 'title' is left untouched
+ * and must be scanned normally.
+ **********************************************************************/
+int hb_scan_cache_apply( hb_scan_cache_t * c, hb_title_t * title )
+{
+    json_t     * t, * audio_list, * audio_scan, * subtitle_list;
+    json_int_t   width, height, par_num, par_den, crop[4];
+    json_int_t   color_prim, color_transfer, color_matrix;
+    json_int_t   rate_num, rate_den, dar_num, dar_den;
+    json_int_t   video_bitrate, decode_support, video_id;
+    int          interlaced, resolution_change;
+    const char * video_codec;
+    json_error_t error;
+    int          ii, jj;
+
+    if( c == NULL || c->entry == NULL )
+        return 0;
+
+    t = json_object_get( c->entry, "Title" );
+    if( json_unpack_ex( t, &error, 0,
+        "{s:{s:I, s:I, s:{s:I, s:I}}, s:[IIII], s:{s:I, s:I, s:I},"
+        " s:{s:I, s:I}, s:b, s:s, s:o, s:o,"
+        " s:{s:I, s:b, s:I, s:I, s:{s:I, s:I}, s:o}}",
+        "Geometry",
+            "Width",            &width,
+            "Height",           &height,
+            "PAR",
+                "Num",          &par_num,
+                "Den",          &par_den,
+        "Crop",                 &crop[0], &crop[1], &crop[2], &crop[3],
+        "Color",
+            "Primary",          &color_prim,
+            "Transfer",         &color_transfer,
+            "Matrix",           &color_matrix,
+        "FrameRate",
+            "Num",              &rate_num,
+            "Den",              &rate_den,
+        "InterlaceDetected",    &interlaced,
+        "VideoCodec",           &video_codec,
+        "AudioList",            &audio_list,
+        "SubtitleList",         &subtitle_list,
+        "Scan",
+            "VideoId",          &video_id,
+            "ResolutionChange", &resolution_change,
+            "VideoBitRate",     &video_bitrate,
+            "VideoDecodeSupport", &decode_support,
+            "DAR",
+                "Num",          &dar_num,
+                "Den",          &dar_den,
+            "AudioList",        &audio_scan ) < 0 )
+    {
+        hb_log( "scan cache: ignoring bad entry %s (%s)",
+                c->filename, error.text );
+        return 0;
+    }
+    if( video_id != title->video_id ||
+        !json_is_array( audio_list ) || !json_is_array( audio_scan ) ||
+        json_array_size( audio_list ) != json_array_size( audio_scan ) ||
+        !json_is_array( subtitle_list ) )
+    {
+        hb_log( "scan cache: entry doesn't match title %d", title->index );
+        return 0;
+    }
+
+    // Every cached audio must still be there
+    for( ii = 0; ii < json_array_size( audio_scan ); ii++ )
+    {
+        json_int_t id = json_integer_value(
+            json_object_get( json_array_get( audio_scan, ii ), "Id" ) );
+        for( jj = 0; jj < hb_list_count( title->list_audio ); jj++ )
+        {
+            hb_audio_t * audio = hb_list_item( title->list_audio, jj );
+            if( audio->id == id )
+                break;
+        }
+        if( jj == hb_list_count( title->list_audio ) )
+        {
+            hb_log( "scan cache: audio 0x%x missing from title %d",
+                    (int)id, title->index );
+            return 0;
+        }
+    }
+
+    title->geometry.width       = width;
+    title->geometry.height      = height;
+    title->geometry.par.num     = par_num;
+    title->geometry.par.den     = par_den;
+    title->dar.num              = dar_num;
+    title->dar.den              = dar_den;
+    title->crop[0]              = crop[0];
+    title->crop[1]              = crop[1];
+    title->crop[2]              = crop[2];
+    title->crop[3]              = crop[3];
+    title->color_prim           = color_prim;
+    title->color_transfer       = color_transfer;
+    title->color_matrix         = color_matrix;
+    title->vrate.num            = rate_num;
+    title->vrate.den            = rate_den;
+    title->detected_interlacing = interlaced;
+    title->has_resolution_change = resolution_change;
+    title->video_bitrate        = video_bitrate;
+    title->video_decode_support = decode_support;
+    title->opencl_support       = !!hb_opencl_available();
+    if( title->video_codec_name == NULL )
+    {
+        title->video_codec_name = strdup( video_codec );
+    }
+
+    // Audio tracks that aren't cached were dropped by the audio probe
+    for( jj = 0; jj < hb_list_count( title->list_audio ); )
+    {
+        hb_audio_t * audio = hb_list_item( title->list_audio, jj );
+        json_t     * a = NULL, * s = NULL;
+
+        for( ii = 0; ii < json_array_size( audio_scan ); ii++ )
+        {
+            s = json_array_get( audio_scan, ii );
+            if( json_integer_value( json_object_get( s, "Id" ) ) == audio->id )
+            {
+                a = json_array_get( audio_list, ii );
+                break;
+            }
+        }
+        if( a == NULL )
+        {
+            hb_list_rem( title->list_audio, audio );
+            free( audio );
+            continue;
+        }
+
+        audio->config.in.samplerate =
+            json_integer_value( json_object_get( a, "SampleRate" ) );
+        audio->config.in.bitrate =
+            json_integer_value( json_object_get( a, "BitRate" ) );
+        audio->config.in.channel_layout =
+            json_integer_value( json_object_get( a, "ChannelLayout" ) );
+        audio->config.in.samples_per_frame =
+            json_integer_value( json_object_get( s, "SamplesPerFrame" ) );
+        audio->config.in.matrix_encoding =
+            json_integer_value( json_object_get( s, "MatrixEncoding" ) );
+        audio->config.in.channel_map =
+            json_to_chan_map( json_object_get( s, "ChannelMap" ) );
+        audio->config.in.version =
+            json_integer_value( json_object_get( s, "Version" ) );
+        audio->config.in.flags =
+            json_integer_value( json_object_get( s, "Flags" ) );
+        audio->config.in.mode =
+            json_integer_value( json_object_get( s, "Mode" ) );
+        snprintf( audio->config.lang.description,
+                  sizeof( audio->config.lang.description ), "%s",
+                  json_string_value( json_object_get( a, "Description" ) ) );
+        jj++;
+    }
+
+    // Closed captions are found while decoding previews
+    for( ii = 0; ii < json_array_size( subtitle_list ); ii++ )
+    {
+        json_t        * s = json_array_get( subtitle_list, ii );
+        hb_subtitle_t * subtitle;
+
+        if( json_integer_value( json_object_get( s, "Source" ) ) != CC608SUB )
+            continue;
+        for( jj = 0; jj < hb_list_count( title->list_subtitle ); jj++ )
+        {
+            subtitle = hb_list_item( title->list_subtitle, jj );
+            if( subtitle->source == CC608SUB )
+                break;
+        }
+        if( jj < hb_list_count( title->list_subtitle ) )
+            continue;
+
+        subtitle = calloc( sizeof( hb_subtitle_t ), 1 );
+        subtitle->track = hb_list_count( title->list_subtitle );
+        subtitle->id = 0;
+        subtitle->format = TEXTSUB;
+        subtitle->source = CC608SUB;
+        subtitle->config.dest = PASSTHRUSUB;
+        subtitle->codec = WORK_DECCC608;
+        subtitle->type = 5;
+        snprintf( subtitle->lang, sizeof( subtitle->lang ), "%s",
+                  json_string_value( json_object_get( s, "Language" ) ) );
+        snprintf( subtitle->iso639_2, sizeof( subtitle->iso639_2 ), "%s",
+                  json_string_value( json_object_get( s, "LanguageCode" ) ) );
+        hb_list_add( title->list_subtitle, subtitle );
+    }
+
+    hb_log( "scan: using cached scan of title %d, %dx%d, %.3f fps, "
+            "autocrop = %d/%d/%d/%d",
+            title->index, title->geometry.width, title->geometry.height,
+            (float)title->vrate.num / title->vrate.den,
+            title->crop[0], title->crop[1], title->crop[2], title->crop[3] );
+    return 1;
+}
+
+/***********************************************************************
+ * hb_scan_cache_store
+ ***********************************************************************
+ * Saves the scan results of 'title'.  Failures are only logged, the
+ * cache is an optimization.
+ **********************************************************************/
+void hb_scan_cache_store( hb_scan_cache_t * c, hb_title_t * title )
+{
+    json_t     * entry, * t, * scan, * audio_scan;
+    char       * json_title;
+    char         dir[512], path[1024], tmp[1024];
+    json_error_t error;
+    FILE       * file;
+    int          ii;
+
+    if( c == NULL )
+        return;
+
+    json_title = hb_title_to_json( title );
+    if( json_title == NULL )
+        return;
+    t = json_loads( json_title, 0, &error );
+    free( json_title );
+    if( t == NULL )
+        return;
+
+    audio_scan = json_array();
+    for( ii = 0; ii < hb_list_count( title->list_audio ); ii++ )
+    {
+        hb_audio_t * audio = hb_list_item( title->list_audio, ii );
+
+        json_array_append_new( audio_scan, json_pack_ex( &error, 0,
+            "{s:o, s:o, s:o, s:o, s:o, s:o, s:o}",
+            "Id",               json_integer( audio->id ),
+            "SamplesPerFrame",  json_integer( audio->config.in.samples_per_frame ),
+            "MatrixEncoding",   json_integer( audio->config.in.matrix_encoding ),
+            "ChannelMap",       chan_map_to_json( audio->config.in.channel_map ),
+            "Version",          json_integer( audio->config.in.version ),
+            "Flags",            json_integer( audio->config.in.flags ),
+            "Mode",             json_integer( audio->config.in.mode ) ) );
+    }
+    scan = json_pack_ex( &error, 0,
+        "{s:o, s:o, s:o, s:o, s:{s:o, s:o}, s:o}",
+        "VideoId",              json_integer( title->video_id ),
+        "ResolutionChange",     json_boolean( title->has_resolution_change ),
+        "VideoBitRate",         json_integer( title->video_bitrate ),
+        "VideoDecodeSupport",   json_integer( title->video_decode_support ),
+        "DAR",
+            "Num",              json_integer( title->dar.num ),
+            "Den",              json_integer( title->dar.den ),
+        "AudioList",            audio_scan );
+    if( scan == NULL )
+    {
+        hb_error( "json pack failure: %s", error.text );
+        json_decref( t );
+        return;
+    }
+    json_object_set_new( t, "Scan", scan );
+
+    entry = json_pack_ex( &error, 0,
+        "{s:o, s:o, s:o, s:o, s:o, s:o, s:o, s:o}",
+        "Version",      json_integer( SCAN_CACHE_VERSION ),
+        "Build",        json_integer( HB_PROJECT_BUILD ),
+        "Path",         json_string( c->path ),
+        "Size",         json_integer( c->size ),
+        "MTime",        json_integer( c->mtime ),
+        "Hash",         json_string( c->hash ),
+        "PreviewCount", json_integer( c->preview_count ),
+        "Title",        t );
+    if( entry == NULL )
+    {
+        hb_error( "json pack failure: %s", error.text );
+        return;
+    }
+
+    // Create the cache directories as needed
+    hb_get_cache_directory( dir );
+    snprintf( path, sizeof( path ), "%s", dir );
+    if( strrchr( path, '/' ) != NULL )
+    {
+        *strrchr( path, '/' ) = 0;
+        hb_mkdir( path );
+    }
+    hb_mkdir( dir );
+    snprintf( path, sizeof( path ), "%s/scan", dir );
+    hb_mkdir( path );
+
+    // Write a temporary file and rename it so that concurrent scans
+    // never see a partial entry.  Scans of several handles or titles of
+    // one process can store the same file at once.
+    snprintf( tmp, sizeof( tmp ), "%s.%d.%d.tmp", c->filename, (int)getpid(),
+              __atomic_add_fetch( &scan_cache_sequence, 1, __ATOMIC_RELAXED ) );
+    file = hb_fopen( tmp, "wb" );
+    if( file == NULL )
+    {
+        hb_deep_log( 2, "scan cache: can't create %s", tmp );
+        json_decref( entry );
+        return;
+    }
+    ii = json_dumpf( entry, file, JSON_INDENT(4)|JSON_PRESERVE_ORDER );
+    json_decref( entry );
+    if( fclose( file ) != 0 || ii != 0 )
+    {
+        remove( tmp );
+        return;
+    }
+#if defined( SYS_MINGW )
+    remove( c->filename );
+#endif
+    if( rename( tmp, c->filename ) != 0 )
+    {
+        remove( tmp );
+        return;
+    }
+    hb_deep_log( 2, "scan cache: saved title %d to %s",
+                 title->index, c->filename );
+}
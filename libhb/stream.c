@@ -11,6 +11,11 @@
 #include <ctype.h>
 #include <errno.h>
 
+#if !defined( SYS_MINGW )
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 #include "hb.h"
 #include "hbffmpeg.h"
 #include "lang.h"
@@ -109,6 +114,8 @@ typedef enum {
 } hb_stream_type_t;
 
 #define MAX_PS_PROBE_SIZE (5*1024*1024)
+#define STREAM_READ_AHEAD_SIZE (1*1024*1024)
+#define STREAM_MAP_WINDOW_SIZE (64*1024*1024)
 #define kMaxNumberPMTStreams 32
 
 typedef struct {
@@ -197,6 +204,14 @@ struct hb_stream_s
 
     char    *path;
     FILE    *file_handle;
+    int      mapped;            // read through 'map', see stream_file_open()
+    uint8_t *map;               // window of the file mapped into memory
+    int64_t  map_off;           // file offset of the window
+    int64_t  map_len;
+    uint8_t *map_prev;          // previous window
+    int64_t  map_prev_len;
+    int64_t  map_pos;           // read position when mapped
+    int64_t  file_size;         // when the window last moved
     hb_stream_type_t hb_stream_type;
     hb_title_t *title;
 
@@ -285,6 +300,262 @@ static void hb_ps_resolve_stream_types(hb_stream_t *stream);
 void hb_ts_stream_reset(hb_stream_t *stream);
 void hb_ps_stream_reset(hb_stream_t *stream);
 
+/*
+ * File access for transport & program streams.
+ *
+ * Regular files are read through a window of the file mapped into
+ * memory, so that next_packet() can return pointers straight into the
+ * mapping and most seeks are just offset updates.  The window moves
+ * along with the read position.  Every time it moves the file size is
+ * checked again, so a file that is still being written is read to its
+ * current end.  A file that shrank (where touching the old pages would
+ * raise SIGBUS), a failed mapping, a file that isn't regular and mingw
+ * all use stdio with a large read-ahead buffer instead.
+ */
+static void stream_file_open( hb_stream_t *stream, FILE *f )
+{
+    stream->file_handle = f;
+    stream->mapped = 0;
+    stream->map = NULL;
+    stream->map_off = 0;
+    stream->map_len = 0;
+    stream->map_prev = NULL;
+    stream->map_prev_len = 0;
+    stream->map_pos = 0;
+    stream->file_size = 0;
+
+#if !defined( SYS_MINGW )
+    struct stat st;
+
+    if ( fstat( fileno( f ), &st ) == 0 && S_ISREG( st.st_mode ) )
+    {
+        // The first window is mapped on the first read
+        stream->mapped = 1;
+        stream->file_size = st.st_size;
+        return;
+    }
+#endif
+    setvbuf( f, NULL, _IOFBF, STREAM_READ_AHEAD_SIZE );
+}
+
+static void stream_file_close( hb_stream_t *stream )
+{
+#if !defined( SYS_MINGW )
+    if ( stream->map != NULL )
+    {
+        munmap( stream->map, stream->map_len );
+    }
+    if ( stream->map_prev != NULL )
+    {
+        munmap( stream->map_prev, stream->map_prev_len );
+    }
+#endif
+    stream->mapped = 0;
+    stream->map = NULL;
+    stream->map_len = 0;
+    stream->map_prev = NULL;
+    stream->map_prev_len = 0;
+    stream->map_pos = 0;
+    if ( stream->file_handle != NULL )
+    {
+        fclose( stream->file_handle );
+        stream->file_handle = NULL;
+    }
+}
+
+#if !defined( SYS_MINGW )
+// Continues at the current read position with stdio.  The windows stay
+// mapped until the file is closed, the last packet may point into one.
+static void stream_map_fallback( hb_stream_t *stream, const char *why )
+{
+    hb_deep_log( 2, "stream: %s, using stdio", why );
+    stream->mapped = 0;
+    setvbuf( stream->file_handle, NULL, _IOFBF, STREAM_READ_AHEAD_SIZE );
+    fseeko( stream->file_handle, stream->map_pos, SEEK_SET );
+}
+
+// Updates the file size, returns -1 if the file can't be mapped any more
+static int stream_map_stat( hb_stream_t *stream )
+{
+    struct stat st;
+
+    if ( fstat( fileno( stream->file_handle ), &st ) != 0 )
+    {
+        stream_map_fallback( stream, strerror( errno ) );
+        return -1;
+    }
+    if ( st.st_size < stream->file_size )
+    {
+        stream_map_fallback( stream, "file was truncated" );
+        return -1;
+    }
+    stream->file_size = st.st_size;
+    return 0;
+}
+
+/*
+ * Maps a window that starts at the read position.  Returns the bytes
+ * mapped from the read position on, or -1 after falling back to stdio.
+ */
+static int64_t stream_map_window( hb_stream_t *stream )
+{
+    int64_t off, len;
+    void *map;
+
+    if ( stream_map_stat( stream ) < 0 )
+    {
+        return -1;
+    }
+    if ( stream->map != NULL && stream->map_pos >= stream->map_off &&
+         stream->map_off + stream->map_len >= stream->file_size )
+    {
+        // Still at the end of the file, nothing new to map
+        return MAX( stream->map_off + stream->map_len - stream->map_pos, 0 );
+    }
+    if ( stream->map_pos >= stream->file_size )
+    {
+        return 0;
+    }
+
+    off = stream->map_pos & ~(int64_t)( sysconf( _SC_PAGESIZE ) - 1 );
+    len = MIN( STREAM_MAP_WINDOW_SIZE, stream->file_size - off );
+    map = mmap( NULL, len, PROT_READ, MAP_SHARED,
+                fileno( stream->file_handle ), off );
+    if ( map == MAP_FAILED )
+    {
+        stream_map_fallback( stream, strerror( errno ) );
+        return -1;
+    }
+    posix_madvise( map, len, POSIX_MADV_SEQUENTIAL );
+
+    // Keep the current window for a packet handed out from it
+    if ( stream->map_prev != NULL )
+    {
+        munmap( stream->map_prev, stream->map_prev_len );
+    }
+    stream->map_prev = stream->map;
+    stream->map_prev_len = stream->map_len;
+    stream->map = map;
+    stream->map_off = off;
+    stream->map_len = len;
+
+    return off + len - stream->map_pos;
+}
+#endif
+
+/*
+ * Returns the bytes mapped from the read position on, at least 'len'
+ * unless the file ends first.  Returns -1 if the stream uses stdio.
+ */
+static inline int64_t stream_map_avail( hb_stream_t *stream, int64_t len )
+{
+#if !defined( SYS_MINGW )
+    if ( stream->mapped )
+    {
+        int64_t avail = stream->map_off + stream->map_len - stream->map_pos;
+
+        if ( stream->map != NULL && stream->map_pos >= stream->map_off &&
+             avail >= len )
+        {
+            return avail;
+        }
+        return stream_map_window( stream );
+    }
+#endif
+    return -1;
+}
+
+static inline const uint8_t * stream_map_ptr( hb_stream_t *stream )
+{
+    return stream->map + ( stream->map_pos - stream->map_off );
+}
+
+static size_t stream_read( hb_stream_t *stream, void *buf, size_t len )
+{
+    size_t done = 0;
+
+    while ( done < len )
+    {
+        int64_t avail = stream_map_avail( stream, len - done );
+
+        if ( avail < 0 )
+        {
+            return done + fread( (uint8_t*)buf + done, 1, len - done,
+                                 stream->file_handle );
+        }
+        if ( avail == 0 )
+        {
+            break;
+        }
+        avail = MIN( avail, len - done );
+        memcpy( (uint8_t*)buf + done, stream_map_ptr( stream ), avail );
+        stream->map_pos += avail;
+        done += avail;
+    }
+    return done;
+}
+
+static int stream_seek( hb_stream_t *stream, int64_t offset, int whence )
+{
+#if !defined( SYS_MINGW )
+    if ( stream->mapped && whence == SEEK_END )
+    {
+        stream_map_stat( stream );
+    }
+    if ( stream->mapped )
+    {
+        if ( whence == SEEK_CUR )
+            offset += stream->map_pos;
+        else if ( whence == SEEK_END )
+            offset += stream->file_size;
+        if ( offset < 0 )
+        {
+            errno = EINVAL;
+            return -1;
+        }
+        stream->map_pos = offset;
+        return 0;
+    }
+#endif
+    return fseeko( stream->file_handle, offset, whence );
+}
+
+static int64_t stream_tell( hb_stream_t *stream )
+{
+    if ( stream->mapped )
+        return stream->map_pos;
+    return ftello( stream->file_handle );
+}
+
+// stream_getc() must be bracketed by stream_lock() / stream_unlock().
+// The stream can fall back to stdio in between, so always lock.
+static inline void stream_lock( hb_stream_t *stream )
+{
+    flockfile( stream->file_handle );
+}
+
+static inline void stream_unlock( hb_stream_t *stream )
+{
+    funlockfile( stream->file_handle );
+}
+
+static inline int stream_getc( hb_stream_t *stream )
+{
+    int64_t avail = stream_map_avail( stream, 1 );
+
+    if ( avail > 0 )
+    {
+        int c = *stream_map_ptr( stream );
+        stream->map_pos++;
+        return c;
+    }
+    if ( avail == 0 )
+    {
+        return EOF;
+    }
+    return getc_unlocked( stream->file_handle );
+}
+
 /*
  * logging routines.
  * these frontend hb_log because transport streams can have a lot of errors
@@ -544,7 +815,7 @@ static int hb_stream_check_for_ps(hb_stream_t *stream)
     uint8_t sc_buf[4];
     int pos = 0;
 
-    fseek(stream->file_handle, 0, SEEK_SET);
+    stream_seek(stream, 0, SEEK_SET);
 
     // program streams should start with a PACK then some other mpeg start
     // code (usually a SYS but that might be missing if we only have a clip).
@@ -552,7 +823,7 @@ static int hb_stream_check_for_ps(hb_stream_t *stream)
     {
         int offset;
 
-        if ( fread(buf, 1, sizeof(buf), stream->file_handle) != sizeof(buf) )
+        if ( stream_read(stream, buf, sizeof(buf)) != sizeof(buf) )
             return 0;
 
         for ( offset = 0; offset < 8*1024-27; ++offset )
@@ -582,23 +853,23 @@ static int hb_stream_check_for_ps(hb_stream_t *stream)
                 data_len = (b[4] << 8) + b[5];
                 if ( data_len && sid > 0xba && sid < 0xf9 )
                 {
-                    prev = ftell( stream->file_handle );
+                    prev = stream_tell( stream );
                     pos = prev - ( sizeof(buf) - offset );
                     pos += pes_offset + 6 + data_len;
-                    fseek( stream->file_handle, pos, SEEK_SET );
-                    if ( fread(sc_buf, 1, 4, stream->file_handle) != 4 )
+                    stream_seek( stream, pos, SEEK_SET );
+                    if ( stream_read(stream, sc_buf, 4) != 4 )
                         return 0;
                     if (sc_buf[0] == 0x00 && sc_buf[1] == 0x00 &&
                         sc_buf[2] == 0x01)
                     {
                         return 1;
                     }
-                    fseek( stream->file_handle, prev, SEEK_SET );
+                    stream_seek( stream, prev, SEEK_SET );
                 }
             }
         }
-        fseek( stream->file_handle, -27, SEEK_CUR );
-        pos = ftell( stream->file_handle );
+        stream_seek( stream, -27, SEEK_CUR );
+        pos = stream_tell( stream );
     }
     return 0;
 }
@@ -607,7 +878,7 @@ static int hb_stream_get_type(hb_stream_t *stream)
 {
     uint8_t buf[2048*4];
 
-    if ( fread(buf, 1, sizeof(buf), stream->file_handle) == sizeof(buf) )
+    if ( stream_read(stream, buf, sizeof(buf)) == sizeof(buf) )
     {
 #ifdef USE_HWD
         if ( hb_gui_use_hwd_flag == 1 )
@@ -640,11 +911,7 @@ static int hb_stream_get_type(hb_stream_t *stream)
 
 static void hb_stream_delete_dynamic( hb_stream_t *d )
 {
-    if( d->file_handle )
-    {
-        fclose( d->file_handle );
-        d->file_handle = NULL;
-    }
+    stream_file_close( d );
 
     int i=0;
 
@@ -839,7 +1106,7 @@ hb_stream_t * hb_stream_open( char *path, hb_title_t *title, int scan )
      * If it's something we can deal with (MPEG2 PS or TS) return a stream
      * reference structure & null otherwise.
      */
-    d->file_handle = f;
+    stream_file_open( d, f );
     d->title = title;
     d->scan = scan;
     d->path = strdup( path );
@@ -856,17 +1123,13 @@ hb_stream_t * hb_stream_open( char *path, hb_title_t *title, int scan )
             hb_stream_seek( d, 0. );
             return d;
         }
-        fclose( d->file_handle );
-        d->file_handle = NULL;
+        stream_file_close( d );
         if ( ffmpeg_open( d, title, scan ) )
         {
             return d;
         }
     }
-    if ( d->file_handle )
-    {
-        fclose( d->file_handle );
-    }
+    stream_file_close( d );
     if (d->path)
     {
         free( d->path );
@@ -1135,21 +1398,38 @@ hb_title_t * hb_stream_title_scan(hb_stream_t *stream, hb_title_t * title)
  */
 static const uint8_t *next_packet( hb_stream_t *stream )
 {
-    uint8_t *buf = stream->ts.packet + stream->packetsize - 188;
+    const uint8_t *buf;
 
     while ( 1 )
     {
-        if ( fread(stream->ts.packet, 1, stream->packetsize, stream->file_handle) !=
-             stream->packetsize )
+        int64_t avail = stream_map_avail( stream, stream->packetsize );
+        if ( avail >= 0 )
         {
-            return NULL;
+            // Hand out the packet in place, no copy.  It stays valid
+            // until the window moves twice.
+            if ( avail < stream->packetsize )
+            {
+                return NULL;
+            }
+            buf = stream_map_ptr( stream );
+            stream->map_pos += stream->packetsize;
         }
+        else
+        {
+            if ( fread(stream->ts.packet, 1, stream->packetsize,
+                       stream->file_handle) != stream->packetsize )
+            {
+                return NULL;
+            }
+            buf = stream->ts.packet;
+        }
+        buf += stream->packetsize - 188;
         if (buf[0] == 0x47)
         {
             return buf;
         }
         // lost sync - back up to where we started then try to re-establish.
-        off_t pos = ftello(stream->file_handle) - stream->packetsize;
+        off_t pos = stream_tell(stream) - stream->packetsize;
         off_t pos2 = align_to_next_packet(stream);
         if ( pos2 == 0 )
         {
@@ -1170,21 +1450,21 @@ static void skip_to_next_pack( hb_stream_t *src_stream )
     uint32_t strt_code = -1;
     int c;
 
-    flockfile( src_stream->file_handle );
-    while ( ( c = getc_unlocked( src_stream->file_handle ) ) != EOF )
+    stream_lock( src_stream );
+    while ( ( c = stream_getc( src_stream ) ) != EOF )
     {
         strt_code = ( strt_code << 8 ) | c;
         if ( strt_code == 0x000001ba )
             // we found the start of the next pack
             break;
     }
-    funlockfile( src_stream->file_handle );
+    stream_unlock( src_stream );
 
     // if we didn't terminate on an eof back up so the next read
     // starts on the pack boundary.
     if ( c != EOF )
     {
-        fseeko( src_stream->file_handle, -4, SEEK_CUR );
+        stream_seek( src_stream, -4, SEEK_CUR );
     }
 }
 
@@ -1543,7 +1823,7 @@ static struct pts_pos hb_sample_pts(hb_stream_t *stream, uint64_t fpos)
     {
         const uint8_t *buf;
         int adapt_len;
-        fseeko( stream->file_handle, fpos, SEEK_SET );
+        stream_seek( stream, fpos, SEEK_SET );
         align_to_next_packet( stream );
         int pid = stream->ts.list[ts_index_of_video(stream)].pid;
         buf = hb_ts_stream_getPEStype( stream, pid, &adapt_len );
@@ -1571,7 +1851,7 @@ static struct pts_pos hb_sample_pts(hb_stream_t *stream, uint64_t fpos)
                 ++stream->has_IDRs;
             }
         }
-        pp.pos = ftello(stream->file_handle);
+        pp.pos = stream_tell(stream);
         if ( !stream->has_IDRs )
         {
             // Scan a little more to see if we will stumble upon one
@@ -1596,7 +1876,7 @@ static struct pts_pos hb_sample_pts(hb_stream_t *stream, uint64_t fpos)
 
         // round address down to nearest dvd sector start
         fpos &=~ ( HB_DVD_READ_BUFFER_SIZE - 1 );
-        fseeko( stream->file_handle, fpos, SEEK_SET );
+        stream_seek( stream, fpos, SEEK_SET );
         if ( stream->hb_stream_type == program )
         {
             skip_to_next_pack( stream );
@@ -1641,7 +1921,7 @@ static struct pts_pos hb_sample_pts(hb_stream_t *stream, uint64_t fpos)
         }
 
         pp.pts = pes_info.pts;
-        pp.pos = ftello(stream->file_handle);
+        pp.pos = stream_tell(stream);
     }
     return pp;
 }
@@ -1701,8 +1981,8 @@ static void hb_stream_duration(hb_stream_t *stream, hb_title_t *inTitle)
     struct pts_pos *pp = ptspos;
     int i;
 
-    fseeko(stream->file_handle, 0, SEEK_END);
-    uint64_t fsize = ftello(stream->file_handle);
+    stream_seek(stream, 0, SEEK_END);
+    uint64_t fsize = stream_tell(stream);
     uint64_t fincr = fsize / NDURSAMPLES;
     uint64_t fpos = fincr / 2;
     for ( i = NDURSAMPLES; --i >= 0; fpos += fincr )
@@ -1716,7 +1996,7 @@ static void hb_stream_duration(hb_stream_t *stream, hb_title_t *inTitle)
     inTitle->minutes  = ( dur % 3600 ) / 60;
     inTitle->seconds  = dur % 60;
 
-    rewind(stream->file_handle);
+    stream_seek(stream, 0, SEEK_SET);
 }
 
 /***********************************************************************
@@ -1811,16 +2091,16 @@ int hb_stream_seek( hb_stream_t * stream, float f )
     }
     off_t stream_size, cur_pos, new_pos;
     double pos_ratio = f;
-    cur_pos = ftello( stream->file_handle );
-    fseeko( stream->file_handle, 0, SEEK_END );
-    stream_size = ftello( stream->file_handle );
+    cur_pos = stream_tell( stream );
+    stream_seek( stream, 0, SEEK_END );
+    stream_size = stream_tell( stream );
     new_pos = (off_t) ((double) (stream_size) * pos_ratio);
     new_pos &=~ (HB_DVD_READ_BUFFER_SIZE - 1);
 
-    int r = fseeko( stream->file_handle, new_pos, SEEK_SET );
+    int r = stream_seek( stream, new_pos, SEEK_SET );
     if (r == -1)
     {
-        fseeko( stream->file_handle, cur_pos, SEEK_SET );
+        stream_seek( stream, cur_pos, SEEK_SET );
         return 0;
     }
 
@@ -2394,18 +2674,18 @@ static off_t align_to_next_packet(hb_stream_t *stream)
 {
     uint8_t buf[MAX_HOLE];
     off_t pos = 0;
-    off_t start = ftello(stream->file_handle);
+    off_t start = stream_tell(stream);
     off_t orig;
 
     if ( start >= stream->packetsize ) {
         start -= stream->packetsize;
-        fseeko(stream->file_handle, start, SEEK_SET);
+        stream_seek(stream, start, SEEK_SET);
     }
     orig = start;
 
     while (1)
     {
-        if (fread(buf, sizeof(buf), 1, stream->file_handle) == 1)
+        if (stream_read(stream, buf, sizeof(buf)) == sizeof(buf))
         {
             const uint8_t *bp = buf;
             int i;
@@ -2422,15 +2702,15 @@ static off_t align_to_next_packet(hb_stream_t *stream)
                 pos = ( bp - buf ) - stream->packetsize + 188;
                 break;
             }
-            fseeko(stream->file_handle, -8 * stream->packetsize, SEEK_CUR);
-            start = ftello(stream->file_handle);
+            stream_seek(stream, -8 * stream->packetsize, SEEK_CUR);
+            start = stream_tell(stream);
         }
         else
         {
             return 0;
         }
     }
-    fseeko(stream->file_handle, start+pos, SEEK_SET);
+    stream_seek(stream, start+pos, SEEK_SET);
     return start - orig + pos;
 }
 
@@ -3245,8 +3525,8 @@ static int hb_ps_read_packet( hb_stream_t * stream, hb_buffer_t *b )
     int c;
 
 #define cp (b->data)
-    flockfile( stream->file_handle );
-    while ( ( c = getc_unlocked( stream->file_handle ) ) != EOF )
+    stream_lock( stream );
+    while ( ( c = stream_getc( stream ) ) != EOF )
     {
         start_code = ( start_code << 8 ) | c;
         if ( ( start_code >> 8 )== 0x000001 )
@@ -3278,17 +3558,17 @@ static int hb_ps_read_packet( hb_stream_t * stream, hb_buffer_t *b )
         }
 
         // There are at least 8 bytes.  More if this is mpeg2 pack.
-        fread( cp+pos, 1, 8, stream->file_handle );
+        stream_read( stream, cp+pos, 8 );
         int mark = cp[pos] >> 4;
         pos += 8;
 
         if ( mark != 0x02 )
         {
             // mpeg-2 pack,
-            fread( cp+pos, 1, 2, stream->file_handle );
+            stream_read( stream, cp+pos, 2 );
             pos += 2;
             int len = cp[start+13] & 0x7;
-            fread( cp+pos, 1, len, stream->file_handle );
+            stream_read( stream, cp+pos, len );
             pos += len;
         }
     }
@@ -3298,11 +3578,11 @@ static int hb_ps_read_packet( hb_stream_t * stream, hb_buffer_t *b )
     else if ( stream_id >= 0xbb )
     {
         int len = 0;
-        c = getc_unlocked( stream->file_handle );
+        c = stream_getc( stream );
         if ( c == EOF )
             goto done;
         len = c << 8;
-        c = getc_unlocked( stream->file_handle );
+        c = stream_getc( stream );
         if ( c == EOF )
             goto done;
         len |= c;
@@ -3318,7 +3598,7 @@ static int hb_ps_read_packet( hb_stream_t * stream, hb_buffer_t *b )
         if ( len )
         {
             // Length is non-zero, read the packet all at once
-            len = fread( cp+pos, 1, len, stream->file_handle );
+            len = stream_read( stream, cp+pos, len );
             pos += len;
         }
         else
@@ -3326,7 +3606,7 @@ static int hb_ps_read_packet( hb_stream_t * stream, hb_buffer_t *b )
             // Length is zero, read bytes till we find a start code.
             // Only video PES packets are allowed to have zero length.
             start_code = -1;
-            while ( ( c = getc_unlocked( stream->file_handle ) ) != EOF )
+            while ( ( c = stream_getc( stream ) ) != EOF )
             {
                 start_code = ( start_code << 8 ) | c;
                 if ( pos  >= b->alloc )
@@ -3345,14 +3625,14 @@ static int hb_ps_read_packet( hb_stream_t * stream, hb_buffer_t *b )
             if ( c == EOF )
                 goto done;
             pos -= 4;
-            fseeko( stream->file_handle, -4, SEEK_CUR );
+            stream_seek( stream, -4, SEEK_CUR );
         }
     }
     else
     {
         // Unknown, find next start code
         start_code = -1;
-        while ( ( c = getc_unlocked( stream->file_handle ) ) != EOF )
+        while ( ( c = stream_getc( stream ) ) != EOF )
         {
             start_code = ( start_code << 8 ) | c;
             if ( pos  >= b->alloc )
@@ -3369,11 +3649,11 @@ static int hb_ps_read_packet( hb_stream_t * stream, hb_buffer_t *b )
         if ( c == EOF )
             goto done;
         pos -= 4;
-        fseeko( stream->file_handle, -4, SEEK_CUR );
+        stream_seek( stream, -4, SEEK_CUR );
     }
 done:
     // Parse packet for information we might need
-    funlockfile( stream->file_handle );
+    stream_unlock( stream );
     int len = pos - b->size;
     b->size = pos;
 #undef cp
@@ -3748,7 +4028,7 @@ static void hb_ps_stream_find_streams(hb_stream_t *stream)
     int ii, jj;
     hb_buffer_t *buf  = hb_buffer_init(HB_DVD_READ_BUFFER_SIZE);
 
-    fseeko( stream->file_handle, 0, SEEK_SET );
+    stream_seek( stream, 0, SEEK_SET );
     // Scan beginning of file, then if no program stream map is found
     // seek to 20% and scan again since there's occasionally no
     // audio at the beginning (particularly for vobs).
@@ -4370,9 +4650,9 @@ static int hb_ts_stream_find_pids(hb_stream_t *stream)
     // changes PMTs (and thus video & audio PIDs) when 'programs' change. Since
     // we may have the tail of the previous program at the beginning of this
     // file, take our PMT from the middle of the file.
-    fseeko(stream->file_handle, 0, SEEK_END);
-    uint64_t fsize = ftello(stream->file_handle);
-    fseeko(stream->file_handle, fsize >> 1, SEEK_SET);
+    stream_seek(stream, 0, SEEK_END);
+    uint64_t fsize = stream_tell(stream);
+    stream_seek(stream, fsize >> 1, SEEK_SET);
     align_to_next_packet(stream);
 
     // Read the Transport Stream Packets (188 bytes each) looking at first for PID 0 (the PAT PID), then decode that
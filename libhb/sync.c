@@ -10,7 +10,6 @@
 #include "hb.h"
 #include "hbffmpeg.h"
 #include <stdio.h>
-#include "samplerate.h"
 
 #ifdef INT64_MIN
 #undef INT64_MIN /* Because it isn't defined correctly in Zeta */
@@ -41,10 +40,6 @@ typedef struct
     int64_t      first_drop;   /* PTS of first 'went backwards' frame dropped */
     int          drop_count;   /* count of 'time went backwards' drops */
 
-    /* Raw */
-    SRC_STATE  * state;
-    SRC_DATA     data;
-
     int          silence_size;
     uint8_t    * silence_buf;
 
@@ -645,6 +640,13 @@ int syncVideoWork( hb_work_object_t * w, hb_buffer_t ** buf_in,
 
             return HB_WORK_OK;
         }
+        if( job->chunk && job->pts_to_start && job->pts_to_stop )
+        {
+            // A video segment must end right before the first frame
+            // of the next segment, which is the first frame at or
+            // after pts_to_start + pts_to_stop.
+            job->pts_to_stop -= next->s.start - job->pts_to_start;
+        }
         hb_lock( pv->common->mutex );
         pv->common->audio_pts_thresh = 0;
         pv->common->audio_pts_slip += next_start;
@@ -986,10 +988,6 @@ void syncAudioClose( hb_work_object_t * w )
     {
         free( sync->silence_buf );
     }
-    if ( sync->state )
-    {
-        src_delete( sync->state );
-    }
 
     hb_lock( pv->common->mutex );
     if ( --pv->common->ref == 0 )
@@ -1360,21 +1358,9 @@ static void InitAudio( hb_job_t * job, hb_sync_common_t * common, int i )
         }
         av_free( c );
     }
-    else
+    else if( w->audio->config.out.codec & HB_ACODEC_PASS_FLAG )
     {
-        if( w->audio->config.out.codec & HB_ACODEC_PASS_FLAG )
-        {
-            sync->drop_video_to_sync = 1;
-        }
-        else
-        {
-            /* Not passthru, initialize libsamplerate */
-            int error;
-            sync->state = src_new( SRC_SINC_MEDIUM_QUALITY,
-                                   hb_mixdown_get_discrete_channel_count( w->audio->config.out.mixdown ),
-                                   &error );
-            sync->data.end_of_input = 0;
-        }
+        sync->drop_video_to_sync = 1;
     }
 
     sync->gain_factor = pow(10, w->audio->config.out.gain / 20);
@@ -1398,54 +1384,9 @@ static hb_buffer_t * OutputAudioFrame( hb_audio_t *audio, hb_buffer_t *buf,
 
     if ( !( audio->config.out.codec & HB_ACODEC_PASS_FLAG ) )
     {
-        // Audio is not passthru.  Check if we need to modify the audio
-        // in any way.
-        if( audio->config.in.samplerate != audio->config.out.samplerate )
-        {
-            /* do sample rate conversion */
-            int count_in, count_out;
-            hb_buffer_t * buf_raw = buf;
-            int sample_size = hb_mixdown_get_discrete_channel_count( audio->config.out.mixdown ) *
-                              sizeof( float );
-
-            count_in  = buf_raw->size / sample_size;
-            /*
-             * When using stupid rates like 44.1 there will always be some
-             * truncation error. E.g., a 1536 sample AC3 frame will turn into a
-             * 1536*44.1/48.0 = 1411.2 sample frame. If we just truncate the .2
-             * the error will build up over time and eventually the audio will
-             * substantially lag the video. libsamplerate will keep track of the
-             * fractional sample & give it to us when appropriate if we give it
-             * an extra sample of space in the output buffer.
-             */
-            count_out = ( duration * audio->config.out.samplerate ) / 90000 + 1;
-
-            sync->data.input_frames = count_in;
-            sync->data.output_frames = count_out;
-            sync->data.src_ratio = (double)audio->config.out.samplerate /
-                                   (double)audio->config.in.samplerate;
-
-            buf = hb_buffer_init( count_out * sample_size );
-            sync->data.data_in  = (float *) buf_raw->data;
-            sync->data.data_out = (float *) buf->data;
-            if( src_process( sync->state, &sync->data ) )
-            {
-                /* XXX If this happens, we're screwed */
-                hb_log( "sync: audio 0x%x src_process failed", audio->id );
-            }
-            hb_buffer_close( &buf_raw );
-
-            if (sync->data.output_frames_gen <= 0)
-            {
-                // XXX: don't send empty buffers downstream (EOF)
-                // possibly out-of-sync audio is better than no audio at all
-                hb_buffer_close(&buf);
-                return NULL;
-            }
-            buf->size = sync->data.output_frames_gen * sample_size;
-            duration = (double)( sync->data.output_frames_gen * 90000 ) /
-                       audio->config.out.samplerate;
-        }
+        // Audio is not passthru.  The decoder has already converted it to
+        // the output samplerate and mixdown (see hb_audio_resample()), so
+        // only the gain is left to apply.
         if( audio->config.out.gain > 0.0 )
         {
             int count, ii;
@@ -1509,7 +1450,7 @@ static void InsertSilence( hb_work_object_t * w, int64_t duration )
     else
     {
         frame_dur = ( 90000 * w->audio->config.out.samples_per_frame ) /
-                                            w->audio->config.in.samplerate;
+                                            w->audio->config.out.samplerate;
     }
 
     while (duration >= frame_dur >> 2)
@@ -1531,13 +1472,13 @@ static void InsertSilence( hb_work_object_t * w, int64_t duration )
                        channel_count;
             if (frame_dur > duration)
             {
-                int samples = duration * w->audio->config.in.samplerate / 90000;
+                int samples = duration * w->audio->config.out.samplerate / 90000;
                 if (samples == 0)
                 {
                     break;
                 }
                 size = sizeof(float) * samples * channel_count;
-                frame_dur = (90000 * samples) / w->audio->config.in.samplerate;
+                frame_dur = (90000 * samples) / w->audio->config.out.samplerate;
             }
             buf = hb_buffer_init(size);
             buf->s.start = sync->next_start;
@@ -1573,6 +1514,11 @@ static void UpdateState( hb_work_object_t * w )
         // to find start & end points.
         return;
     }
+    if (pv->job->chunk != NULL)
+    {
+        // Video segments don't report progress, their main job does
+        return;
+    }
 
     if( hb_get_date() > sync->st_dates[3] + 1000 )
     {
@@ -1641,6 +1587,11 @@ static void UpdateSearchState( hb_work_object_t * w, int64_t start )
         // to find start & end points.
         return;
     }
+    if (pv->job->chunk != NULL)
+    {
+        // Video segments don't report progress, their main job does
+        return;
+    }
 
 #define p state.param.working
     state.state = HB_STATE_SEARCHING;
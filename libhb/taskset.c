@@ -11,187 +11,324 @@
 #include "ports.h"
 #include "taskset.h"
 
+struct taskset_task_s
+{
+    taskset_t      * ts;
+    int              idx;
+    thread_func_t  * func;
+    int              queue;     // pool queue this task was pushed to
+    taskset_task_t * next;
+};
+
+typedef struct
+{
+    hb_lock_t      * lock;
+    taskset_task_t * first;
+    taskset_task_t * last;
+} task_queue_t;
+
+/*
+ * The process-wide worker pool.
+ *
+ * Every worker owns a task queue.  taskset_cycle() spreads the tasks of a
+ * cycle over the queues.  A worker runs the tasks of its own queue and
+ * steals from the other queues when its own is empty, so idle workers
+ * help out wherever there is work.  Workers sleep on pool.cond when
+ * there are no pending tasks at all.
+ */
+static struct
+{
+    hb_lock_t      * lock;
+    hb_cond_t      * cond;
+    int              started;
+    int              stop;
+    int              count;
+    int              pending;       // queued tasks, updated atomically
+    unsigned         next_queue;    // updated atomically
+    hb_thread_t   ** threads;
+    task_queue_t   * queues;
+} pool;
+
+static void queue_push( task_queue_t * q, taskset_task_t * task )
+{
+    hb_lock( q->lock );
+    task->next = NULL;
+    if ( q->last != NULL )
+    {
+        q->last->next = task;
+    }
+    else
+    {
+        q->first = task;
+    }
+    q->last = task;
+    hb_unlock( q->lock );
+}
+
+static taskset_task_t * queue_pop( task_queue_t * q )
+{
+    taskset_task_t * task;
+
+    hb_lock( q->lock );
+    task = q->first;
+    if ( task != NULL )
+    {
+        q->first = task->next;
+        if ( q->first == NULL )
+        {
+            q->last = NULL;
+        }
+        __atomic_sub_fetch( &pool.pending, 1, __ATOMIC_RELAXED );
+    }
+    hb_unlock( q->lock );
+
+    return task;
+}
+
+// Removes 'task' from queue 'q'.  Returns 0 if a worker already took it.
+static int queue_remove( task_queue_t * q, taskset_task_t * task )
+{
+    taskset_task_t * prev = NULL, * cur;
+
+    hb_lock( q->lock );
+    for ( cur = q->first; cur != NULL && cur != task; cur = cur->next )
+    {
+        prev = cur;
+    }
+    if ( cur != NULL )
+    {
+        if ( prev != NULL )
+        {
+            prev->next = cur->next;
+        }
+        else
+        {
+            q->first = cur->next;
+        }
+        if ( q->last == cur )
+        {
+            q->last = prev;
+        }
+        __atomic_sub_fetch( &pool.pending, 1, __ATOMIC_RELAXED );
+    }
+    hb_unlock( q->lock );
+
+    return cur != NULL;
+}
+
+static void task_run( taskset_task_t * task )
+{
+    taskset_t * ts = task->ts;
+
+    task->func( taskset_thread_args( ts, task->idx ) );
+
+    // The taskset may be gone as soon as the lock is released,
+    // so don't touch it (or the task) after that.
+    hb_lock( ts->task_cond_lock );
+    if ( ++ts->task_done == ts->thread_count )
+    {
+        hb_cond_signal( ts->task_complete );
+    }
+    hb_unlock( ts->task_cond_lock );
+}
+
+static void pool_worker( void * _idx )
+{
+    int              idx = (intptr_t)_idx;
+    int              ii, stop = 0;
+    taskset_task_t * task;
+
+    while ( !stop )
+    {
+        task = NULL;
+        for ( ii = 0; task == NULL && ii < pool.count; ii++ )
+        {
+            task = queue_pop( &pool.queues[( idx + ii ) % pool.count] );
+        }
+        if ( task != NULL )
+        {
+            task_run( task );
+            continue;
+        }
+
+        hb_lock( pool.lock );
+        while ( !pool.stop &&
+                __atomic_load_n( &pool.pending, __ATOMIC_RELAXED ) <= 0 )
+        {
+            hb_cond_wait( pool.cond, pool.lock );
+        }
+        stop = pool.stop;
+        hb_unlock( pool.lock );
+    }
+}
+
+/*
+ * Workers are started on first use so that applications which never
+ * run a job don't pay for them.
+ */
+static void pool_start( void )
+{
+    int ii;
+
+    hb_lock( pool.lock );
+    if ( !pool.started )
+    {
+        pool.count   = hb_get_cpu_count();
+        pool.queues  = calloc( pool.count, sizeof( task_queue_t ) );
+        pool.threads = calloc( pool.count, sizeof( hb_thread_t * ) );
+        for ( ii = 0; ii < pool.count; ii++ )
+        {
+            pool.queues[ii].lock = hb_lock_init();
+        }
+        for ( ii = 0; ii < pool.count; ii++ )
+        {
+            pool.threads[ii] = hb_thread_init( "taskset_worker", pool_worker,
+                                               (void *)(intptr_t)ii,
+                                               HB_NORMAL_PRIORITY );
+        }
+        pool.started = 1;
+    }
+    hb_unlock( pool.lock );
+}
+
+void
+taskset_pool_init( void )
+{
+    memset( &pool, 0, sizeof( pool ) );
+    pool.lock = hb_lock_init();
+    pool.cond = hb_cond_init();
+}
+
+void
+taskset_pool_close( void )
+{
+    int ii;
+
+    if ( pool.lock == NULL )
+        return;
+
+    hb_lock( pool.lock );
+    pool.stop = 1;
+    hb_cond_broadcast( pool.cond );
+    hb_unlock( pool.lock );
+
+    if ( pool.started )
+    {
+        for ( ii = 0; ii < pool.count; ii++ )
+        {
+            hb_thread_close( &pool.threads[ii] );
+            hb_lock_close( &pool.queues[ii].lock );
+        }
+        free( pool.threads );
+        free( pool.queues );
+    }
+    hb_cond_close( &pool.cond );
+    hb_lock_close( &pool.lock );
+}
+
 int
 taskset_init( taskset_t *ts, int thread_count, size_t arg_size )
 {
-    int init_step;
+    int ii;
 
-    init_step = 0;
     memset( ts, 0, sizeof( *ts ) );
     ts->thread_count = thread_count;
     ts->arg_size = arg_size;
-    ts->bitmap_elements = ( ts->thread_count + 31 ) / 32;
-    ts->task_threads = malloc( sizeof( hb_thread_t* ) * ts->thread_count );
-    if( ts->task_threads == NULL )
+
+    ts->tasks = calloc( thread_count, sizeof( taskset_task_t ) );
+    if( ts->tasks == NULL )
         goto fail;
-    init_step++;
 
     if( arg_size != 0 )
     {
-        ts->task_threads_args = malloc( arg_size * ts->thread_count );
-        if( ts->task_threads == NULL )
+        ts->task_threads_args = calloc( thread_count, arg_size );
+        if( ts->task_threads_args == NULL )
             goto fail;
     }
-    init_step++;
-
-    ts->task_begin_bitmap = malloc( sizeof( uint32_t  ) * ts->bitmap_elements );
-    if( ts->task_begin_bitmap == NULL )
-        goto fail;
-    init_step++;
-
-    ts->task_complete_bitmap = malloc( sizeof( uint32_t ) * ts->bitmap_elements );
-    if( ts->task_complete_bitmap == NULL )
-        goto fail;
-    init_step++;
-
-    ts->task_stop_bitmap = malloc( sizeof( uint32_t ) * ts->bitmap_elements );
-    if( ts->task_stop_bitmap == NULL )
-        goto fail;
-    init_step++;
 
     ts->task_cond_lock = hb_lock_init();
     if( ts->task_cond_lock == NULL)
         goto fail;
-    init_step++;
-
-    ts->task_begin = hb_cond_init();
-    if( ts->task_begin == NULL)
-        goto fail;
-    init_step++;
 
     ts->task_complete = hb_cond_init();
     if( ts->task_complete == NULL)
         goto fail;
-    init_step++;
 
-    /*
-     * Initialize all arg data to 0.
-     */
-    memset(ts->task_threads_args, 0, ts->arg_size * ts->thread_count );
+    for( ii = 0; ii < thread_count; ii++ )
+    {
+        ts->tasks[ii].ts  = ts;
+        ts->tasks[ii].idx = ii;
+    }
 
-    /*
-     * Inialize bitmaps to all bits set.  This means that any unused bits
-     * in the bitmap are already in the "condition satisfied" state allowing
-     * us to test the bitmap 32bits at a time without having to mask off
-     * the end.
-     */
-    memset(ts->task_begin_bitmap, 0xFF, sizeof( uint32_t ) * ts->bitmap_elements );
-    memset(ts->task_complete_bitmap, 0xFF, sizeof( uint32_t ) * ts->bitmap_elements );
-    memset(ts->task_stop_bitmap, 0, sizeof( uint32_t ) * ts->bitmap_elements );
-    
-    /*
-     * Important to start off with the threads locked waiting
-     * on input, no work completed, and not asked to stop.
-     */
-    bit_nclear( ts->task_begin_bitmap, 0, ts->thread_count - 1 );
-    bit_nclear( ts->task_complete_bitmap, 0, ts->thread_count - 1 );
-    bit_nclear( ts->task_stop_bitmap, 0, ts->thread_count - 1 );
+    pool_start();
     return (1);
 
 fail:
-    switch (init_step)
-    {
-        default:
-            hb_cond_close( &ts->task_complete );
-            /* FALL THROUGH */
-        case 7:
-            hb_cond_close( &ts->task_begin );
-            /* FALL THROUGH */
-        case 6:
-            hb_lock_close( &ts->task_cond_lock );
-            /* FALL THROUGH */
-        case 5:
-            free( ts->task_stop_bitmap );
-            /* FALL THROUGH */
-        case 4:
-            free( ts->task_complete_bitmap );
-            /* FALL THROUGH */
-        case 3:
-            free( ts->task_begin_bitmap );
-            /* FALL THROUGH */
-        case 2:
-            if( ts->task_threads_args == NULL )
-                free( ts->task_threads_args );
-            /* FALL THROUGH */
-        case 1:
-            free( ts->task_threads );
-            /* FALL THROUGH */
-        case 0:
-            break;
-    }
+    taskset_fini( ts );
     return (0);
 }
 
+/*
+ * Sets the function that processes task 'thr_idx'.  It is called with
+ * taskset_thread_args( ts, thr_idx ) once per taskset_cycle().
+ */
 int
 taskset_thread_spawn( taskset_t *ts, int thr_idx, const char *descr,
                       thread_func_t *func, int priority )
 {
-    ts->task_threads[thr_idx] = hb_thread_init( descr, func,
-                                                taskset_thread_args( ts, thr_idx ),
-                                                priority);
-    return( ts->task_threads[thr_idx] != NULL );
+    ts->tasks[thr_idx].func = func;
+    return 1;
 }
 
 void
 taskset_cycle( taskset_t *ts )
 {
-    hb_lock( ts->task_cond_lock );
+    unsigned first_queue;
+    int      ii;
 
-    /*
-     * Signal all threads that their work is available.
-     */
-    bit_nset( ts->task_begin_bitmap, 0, ts->thread_count - 1 );
-    hb_cond_broadcast( ts->task_begin );
+    ts->task_done = 0;
 
     /*
-     * Wait until all threads have completed.  Note that we must
-     * loop here as hb_cond_wait() on some platforms (e.g pthead_cond_wait)
-     * may unblock prematurely.
+     * Hand the tasks to the workers and wake them up.
      */
-    do
+    first_queue = __atomic_fetch_add( &pool.next_queue, ts->thread_count,
+                                      __ATOMIC_RELAXED );
+    __atomic_add_fetch( &pool.pending, ts->thread_count, __ATOMIC_RELAXED );
+    for( ii = 0; ii < ts->thread_count; ii++ )
     {
-        hb_cond_wait( ts->task_complete, ts->task_cond_lock );
-    } while ( !allbits_set( ts->task_complete_bitmap, ts->bitmap_elements ) );
+        taskset_task_t * task = &ts->tasks[ii];
+
+        task->queue = ( first_queue + ii ) % pool.count;
+        queue_push( &pool.queues[task->queue], task );
+    }
+    hb_lock( pool.lock );
+    hb_cond_broadcast( pool.cond );
+    hb_unlock( pool.lock );
 
     /*
-     * Clear completion indications for next time.
+     * Rather than sleep, run the tasks no worker has gotten to yet.
+     * Take them from the end so that we compete with the workers
+     * as little as possible.
      */
-    bit_nclear( ts->task_complete_bitmap, 0, ts->thread_count - 1 );
-
-    hb_unlock( ts->task_cond_lock );
-}
+    for( ii = ts->thread_count - 1; ii >= 0; ii-- )
+    {
+        taskset_task_t * task = &ts->tasks[ii];
 
-/*
- * Block current thread until work is available for it.
- */
-void
-taskset_thread_wait4start( taskset_t *ts, int thr_idx )
-{
-    hb_lock( ts->task_cond_lock );
-    while ( bit_is_clear( ts->task_begin_bitmap, thr_idx ) )
-        hb_cond_wait( ts->task_begin, ts->task_cond_lock );
+        if( queue_remove( &pool.queues[task->queue], task ) )
+        {
+            task_run( task );
+        }
+    }
 
     /*
-     * We've been released for one run.  Insure we block the next
-     * time through the loop.
+     * Wait until all tasks have completed.  Note that we must
+     * loop here as hb_cond_wait() on some platforms (e.g pthead_cond_wait)
+     * may unblock prematurely.
      */
-    bit_clear( ts->task_begin_bitmap, thr_idx );
-    hb_unlock( ts->task_cond_lock );
-}
-
-/*
- * Current thread has completed its work.  Indicate completion,
- * and if all threads in this task set have completed, wakeup
- * anyone waiting for this condition.
- */
-void
-taskset_thread_complete( taskset_t *ts, int thr_idx )
-{
     hb_lock( ts->task_cond_lock );
-    bit_set( ts->task_complete_bitmap, thr_idx );
-    if( allbits_set( ts->task_complete_bitmap, ts->bitmap_elements ) )
+    while ( ts->task_done < ts->thread_count )
     {
-        hb_cond_signal( ts->task_complete );
+        hb_cond_wait( ts->task_complete, ts->task_cond_lock );
     }
     hb_unlock( ts->task_cond_lock );
 }
@@ -199,36 +336,16 @@ taskset_thread_complete( taskset_t *ts, int thr_idx )
 void
 taskset_fini( taskset_t *ts )
 {
-    int i;
-
-    hb_lock( ts->task_cond_lock );
-    /*
-     * Tell each thread to stop, and then cleanup.
-     */
-    bit_nset( ts->task_stop_bitmap, 0, ts->thread_count - 1 );
-    bit_nset( ts->task_begin_bitmap, 0, ts->thread_count - 1 );
-    hb_cond_broadcast( ts->task_begin );
-
-    /*
-     * Wait for all threads to exit.
-     */
-    hb_cond_wait( ts->task_complete, ts->task_cond_lock );
-    hb_unlock( ts->task_cond_lock );
-
     /*
-     * Clean up taskset memory.
+     * Tasks are only queued during taskset_cycle(), so there is
+     * nothing left to stop here.
      */
-    for( i = 0; i < ts->thread_count; i++)
-    {
-        hb_thread_close( &ts->task_threads[i] );
-    }
-    hb_lock_close( &ts->task_cond_lock );
-    hb_cond_close( &ts->task_begin );
-    hb_cond_close( &ts->task_complete );
-    free( ts->task_threads );
-    if( ts->task_threads_args != NULL )
-        free( ts->task_threads_args );
-    free( ts->task_begin_bitmap );
-    free( ts->task_complete_bitmap );
-    free( ts->task_stop_bitmap );
+    if( ts->task_cond_lock != NULL )
+        hb_lock_close( &ts->task_cond_lock );
+    if( ts->task_complete != NULL )
+        hb_cond_close( &ts->task_complete );
+    free( ts->tasks );
+    free( ts->task_threads_args );
+    ts->tasks = NULL;
+    ts->task_threads_args = NULL;
 }
@@ -10,35 +10,39 @@
 #ifndef HB_TASKSET_H
 #define HB_TASKSET_H
 
-#define TASKSET_POSIX_COMPLIANT 1
+/*
+ * A taskset splits a piece of work into thread_count independent tasks
+ * (e.g. the row segments of a frame).  The function registered for each
+ * task with taskset_thread_spawn() is run once per taskset_cycle() on the
+ * process-wide worker pool, so the number of worker threads stays at the
+ * cpu count no matter how many filters and jobs use tasksets.  The thread
+ * calling taskset_cycle() runs any of its tasks that no worker has picked
+ * up yet, so a cycle always completes even when every worker is busy.
+ */
 
-#include "bits.h"
+typedef struct taskset_task_s taskset_task_t;
 
 typedef struct hb_taskset_s {
     int                thread_count;
     int                arg_size;
-    int                bitmap_elements;
-    hb_thread_t     ** task_threads;
     uint8_t          * task_threads_args;
-    uint32_t         * task_begin_bitmap;    // Threads can begin
-    uint32_t         * task_complete_bitmap; // Threads have completed
-    uint32_t         * task_stop_bitmap;     // Threads should exit
+    taskset_task_t   * tasks;
+    int                task_done;            // Tasks completed this cycle
     hb_lock_t        * task_cond_lock;       // Held during condition tests
-    hb_cond_t        * task_begin;           // Threads can begin work
-    hb_cond_t        * task_complete;        // Threads have finished work.
+    hb_cond_t        * task_complete;        // All tasks have finished
 } taskset_t;
 
+void taskset_pool_init( void );
+void taskset_pool_close( void );
+
 int taskset_init( taskset_t *, int /*thread_count*/, size_t /*user_arg_size*/ );
 void taskset_cycle( taskset_t * );
 void taskset_fini( taskset_t * );
 
 int  taskset_thread_spawn( taskset_t *, int /*thr_idx*/, const char * /*descr*/,
                            thread_func_t *, int /*priority*/ );
-void taskset_thread_wait4start( taskset_t *, int );
-void taskset_thread_complete( taskset_t *, int );
 
 static inline void *taskset_thread_args( taskset_t *, int );
-static inline int   taskset_thread_stop( taskset_t *, int );
 
 static inline void *
 taskset_thread_args( taskset_t *ts, int thr_idx )
@@ -46,10 +50,4 @@ taskset_thread_args( taskset_t *ts, int thr_idx )
     return( ts->task_threads_args + ( ts->arg_size * thr_idx ) );
 }
 
-static inline int
-taskset_thread_stop( taskset_t *ts, int thr_idx )
-{
-    return bit_is_set( ts->task_stop_bitmap, thr_idx );
-}
-
 #endif /* HB_TASKSET_H */
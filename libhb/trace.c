@@ -0,0 +1,162 @@
+/* trace.c
+
+   Copyright (c) 2003-2014 HandBrake Team
+   This file is part of the HandBrake source code
+   Homepage: <http://handbrake.fr/>.
+   It may be used under the terms of the GNU General Public License v2.
+   For full terms see the file COPYING file or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*
+ * Pipeline timeline in the Chrome trace event format, which
+ * chrome://tracing and ui.perfetto.dev open directly.
+ *
+ * Each job (pass or segment) is a process and each pipeline stage one of
+ * its threads.  Every buffer a stage takes in gives a complete ("X")
+ * event for the time it spent working on it, with the buffer's sequence
+ * number and start time as arguments, and one for the time it then spent
+ * waiting for room in its output fifo.  The gaps between events are the
+ * time the stage waited for input.
+ */
+
+#include <errno.h>
+#include "hb.h"
+
+struct hb_trace_s
+{
+    FILE      * file;
+    hb_lock_t * lock;
+    int         events;     // written so far, for the separators
+    int         next_pid;
+    int         next_tid;
+};
+
+// Writes 'str' as the contents of a JSON string
+static void trace_write_string( FILE * file, const char * str )
+{
+    for ( ; *str; str++ )
+    {
+        if ( *str == '"' || *str == '\\' )
+        {
+            fputc( '\\', file );
+            fputc( *str, file );
+        }
+        else if ( (unsigned char)*str >= ' ' )
+        {
+            fputc( *str, file );
+        }
+    }
+}
+
+// Called with the lock held
+static void trace_separator( hb_trace_t * trace )
+{
+    fputs( trace->events++ ? ",\n" : "\n", trace->file );
+}
+
+static void trace_metadata( hb_trace_t * trace, const char * what,
+                            int pid, int tid, const char * name )
+{
+    hb_lock( trace->lock );
+    trace_separator( trace );
+    fprintf( trace->file, "{\"name\":\"%s\",\"ph\":\"M\",\"pid\":%d,"
+             "\"tid\":%d,\"args\":{\"name\":\"", what, pid, tid );
+    trace_write_string( trace->file, name );
+    fputs( "\"}}", trace->file );
+    hb_unlock( trace->lock );
+}
+
+/*
+ * Creates (or truncates) the trace file at 'path'.
+ */
+hb_trace_t * hb_trace_open( const char * path )
+{
+    hb_trace_t * trace = calloc( 1, sizeof( hb_trace_t ) );
+
+    if ( trace == NULL )
+    {
+        return NULL;
+    }
+    trace->file = hb_fopen( path, "w" );
+    if ( trace->file == NULL )
+    {
+        hb_error( "trace: could not open %s: %s", path, strerror( errno ) );
+        free( trace );
+        return NULL;
+    }
+    trace->lock     = hb_lock_init();
+    trace->next_pid = 1;
+    trace->next_tid = 1;
+    fputs( "[", trace->file );
+
+    return trace;
+}
+
+void hb_trace_close( hb_trace_t ** _trace )
+{
+    hb_trace_t * trace = *_trace;
+
+    if ( trace == NULL )
+    {
+        return;
+    }
+    fputs( "\n]\n", trace->file );
+    if ( fclose( trace->file ) != 0 )
+    {
+        hb_error( "trace: write failed: %s", strerror( errno ) );
+    }
+    hb_log( "trace: %d events", trace->events );
+    hb_lock_close( &trace->lock );
+    free( trace );
+    *_trace = NULL;
+}
+
+/*
+ * Starts a process (a job) named 'name' and returns its pid.
+ */
+int hb_trace_process( hb_trace_t * trace, const char * name )
+{
+    int pid;
+
+    hb_lock( trace->lock );
+    pid = trace->next_pid++;
+    hb_unlock( trace->lock );
+    trace_metadata( trace, "process_name", pid, 0, name );
+
+    return pid;
+}
+
+/*
+ * Starts a thread (a stage) named 'name' of process 'pid' and returns its
+ * tid.
+ */
+int hb_trace_thread( hb_trace_t * trace, int pid, const char * name )
+{
+    int tid;
+
+    hb_lock( trace->lock );
+    tid = trace->next_tid++;
+    hb_unlock( trace->lock );
+    trace_metadata( trace, "thread_name", pid, tid, name );
+
+    return tid;
+}
+
+/*
+ * Adds an event spanning 'start' to 'end' (hb_get_time_us() values) for
+ * the buffer with the given sequence number and start time.
+ */
+void hb_trace_event( hb_trace_t * trace, int pid, int tid, const char * name,
+                     const char * cat, uint64_t start, uint64_t end,
+                     int64_t sequence, int64_t pts )
+{
+    hb_lock( trace->lock );
+    trace_separator( trace );
+    fputs( "{\"name\":\"", trace->file );
+    trace_write_string( trace->file, name );
+    fprintf( trace->file, "\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":%d,"
+             "\"tid\":%d,\"ts\":%"PRIu64",\"dur\":%"PRIu64","
+             "\"args\":{\"sequence\":%"PRId64",\"start\":%"PRId64"}}",
+             cat, pid, tid, start, end - start, sequence, pts );
+    hb_unlock( trace->lock );
+}
@@ -8,6 +8,21 @@
  */
  
 #include "hb.h"
+#include "taskset.h"
+#if HB_SIMD_X86
+#include <immintrin.h>
+#endif
+
+// Sum of squared errors of a row of 'bw' 16x16 blocks, see sse_block16()
+typedef uint64_t (sse_band_t)( const unsigned * g, const uint8_t * a,
+                               const uint8_t * b, int stride, int bw );
+
+typedef struct
+{
+    hb_filter_private_t * pv;
+    int                   segment;
+    uint64_t              sum;
+} metric_thread_arg_t;
 
 struct hb_filter_private_s
 {
@@ -36,6 +51,13 @@ struct hb_filter_private_s
     float         out_metric;   // motion metric of last output frame
     int           sync_parity;
     unsigned      gamma_lut[256];
+
+    // Motion metric, computed by segments of rows of blocks in parallel
+    sse_band_t  * sse_band;
+    int           segments;
+    taskset_t     metric_taskset;
+    hb_buffer_t * metric_a;
+    hb_buffer_t * metric_b;
 };
 
 static int hb_vfr_init( hb_filter_object_t * filter,
@@ -89,12 +111,11 @@ static hb_buffer_t *insert_buffer_in_chain(
 // Compute ths sum of squared errors for a 16x16 block
 // Gamma adjusts pixel values so that less visible diffreences
 // count less.
-static inline unsigned sse_block16( hb_filter_private_t *pv, uint8_t *a, uint8_t *b, int stride )
+static inline unsigned sse_block16( const unsigned *g, const uint8_t *a, const uint8_t *b, int stride )
 {
     int x, y;
     unsigned sum = 0;
     int diff;
-    unsigned *g = pv->gamma_lut;
 
     for( y = 0; y < 16; y++ )
     {
@@ -109,27 +130,213 @@ static inline unsigned sse_block16( hb_filter_private_t *pv, uint8_t *a, uint8_t
     return sum;
 }
 
-// Sum of squared errors.  Computes and sums the SSEs for all
-// 16x16 blocks in the images.  Only checks the Y component.
-static float motion_metric( hb_filter_private_t * pv, hb_buffer_t * a, hb_buffer_t * b )
+static uint64_t sse_band_c( const unsigned * g, const uint8_t * a,
+                            const uint8_t * b, int stride, int bw )
+{
+    int x;
+    uint64_t sum = 0;
+
+    for( x = 0; x < bw; x++ )
+    {
+        sum += sse_block16( g, a + x * 16, b + x * 16, stride );
+    }
+    return sum;
+}
+
+#if HB_SIMD_X86
+// Gamma adjusted pixels are below 4096, so their differences fit in 16
+// bits and pmaddwd can square and add them.  Each 32 bit lane adds up at
+// most 64 squares of a block, less than 2^31, before it is widened.
+__attribute__((target("sse2")))
+static inline __m128i gamma_epi16_sse2( const unsigned * g, const uint8_t * p )
 {
+    return _mm_setr_epi16( g[p[0]], g[p[1]], g[p[2]], g[p[3]],
+                           g[p[4]], g[p[5]], g[p[6]], g[p[7]] );
+}
+
+__attribute__((target("sse2")))
+static uint64_t sse_band_sse2( const unsigned * g, const uint8_t * a,
+                               const uint8_t * b, int stride, int bw )
+{
+    __m128i sum  = _mm_setzero_si128();
+    __m128i zero = _mm_setzero_si128();
+    uint64_t lanes[2];
+    int x, y;
+
+    for( x = 0; x < bw * 16; x += 16 )
+    {
+        __m128i acc = _mm_setzero_si128();
+
+        for( y = 0; y < 16; y++ )
+        {
+            const uint8_t * pa = a + y * stride + x;
+            const uint8_t * pb = b + y * stride + x;
+            __m128i d0 = _mm_sub_epi16( gamma_epi16_sse2( g, pa ),
+                                        gamma_epi16_sse2( g, pb ) );
+            __m128i d1 = _mm_sub_epi16( gamma_epi16_sse2( g, pa + 8 ),
+                                        gamma_epi16_sse2( g, pb + 8 ) );
+
+            acc = _mm_add_epi32( acc, _mm_madd_epi16( d0, d0 ) );
+            acc = _mm_add_epi32( acc, _mm_madd_epi16( d1, d1 ) );
+        }
+        sum = _mm_add_epi64( sum, _mm_unpacklo_epi32( acc, zero ) );
+        sum = _mm_add_epi64( sum, _mm_unpackhi_epi32( acc, zero ) );
+    }
+    _mm_storeu_si128( (__m128i *)lanes, sum );
+    return lanes[0] + lanes[1];
+}
+
+// Looks up 8 pixels in the gamma table
+__attribute__((target("avx2")))
+static inline __m256i gamma_epi32_avx2( const unsigned * g, const uint8_t * p )
+{
+    __m256i idx = _mm256_cvtepu8_epi32( _mm_loadl_epi64( (const __m128i *)p ) );
+    return _mm256_i32gather_epi32( (const int *)g, idx, 4 );
+}
+
+__attribute__((target("avx2")))
+static uint64_t sse_band_avx2( const unsigned * g, const uint8_t * a,
+                               const uint8_t * b, int stride, int bw )
+{
+    __m256i sum  = _mm256_setzero_si256();
+    __m256i zero = _mm256_setzero_si256();
+    uint64_t lanes[4];
+    int x, y;
+
+    for( x = 0; x < bw * 16; x += 16 )
+    {
+        __m256i acc = _mm256_setzero_si256();
+
+        for( y = 0; y < 16; y++ )
+        {
+            const uint8_t * pa = a + y * stride + x;
+            const uint8_t * pb = b + y * stride + x;
+            // The order of the pixels packs_epi32 gives doesn't matter
+            // to the sum
+            __m256i d = _mm256_packs_epi32(
+                _mm256_sub_epi32( gamma_epi32_avx2( g, pa ),
+                                  gamma_epi32_avx2( g, pb ) ),
+                _mm256_sub_epi32( gamma_epi32_avx2( g, pa + 8 ),
+                                  gamma_epi32_avx2( g, pb + 8 ) ) );
+
+            acc = _mm256_add_epi32( acc, _mm256_madd_epi16( d, d ) );
+        }
+        sum = _mm256_add_epi64( sum, _mm256_unpacklo_epi32( acc, zero ) );
+        sum = _mm256_add_epi64( sum, _mm256_unpackhi_epi32( acc, zero ) );
+    }
+    _mm256_storeu_si256( (__m256i *)lanes, sum );
+    _mm256_zeroupper();
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+#endif // HB_SIMD_X86
+
+// Sums the SSEs of this segment of the rows of blocks.  The metric is
+// kept and compared with the metrics of the following frames, so it is
+// always summed in full.
+static void motion_metric_thread( void * thread_args_v )
+{
+    metric_thread_arg_t * thread_args = thread_args_v;
+    hb_filter_private_t * pv = thread_args->pv;
+    hb_buffer_t * a = pv->metric_a;
     int bw = a->f.width / 16;
     int bh = a->f.height / 16;
     int stride = a->plane[0].stride;
     uint8_t * pa = a->plane[0].data;
-    uint8_t * pb = b->plane[0].data;
-    int x, y;
+    uint8_t * pb = pv->metric_b->plane[0].data;
+    int start = bh *  thread_args->segment      / pv->segments;
+    int stop  = bh * (thread_args->segment + 1) / pv->segments;
+    int y;
+    uint64_t sum = 0;
+
+    for( y = start; y < stop; y++ )
+    {
+        sum += pv->sse_band( pv->gamma_lut, pa + y * 16 * stride,
+                             pb + y * 16 * stride, stride, bw );
+    }
+    thread_args->sum = sum;
+}
+
+static void motion_metric_init( hb_filter_private_t * pv, int height )
+{
+    int ii;
+
+    pv->sse_band = sse_band_c;
+#if HB_SIMD_X86
+    if( hb_get_cpu_flags() & HB_CPU_FLAG_AVX2 )
+    {
+        pv->sse_band = sse_band_avx2;
+    }
+    else if( hb_get_cpu_flags() & HB_CPU_FLAG_SSE2 )
+    {
+        pv->sse_band = sse_band_sse2;
+    }
+#endif
+
+    // Keep at least 4 rows of blocks in a segment
+    pv->segments = MIN( hb_get_cpu_count(), height / 64 );
+    if( pv->segments <= 1 )
+    {
+        pv->segments = 1;
+        return;
+    }
+    if( taskset_init( &pv->metric_taskset, pv->segments,
+                      sizeof( metric_thread_arg_t ) ) == 0 )
+    {
+        hb_error( "vfr could not initialize taskset" );
+        pv->segments = 1;
+        return;
+    }
+    for( ii = 0; ii < pv->segments; ii++ )
+    {
+        metric_thread_arg_t *thread_args;
+
+        thread_args = taskset_thread_args( &pv->metric_taskset, ii );
+        thread_args->pv = pv;
+        thread_args->segment = ii;
+
+        if( taskset_thread_spawn( &pv->metric_taskset, ii,
+                                  "vfr_metric_segment",
+                                  motion_metric_thread,
+                                  HB_NORMAL_PRIORITY ) == 0 )
+        {
+            hb_error( "vfr could not spawn thread" );
+            taskset_fini( &pv->metric_taskset );
+            pv->segments = 1;
+            return;
+        }
+    }
+}
+
+// Sum of squared errors.  Computes and sums the SSEs for all
+// 16x16 blocks in the images.  Only checks the Y component.
+static float motion_metric( hb_filter_private_t * pv, hb_buffer_t * a, hb_buffer_t * b )
+{
     uint64_t sum = 0;
 
-    for( y = 0; y < bh; y++ )
+    pv->metric_a = a;
+    pv->metric_b = b;
+
+    if( pv->segments == 1 )
     {
-        for( x = 0; x < bw; x++ )
+        metric_thread_arg_t thread_args = { pv, 0, 0 };
+        motion_metric_thread( &thread_args );
+        sum = thread_args.sum;
+    }
+    else
+    {
+        int ii;
+
+        /* Allow the taskset threads to make one pass over the data. */
+        taskset_cycle( &pv->metric_taskset );
+        for( ii = 0; ii < pv->segments; ii++ )
         {
-            sum +=  sse_block16( pv, pa + y * 16 * stride + x * 16,
-                                 pb + y * 16 * stride + x * 16, stride );
+            metric_thread_arg_t *thread_args;
+
+            thread_args = taskset_thread_args( &pv->metric_taskset, ii );
+            sum += thread_args->sum;
         }
     }
-    return (float)sum / ( a->f.width * a->f.height );;
+    return (float)sum / ( a->f.width * a->f.height );
 }
 
 // This section of the code implements video frame rate control.
@@ -352,6 +559,11 @@ static int hb_vfr_init(hb_filter_object_t *filter, hb_filter_init_t *init)
     pv->frame_rate        = (double)pv->vrate.den * 90000. / pv->vrate.num;
     init->cfr             = pv->cfr;
 
+    if (pv->cfr != 0)
+    {
+        motion_metric_init(pv, init->geometry.height);
+    }
+
     return 0;
 }
 
@@ -454,6 +666,11 @@ static void hb_vfr_close( hb_filter_object_t * filter )
         hb_fifo_close( &pv->delay_queue );
     }
 
+    if( pv->segments > 1 )
+    {
+        taskset_fini( &pv->metric_taskset );
+    }
+
     /* Cleanup render work structure */
     free( pv );
     filter->private_data = NULL;
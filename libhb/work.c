@@ -39,6 +39,33 @@ static void filter_loop( void * );
 #define FIFO_SMALL_WAKE 15
 #define FIFO_MINI 4
 #define FIFO_MINI_WAKE 3
+// Video frame fifos grow up to FIFO_LARGE while the buffers allocated
+// stay below this, see hb_fifo_set_adaptive()
+#define FIFO_MEMORY_BUDGET ((int64_t)1024 * 1024 * 1024)
+
+/*
+ * Stage profiler
+ *
+ * Each thread loop (work_loop, filter_loop, ReadLoop and the muxer loop in
+ * do_job) charges its time to the busy, wait_in and wait_out counters of
+ * its stage, see hb_stage_stats_t.  With a trace file set they also add
+ * each buffer's work and output wait to the job's timeline.
+ */
+static void stage_start( hb_job_t * job, hb_stage_stats_t * stats,
+                         const char * name )
+{
+    memset( stats, 0, sizeof( *stats ) );
+    stats->name = name;
+    stats->trace = hb_get_trace( job->h );
+    stats->measure_cpu = hb_get_stage_cpu_time( job->h );
+    if ( stats->trace != NULL )
+    {
+        stats->trace_pid = job->trace_pid;
+        stats->trace_tid = hb_trace_thread( stats->trace, job->trace_pid,
+                                            name );
+    }
+    hb_stage_register( job->h, stats );
+}
 
 /**
  * Allocates work object and launches work thread with work_func.
@@ -101,6 +128,17 @@ static void work_func( void * _work )
     free( work );
 }
 
+/**
+ * Runs a single job to completion in the calling thread.
+ * Used for the sub-jobs that encode video segments, see chunk.c.
+ * The job is freed when done.
+ * @param job Handle to hb_job_t.
+ */
+void hb_work_run_job( hb_job_t * job )
+{
+    do_job( job );
+}
+
 hb_work_object_t * hb_get_work( int id )
 {
     hb_work_object_t * w;
@@ -148,6 +186,44 @@ hb_work_object_t* hb_codec_encoder(int codec)
     return NULL;
 }
 
+hb_work_object_t* hb_video_encoder(int vcodec)
+{
+    hb_work_object_t * w = NULL;
+
+    switch (vcodec)
+    {
+        case HB_VCODEC_FFMPEG_MPEG4:
+            w = hb_get_work(WORK_ENCAVCODEC);
+            w->codec_param = AV_CODEC_ID_MPEG4;
+            break;
+        case HB_VCODEC_FFMPEG_MPEG2:
+            w = hb_get_work(WORK_ENCAVCODEC);
+            w->codec_param = AV_CODEC_ID_MPEG2VIDEO;
+            break;
+        case HB_VCODEC_FFMPEG_VP8:
+            w = hb_get_work(WORK_ENCAVCODEC);
+            w->codec_param = AV_CODEC_ID_VP8;
+            break;
+        case HB_VCODEC_X264:
+            w = hb_get_work(WORK_ENCX264);
+            break;
+        case HB_VCODEC_QSV_H264:
+            w = hb_get_work(WORK_ENCQSV);
+            break;
+        case HB_VCODEC_THEORA:
+            w = hb_get_work(WORK_ENCTHEORA);
+            break;
+#ifdef USE_X265
+        case HB_VCODEC_X265:
+            w = hb_get_work(WORK_ENCX265);
+            break;
+#endif
+        default:
+            break;
+    }
+    return w;
+}
+
 /**
  * Displays job parameters in the debug log.
  * @param job Handle work hb_job_t.
@@ -372,6 +448,24 @@ void hb_display_job_info(hb_job_t *job)
         }
     }
 
+    for( i = 0; i < hb_list_count( job->list_rendition ); i++ )
+    {
+        hb_rendition_t * rendition = hb_list_item( job->list_rendition, i );
+
+        hb_log( " * rendition %d", i + 1 );
+        hb_log( "   + %s", rendition->file );
+        hb_log( "   + dimensions: %d * %d", rendition->width, rendition->height );
+        if( rendition->vquality >= 0 )
+        {
+            hb_log( "   + quality: %.2f (%s)", rendition->vquality,
+                    hb_video_quality_get_name( job->vcodec ) );
+        }
+        else
+        {
+            hb_log( "   + bitrate: %d kbps", rendition->vbitrate );
+        }
+    }
+
     if( job->indepth_scan )
     {
         hb_log( " * Foreign Audio Search: %s%s%s",
@@ -524,6 +618,7 @@ static void do_job(hb_job_t *job)
     hb_work_object_t *w;
     hb_work_object_t *sync;
     hb_work_object_t *muxer;
+    hb_work_object_t *fanout;
     hb_work_object_t *reader = hb_get_work(WORK_READER);
 
     hb_audio_t *audio;
@@ -863,6 +958,11 @@ static void do_job(hb_job_t *job)
     }
 #endif
 
+    // Split the video into segments encoded in parallel if requested.
+    // This must happen before the filters are initialized since
+    // the segments get their own copies of them.
+    hb_chunk_init( job );
+
     // Filters have an effect on settings.
     // So initialize the filters and update the job.
     if( job->list_filter && hb_list_count( job->list_filter ) )
@@ -940,11 +1040,17 @@ static void do_job(hb_job_t *job)
     else
 #endif
     {
-        job->fifo_mpeg2  = hb_fifo_init( FIFO_LARGE, FIFO_LARGE_WAKE );
-        job->fifo_raw    = hb_fifo_init( FIFO_SMALL, FIFO_SMALL_WAKE );
-        job->fifo_sync   = hb_fifo_init( FIFO_SMALL, FIFO_SMALL_WAKE );
-        job->fifo_mpeg4  = hb_fifo_init( FIFO_LARGE, FIFO_LARGE_WAKE );
+        // Each of these has exactly one producer and one consumer thread
+        job->fifo_mpeg2  = hb_fifo_init_spsc( FIFO_LARGE, FIFO_LARGE_WAKE );
+        job->fifo_raw    = hb_fifo_init_spsc( FIFO_SMALL, FIFO_SMALL_WAKE );
+        job->fifo_sync   = hb_fifo_init_spsc( FIFO_SMALL, FIFO_SMALL_WAKE );
+        job->fifo_mpeg4  = hb_fifo_init_spsc( FIFO_LARGE, FIFO_LARGE_WAKE );
         job->fifo_render = NULL; // Attached to filter chain
+
+        hb_fifo_set_adaptive( job->fifo_raw, "decoder", FIFO_LARGE,
+                              FIFO_MEMORY_BUDGET );
+        hb_fifo_set_adaptive( job->fifo_sync, "sync", FIFO_LARGE,
+                              FIFO_MEMORY_BUDGET );
     }
 
     /* Audio fifos must be initialized before sync */
@@ -991,10 +1097,10 @@ static void do_job(hb_job_t *job)
             audio = hb_list_item(job->list_audio, i);
 
             /* set up the audio work structures */
-            audio->priv.fifo_raw  = hb_fifo_init(FIFO_SMALL, FIFO_SMALL_WAKE);
-            audio->priv.fifo_sync = hb_fifo_init(FIFO_SMALL, FIFO_SMALL_WAKE);
-            audio->priv.fifo_out  = hb_fifo_init(FIFO_LARGE, FIFO_LARGE_WAKE);
-            audio->priv.fifo_in   = hb_fifo_init(FIFO_LARGE, FIFO_LARGE_WAKE);
+            audio->priv.fifo_raw  = hb_fifo_init_spsc(FIFO_SMALL, FIFO_SMALL_WAKE);
+            audio->priv.fifo_sync = hb_fifo_init_spsc(FIFO_SMALL, FIFO_SMALL_WAKE);
+            audio->priv.fifo_out  = hb_fifo_init_spsc(FIFO_LARGE, FIFO_LARGE_WAKE);
+            audio->priv.fifo_in   = hb_fifo_init_spsc(FIFO_LARGE, FIFO_LARGE_WAKE);
 
             /* Passthru audio */
             if (audio->config.out.codec & HB_ACODEC_PASS_FLAG)
@@ -1181,7 +1287,13 @@ static void do_job(hb_job_t *job)
         hb_error("No video decoder set!");
         goto cleanup;
     }
-    hb_list_add(job->list_work, (w = hb_get_work(title->video_codec)));
+    // The segments decode the video themselves, the main job only
+    // needs the time stamps.
+    if( job->list_chunk )
+        w = hb_get_work( WORK_DECCHUNK );
+    else
+        w = hb_get_work( title->video_codec );
+    hb_list_add(job->list_work, w);
     w->codec_param = title->video_codec_param;
     w->fifo_in  = job->fifo_mpeg2;
     w->fifo_out = job->fifo_raw;
@@ -1216,7 +1328,13 @@ static void do_job(hb_job_t *job)
     /* Set up the video filter fifo pipeline */
     if( !job->indepth_scan )
     {
-        if( job->list_filter )
+        if( job->list_chunk )
+        {
+            // The segments run the filters, the main job only needs the
+            // synced packets for pacing the segmented encoder.
+            job->fifo_render = NULL;
+        }
+        else if( job->list_filter )
         {
             int filter_count = hb_list_count( job->list_filter );
             int i;
@@ -1227,7 +1345,9 @@ static void do_job(hb_job_t *job)
                 hb_filter_object_t * filter = hb_list_item( job->list_filter, i );
 
                 filter->fifo_in = fifo_in;
-                filter->fifo_out = hb_fifo_init( FIFO_MINI, FIFO_MINI_WAKE );
+                filter->fifo_out = hb_fifo_init_spsc( FIFO_MINI, FIFO_MINI_WAKE );
+                hb_fifo_set_adaptive( filter->fifo_out, filter->name,
+                                      FIFO_LARGE, FIFO_MEMORY_BUDGET );
                 fifo_in = filter->fifo_out;
             }
             job->fifo_render = fifo_in;
@@ -1239,34 +1359,11 @@ static void do_job(hb_job_t *job)
         }
 
         /* Video encoder */
-        switch( job->vcodec )
+        w = hb_video_encoder( job->vcodec );
+        if( job->list_chunk )
         {
-        case HB_VCODEC_FFMPEG_MPEG4:
-            w = hb_get_work( WORK_ENCAVCODEC );
-            w->codec_param = AV_CODEC_ID_MPEG4;
-            break;
-        case HB_VCODEC_FFMPEG_MPEG2:
-            w = hb_get_work( WORK_ENCAVCODEC );
-            w->codec_param = AV_CODEC_ID_MPEG2VIDEO;
-            break;
-        case HB_VCODEC_FFMPEG_VP8:
-            w = hb_get_work( WORK_ENCAVCODEC );
-            w->codec_param = AV_CODEC_ID_VP8;
-            break;
-        case HB_VCODEC_X264:
-            w = hb_get_work( WORK_ENCX264 );
-            break;
-        case HB_VCODEC_QSV_H264:
-            w = hb_get_work( WORK_ENCQSV );
-            break;
-        case HB_VCODEC_THEORA:
-            w = hb_get_work( WORK_ENCTHEORA );
-            break;
-#ifdef USE_X265
-        case HB_VCODEC_X265:
-            w = hb_get_work( WORK_ENCX265 );
-            break;
-#endif
+            free( w );
+            w = hb_get_work( WORK_ENCCHUNK );
         }
         // Handle case where there are no filters.  
         // This really should never happen.
@@ -1278,6 +1375,16 @@ static void do_job(hb_job_t *job)
         w->fifo_out = job->fifo_mpeg4;
         w->config   = &job->config;
 
+        // The renditions take their share of the frames on the
+        // way to the encoder
+        fanout = hb_rendition_fanout_init( job );
+        if( fanout != NULL )
+        {
+            fanout->fifo_in = w->fifo_in;
+            w->fifo_in = fanout->fifo_out;
+            hb_list_add( job->list_work, fanout );
+        }
+
         hb_list_add( job->list_work, w );
 
         for( i = 0; i < hb_list_count( job->list_audio ); i++ )
@@ -1338,7 +1445,22 @@ static void do_job(hb_job_t *job)
     }
 
     /* Display settings */
-    hb_display_job_info( job );
+    if( job->chunk == NULL )
+    {
+        hb_display_job_info( job );
+    }
+
+    if ( hb_get_trace( job->h ) != NULL )
+    {
+        char name[64];
+        if ( job->chunk != NULL )
+            snprintf( name, sizeof( name ), "job %d segment",
+                      job->sequence_id & 0xFFFFFF );
+        else
+            snprintf( name, sizeof( name ), "job %d pass %d",
+                      job->sequence_id & 0xFFFFFF, job->pass );
+        job->trace_pid = hb_trace_process( hb_get_trace( job->h ), name );
+    }
 
     /* Init read & write threads */
     if ( reader->init( reader, job ) )
@@ -1349,11 +1471,12 @@ static void do_job(hb_job_t *job)
         goto cleanup;
     }
     reader->done = &job->done;
+    stage_start( job, &reader->stats, reader->name );
     reader->thread = hb_thread_init( reader->name, ReadLoop, reader, HB_NORMAL_PRIORITY );
 
     job->done = 0;
 
-    if( job->list_filter && !job->indepth_scan )
+    if( job->list_filter && !job->list_chunk && !job->indepth_scan )
     {
         int filter_count = hb_list_count( job->list_filter );
         int i;
@@ -1367,6 +1490,7 @@ static void do_job(hb_job_t *job)
             // Filters were initialized earlier, so we just need
             // to start the filter's thread
             filter->done = &job->done;
+            stage_start( job, &filter->stats, filter->name );
             filter->thread = hb_thread_init( filter->name, filter_loop, filter,
                                              HB_LOW_PRIORITY );
         }
@@ -1385,6 +1509,7 @@ static void do_job(hb_job_t *job)
             *job->die = 1;
             goto cleanup;
         }
+        stage_start( job, &w->stats, w->name );
         w->thread = hb_thread_init( w->name, work_loop, w,
                                     HB_LOW_PRIORITY );
     }
@@ -1406,20 +1531,30 @@ static void do_job(hb_job_t *job)
             *job->die = 1;
             goto cleanup;
         }
+        stage_start( job, &sync->stats, sync->name );
         sync->thread = hb_thread_init( sync->name, work_loop, sync,
                                     HB_LOW_PRIORITY );
 
         // The muxer requires track information that's set up by the encoder
         // init routines so we have to init the muxer last.
-        muxer = hb_muxer_init( job );
+        // Segments are written out for the main job to mux.
+        if( job->chunk )
+            muxer = hb_chunk_writer_init( job );
+        else
+            muxer = hb_muxer_init( job );
         w = muxer;
     }
 
     hb_buffer_t      * buf_in, * buf_out = NULL;
+    uint64_t           t, start;
+    int64_t            sequence, pts;
 
+    stage_start( job, &w->stats, w->name );
+    t = hb_get_time_us();
     while ( !*job->die && !*w->done && w->status != HB_WORK_DONE )
     {
         buf_in = hb_fifo_get_wait( w->fifo_in );
+        t = hb_stage_lap( &w->stats.wait_in, t );
         if ( buf_in == NULL )
             continue;
         if ( *job->die )
@@ -1430,6 +1565,10 @@ static void do_job(hb_job_t *job)
             }
             break;
         }
+        hb_stage_count( &w->stats, buf_in->size );
+        sequence = buf_in->sequence;
+        pts = buf_in->s.start;
+        start = t;
 
         buf_out = NULL;
         w->status = w->work( w, &buf_in, &buf_out );
@@ -1442,8 +1581,11 @@ static void do_job(hb_job_t *job)
         {
             hb_buffer_close( &buf_out );
         }
+        t = hb_stage_lap( &w->stats.busy, t );
+        hb_stage_trace( &w->stats, "work", start, t, sequence, pts );
         if( buf_out )
         {
+            start = t;
             while ( !*job->die )
             {
                 if ( hb_fifo_full_wait( w->fifo_out ) )
@@ -1453,19 +1595,25 @@ static void do_job(hb_job_t *job)
                     break;
                 }
             }
+            t = hb_stage_lap( &w->stats.wait_out, t );
+            hb_stage_trace( &w->stats, "wait", start, t, sequence, pts );
         }
     }
+    hb_stage_close( job->h, &w->stats );
 
     if ( buf_out )
     {
         hb_buffer_close( &buf_out );
     }
 
-    hb_handle_t * h = job->h;
-    hb_state_t state;
-    hb_get_state( h, &state );
-    
-    hb_log("work: average encoding speed for job is %f fps", state.param.working.rate_avg);
+    if( job->chunk == NULL )
+    {
+        hb_handle_t * h = job->h;
+        hb_state_t state;
+        hb_get_state( h, &state );
+
+        hb_log("work: average encoding speed for job is %f fps", state.param.working.rate_avg);
+    }
 
     job->done = 1;
     if( muxer != NULL )
@@ -1476,6 +1624,7 @@ static void do_job(hb_job_t *job)
         if( sync->thread != NULL )
         {
             hb_thread_close( &sync->thread );
+            hb_stage_close( job->h, &sync->stats );
             sync->close( sync );
         }
         free( sync );
@@ -1500,6 +1649,7 @@ cleanup:
             if( filter->thread != NULL )
             {
                 hb_thread_close( &filter->thread );
+                hb_stage_close( job->h, &filter->stats );
             }
             filter->close( filter );
         }
@@ -1512,6 +1662,7 @@ cleanup:
         if( w->thread != NULL )
         {
             hb_thread_close( &w->thread );
+            hb_stage_close( job->h, &w->stats );
             w->close( w );
         }
         free( w );
@@ -1519,14 +1670,33 @@ cleanup:
 
     hb_list_close( &job->list_work );
 
+    /* The segment encoder has stopped its sub-jobs, remove their files */
+    hb_chunk_close( job );
+
+    /* Let the renditions finish their files */
+    hb_rendition_fanout_close( job );
+
     /* Stop the read thread */
     if( reader->thread != NULL )
     {
         hb_thread_close( &reader->thread );
+        hb_stage_close( job->h, &reader->stats );
         reader->close( reader );
     }
     free( reader );
 
+    /* Report how full the video fifos ran */
+    hb_fifo_log_stats( job->fifo_raw );
+    hb_fifo_log_stats( job->fifo_sync );
+    if( job->list_filter )
+    {
+        for( i = 0; i < hb_list_count( job->list_filter ); i++ )
+        {
+            hb_filter_object_t * filter = hb_list_item( job->list_filter, i );
+            hb_fifo_log_stats( filter->fifo_out );
+        }
+    }
+
     /* Close fifos */
     hb_fifo_close( &job->fifo_mpeg2 );
     hb_fifo_close( &job->fifo_raw );
@@ -1642,7 +1812,11 @@ cleanup:
         }
     }
 
-    hb_buffer_pool_free();
+    // Other segments of the same job may still be using the pool
+    if( job->chunk == NULL )
+    {
+        hb_buffer_pool_free();
+    }
           
     /* OpenCL: must be closed *after* freeing the buffer pool */
     if (job->use_opencl)
@@ -1678,10 +1852,13 @@ static void work_loop( void * _w )
 {
     hb_work_object_t * w = _w;
     hb_buffer_t      * buf_in = NULL, * buf_out = NULL;
+    uint64_t           t = hb_get_time_us(), start;
+    int64_t            sequence, pts;
 
     while( !*w->done && w->status != HB_WORK_DONE )
     {
         buf_in = hb_fifo_get_wait( w->fifo_in );
+        t = hb_stage_lap( &w->stats.wait_in, t );
         if ( buf_in == NULL )
             continue;
         if ( *w->done )
@@ -1692,6 +1869,10 @@ static void work_loop( void * _w )
             }
             break;
         }
+        hb_stage_count( &w->stats, buf_in->size );
+        sequence = buf_in->sequence;
+        pts = buf_in->s.start;
+        start = t;
         // Invalidate buf_out so that if there is no output
         // we don't try to pass along junk.
         buf_out = NULL;
@@ -1707,8 +1888,11 @@ static void work_loop( void * _w )
         {
             hb_buffer_close( &buf_out );
         }
+        t = hb_stage_lap( &w->stats.busy, t );
+        hb_stage_trace( &w->stats, "work", start, t, sequence, pts );
         if( buf_out )
         {
+            start = t;
             while ( !*w->done )
             {
                 if ( hb_fifo_full_wait( w->fifo_out ) )
@@ -1718,6 +1902,8 @@ static void work_loop( void * _w )
                     break;
                 }
             }
+            t = hb_stage_lap( &w->stats.wait_out, t );
+            hb_stage_trace( &w->stats, "wait", start, t, sequence, pts );
         }
     }
     if ( buf_out )
@@ -1747,12 +1933,19 @@ static void filter_loop( void * _f )
 {
     hb_filter_object_t * f = _f;
     hb_buffer_t      * buf_in, * buf_out = NULL;
+    uint64_t           t = hb_get_time_us(), start;
+    int64_t            sequence, pts;
 
     while( !*f->done && f->status != HB_FILTER_DONE )
     {
         buf_in = hb_fifo_get_wait( f->fifo_in );
+        t = hb_stage_lap( &f->stats.wait_in, t );
         if ( buf_in == NULL )
             continue;
+        hb_stage_count( &f->stats, buf_in->size );
+        sequence = buf_in->sequence;
+        pts = buf_in->s.start;
+        start = t;
 
         // Filters can drop buffers.  Remember chapter information
         // so that it can be propagated to the next buffer
@@ -1808,8 +2001,11 @@ static void filter_loop( void * _f )
         {
             hb_buffer_close( &buf_out );
         }
+        t = hb_stage_lap( &f->stats.busy, t );
+        hb_stage_trace( &f->stats, "work", start, t, sequence, pts );
         if( buf_out )
         {
+            start = t;
             while ( !*f->done )
             {
                 if ( hb_fifo_full_wait( f->fifo_out ) )
@@ -1819,6 +2015,8 @@ static void filter_loop( void * _f )
                     break;
                 }
             }
+            t = hb_stage_lap( &f->stats.wait_out, t );
+            hb_stage_trace( &f->stats, "wait", start, t, sequence, pts );
         }
     }
     if ( buf_out )
@@ -0,0 +1,358 @@
+/* writebehind.c
+
+   Copyright (c) 2003-2014 HandBrake Team
+   This file is part of the HandBrake source code
+   Homepage: <http://handbrake.fr/>.
+   It may be used under the terms of the GNU General Public License v2.
+   For full terms see the file COPYING file or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*
+ * Write-behind output file.
+ *
+ * Writes are copied into large blocks which a thread of its own writes
+ * to the file in the order they were made, so the muxer never waits for
+ * the disk unless the blocks in flight exceed the memory budget.
+ * Sequential writes fill blocks aligned to the block size; a write that
+ * doesn't follow the previous one (e.g. a muxer going back to patch a
+ * header) starts a new block at its own position.
+ */
+
+#include <errno.h>
+#include "hb.h"
+
+#define WB_BLOCK_SIZE   (1 << 20)
+
+typedef struct hb_wb_block_s hb_wb_block_t;
+
+struct hb_wb_block_s
+{
+    int64_t         pos;
+    int             size;
+    int             alloc;      // room up to the next block boundary
+    uint8_t       * data;
+    hb_wb_block_t * next;
+};
+
+struct hb_write_behind_s
+{
+    FILE          * file;
+    hb_thread_t   * thread;
+
+    hb_lock_t     * lock;
+    hb_cond_t     * cond;       // blocks queued or written
+    hb_wb_block_t * first;      // queued blocks, protected by lock
+    hb_wb_block_t * last;
+    hb_wb_block_t * free;       // written blocks, for reuse
+    hb_wb_block_t * current;    // block being filled, not queued yet
+    int             pending;    // blocks queued or being filled
+    int             max_pending;
+    int             stop;
+    int             error;      // errno of the first failed write
+
+    int             direct;     // write through, see hb_write_behind_sync()
+
+    // Statistics
+    int64_t         bytes;
+    int             writes;
+    int64_t         wait_time;  // time spent waiting for the budget, in ms
+};
+
+static int wb_file_write( FILE * file, int64_t pos, const uint8_t * data,
+                          int size )
+{
+    errno = 0;
+    if ( fseeko( file, pos, SEEK_SET ) != 0 ||
+         fwrite( data, 1, size, file ) != size )
+    {
+        return errno ? errno : EIO;
+    }
+    return 0;
+}
+
+static void wb_thread( void * _wb )
+{
+    hb_write_behind_t * wb = _wb;
+    hb_wb_block_t     * block;
+    int                 error;
+
+    hb_lock( wb->lock );
+    while ( 1 )
+    {
+        while ( wb->first == NULL && !wb->stop )
+        {
+            hb_cond_wait( wb->cond, wb->lock );
+        }
+        if ( wb->first == NULL )
+        {
+            break;
+        }
+        block = wb->first;
+        wb->first = block->next;
+        if ( wb->first == NULL )
+        {
+            wb->last = NULL;
+        }
+        hb_unlock( wb->lock );
+
+        // Once a write has failed the rest is dropped
+        error = 0;
+        if ( !wb->error )
+        {
+            error = wb_file_write( wb->file, block->pos, block->data,
+                                   block->size );
+        }
+
+        hb_lock( wb->lock );
+        if ( error && !wb->error )
+        {
+            wb->error = error;
+        }
+        wb->bytes += block->size;
+        wb->writes++;
+        block->next = wb->free;
+        wb->free = block;
+        wb->pending--;
+        hb_cond_broadcast( wb->cond );
+    }
+    hb_unlock( wb->lock );
+}
+
+// Called with the lock held
+static void wb_queue_current( hb_write_behind_t * wb )
+{
+    hb_wb_block_t * block = wb->current;
+
+    if ( block == NULL )
+    {
+        return;
+    }
+    wb->current = NULL;
+    if ( block->size == 0 )
+    {
+        block->next = wb->free;
+        wb->free = block;
+        wb->pending--;
+        return;
+    }
+    block->next = NULL;
+    if ( wb->last != NULL )
+    {
+        wb->last->next = block;
+    }
+    else
+    {
+        wb->first = block;
+    }
+    wb->last = block;
+    hb_cond_broadcast( wb->cond );
+}
+
+// Called with the lock held, waits for room in the budget
+static hb_wb_block_t * wb_new_block( hb_write_behind_t * wb, int64_t pos )
+{
+    hb_wb_block_t * block;
+
+    if ( wb->pending >= wb->max_pending )
+    {
+        uint64_t start = hb_get_date();
+        while ( wb->pending >= wb->max_pending && !wb->error )
+        {
+            hb_cond_wait( wb->cond, wb->lock );
+        }
+        wb->wait_time += hb_get_date() - start;
+    }
+    if ( wb->error )
+    {
+        return NULL;
+    }
+
+    block = wb->free;
+    if ( block != NULL )
+    {
+        wb->free = block->next;
+    }
+    else
+    {
+        block = calloc( 1, sizeof( hb_wb_block_t ) );
+        if ( block == NULL )
+        {
+            return NULL;
+        }
+        block->data = malloc( WB_BLOCK_SIZE );
+        if ( block->data == NULL )
+        {
+            free( block );
+            return NULL;
+        }
+    }
+    block->pos   = pos;
+    block->size  = 0;
+    block->alloc = WB_BLOCK_SIZE - pos % WB_BLOCK_SIZE;
+    block->next  = NULL;
+    wb->pending++;
+
+    return block;
+}
+
+/*
+ * Creates (or truncates) the file at 'path'.  At most 'budget' bytes of
+ * writes are held in memory.
+ */
+hb_write_behind_t * hb_write_behind_open( const char * path, int64_t budget )
+{
+    hb_write_behind_t * wb = calloc( 1, sizeof( hb_write_behind_t ) );
+
+    if ( wb == NULL )
+    {
+        return NULL;
+    }
+    wb->file = hb_fopen( path, "wb" );
+    if ( wb->file == NULL )
+    {
+        hb_error( "writebehind: could not open %s: %s", path,
+                  strerror( errno ) );
+        free( wb );
+        return NULL;
+    }
+    // Blocks are large, stdio buffering would only add a copy
+    setvbuf( wb->file, NULL, _IONBF, 0 );
+
+    wb->max_pending = MAX( budget / WB_BLOCK_SIZE, 2 );
+    wb->lock   = hb_lock_init();
+    wb->cond   = hb_cond_init();
+    wb->thread = hb_thread_init( "writebehind", wb_thread, wb,
+                                 HB_NORMAL_PRIORITY );
+
+    return wb;
+}
+
+/*
+ * Writes 'size' bytes at file position 'pos'.  Returns 0 or the errno of
+ * a write that failed since, in which case nothing more gets written.
+ */
+int hb_write_behind_write( hb_write_behind_t * wb, int64_t pos,
+                           const uint8_t * data, int size )
+{
+    hb_wb_block_t * block;
+    int             len, error;
+
+    if ( wb->direct )
+    {
+        if ( wb->error )
+        {
+            return wb->error;
+        }
+        error = wb_file_write( wb->file, pos, data, size );
+        if ( error )
+        {
+            wb->error = error;
+        }
+        wb->bytes += size;
+        wb->writes++;
+        return error;
+    }
+
+    hb_lock( wb->lock );
+    while ( size > 0 && !wb->error )
+    {
+        block = wb->current;
+        if ( block == NULL || block->pos + block->size != pos ||
+             block->size == block->alloc )
+        {
+            wb_queue_current( wb );
+            block = wb->current = wb_new_block( wb, pos );
+            if ( block == NULL )
+            {
+                if ( !wb->error )
+                {
+                    wb->error = ENOMEM;
+                }
+                break;
+            }
+        }
+        len = MIN( size, block->alloc - block->size );
+        memcpy( block->data + block->size, data, len );
+        block->size += len;
+        pos  += len;
+        data += len;
+        size -= len;
+
+        if ( block->size == block->alloc )
+        {
+            wb_queue_current( wb );
+        }
+    }
+    error = wb->error;
+    hb_unlock( wb->lock );
+
+    return error;
+}
+
+/*
+ * Waits until everything written so far is in the file.  Later writes
+ * go straight to the file, for muxers that read the file back while
+ * finishing it (e.g. to move the MP4 moov atom to the front).
+ */
+int hb_write_behind_sync( hb_write_behind_t * wb )
+{
+    int error;
+
+    hb_lock( wb->lock );
+    wb_queue_current( wb );
+    while ( wb->pending > 0 )
+    {
+        hb_cond_wait( wb->cond, wb->lock );
+    }
+    wb->direct = 1;
+    error = wb->error;
+    hb_unlock( wb->lock );
+
+    return error;
+}
+
+/*
+ * Writes what is left, closes the file and returns 0 or the errno of
+ * the first write that failed.
+ */
+int hb_write_behind_close( hb_write_behind_t ** _wb )
+{
+    hb_write_behind_t * wb = *_wb;
+    hb_wb_block_t     * block;
+    int                 error;
+
+    if ( wb == NULL )
+    {
+        return 0;
+    }
+    hb_write_behind_sync( wb );
+
+    hb_lock( wb->lock );
+    wb->stop = 1;
+    hb_cond_broadcast( wb->cond );
+    hb_unlock( wb->lock );
+    hb_thread_close( &wb->thread );
+
+    if ( fclose( wb->file ) != 0 && !wb->error )
+    {
+        wb->error = errno ? errno : EIO;
+    }
+    error = wb->error;
+
+    hb_log( "writebehind: %"PRId64" bytes in %d writes, "
+            "waited %.2f s for the disk",
+            wb->bytes, wb->writes, wb->wait_time / 1000. );
+
+    while ( ( block = wb->free ) != NULL )
+    {
+        wb->free = block->next;
+        free( block->data );
+        free( block );
+    }
+    hb_cond_close( &wb->cond );
+    hb_lock_close( &wb->lock );
+    free( wb );
+    *_wb = NULL;
+
+    return error;
+}
@@ -0,0 +1,646 @@
+/* bench.c
+
+   Copyright (c) 2003-2014 HandBrake Team
+   This file is part of the HandBrake source code
+   Homepage: <http://handbrake.fr/>.
+   It may be used under the terms of the GNU General Public License v2.
+   For full terms see the file COPYING file or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*
+ * hb-bench: video filter micro-benchmarks.
+ *
+ * Feeds synthetic frames, or raw I420 frames read from a file, straight
+ * into libhb's video filters through their init, work and close
+ * functions, without demuxing, decoding or encoding.  For every filter
+ * and setting it reports the frames per second and nanoseconds per pixel
+ * spent in the filter's work function, and the peak resident set size.
+ * With --pools it also reports the buffer pool counters of each setting,
+ * for sizing the buffer caches.  With --check it instead verifies that
+ * the SIMD kernels of the filters give the same results as their C
+ * versions.
+ *
+ * It uses the filters' private interface, so it is built with the same
+ * flags as libhb ('make hb-bench' in the build directory).
+ */
+
+#include <getopt.h>
+#include <errno.h>
+#if !defined(SYS_MINGW)
+#include <sys/resource.h>
+#endif
+#include "hb.h"
+#include "check.h"
+
+// Synthetic frames cycled through, and the most frames kept of a file
+#define BENCH_SYNTHETIC 8
+#define BENCH_RECORDED  32
+
+// More buffer pools than libhb has
+#define BENCH_POOLS     32
+
+typedef struct
+{
+    int          id;
+    const char * name;
+    const char * label;
+    const char * settings;  // or a preset for hb_generate_filter_settings()
+    int          preset;
+} bench_case_t;
+
+static const bench_case_t bench_cases[] =
+{
+    { HB_FILTER_DECOMB,      "decomb",      "default", NULL,           0 },
+    { HB_FILTER_DECOMB,      "decomb",      "fast",    "7:2:6:9:1:80", 0 },
+    { HB_FILTER_DECOMB,      "decomb",      "bob",     "455",          0 },
+    { HB_FILTER_DEINTERLACE, "deinterlace", "fast",    "0",            0 },
+    { HB_FILTER_DEINTERLACE, "deinterlace", "slow",    "1",            0 },
+    { HB_FILTER_DEINTERLACE, "deinterlace", "slower",  "3",            0 },
+    { HB_FILTER_DEINTERLACE, "deinterlace", "bob",     "15",           0 },
+    { HB_FILTER_DETELECINE,  "detelecine",  "default", NULL,           0 },
+    { HB_FILTER_DENOISE,     "denoise",     "light",   "light",        1 },
+    { HB_FILTER_DENOISE,     "denoise",     "strong",  "strong",       1 },
+    { HB_FILTER_NLMEANS,     "nlmeans",     "light",   "light",        1 },
+    { HB_FILTER_NLMEANS,     "nlmeans",     "medium",  "medium",       1 },
+    { HB_FILTER_DEBLOCK,     "deblock",     "default", NULL,           0 },
+    { HB_FILTER_DEBLOCK,     "deblock",     "strong",  "15",           0 },
+    { HB_FILTER_ROTATE,      "rotate",      "flip",    "3",            0 },
+    { HB_FILTER_ROTATE,      "rotate",      "90",      "4",            0 },
+    { HB_FILTER_CROP_SCALE,  "cropscale",   "crop",    NULL,           0 },
+    { HB_FILTER_CROP_SCALE,  "cropscale",   "half",    NULL,           0 },
+    { HB_FILTER_VFR,         "vfr",         "vfr",     "0",            0 },
+    { HB_FILTER_VFR,         "vfr",         "cfr-25",  "1:27000000:1080000", 0 },
+    { HB_FILTER_RENDER_SUB,  "rendersub",   "vobsub",  "0:0:0:0",      0 },
+};
+
+typedef struct
+{
+    hb_job_t      * job;
+    hb_subtitle_t * subtitle;   // burned in by rendersub
+    hb_buffer_t   * src[BENCH_RECORDED];
+    int             src_count;
+    int             width;
+    int             height;
+    hb_rational_t   vrate;
+    int             frames;
+    int             pools;      // report buffer pool counters
+} bench_t;
+
+typedef struct
+{
+    int     frames_in;
+    int     frames_out;
+    int64_t work_time;  // us in the work function
+    int64_t peak_rss;   // bytes, -1 if unknown
+    int     pool_count;
+    hb_buffer_pool_stats_t pools[BENCH_POOLS];
+} bench_result_t;
+
+static void usage( FILE * out )
+{
+    int ii;
+
+    fprintf( out,
+    "Syntax: hb-bench [options]\n"
+    "\n"
+    "    -W, --width <number>     Frame width (default: 1920)\n"
+    "    -H, --height <number>    Frame height (default: 1080)\n"
+    "    -n, --frames <number>    Frames per filter setting (default: 300)\n"
+    "    -i, --input <file>       Read raw I420 frames of the given size from\n"
+    "                             a file instead of generating them (the first\n"
+    "                             %d are cycled through)\n"
+    "    -f, --filter <name>      Only run this filter (may be repeated)\n"
+    "    -s, --settings <string>  Run the filter given with -f with these\n"
+    "                             settings only\n"
+    "    -p, --pools              Report the buffer pool counters of each\n"
+    "                             filter setting\n"
+    "    -c, --check              Check that the SIMD kernels give the same\n"
+    "                             results as the C kernels, then exit\n"
+    "    -h, --help               Print help\n"
+    "\n"
+    "Filters:", BENCH_RECORDED );
+    for ( ii = 0; ii < sizeof( bench_cases ) / sizeof( bench_cases[0] ); ii++ )
+    {
+        if ( ii == 0 || strcmp( bench_cases[ii].name, bench_cases[ii - 1].name ) )
+        {
+            fprintf( out, " %s", bench_cases[ii].name );
+        }
+    }
+    fprintf( out, "\n" );
+}
+
+/*
+ * Resets the peak resident set size where the system allows it, so each
+ * filter setting gets its own peak rather than the largest so far.
+ */
+static void bench_rss_reset( void )
+{
+#if defined(SYS_LINUX)
+    FILE * file = fopen( "/proc/self/clear_refs", "w" );
+    if ( file != NULL )
+    {
+        fputs( "5", file );
+        fclose( file );
+    }
+#endif
+}
+
+static int64_t bench_rss_peak( void )
+{
+#if defined(SYS_LINUX)
+    FILE * file = fopen( "/proc/self/status", "r" );
+    char   line[256];
+    long   kb;
+
+    if ( file != NULL )
+    {
+        while ( fgets( line, sizeof( line ), file ) != NULL )
+        {
+            if ( sscanf( line, "VmHWM: %ld kB", &kb ) == 1 )
+            {
+                fclose( file );
+                return (int64_t)kb * 1024;
+            }
+        }
+        fclose( file );
+    }
+#endif
+#if defined(SYS_MINGW)
+    return -1;
+#else
+    struct rusage usage;
+
+    if ( getrusage( RUSAGE_SELF, &usage ) != 0 )
+    {
+        return -1;
+    }
+#if defined(SYS_DARWIN)
+    return usage.ru_maxrss;
+#else
+    return (int64_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+/*
+ * Moving gradients with noise.  The two fields of every other frame are
+ * sampled half a frame apart, so the deinterlacers and the comb detector
+ * have combing to work on.
+ */
+static hb_buffer_t * bench_synthetic_frame( int width, int height, int index )
+{
+    hb_buffer_t * buf = hb_frame_buffer_init( AV_PIX_FMT_YUV420P,
+                                              width, height );
+    uint32_t      noise = 0x9e3779b9 * ( index + 1 );
+    int           pp, xx, yy, t;
+
+    for ( pp = 0; pp < 3; pp++ )
+    {
+        for ( yy = 0; yy < buf->plane[pp].height; yy++ )
+        {
+            uint8_t * row = buf->plane[pp].data + yy * buf->plane[pp].stride;
+
+            t = 4 * index;
+            if ( ( index & 1 ) && ( yy & 1 ) )
+            {
+                t += 2;
+            }
+            for ( xx = 0; xx < buf->plane[pp].width; xx++ )
+            {
+                noise = noise * 1664525 + 1013904223;
+                if ( pp == 0 )
+                {
+                    row[xx] = ( ( xx + yy + 4 * t ) & 0xff ) / 2 + 64 +
+                              ( noise >> 29 );
+                }
+                else
+                {
+                    row[xx] = 128 + ( ( ( pp == 1 ? xx : yy ) + t ) & 0x3f ) -
+                              32;
+                }
+            }
+        }
+    }
+
+    return buf;
+}
+
+static int bench_read_frames( bench_t * b, const char * path )
+{
+    FILE * file = hb_fopen( path, "rb" );
+    int    pp, yy;
+
+    if ( file == NULL )
+    {
+        fprintf( stderr, "hb-bench: could not open %s: %s\n", path,
+                 strerror( errno ) );
+        return -1;
+    }
+    while ( b->src_count < BENCH_RECORDED )
+    {
+        hb_buffer_t * buf = hb_frame_buffer_init( AV_PIX_FMT_YUV420P,
+                                                  b->width, b->height );
+        int ok = 1;
+
+        for ( pp = 0; pp < 3 && ok; pp++ )
+        {
+            for ( yy = 0; yy < buf->plane[pp].height && ok; yy++ )
+            {
+                ok = fread( buf->plane[pp].data + yy * buf->plane[pp].stride,
+                            buf->plane[pp].width, 1, file ) == 1;
+            }
+        }
+        if ( !ok )
+        {
+            hb_buffer_close( &buf );
+            break;
+        }
+        b->src[b->src_count++] = buf;
+    }
+    fclose( file );
+
+    if ( b->src_count == 0 )
+    {
+        fprintf( stderr, "hb-bench: %s holds no %dx%d I420 frame\n", path,
+                 b->width, b->height );
+        return -1;
+    }
+    return 0;
+}
+
+// A subtitle picture across the lower part of the frame, shown throughout
+static void bench_queue_subtitle( bench_t * b )
+{
+    hb_buffer_t * sub;
+    int           pp, xx, yy;
+
+    sub = hb_frame_buffer_init( AV_PIX_FMT_YUVA420P, b->width * 3 / 4 & ~1,
+                                b->height / 6 & ~1 );
+    for ( pp = 0; pp < 4; pp++ )
+    {
+        for ( yy = 0; yy < sub->plane[pp].height; yy++ )
+        {
+            uint8_t * row = sub->plane[pp].data + yy * sub->plane[pp].stride;
+            for ( xx = 0; xx < sub->plane[pp].width; xx++ )
+            {
+                // Opaque text strokes over a translucent box
+                row[xx] = pp == 0 ? 235 : pp < 3 ? 128 :
+                          ( xx / 8 + yy / 8 ) & 1 ? 255 : 96;
+            }
+        }
+    }
+    sub->f.x = ( b->width - sub->f.width ) / 2;
+    sub->f.y = b->height - sub->f.height - b->height / 20;
+    sub->s.start = 0;
+    sub->s.stop  = AV_NOPTS_VALUE;
+    hb_fifo_push( b->subtitle->fifo_out, sub );
+}
+
+static char * bench_settings( bench_t * b, const bench_case_t * c )
+{
+    char settings[64];
+
+    if ( c->id == HB_FILTER_CROP_SCALE )
+    {
+        // Crop 8% of each edge, or scale to half the size
+        if ( !strcmp( c->label, "crop" ) )
+        {
+            int ch = b->height * 8 / 100 & ~1, cw = b->width * 8 / 100 & ~1;
+            snprintf( settings, sizeof( settings ), "%d:%d:%d:%d:%d:%d",
+                      b->width - 2 * cw, b->height - 2 * ch, ch, ch, cw, cw );
+        }
+        else
+        {
+            snprintf( settings, sizeof( settings ), "%d:%d:0:0:0:0",
+                      b->width / 2 & ~1, b->height / 2 & ~1 );
+        }
+        return strdup( settings );
+    }
+    if ( c->preset )
+    {
+        return hb_generate_filter_settings( c->id, c->settings, NULL );
+    }
+    return c->settings != NULL ? strdup( c->settings ) : NULL;
+}
+
+static int bench_output( hb_buffer_t ** out )
+{
+    hb_buffer_t * buf;
+    int           count = 0;
+
+    for ( buf = *out; buf != NULL; buf = buf->next )
+    {
+        count += buf->size > 0;
+    }
+    hb_buffer_close( out );
+
+    return count;
+}
+
+static int bench_run( bench_t * b, const bench_case_t * c,
+                      const char * settings, bench_result_t * result )
+{
+    hb_filter_object_t * filter;
+    hb_filter_init_t     init;
+    hb_buffer_t        * in, * out;
+    int64_t              duration = 90000LL * b->vrate.den / b->vrate.num;
+    uint64_t             start;
+    int                  status = HB_FILTER_OK, ii, base_count;
+    hb_buffer_pool_stats_t base[BENCH_POOLS];
+
+    memset( result, 0, sizeof( *result ) );
+    bench_rss_reset();
+    base_count = hb_buffer_pool_get_stats( base, BENCH_POOLS );
+
+    filter = hb_filter_init( c->id );
+    filter->settings = settings != NULL ? strdup( settings ) : NULL;
+
+    memset( &init, 0, sizeof( init ) );
+    init.job             = b->job;
+    init.pix_fmt         = AV_PIX_FMT_YUV420P;
+    init.geometry.width  = b->width;
+    init.geometry.height = b->height;
+    init.geometry.par.num = 1;
+    init.geometry.par.den = 1;
+    init.vrate           = b->vrate;
+    init.cfr             = 0;
+
+    if ( c->id == HB_FILTER_RENDER_SUB )
+    {
+        bench_queue_subtitle( b );
+    }
+    if ( filter->init( filter, &init ) )
+    {
+        fprintf( stderr, "hb-bench: %s (%s) failed to initialize\n",
+                 c->name, settings ? settings : "default" );
+        hb_filter_close( &filter );
+        return -1;
+    }
+
+    for ( ii = 0; ii < b->frames && status != HB_FILTER_DONE; ii++ )
+    {
+        in = hb_buffer_dup( b->src[ii % b->src_count] );
+        in->sequence = ii;
+        in->s.start  = ii * duration;
+        in->s.stop   = in->s.start + duration;
+        in->s.duration = duration;
+        out = NULL;
+
+        start = hb_get_time_us();
+        status = filter->work( filter, &in, &out );
+        result->work_time += hb_get_time_us() - start;
+
+        hb_buffer_close( &in );
+        result->frames_in++;
+        result->frames_out += bench_output( &out );
+    }
+
+    // Flush what the filter held back, filters are done at end of stream
+    if ( status != HB_FILTER_DONE )
+    {
+        in = hb_buffer_init( 0 );
+        out = NULL;
+
+        start = hb_get_time_us();
+        status = filter->work( filter, &in, &out );
+        result->work_time += hb_get_time_us() - start;
+
+        hb_buffer_close( &in );
+        result->frames_out += bench_output( &out );
+    }
+
+    filter->close( filter );
+    hb_filter_close( &filter );
+
+    result->peak_rss = bench_rss_peak();
+
+    // Only count what this run did, e.g. not allocating the source frames
+    result->pool_count = hb_buffer_pool_get_stats( result->pools, BENCH_POOLS );
+    for ( ii = 0; ii < result->pool_count && ii < base_count; ii++ )
+    {
+        result->pools[ii].hits    -= base[ii].hits;
+        result->pools[ii].refills -= base[ii].refills;
+        result->pools[ii].misses  -= base[ii].misses;
+        result->pools[ii].spills  -= base[ii].spills;
+        result->pools[ii].frees   -= base[ii].frees;
+    }
+    hb_buffer_pool_free();
+
+    return 0;
+}
+
+static void bench_report( const bench_case_t * c, const char * label,
+                          bench_t * b, bench_result_t * r )
+{
+    double seconds = r->work_time / 1e6;
+    double pixels  = (double)r->frames_in * b->width * b->height;
+    char   rss[32];
+    int    ii;
+
+    if ( r->peak_rss >= 0 )
+    {
+        snprintf( rss, sizeof( rss ), "%.1f", r->peak_rss / ( 1024. * 1024. ) );
+    }
+    else
+    {
+        snprintf( rss, sizeof( rss ), "n/a" );
+    }
+    printf( "%-12s %-20s %7d %7d %9.1f %9.2f %9s\n", c->name, label,
+            r->frames_in, r->frames_out,
+            seconds > 0 ? r->frames_in / seconds : 0.,
+            pixels > 0 ? r->work_time * 1000. / pixels : 0., rss );
+    for ( ii = 0; b->pools && ii < r->pool_count; ii++ )
+    {
+        hb_buffer_pool_stats_t * st = &r->pools[ii];
+        if ( st->hits + st->refills + st->misses )
+        {
+            printf( "    pool %8d: %"PRIu64" hits, %"PRIu64" refills, "
+                    "%"PRIu64" misses, %"PRIu64" spills, %"PRIu64" frees\n",
+                    st->buffer_size, st->hits, st->refills, st->misses,
+                    st->spills, st->frees );
+        }
+    }
+    fflush( stdout );
+}
+
+int main( int argc, char ** argv )
+{
+    static struct option long_options[] =
+    {
+        { "width",    required_argument, NULL, 'W' },
+        { "height",   required_argument, NULL, 'H' },
+        { "frames",   required_argument, NULL, 'n' },
+        { "input",    required_argument, NULL, 'i' },
+        { "filter",   required_argument, NULL, 'f' },
+        { "settings", required_argument, NULL, 's' },
+        { "pools",    no_argument,       NULL, 'p' },
+        { "check",    no_argument,       NULL, 'c' },
+        { "help",     no_argument,       NULL, 'h' },
+        { 0, 0, 0, 0 }
+    };
+
+    hb_handle_t    * h;
+    hb_title_t     * title;
+    bench_t          b;
+    bench_result_t   result;
+    hb_list_t      * filters = hb_list_init();
+    char           * input = NULL, * settings = NULL;
+    int              c, ii, jj, check = 0, failed = 0;
+
+    memset( &b, 0, sizeof( b ) );
+    b.width  = 1920;
+    b.height = 1080;
+    b.frames = 300;
+    b.vrate.num = 27000000;
+    b.vrate.den = 900900;
+
+    while ( ( c = getopt_long( argc, argv, "W:H:n:i:f:s:pch",
+                               long_options, NULL ) ) != -1 )
+    {
+        switch ( c )
+        {
+            case 'W':
+                b.width = atoi( optarg );
+                break;
+            case 'H':
+                b.height = atoi( optarg );
+                break;
+            case 'n':
+                b.frames = atoi( optarg );
+                break;
+            case 'i':
+                input = optarg;
+                break;
+            case 'f':
+                hb_list_add( filters, optarg );
+                break;
+            case 's':
+                settings = optarg;
+                break;
+            case 'p':
+                b.pools = 1;
+                break;
+            case 'c':
+                check = 1;
+                break;
+            case 'h':
+                usage( stdout );
+                return 0;
+            default:
+                usage( stderr );
+                return 1;
+        }
+    }
+    if ( b.width < 64 || b.height < 64 || ( b.width | b.height ) & 1 ||
+         b.frames <= 0 )
+    {
+        fprintf( stderr, "hb-bench: invalid frame size or count\n" );
+        return 1;
+    }
+    if ( settings != NULL && hb_list_count( filters ) != 1 )
+    {
+        fprintf( stderr, "hb-bench: --settings needs exactly one --filter\n" );
+        return 1;
+    }
+
+    hb_global_init();
+
+    if ( check )
+    {
+        failed = bench_check_decomb();
+        printf( "decomb kernels: %s\n", failed ? "FAILED" : "ok" );
+        hb_list_close( &filters );
+        hb_global_close();
+        return failed != 0;
+    }
+
+    h = hb_init( HB_DEBUG_NONE, 0 );
+
+    if ( input != NULL )
+    {
+        if ( bench_read_frames( &b, input ) )
+        {
+            hb_close( &h );
+            hb_global_close();
+            return 1;
+        }
+    }
+    else
+    {
+        for ( ii = 0; ii < BENCH_SYNTHETIC; ii++ )
+        {
+            b.src[b.src_count++] = bench_synthetic_frame( b.width, b.height,
+                                                          ii );
+        }
+    }
+
+    // The few job and title fields the filters look at
+    title = hb_title_init( "hb-bench", 1 );
+    title->geometry.width  = b.width;
+    title->geometry.height = b.height;
+    title->vrate           = b.vrate;
+    b.job = hb_job_init( title );
+    b.job->h = h;
+
+    b.subtitle = calloc( 1, sizeof( hb_subtitle_t ) );
+    b.subtitle->source      = VOBSUB;
+    b.subtitle->config.dest = RENDERSUB;
+    b.subtitle->fifo_out    = hb_fifo_init( 8, 1 );
+    hb_list_add( b.job->list_subtitle, b.subtitle );
+
+    printf( "%dx%d, %d frames, %s, %d CPUs\n\n", b.width, b.height, b.frames,
+            input != NULL ? input : "synthetic", hb_get_cpu_count() );
+    printf( "%-12s %-20s %7s %7s %9s %9s %9s\n", "filter", "settings",
+            "in", "out", "fps", "ns/pixel", "RSS (MB)" );
+
+    for ( ii = 0; ii < sizeof( bench_cases ) / sizeof( bench_cases[0] ); ii++ )
+    {
+        const bench_case_t * bc = &bench_cases[ii];
+        char               * case_settings;
+
+        if ( hb_list_count( filters ) > 0 )
+        {
+            for ( jj = 0; jj < hb_list_count( filters ); jj++ )
+            {
+                if ( !strcmp( hb_list_item( filters, jj ), bc->name ) )
+                    break;
+            }
+            if ( jj == hb_list_count( filters ) )
+            {
+                continue;
+            }
+            // With explicit settings each filter runs once
+            if ( settings != NULL && ii > 0 &&
+                 !strcmp( bench_cases[ii - 1].name, bc->name ) )
+            {
+                continue;
+            }
+        }
+
+        case_settings = settings != NULL ? strdup( settings ) :
+                                           bench_settings( &b, bc );
+        if ( bench_run( &b, bc, case_settings, &result ) == 0 )
+        {
+            bench_report( bc, settings != NULL ? settings : bc->label,
+                          &b, &result );
+        }
+        else
+        {
+            failed = 1;
+        }
+        free( case_settings );
+    }
+
+    hb_fifo_close( &b.subtitle->fifo_out );
+    hb_job_close( &b.job );
+    hb_title_close( &title );
+    for ( ii = 0; ii < b.src_count; ii++ )
+    {
+        hb_buffer_close( &b.src[ii] );
+    }
+    hb_list_close( &filters );
+    hb_close( &h );
+    hb_global_close();
+
+    return failed;
+}
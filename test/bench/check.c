@@ -0,0 +1,242 @@
+/* check.c
+
+   Copyright (c) 2003-2014 HandBrake Team
+   This file is part of the HandBrake source code
+   Homepage: <http://handbrake.fr/>.
+   It may be used under the terms of the GNU General Public License v2.
+   For full terms see the file COPYING file or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*
+ * hb-bench --check: bit-exactness checks of the SIMD kernels of the
+ * filters against their C versions.
+ */
+
+#include <math.h>
+#include "hb.h"
+#include "decomb.h"
+#include "check.h"
+
+#define CHECK_WIDTH  273
+#define CHECK_STRIDE ( CHECK_WIDTH + 64 )
+
+static uint32_t check_rand( uint32_t * seed )
+{
+    *seed = *seed * 1664525 + 1013904223;
+    return *seed >> 8;
+}
+
+// Fills 5 rows of a frame with one of the test patterns
+static void check_fill( uint8_t * p, int pattern, uint32_t * seed )
+{
+    int x, y;
+
+    for( y = 0; y < 5; y++ )
+    {
+        for( x = 0; x < CHECK_STRIDE; x++ )
+        {
+            uint8_t * v = &p[y * CHECK_STRIDE + x];
+            switch( pattern )
+            {
+                case 0:  *v = check_rand( seed );                      break;
+                case 1:  *v = 0;                                      break;
+                case 2:  *v = 255;                                    break;
+                case 3:  *v = ( y & 1 ) ? 255 : 0;                    break;
+                case 4:  *v = ( check_rand( seed ) & 1 ) ? 255 : 0;   break;
+                default: *v = ( y & 1 ) ? 128 + check_rand( seed ) % 128 :
+                                          check_rand( seed ) % 128;   break;
+            }
+        }
+    }
+}
+
+static int check_kernels( const char * name, const decomb_kernels_t * ref,
+                          const decomb_kernels_t * k )
+{
+    static const int widths[] = { 1, 7, 8, 15, 16, 17, 31, 32, 33, 64,
+                                  100, CHECK_WIDTH };
+    static const int thresh[] = { -300, -1, 0, 1, 9, 47, 255, 256, 300 };
+    static const int taps[][6] =
+    {
+        { -1, 4, 2, 4, -1, 3 },
+        { -1, 2, 6, 2, -1, 3 },
+        { 30, -40, 60, -40, 30, 6 },    // too large for 16 bits
+    };
+    uint8_t  frames[3][5 * CHECK_STRIDE];
+    uint8_t  out_ref[CHECK_STRIDE], out[CHECK_STRIDE];
+    float    gamma_lut[256];
+    uint32_t seed = 1;
+    int      failed = 0;
+    int      pattern, w, ii, jj, kk;
+
+    for( ii = 0; ii < 256; ii++ )
+    {
+        gamma_lut[ii] = pow( ( (float)ii / (float)255 ), 2.2f );
+    }
+
+    for( pattern = 0; pattern < 6; pattern++ )
+    {
+        for( ii = 0; ii < 3; ii++ )
+        {
+            check_fill( frames[ii], ( ii == 1 || pattern != 3 ) ? pattern : 0,
+                        &seed );
+        }
+        const uint8_t * prev = &frames[0][2 * CHECK_STRIDE];
+        const uint8_t * cur  = &frames[1][2 * CHECK_STRIDE];
+        const uint8_t * next = &frames[2][2 * CHECK_STRIDE];
+
+        for( w = 0; w < sizeof( widths ) / sizeof( widths[0] ); w++ )
+        {
+            int width = widths[w];
+
+            for( ii = 0; ii < 3 * 2 * 9 * 9; ii++ )
+            {
+                comb_param_t param;
+                param.spatial_metric  = ii % 3;
+                param.force_motion    = ( ii / 3 ) % 2;
+                param.mthresh         = thresh[( ii / 6 ) % 9];
+                param.athresh         = thresh[( ii / 54 ) % 9];
+                param.athresh_squared = param.athresh * param.athresh;
+                param.athresh6        = 6 * param.athresh;
+
+                memset( out_ref, 0, sizeof( out_ref ) );
+                memset( out, 0, sizeof( out ) );
+                ref->detect_row( &param, out_ref, prev, cur, next,
+                                 CHECK_STRIDE, width );
+                k->detect_row( &param, out, prev, cur, next,
+                               CHECK_STRIDE, width );
+                if( memcmp( out_ref, out, CHECK_STRIDE ) )
+                {
+                    hb_error( "decomb: %s detect_row differs, pattern %d "
+                              "width %d metric %d mthresh %d athresh %d",
+                              name, pattern, width, param.spatial_metric,
+                              param.mthresh, param.athresh );
+                    failed++;
+                }
+            }
+
+            for( ii = 0; ii < 2 * 9 * 9; ii++ )
+            {
+                gamma_comb_param_t param;
+                param.gamma_lut    = gamma_lut;
+                param.force_motion = ii % 2;
+                param.mthresh      = (float)thresh[( ii / 2 ) % 9] / 255;
+                param.athresh      = (float)thresh[( ii / 18 ) % 9] / 255;
+                param.athresh6     = 6 * param.athresh;
+
+                memset( out_ref, 0, sizeof( out_ref ) );
+                memset( out, 0, sizeof( out ) );
+                ref->detect_gamma_row( &param, out_ref, prev, cur, next,
+                                       CHECK_STRIDE, width );
+                k->detect_gamma_row( &param, out, prev, cur, next,
+                                     CHECK_STRIDE, width );
+                if( memcmp( out_ref, out, CHECK_STRIDE ) )
+                {
+                    hb_error( "decomb: %s detect_gamma_row differs, pattern %d "
+                              "width %d mthresh %f athresh %f", name, pattern,
+                              width, param.mthresh, param.athresh );
+                    failed++;
+                }
+            }
+
+            // Offsets of the rows used at the top, middle and bottom
+            for( ii = 0; ii < 3; ii++ )
+            {
+                int up2   = ( ii == 1 ? 2 : -2 ) * CHECK_STRIDE;
+                int up1   = ( ii == 1 ? 1 : -1 ) * CHECK_STRIDE;
+                int down1 = ( ii == 2 ? -1 : 1 ) * CHECK_STRIDE;
+                int down2 = ( ii == 2 ? -2 : 2 ) * CHECK_STRIDE;
+
+                for( jj = 0; jj < sizeof( taps ) / sizeof( taps[0] ); jj++ )
+                {
+                    filter_param_t filter;
+                    for( kk = 0; kk < 5; kk++ )
+                    {
+                        filter.tap[kk] = taps[jj][kk];
+                    }
+                    filter.normalize = taps[jj][5];
+
+                    memset( out_ref, 0, sizeof( out_ref ) );
+                    memset( out, 0, sizeof( out ) );
+                    ref->blend_row( &filter, out_ref, cur, up2, up1,
+                                    down1, down2, width );
+                    k->blend_row( &filter, out, cur, up2, up1,
+                                  down1, down2, width );
+                    if( memcmp( out_ref, out, CHECK_STRIDE ) )
+                    {
+                        hb_error( "decomb: %s blend_row differs, pattern %d "
+                                  "width %d taps %d", name, pattern, width, jj );
+                        failed++;
+                    }
+                }
+            }
+
+            memset( out_ref, 0, sizeof( out_ref ) );
+            memset( out, 0, sizeof( out ) );
+            ref->cubic_row( out_ref, cur - 2 * CHECK_STRIDE, cur - CHECK_STRIDE,
+                            cur + CHECK_STRIDE, cur + 2 * CHECK_STRIDE, width );
+            k->cubic_row( out, cur - 2 * CHECK_STRIDE, cur - CHECK_STRIDE,
+                          cur + CHECK_STRIDE, cur + 2 * CHECK_STRIDE, width );
+            if( memcmp( out_ref, out, CHECK_STRIDE ) )
+            {
+                hb_error( "decomb: %s cubic_row differs, pattern %d width %d",
+                          name, pattern, width );
+                failed++;
+            }
+        }
+    }
+
+    // Combing masks hold 0 and 1
+    for( pattern = 0; pattern < 3; pattern++ )
+    {
+        uint8_t mask[CHECK_STRIDE];
+
+        for( ii = 0; ii < CHECK_STRIDE; ii++ )
+        {
+            mask[ii] = pattern == 0 ? check_rand( &seed ) & 1 : pattern - 1;
+        }
+        for( w = 0; w < sizeof( widths ) / sizeof( widths[0] ); w++ )
+        {
+            int width = widths[w];
+            int block_width, x;
+
+            for( block_width = 1; block_width <= width; block_width += 7 )
+            {
+                for( x = 0; x + block_width <= width; x += 1 + x / 2 )
+                {
+                    if( ref->comb_block_row( mask, x, width, block_width ) !=
+                        k->comb_block_row( mask, x, width, block_width ) ||
+                        ref->filtered_block_row( mask, x, width, block_width ) !=
+                        k->filtered_block_row( mask, x, width, block_width ) )
+                    {
+                        hb_error( "decomb: %s block score differs, pattern %d "
+                                  "width %d x %d block %d", name, pattern,
+                                  width, x, block_width );
+                        failed++;
+                    }
+                }
+            }
+        }
+    }
+
+    return failed;
+}
+
+/*
+ * Runs every decomb kernel set the CPU supports against the C versions
+ * on random and extreme rows and thresholds.  Logs each difference and
+ * returns the number of them.
+ */
+int bench_check_decomb( void )
+{
+    const decomb_kernels_t * ref, * k;
+    const char             * name;
+    int                      failed = 0, ii;
+
+    ref = hb_decomb_kernels( 0, NULL );
+    for( ii = 1; ( k = hb_decomb_kernels( ii, &name ) ) != NULL; ii++ )
+    {
+        failed += check_kernels( name, ref, k );
+    }
+    return failed;
+}
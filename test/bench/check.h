@@ -0,0 +1,15 @@
+/* check.h
+
+   Copyright (c) 2003-2014 HandBrake Team
+   This file is part of the HandBrake source code
+   Homepage: <http://handbrake.fr/>.
+   It may be used under the terms of the GNU General Public License v2.
+   For full terms see the file COPYING file or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+#ifndef HB_BENCH_CHECK_H
+#define HB_BENCH_CHECK_H
+
+int bench_check_decomb( void );
+
+#endif // HB_BENCH_CHECK_H
@@ -15,16 +15,20 @@
 #include <time.h>
 #include <unistd.h>
 #include <inttypes.h>
+#include <math.h>
 
 #if defined( __MINGW32__ )
 #include <windows.h>
 #include <conio.h>
+#else
+#include <sys/resource.h>
 #endif
 
 #if defined( PTW32_STATIC_LIB )
 #include <pthread.h>
 #endif
 
+#include <jansson.h>
 #include "hb.h"
 #include "lang.h"
 #include "parsecsv.h"
@@ -129,6 +133,16 @@ static char * h264_level    = NULL;
 static int    maxHeight     = 0;
 static int    maxWidth      = 0;
 static int    fastfirstpass = 0;
+static int    chunk_count   = 0;
+static char ** renditions   = NULL;
+static int    rendition_count = 0;
+static char * trace_file    = NULL;
+static char * bench_report  = NULL;
+static char * bench_baseline = NULL;
+static double bench_tolerance = 5.;
+static char * bench_job     = NULL;
+static uint64_t bench_start = 0;
+static json_t * bench_passes = NULL;
 static int    preset        = 0;
 static char * preset_name   = 0;
 static int    cfr           = 0;
@@ -170,6 +184,11 @@ static void ShowCommands()
 static int  ParseOptions( int argc, char ** argv );
 static int  CheckOptions( int argc, char ** argv );
 static int  HandleEvents( hb_handle_t * h );
+static int  AddRendition( hb_job_t * job, const char * opt );
+
+static int  BenchMain( const char * exe );
+static void BenchSample( hb_handle_t * h, int pass, float rate_avg );
+static void BenchWriteJob( hb_error_code error );
 
 static void str_vfree( char **strv );
 static char** str_split( char *str, char delem );
@@ -260,12 +279,27 @@ int main( int argc, char ** argv )
         return 1;
     }
 
+    if( bench_report != NULL )
+    {
+        int ret = BenchMain( argv[0] );
+        hb_global_close();
+        return ret;
+    }
+
     /* Register our error handler */
     hb_register_error_handler(&hb_cli_error_handler);
 
     /* Init libhb */
     h = hb_init( debug, update );
     hb_dvd_set_dvdnav( dvdnav );
+    if( trace_file != NULL )
+    {
+        hb_set_trace_file( h, trace_file );
+    }
+    if( bench_job != NULL )
+    {
+        hb_set_stage_cpu_time( h, 1 );
+    }
 
     /* Show version */
     fprintf( stderr, "%s - %s - %s\n",
@@ -432,6 +466,15 @@ int main( int argc, char ** argv )
     free(input);
     free(output);
     free(preset_name);
+    free(trace_file);
+    while (rendition_count > 0)
+    {
+        free(renditions[--rendition_count]);
+    }
+    free(renditions);
+    free(bench_report);
+    free(bench_baseline);
+    free(bench_job);
     free(x264_preset);
     free(x264_tune);
     free(advanced_opts);
@@ -2813,11 +2856,22 @@ static int HandleEvents( hb_handle_t * h )
             job->indepth_scan = subtitle_scan;
             job->twopass = twoPass;
             job->fastfirstpass = fastfirstpass;
+            job->chunk_count = chunk_count;
             hb_job_set_encoder_options(job, advanced_opts);
 
+            for( i = 0; i < rendition_count; i++ )
+            {
+                if( AddRendition( job, renditions[i] ) )
+                {
+                    fprintf( stderr, "rendition: invalid syntax (%s)\n",
+                             renditions[i] );
+                }
+            }
+
             hb_add( h, job );
             hb_job_close( &job );
             hb_start( h );
+            bench_start = hb_get_time_us();
             break;
         }
 
@@ -2834,6 +2888,10 @@ static int HandleEvents( hb_handle_t * h )
             break;
 
         case HB_STATE_WORKING:
+            if( bench_job != NULL )
+            {
+                BenchSample( h, p.job_cur, p.rate_avg );
+            }
             fprintf( stdout, "\rEncoding: task %d of %d, %.2f %%",
                      p.job_cur, p.job_count, 100.0 * p.progress );
             if( p.seconds > -1 )
@@ -2874,6 +2932,10 @@ static int HandleEvents( hb_handle_t * h )
                     fprintf( stderr, "\nEncode failed (error %x).\n",
                              p.error );
             }
+            if( bench_job != NULL )
+            {
+                BenchWriteJob( p.error );
+            }
             done_error = p.error;
             die = 1;
             break;
@@ -2882,6 +2944,537 @@ static int HandleEvents( hb_handle_t * h )
     return 0;
 }
 
+/****************************************************************************
+ * AddRendition: adds a --rendition given as <width>x<height>[@<kb/s>]:<file>
+ * to the job, returns non-zero if it can't be parsed.
+ ****************************************************************************/
+static int AddRendition( hb_job_t * job, const char * opt )
+{
+    hb_rendition_t * rendition;
+    const char     * file = strchr( opt, ':' );
+    int              width, height, bitrate = 0;
+
+    if( file == NULL ||
+        sscanf( opt, "%dx%d@%d", &width, &height, &bitrate ) < 2 )
+    {
+        return -1;
+    }
+    rendition = hb_job_add_rendition( job, file + 1, width, height );
+    if( rendition == NULL )
+    {
+        return -1;
+    }
+    if( bitrate > 0 )
+    {
+        rendition->vquality = -1.0;
+        rendition->vbitrate = bitrate;
+    }
+    return 0;
+}
+
+/****************************************************************************
+ * Benchmark mode
+ *
+ * --bench runs this executable once per preset of bench_presets, each run
+ * encoding the same source with --bench-job, and collects what the runs
+ * report into one JSON file.  Without -i the source is a generated AVI of
+ * uncompressed video and PCM audio, so runs are comparable across
+ * machines and releases.  With --bench-baseline the fps and peak memory
+ * of every preset are checked against an earlier report.
+ *
+ * A --bench-job run samples the pipeline stage statistics of every pass
+ * while it encodes and writes them with its wall time, fps, CPU time and
+ * peak memory when done.
+ ****************************************************************************/
+#define BENCH_WIDTH     640
+#define BENCH_HEIGHT    360
+#define BENCH_FPS       25
+#define BENCH_SECONDS   10
+#define BENCH_RATE      48000
+
+static const char * bench_presets[] =
+{
+    "Universal", "Android", "Normal", "High Profile", NULL
+};
+
+static void bench_put_le16( FILE * file, int v )
+{
+    fputc( v & 0xff, file );
+    fputc( ( v >> 8 ) & 0xff, file );
+}
+
+static void bench_put_le32( FILE * file, uint32_t v )
+{
+    bench_put_le16( file, v & 0xffff );
+    bench_put_le16( file, v >> 16 );
+}
+
+// Starts a RIFF chunk (or list, if 'type' is given), returns the position
+// of its size for bench_end_chunk()
+static long bench_begin_chunk( FILE * file, const char * id, const char * type )
+{
+    long pos;
+
+    fwrite( id, 1, 4, file );
+    pos = ftell( file );
+    bench_put_le32( file, 0 );
+    if( type != NULL )
+    {
+        fwrite( type, 1, 4, file );
+    }
+    return pos;
+}
+
+static void bench_end_chunk( FILE * file, long pos )
+{
+    long end = ftell( file );
+
+    fseek( file, pos, SEEK_SET );
+    bench_put_le32( file, end - pos - 4 );
+    fseek( file, end, SEEK_SET );
+}
+
+/*
+ * Writes BENCH_SECONDS of moving colour bars and a sine tone as an AVI of
+ * I420 video and 16 bit stereo PCM, which libhb reads through libavformat.
+ */
+static int BenchWriteSource( const char * path )
+{
+    static const uint8_t bars[7][3] =
+    {
+        { 180, 128, 128 }, { 168,  44, 136 }, { 145, 147,  44 },
+        { 133,  63,  52 }, {  63, 193, 204 }, {  51, 109, 212 },
+        {  28, 212, 120 }
+    };
+    int        frames  = BENCH_FPS * BENCH_SECONDS;
+    int        samples = BENCH_RATE / BENCH_FPS;
+    int        vsize   = BENCH_WIDTH * BENCH_HEIGHT * 3 / 2;
+    int        asize   = samples * 4;
+    uint8_t  * picture = malloc( vsize );
+    uint32_t * index   = malloc( frames * 2 * sizeof( uint32_t ) );
+    FILE     * file    = hb_fopen( path, "wb" );
+    long       riff, list, strl, movi, chunk;
+    int        ii, xx, yy, ss;
+
+    if( file == NULL || picture == NULL || index == NULL )
+    {
+        fprintf( stderr, "Could not create %s\n", path );
+        if( file != NULL )
+            fclose( file );
+        free( picture );
+        free( index );
+        return 1;
+    }
+
+    riff = bench_begin_chunk( file, "RIFF", "AVI " );
+    list = bench_begin_chunk( file, "LIST", "hdrl" );
+
+    chunk = bench_begin_chunk( file, "avih", NULL );
+    bench_put_le32( file, 1000000 / BENCH_FPS );
+    bench_put_le32( file, ( vsize + asize ) * BENCH_FPS );
+    bench_put_le32( file, 0 );
+    bench_put_le32( file, 0x10 );               // AVIF_HASINDEX
+    bench_put_le32( file, frames );
+    bench_put_le32( file, 0 );
+    bench_put_le32( file, 2 );
+    bench_put_le32( file, vsize );
+    bench_put_le32( file, BENCH_WIDTH );
+    bench_put_le32( file, BENCH_HEIGHT );
+    for( ii = 0; ii < 4; ii++ )
+        bench_put_le32( file, 0 );
+    bench_end_chunk( file, chunk );
+
+    strl = bench_begin_chunk( file, "LIST", "strl" );
+    chunk = bench_begin_chunk( file, "strh", NULL );
+    fwrite( "vidsI420", 1, 8, file );
+    bench_put_le32( file, 0 );
+    bench_put_le32( file, 0 );
+    bench_put_le32( file, 0 );
+    bench_put_le32( file, 1 );                  // scale
+    bench_put_le32( file, BENCH_FPS );          // rate
+    bench_put_le32( file, 0 );
+    bench_put_le32( file, frames );
+    bench_put_le32( file, vsize );
+    bench_put_le32( file, 0xffffffff );
+    bench_put_le32( file, 0 );
+    bench_put_le16( file, 0 );
+    bench_put_le16( file, 0 );
+    bench_put_le16( file, BENCH_WIDTH );
+    bench_put_le16( file, BENCH_HEIGHT );
+    bench_end_chunk( file, chunk );
+    chunk = bench_begin_chunk( file, "strf", NULL );
+    bench_put_le32( file, 40 );
+    bench_put_le32( file, BENCH_WIDTH );
+    bench_put_le32( file, BENCH_HEIGHT );
+    bench_put_le16( file, 1 );
+    bench_put_le16( file, 12 );
+    fwrite( "I420", 1, 4, file );
+    bench_put_le32( file, vsize );
+    for( ii = 0; ii < 4; ii++ )
+        bench_put_le32( file, 0 );
+    bench_end_chunk( file, chunk );
+    bench_end_chunk( file, strl );
+
+    strl = bench_begin_chunk( file, "LIST", "strl" );
+    chunk = bench_begin_chunk( file, "strh", NULL );
+    fwrite( "auds", 1, 4, file );
+    bench_put_le32( file, 0 );
+    bench_put_le32( file, 0 );
+    bench_put_le32( file, 0 );
+    bench_put_le32( file, 0 );
+    bench_put_le32( file, 4 );                  // scale, the block size
+    bench_put_le32( file, BENCH_RATE * 4 );     // rate, bytes per second
+    bench_put_le32( file, 0 );
+    bench_put_le32( file, frames * samples );
+    bench_put_le32( file, asize );
+    bench_put_le32( file, 0xffffffff );
+    bench_put_le32( file, 4 );
+    bench_put_le32( file, 0 );
+    bench_put_le32( file, 0 );
+    bench_end_chunk( file, chunk );
+    chunk = bench_begin_chunk( file, "strf", NULL );
+    bench_put_le16( file, 1 );                  // WAVE_FORMAT_PCM
+    bench_put_le16( file, 2 );
+    bench_put_le32( file, BENCH_RATE );
+    bench_put_le32( file, BENCH_RATE * 4 );
+    bench_put_le16( file, 4 );
+    bench_put_le16( file, 16 );
+    bench_end_chunk( file, chunk );
+    bench_end_chunk( file, strl );
+    bench_end_chunk( file, list );
+
+    movi = bench_begin_chunk( file, "LIST", "movi" );
+    for( ii = 0; ii < frames; ii++ )
+    {
+        uint8_t * y = picture;
+        uint8_t * u = y + BENCH_WIDTH * BENCH_HEIGHT;
+        uint8_t * v = u + BENCH_WIDTH * BENCH_HEIGHT / 4;
+        int       box = ii * 8 % ( BENCH_WIDTH - 64 );
+
+        // Bars over the top three quarters, a scrolling ramp below and a
+        // box moving across the bars
+        for( yy = 0; yy < BENCH_HEIGHT; yy++ )
+        {
+            for( xx = 0; xx < BENCH_WIDTH; xx++ )
+            {
+                const uint8_t * bar = bars[xx * 7 / BENCH_WIDTH];
+
+                if( yy >= BENCH_HEIGHT * 3 / 4 )
+                    y[xx] = 16 + ( ( xx + ii * 4 ) & 0xff ) * 219 / 255;
+                else if( yy >= 32 && yy < 96 && xx >= box && xx < box + 64 )
+                    y[xx] = 235;
+                else
+                    y[xx] = bar[0];
+                if( !( yy & 1 ) && !( xx & 1 ) )
+                {
+                    int c = yy < BENCH_HEIGHT * 3 / 4 &&
+                            !( yy >= 32 && yy < 96 && xx >= box && xx < box + 64 );
+                    u[xx / 2] = c ? bar[1] : 128;
+                    v[xx / 2] = c ? bar[2] : 128;
+                }
+            }
+            y += BENCH_WIDTH;
+            if( yy & 1 )
+            {
+                u += BENCH_WIDTH / 2;
+                v += BENCH_WIDTH / 2;
+            }
+        }
+        index[2 * ii] = ftell( file ) - movi - 4;
+        chunk = bench_begin_chunk( file, "00dc", NULL );
+        fwrite( picture, 1, vsize, file );
+        bench_end_chunk( file, chunk );
+
+        index[2 * ii + 1] = ftell( file ) - movi - 4;
+        chunk = bench_begin_chunk( file, "01wb", NULL );
+        for( ss = 0; ss < samples; ss++ )
+        {
+            double t = (double)( ii * samples + ss ) / BENCH_RATE;
+            int    s = 8000 * sin( 2 * M_PI * 1000 * t );
+            bench_put_le16( file, s );
+            bench_put_le16( file, s );
+        }
+        bench_end_chunk( file, chunk );
+    }
+    bench_end_chunk( file, movi );
+
+    chunk = bench_begin_chunk( file, "idx1", NULL );
+    for( ii = 0; ii < frames; ii++ )
+    {
+        fwrite( "00dc", 1, 4, file );
+        bench_put_le32( file, 0x10 );           // AVIIF_KEYFRAME
+        bench_put_le32( file, index[2 * ii] );
+        bench_put_le32( file, vsize );
+        fwrite( "01wb", 1, 4, file );
+        bench_put_le32( file, 0x10 );
+        bench_put_le32( file, index[2 * ii + 1] );
+        bench_put_le32( file, asize );
+    }
+    bench_end_chunk( file, chunk );
+    bench_end_chunk( file, riff );
+
+    free( picture );
+    free( index );
+    if( ferror( file ) | fclose( file ) )
+    {
+        fprintf( stderr, "Could not write %s\n", path );
+        return 1;
+    }
+    return 0;
+}
+
+static double bench_number( json_t * dict, const char * key )
+{
+    return json_number_value( json_object_get( dict, key ) );
+}
+
+/*
+ * Prints the presets whose fps dropped or whose peak memory grew by more
+ * than bench_tolerance percent against 'baseline'.  Returns 1 if any did.
+ */
+static int BenchCompare( json_t * report, json_t * baseline )
+{
+    json_t * jobs = json_object_get( report, "Jobs" );
+    json_t * base_jobs = json_object_get( baseline, "Jobs" );
+    json_t * job, * base;
+    size_t   ii, jj;
+    int      regressed = 0;
+    double   value, base_value;
+
+    for( ii = 0; ii < json_array_size( jobs ); ii++ )
+    {
+        const char * preset;
+
+        job = json_array_get( jobs, ii );
+        preset = json_string_value( json_object_get( job, "Preset" ) );
+        for( jj = 0; jj < json_array_size( base_jobs ); jj++ )
+        {
+            const char * base_preset;
+
+            base = json_array_get( base_jobs, jj );
+            base_preset = json_string_value( json_object_get( base, "Preset" ) );
+            if( preset != NULL && base_preset != NULL &&
+                !strcmp( preset, base_preset ) )
+                break;
+        }
+        if( preset == NULL || jj == json_array_size( base_jobs ) )
+        {
+            fprintf( stderr, "%s: not in the baseline\n",
+                     preset != NULL ? preset : "?" );
+            continue;
+        }
+
+        value      = bench_number( job, "Fps" );
+        base_value = bench_number( base, "Fps" );
+        if( base_value > 0 &&
+            value < base_value * ( 1. - bench_tolerance / 100. ) )
+        {
+            fprintf( stderr, "%s: %.2f fps, baseline %.2f fps (%+.1f%%)\n",
+                     preset, value, base_value,
+                     100. * ( value - base_value ) / base_value );
+            regressed = 1;
+        }
+        value      = bench_number( job, "PeakRSS" );
+        base_value = bench_number( base, "PeakRSS" );
+        if( base_value > 0 &&
+            value > base_value * ( 1. + bench_tolerance / 100. ) )
+        {
+            fprintf( stderr, "%s: peak memory %.1f MB, baseline %.1f MB "
+                     "(%+.1f%%)\n", preset, value / 1048576.,
+                     base_value / 1048576.,
+                     100. * ( value - base_value ) / base_value );
+            regressed = 1;
+        }
+    }
+    if( regressed )
+    {
+        fprintf( stderr, "Benchmark regressed by more than %.1f%% against "
+                 "%s\n", bench_tolerance, bench_baseline );
+    }
+    return regressed;
+}
+
+static int BenchMain( const char * exe )
+{
+    json_t       * jobs, * job, * report, * baseline = NULL;
+    json_error_t   error;
+    char           source[1024], out[1024], part[1024], cmd[4096];
+    char           date[64];
+    const char   * src = input;
+    time_t         now = time( NULL );
+    int            ii, status, ret = 0;
+
+    if( bench_baseline != NULL )
+    {
+        baseline = json_load_file( bench_baseline, 0, &error );
+        if( baseline == NULL )
+        {
+            fprintf( stderr, "Could not read baseline %s: %s\n",
+                     bench_baseline, error.text );
+            return 1;
+        }
+    }
+    if( src == NULL )
+    {
+        snprintf( source, sizeof( source ), "%s.source.avi", bench_report );
+        fprintf( stderr, "Generating %s...\n", source );
+        if( BenchWriteSource( source ) )
+        {
+            json_decref( baseline );
+            return 1;
+        }
+        src = source;
+    }
+
+    jobs = json_array();
+    for( ii = 0; bench_presets[ii] != NULL; ii++ )
+    {
+        snprintf( out, sizeof( out ), "%s.%d.mp4", bench_report, ii );
+        snprintf( part, sizeof( part ), "%s.%d.json", bench_report, ii );
+#if defined( __MINGW32__ )
+        // cmd.exe strips the outer quotes of the whole command line
+        snprintf( cmd, sizeof( cmd ), "\"\"%s\" -i \"%s\" -o \"%s\" -Z \"%s\" "
+                  "--bench-job \"%s\"\"", exe, src, out, bench_presets[ii],
+                  part );
+#else
+        snprintf( cmd, sizeof( cmd ), "\"%s\" -i \"%s\" -o \"%s\" -Z \"%s\" "
+                  "--bench-job \"%s\"", exe, src, out, bench_presets[ii],
+                  part );
+#endif
+        remove( part );
+
+        fprintf( stderr, "Benchmark %d: %s\n", ii + 1, bench_presets[ii] );
+        status = system( cmd );
+
+        job = json_load_file( part, 0, &error );
+        if( job == NULL || status != 0 )
+        {
+            fprintf( stderr, "Benchmark %s failed (%d)\n",
+                     bench_presets[ii], status );
+            if( job == NULL )
+                job = json_object();
+            json_object_set_new( job, "Failed", json_integer( status ) );
+            ret = 1;
+        }
+        json_object_set_new( job, "Preset", json_string( bench_presets[ii] ) );
+        json_array_append_new( jobs, job );
+        remove( out );
+        remove( part );
+    }
+    if( src == source )
+    {
+        remove( source );
+    }
+
+    strftime( date, sizeof( date ), "%Y-%m-%dT%H:%M:%S", localtime( &now ) );
+    report = json_pack( "{s:s, s:s, s:i, s:s, s:o}",
+                        "Version", HB_PROJECT_VERSION,
+                        "Date",    date,
+                        "CPUs",    hb_get_cpu_count(),
+                        "Source",  src == source ? "generated" : src,
+                        "Jobs",    jobs );
+    if( report == NULL ||
+        json_dump_file( report, bench_report,
+                        JSON_INDENT( 4 ) | JSON_PRESERVE_ORDER ) != 0 )
+    {
+        fprintf( stderr, "Could not write %s\n", bench_report );
+        ret = 1;
+    }
+
+    fprintf( stdout, "\n%-16s %10s %10s %10s %10s\n", "preset", "time (s)",
+             "fps", "cpu (s)", "mem (MB)" );
+    for( ii = 0; ii < json_array_size( jobs ); ii++ )
+    {
+        job = json_array_get( jobs, ii );
+        fprintf( stdout, "%-16s %10.2f %10.2f %10.2f %10.1f\n",
+                 json_string_value( json_object_get( job, "Preset" ) ),
+                 bench_number( job, "WallTime" ), bench_number( job, "Fps" ),
+                 bench_number( job, "UserTime" ) +
+                 bench_number( job, "SystemTime" ),
+                 bench_number( job, "PeakRSS" ) / 1048576. );
+    }
+
+    if( baseline != NULL && report != NULL )
+    {
+        ret |= BenchCompare( report, baseline );
+    }
+    json_decref( report );
+    json_decref( baseline );
+
+    return ret;
+}
+
+// Called while a --bench-job run encodes, keeps the last statistics of
+// every pass
+static void BenchSample( hb_handle_t * h, int pass, float rate_avg )
+{
+    char   * json = hb_get_stages_json( h );
+    json_t * stages = json != NULL ? json_loads( json, 0, NULL ) : NULL;
+    json_t * sample;
+
+    free( json );
+    if( bench_passes == NULL )
+    {
+        bench_passes = json_array();
+    }
+    while( json_array_size( bench_passes ) < pass )
+    {
+        json_array_append_new( bench_passes, json_object() );
+    }
+    sample = json_array_get( bench_passes, pass - 1 );
+    if( sample == NULL )
+    {
+        json_decref( stages );
+        return;
+    }
+    json_object_set_new( sample, "Pass", json_integer( pass ) );
+    json_object_set_new( sample, "Fps", json_real( rate_avg ) );
+    // Between passes there are no stages, keep the last ones
+    if( json_array_size( stages ) > 0 )
+        json_object_set_new( sample, "Stages", stages );
+    else
+        json_decref( stages );
+}
+
+static void BenchWriteJob( hb_error_code error )
+{
+    json_t * job = json_object();
+    json_t * last;
+
+    json_object_set_new( job, "Error", json_integer( error ) );
+    json_object_set_new( job, "WallTime",
+                         json_real( ( hb_get_time_us() - bench_start ) / 1e6 ) );
+    // The last pass writes the output
+    last = json_array_get( bench_passes, json_array_size( bench_passes ) - 1 );
+    json_object_set_new( job, "Fps", json_real( bench_number( last, "Fps" ) ) );
+#if !defined( __MINGW32__ )
+    struct rusage usage;
+    if( getrusage( RUSAGE_SELF, &usage ) == 0 )
+    {
+        json_object_set_new( job, "UserTime", json_real(
+            usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 ) );
+        json_object_set_new( job, "SystemTime", json_real(
+            usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6 ) );
+#if defined( __APPLE__ )
+        json_object_set_new( job, "PeakRSS", json_integer( usage.ru_maxrss ) );
+#else
+        json_object_set_new( job, "PeakRSS",
+                             json_integer( (json_int_t)usage.ru_maxrss * 1024 ) );
+#endif
+    }
+#endif
+    json_object_set_new( job, "Passes",
+                         bench_passes != NULL ? bench_passes : json_array() );
+    bench_passes = NULL;
+
+    if( json_dump_file( job, bench_job,
+                        JSON_INDENT( 4 ) | JSON_PRESERVE_ORDER ) != 0 )
+    {
+        fprintf( stderr, "Could not write %s\n", bench_job );
+    }
+    json_decref( job );
+}
+
 /****************************************************************************
  * SigHandler:
  ****************************************************************************/
@@ -2930,6 +3523,19 @@ static void ShowHelp()
     "    -z, --preset-list       See a list of available built-in presets\n"
     "        --no-dvdnav         Do not use dvdnav for reading DVDs\n"
     "    --no-opencl             Disable use of OpenCL\n"
+    "        --trace <file>      Write a timeline of the encode's pipeline stages\n"
+    "                            to a Chrome trace file (chrome://tracing or\n"
+    "                            ui.perfetto.dev)\n"
+    "        --bench <file>      Encode a generated test source (or the -i\n"
+    "                            input) with a fixed set of presets and write\n"
+    "                            the wall time, fps, CPU time per pipeline stage\n"
+    "                            and peak memory of each to a JSON report\n"
+    "        --bench-baseline <file>\n"
+    "                            Compare the --bench results with an earlier\n"
+    "                            report and fail on regressions\n"
+    "        --bench-tolerance <percent>\n"
+    "                            Allowed fps loss and memory growth against the\n"
+    "                            baseline (default: 5)\n"
     "\n"
 
     "### Source Options-----------------------------------------------------------\n\n"
@@ -3027,6 +3633,12 @@ static void ShowHelp()
     "    -2, --two-pass          Use two-pass mode\n"
     "    -T, --turbo             When using 2-pass use \"turbo\" options on the\n"
     "                            1st pass to improve speed (only works with x264)\n"
+    "        --chunks <number>   Split the video into this many segments and\n"
+    "                            encode them in parallel (single pass x264 and\n"
+    "                            x265 encodes of files only)\n"
+    "        --rendition         Also encode the video to <file> at this size,\n"
+    "          <WxH[@kb/s]:file> from the same decode and filters (video only,\n"
+    "                            repeat for more renditions)\n"
     "    -r, --rate              Set video framerate (" );
     rate = NULL;
     while ((rate = hb_video_framerate_get_next(rate)) != NULL)
@@ -3552,6 +4164,13 @@ static int ParseOptions( int argc, char ** argv )
     #define QSV_IMPLEMENTATION   297
     #define FILTER_NLMEANS       298
     #define FILTER_NLMEANS_TUNE  299
+    #define CHUNKS               300
+    #define TRACE                301
+    #define BENCH                302
+    #define BENCH_BASELINE       303
+    #define BENCH_TOLERANCE      304
+    #define BENCH_JOB            305
+    #define RENDITION            306
 
     for( ;; )
     {
@@ -3674,6 +4293,13 @@ static int ParseOptions( int argc, char ** argv )
             { "pfr",         no_argument,       &cfr,    2 },
             { "audio-copy-mask", required_argument, NULL, ALLOWED_AUDIO_COPY },
             { "audio-fallback",  required_argument, NULL, AUDIO_FALLBACK },
+            { "chunks",      required_argument, NULL,    CHUNKS },
+            { "rendition",   required_argument, NULL,    RENDITION },
+            { "trace",       required_argument, NULL,    TRACE },
+            { "bench",           required_argument, NULL, BENCH },
+            { "bench-baseline",  required_argument, NULL, BENCH_BASELINE },
+            { "bench-tolerance", required_argument, NULL, BENCH_TOLERANCE },
+            { "bench-job",       required_argument, NULL, BENCH_JOB },
             { 0, 0, 0, 0 }
           };
 
@@ -3965,6 +4591,33 @@ static int ParseOptions( int argc, char ** argv )
                     nlmeans_tune_opt = strdup(optarg);
                 }
                 break;
+            case CHUNKS:
+                chunk_count = atoi( optarg );
+                break;
+            case RENDITION:
+                renditions = realloc( renditions, ( rendition_count + 1 ) *
+                                                  sizeof( char * ) );
+                renditions[rendition_count++] = strdup( optarg );
+                break;
+            case TRACE:
+                free( trace_file );
+                trace_file = strdup( optarg );
+                break;
+            case BENCH:
+                free( bench_report );
+                bench_report = strdup( optarg );
+                break;
+            case BENCH_BASELINE:
+                free( bench_baseline );
+                bench_baseline = strdup( optarg );
+                break;
+            case BENCH_TOLERANCE:
+                bench_tolerance = atof( optarg );
+                break;
+            case BENCH_JOB:
+                free( bench_job );
+                bench_job = strdup( optarg );
+                break;
             case '9':
                 if( optarg != NULL )
                 {
@@ -4308,7 +4961,7 @@ static int ParseOptions( int argc, char ** argv )
 
 static int CheckOptions( int argc, char ** argv )
 {
-    if( update )
+    if( update || bench_report != NULL )
     {
         return 0;
     }